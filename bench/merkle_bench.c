@@ -0,0 +1,559 @@
+/**
+ * @file merkle_bench.c
+ * @brief Build, proof and teardown benchmarks for the Merkle tree library.
+ *
+ * Every combination of leaf count, leaf size, branching factor and layout
+ * runs in its own child process, so the peak RSS reported for a case is that
+ * case's own. Results are printed to stdout as one JSON object per line;
+ * progress and skipped cases go to stderr.
+ *
+ * Usage: merkle_bench [--full] [--leaves N,...] [--sizes B,...] [--bf F,...]
+ *                     [--threads T,...] [--layout pointer|flat|blocked|both|all]
+ *                     [--reps R] [--proofs P] [--max-bytes B]
+ *
+ * Lists accept K, M and G suffixes (powers of 1000 for counts, of 1024 for
+ * byte sizes), e.g. --leaves 1K,1M --sizes 32,4K,1M. "both" runs the pointer
+ * and flat layouts, "all" adds the blocked one. --full also adds the wide
+ * branching factors 64 and 256, where proof sibling copies dominate.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Merkle.h"
+#include "merkle_proof.h"
+#include "merkle_utils.h"
+
+/** Most entries any list option takes. */
+#define BENCH_MAX_LIST (16)
+
+/** Most proof reader threads one measurement starts. */
+#define BENCH_MAX_THREADS (256)
+
+/** Layouts a run can select, indexed by merkle_layout_t. */
+#define BENCH_LAYOUTS (3)
+
+/**
+ * @brief A parsed list option.
+ */
+typedef struct bench_list {
+    size_t values[BENCH_MAX_LIST]; /**< Entries in command-line order. */
+    size_t count;                  /**< Number of entries. */
+} bench_list_t;
+
+/**
+ * @brief Everything the command line selects.
+ */
+typedef struct bench_options {
+    bench_list_t leaves;   /**< Leaf counts. */
+    bench_list_t sizes;    /**< Leaf sizes in bytes. */
+    bench_list_t factors;  /**< Branching factors. */
+    bench_list_t threads;  /**< Reader thread counts for the proof benchmarks. */
+    bool layouts[BENCH_LAYOUTS]; /**< Which layouts run, indexed by merkle_layout_t. */
+    size_t reps;           /**< Builds per case. */
+    size_t proofs;         /**< Proofs generated by every reader thread. */
+    size_t max_bytes;      /**< Cases estimated to need more memory are skipped. */
+} bench_options_t;
+
+/**
+ * @brief One benchmark case.
+ */
+typedef struct bench_case {
+    merkle_layout_t layout; /**< Node storage layout. */
+    size_t leaves;          /**< Number of leaves. */
+    size_t leaf_size;       /**< Bytes per leaf. */
+    size_t bf;              /**< Branching factor. */
+} bench_case_t;
+
+/**
+ * @brief Work and results of one proof reader thread.
+ */
+typedef struct bench_reader {
+    merkle_tree_t *tree;   /**< Tree to prove against. */
+    bool into;             /**< Use generate_proof_into() instead of generate_proof_from_index(). */
+    size_t proofs;         /**< Proofs to generate. */
+    uint64_t seed;         /**< Leaf sequence seed. */
+    double *latencies;     /**< Nanoseconds per proof. */
+    bool failed;           /**< Set if any proof could not be generated. */
+} bench_reader_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Returns quantile @p q of @p values, sorting them in place.
+ */
+static double percentile(double *values, size_t count, double q) {
+    if (count == 0) {
+        return 0.0;
+    }
+
+    qsort(values, count, sizeof(*values), compare_doubles);
+    return values[(size_t)((double)(count - 1) * q + 0.5)];
+}
+
+/**
+ * @brief Peak resident set size of this process in KiB.
+ */
+static long peak_rss_kb(void) {
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+/**
+ * @brief Frees a proof from generate_proof_from_index().
+ */
+static void release_proof(merkle_proof_t *proof) {
+    if (!proof) {
+        return;
+    }
+
+    for (size_t i = 0; i < proof->path_length; i++) {
+        if (proof->path[i]) {
+            MFree(proof->path[i]->sibling_hashes);
+            MFree(proof->path[i]);
+        }
+    }
+
+    MFree(proof->path);
+    MFree(proof);
+}
+
+/**
+ * @brief Parses a count or size with an optional K/M/G suffix.
+ *
+ * @param binary Whether suffixes are powers of 1024 rather than 1000.
+ * @return false if @p text is not a positive number.
+ */
+static bool parse_quantity(const char *text, bool binary, size_t *out) {
+    char *end = NULL;
+    unsigned long long value = strtoull(text, &end, 10);
+    unsigned long long unit = 1;
+
+    if (end == text) {
+        return false;
+    }
+
+    switch (*end) {
+    case 'K': case 'k':
+        unit = binary ? 1ULL << 10 : 1000ULL;
+        end++;
+        break;
+    case 'M': case 'm':
+        unit = binary ? 1ULL << 20 : 1000000ULL;
+        end++;
+        break;
+    case 'G': case 'g':
+        unit = binary ? 1ULL << 30 : 1000000000ULL;
+        end++;
+        break;
+    default:
+        break;
+    }
+
+    if (*end != '\0' || value == 0 || value > SIZE_MAX / unit) {
+        return false;
+    }
+
+    *out = (size_t)(value * unit);
+    return true;
+}
+
+/**
+ * @brief Parses a comma-separated list option.
+ */
+static bool parse_list(const char *text, bool binary, bench_list_t *list) {
+    char buffer[256];
+
+    if (strlen(text) >= sizeof(buffer)) {
+        return false;
+    }
+
+    strcpy(buffer, text);
+    list->count = 0;
+
+    for (char *save = NULL, *item = strtok_r(buffer, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        if (list->count == BENCH_MAX_LIST || !parse_quantity(item, binary, &list->values[list->count])) {
+            return false;
+        }
+
+        list->count++;
+    }
+
+    return list->count > 0;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [--full] [--leaves N,...] [--sizes B,...] [--bf F,...] [--threads T,...]\n"
+            "          [--layout pointer|flat|blocked|both|all] [--reps R] [--proofs P] [--max-bytes B]\n",
+            program);
+}
+
+static const char *layout_name(merkle_layout_t layout) {
+    static const char *const names[BENCH_LAYOUTS] = {"pointer", "flat", "blocked"};
+    return names[layout];
+}
+
+static bool parse_options(int argc, char **argv, bench_options_t *options) {
+    // The default matrix finishes in minutes; --full widens it to the extremes
+    parse_list("1K,10K,100K,1M", false, &options->leaves);
+    parse_list("32,1K,64K,1M", true, &options->sizes);
+    parse_list("2,4,16", false, &options->factors);
+    parse_list("1,2,4,8", false, &options->threads);
+    options->layouts[MERKLE_LAYOUT_POINTER] = true;
+    options->layouts[MERKLE_LAYOUT_FLAT] = true;
+    options->layouts[MERKLE_LAYOUT_BLOCKED] = false;
+    options->reps = 3;
+    options->proofs = 20000;
+    options->max_bytes = (size_t)1 << 30;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        bool ok = true;
+
+        if (strcmp(arg, "--full") == 0) {
+            parse_list("1K,10K,100K,1M,10M,100M", false, &options->leaves);
+            parse_list("32,256,4K,64K,1M", true, &options->sizes);
+            parse_list("2,4,16,64,256", false, &options->factors);
+            options->max_bytes = (size_t)64 << 30;
+            continue;
+        }
+
+        if (!value) {
+            usage(argv[0]);
+            return false;
+        }
+
+        if (strcmp(arg, "--leaves") == 0) {
+            ok = parse_list(value, false, &options->leaves);
+        } else if (strcmp(arg, "--sizes") == 0) {
+            ok = parse_list(value, true, &options->sizes);
+        } else if (strcmp(arg, "--bf") == 0) {
+            ok = parse_list(value, false, &options->factors);
+        } else if (strcmp(arg, "--threads") == 0) {
+            ok = parse_list(value, false, &options->threads);
+
+            for (size_t t = 0; ok && t < options->threads.count; t++) {
+                ok = options->threads.values[t] <= BENCH_MAX_THREADS;
+            }
+        } else if (strcmp(arg, "--reps") == 0) {
+            ok = parse_quantity(value, false, &options->reps);
+        } else if (strcmp(arg, "--proofs") == 0) {
+            ok = parse_quantity(value, false, &options->proofs);
+        } else if (strcmp(arg, "--max-bytes") == 0) {
+            ok = parse_quantity(value, true, &options->max_bytes);
+        } else if (strcmp(arg, "--layout") == 0) {
+            bool all = strcmp(value, "all") == 0;
+            bool both = all || strcmp(value, "both") == 0;
+            options->layouts[MERKLE_LAYOUT_POINTER] = both || strcmp(value, "pointer") == 0;
+            options->layouts[MERKLE_LAYOUT_FLAT] = both || strcmp(value, "flat") == 0;
+            options->layouts[MERKLE_LAYOUT_BLOCKED] = all || strcmp(value, "blocked") == 0;
+            ok = options->layouts[MERKLE_LAYOUT_POINTER] || options->layouts[MERKLE_LAYOUT_FLAT] ||
+                 options->layouts[MERKLE_LAYOUT_BLOCKED];
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "invalid value for %s: %s\n", arg, value);
+            usage(argv[0]);
+            return false;
+        }
+
+        i++;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Rough memory a case needs: the input, the tree's leaf copies and per-leaf bookkeeping.
+ */
+static size_t estimate_bytes(const bench_case_t *bc) {
+    const size_t per_leaf_overhead = 3 * sizeof(void *) + 2 * HASH_SIZE + 64;
+
+    if (bc->leaf_size > (SIZE_MAX - per_leaf_overhead) / 2 ||
+        bc->leaves > SIZE_MAX / (2 * bc->leaf_size + per_leaf_overhead)) {
+        return SIZE_MAX;
+    }
+
+    return bc->leaves * (2 * bc->leaf_size + per_leaf_overhead);
+}
+
+static void print_case(const bench_case_t *bc, const char *op) {
+    printf("{\"op\":\"%s\",\"layout\":\"%s\",\"leaves\":%zu,\"leaf_size\":%zu,\"branching_factor\":%zu",
+           op, layout_name(bc->layout), bc->leaves, bc->leaf_size, bc->bf);
+}
+
+static void *reader_main(void *arg) {
+    bench_reader_t *reader = arg;
+    size_t leaves = merkle_tree_leaf_count(reader->tree);
+    size_t capacity = 0;
+    unsigned char *wire = NULL;
+    uint64_t state = reader->seed;
+
+    if (reader->into) {
+        if (merkle_proof_max_size(reader->tree, &capacity) != MERKLE_SUCCESS || !(wire = malloc(capacity))) {
+            reader->failed = true;
+            return NULL;
+        }
+    }
+
+    for (size_t i = 0; i < reader->proofs; i++) {
+        size_t leaf = (size_t)(xorshift64(&state) % leaves);
+        merkle_error_t ret;
+        double start = now_seconds();
+
+        if (reader->into) {
+            size_t written = 0;
+            ret = generate_proof_into(reader->tree, leaf, wire, capacity, &written);
+        } else {
+            merkle_proof_t *proof = NULL;
+            ret = generate_proof_from_index(reader->tree, leaf, &proof);
+            release_proof(proof);
+        }
+
+        reader->latencies[i] = (now_seconds() - start) * 1e9;
+
+        if (ret != MERKLE_SUCCESS) {
+            reader->failed = true;
+        }
+    }
+
+    free(wire);
+    return NULL;
+}
+
+/**
+ * @brief Runs @p threads readers against @p tree and prints one result line.
+ */
+static bool bench_proofs(const bench_case_t *bc, merkle_tree_t *tree, size_t threads, size_t proofs, bool into) {
+    bench_reader_t readers[BENCH_MAX_THREADS];
+    pthread_t ids[BENCH_MAX_THREADS];
+    double *latencies = malloc(threads * proofs * sizeof(*latencies));
+    bool success = latencies != NULL;
+    size_t started = 0;
+
+    double start = now_seconds();
+
+    for (size_t t = 0; success && t < threads; t++) {
+        readers[t] = (bench_reader_t){
+            .tree = tree, .into = into, .proofs = proofs, .seed = 0x9E3779B97F4A7C15ULL * (t + 1),
+            .latencies = latencies + t * proofs, .failed = false
+        };
+
+        if (pthread_create(&ids[t], NULL, reader_main, &readers[t]) != 0) {
+            success = false;
+            break;
+        }
+
+        started++;
+    }
+
+    for (size_t t = 0; t < started; t++) {
+        pthread_join(ids[t], NULL);
+        success = success && !readers[t].failed;
+    }
+
+    double elapsed = now_seconds() - start;
+
+    if (success) {
+        size_t total = threads * proofs;
+        print_case(bc, into ? "proof_into" : "proof");
+        printf(",\"threads\":%zu,\"proofs\":%zu,\"proofs_per_s\":%.0f", threads, total, (double)total / elapsed);
+        printf(",\"p50_ns\":%.0f", percentile(latencies, total, 0.50));
+        printf(",\"p99_ns\":%.0f,\"peak_rss_kb\":%ld}\n", percentile(latencies, total, 0.99), peak_rss_kb());
+    }
+
+    free(latencies);
+    return success;
+}
+
+/**
+ * @brief Runs one case in the calling (child) process.
+ * @return Process exit status.
+ */
+static int run_case(const bench_case_t *bc, const bench_options_t *options) {
+    unsigned char *buffer = malloc(bc->leaves * bc->leaf_size);
+    const void **data = malloc(bc->leaves * sizeof(*data));
+    size_t *sizes = malloc(bc->leaves * sizeof(*sizes));
+    double *build = malloc(options->reps * sizeof(*build));
+    double *teardown = malloc(options->reps * sizeof(*teardown));
+
+    if (!buffer || !data || !sizes || !build || !teardown) {
+        fprintf(stderr, "out of memory for %zu leaves of %zu bytes\n", bc->leaves, bc->leaf_size);
+        return 1;
+    }
+
+    // Fill every byte so the page cache and the hash kernels see real data
+    uint64_t state = 0x243F6A8885A308D3ULL ^ bc->leaves ^ bc->leaf_size;
+    size_t total = bc->leaves * bc->leaf_size;
+
+    for (size_t off = 0; off < total; off += sizeof(uint64_t)) {
+        uint64_t word = xorshift64(&state);
+        memcpy(buffer + off, &word, total - off < sizeof(word) ? total - off : sizeof(word));
+    }
+
+    for (size_t i = 0; i < bc->leaves; i++) {
+        data[i] = buffer + i * bc->leaf_size;
+        sizes[i] = bc->leaf_size;
+    }
+
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.branching_factor = bc->bf;
+    config.layout = bc->layout;
+
+    merkle_tree_t *tree = NULL;
+
+    // Every build but the last is torn down right away; the last one serves the proofs
+    for (size_t r = 0; r < options->reps; r++) {
+        double start = now_seconds();
+        tree = create_merkle_tree_ex(data, sizes, bc->leaves, &config);
+        build[r] = now_seconds() - start;
+
+        if (!tree) {
+            fprintf(stderr, "build failed for %zu leaves of %zu bytes\n", bc->leaves, bc->leaf_size);
+            return 1;
+        }
+
+        if (r + 1 < options->reps) {
+            start = now_seconds();
+            dealloc_merkle_tree(tree);
+            teardown[r] = now_seconds() - start;
+        }
+    }
+
+    double best = build[0];
+
+    for (size_t r = 1; r < options->reps; r++) {
+        best = build[r] < best ? build[r] : best;
+    }
+
+    print_case(bc, "build");
+    printf(",\"reps\":%zu,\"leaves_per_s\":%.0f,\"gb_per_s\":%.3f", options->reps, (double)bc->leaves / best,
+           (double)total / best / 1e9);
+    printf(",\"p50_ms\":%.3f", percentile(build, options->reps, 0.50) * 1e3);
+    printf(",\"p99_ms\":%.3f,\"peak_rss_kb\":%ld}\n", percentile(build, options->reps, 0.99) * 1e3, peak_rss_kb());
+
+    bool success = true;
+
+    for (size_t t = 0; t < options->threads.count && success; t++) {
+        success = bench_proofs(bc, tree, options->threads.values[t], options->proofs, false) &&
+                  bench_proofs(bc, tree, options->threads.values[t], options->proofs, true);
+    }
+
+    double start = now_seconds();
+    dealloc_merkle_tree(tree);
+    teardown[options->reps - 1] = now_seconds() - start;
+
+    print_case(bc, "teardown");
+    printf(",\"reps\":%zu,\"leaves_per_s\":%.0f", options->reps,
+           (double)bc->leaves / percentile(teardown, options->reps, 0.50));
+    printf(",\"p50_ms\":%.3f", percentile(teardown, options->reps, 0.50) * 1e3);
+    printf(",\"p99_ms\":%.3f,\"peak_rss_kb\":%ld}\n", percentile(teardown, options->reps, 0.99) * 1e3, peak_rss_kb());
+
+    free(teardown);
+    free(build);
+    free(sizes);
+    free(data);
+    free(buffer);
+    return success ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    bench_options_t options;
+
+    if (!parse_options(argc, argv, &options)) {
+        return 2;
+    }
+
+    int failures = 0;
+
+    for (int layout = 0; layout < BENCH_LAYOUTS; layout++) {
+        if (!options.layouts[layout]) {
+            continue;
+        }
+
+        for (size_t l = 0; l < options.leaves.count; l++) {
+            for (size_t s = 0; s < options.sizes.count; s++) {
+                for (size_t f = 0; f < options.factors.count; f++) {
+                    bench_case_t bc = {
+                        (merkle_layout_t)layout, options.leaves.values[l], options.sizes.values[s],
+                        options.factors.values[f]
+                    };
+
+                    if (estimate_bytes(&bc) > options.max_bytes) {
+                        fprintf(stderr, "skip %s leaves=%zu leaf_size=%zu bf=%zu: over --max-bytes\n",
+                                layout_name(bc.layout), bc.leaves, bc.leaf_size, bc.bf);
+                        continue;
+                    }
+
+                    fprintf(stderr, "run  %s leaves=%zu leaf_size=%zu bf=%zu\n",
+                            layout_name(bc.layout), bc.leaves, bc.leaf_size, bc.bf);
+                    fflush(stdout);
+                    fflush(stderr);
+
+                    // A fresh process per case keeps peak RSS and allocator state separate
+                    pid_t child = fork();
+
+                    if (child == 0) {
+                        int status = run_case(&bc, &options);
+                        fflush(stdout);
+                        _exit(status);
+                    }
+
+                    int status = 0;
+
+                    if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) ||
+                        WEXITSTATUS(status) != 0) {
+                        fprintf(stderr, "case failed: %s leaves=%zu leaf_size=%zu bf=%zu\n",
+                                layout_name(bc.layout), bc.leaves, bc.leaf_size, bc.bf);
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+
+    return failures ? 1 : 0;
+}
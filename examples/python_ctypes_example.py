@@ -10,11 +10,18 @@ Requirements:
     - libmerkle.so compiled in the parent directory
     - Python 3.x with ctypes (standard library)
 
+The asynchronous wrappers at the end run builds and proofs on the library's
+worker threads and wait on the operation's eventfd from an asyncio loop, so
+the interpreter keeps serving other coroutines while C does the hashing.
+ctypes.CDLL drops the GIL for the duration of every foreign call, and no
+Python callback is registered, so the workers never need the GIL.
+
 Example:
     $ python3 python_ctypes_example.py
     Root hash: a1554130b3c21a2ae8884cdb7a4993a337ad1aed4d1dcffece16a590899a80eb
 """
 
+import asyncio
 import ctypes
 import os
 from typing import List, Optional
@@ -62,18 +69,92 @@ merkle.get_tree_hash.argtypes = [
     ctypes.c_char * 32      # unsigned char copy_into[32] - SHA-256 hash buffer
 ]
 
+
+class MerkleConfig(ctypes.Structure):
+    """Mirror of merkle_config_t; always fill it with merkle_config_init() first."""
+    _fields_ = [
+        ('branching_factor', ctypes.c_size_t),
+        ('layout', ctypes.c_int),
+        ('thread_count', ctypes.c_size_t),
+        ('thread_pool', ctypes.c_void_p),
+        ('leaf_storage', ctypes.c_int),
+        ('leaf_lookup', ctypes.c_void_p),
+        ('leaf_lookup_ctx', ctypes.c_void_p),
+        ('leaf_index', ctypes.c_int),
+        ('key_extractor', ctypes.c_void_p),
+        ('key_extractor_ctx', ctypes.c_void_p),
+        ('hash', ctypes.c_int),
+        ('input_check', ctypes.c_int),
+    ]
+
+
+# void merkle_config_init(merkle_config_t *config)
+merkle.merkle_config_init.restype = None
+merkle.merkle_config_init.argtypes = [ctypes.POINTER(MerkleConfig)]
+
+# merkle_async_t *create_merkle_tree_async(const void **data, const size_t *size, size_t count,
+#                                          const merkle_config_t *config, merkle_async_callback callback,
+#                                          void *user_data)
+merkle.create_merkle_tree_async.restype = ctypes.c_void_p
+merkle.create_merkle_tree_async.argtypes = [
+    ctypes.POINTER(ctypes.c_void_p),  # const void **data
+    ctypes.POINTER(ctypes.c_size_t),  # const size_t *size
+    ctypes.c_size_t,                  # size_t count
+    ctypes.POINTER(MerkleConfig),     # const merkle_config_t *config
+    ctypes.c_void_p,                  # merkle_async_callback callback (NULL: we watch the eventfd)
+    ctypes.c_void_p                   # void *user_data
+]
+
+# merkle_async_t *generate_proof_async(merkle_tree_t *tree, size_t leaf_index,
+#                                      merkle_async_callback callback, void *user_data)
+merkle.generate_proof_async.restype = ctypes.c_void_p
+merkle.generate_proof_async.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_void_p]
+
+# int merkle_async_fd(const merkle_async_t *op)
+merkle.merkle_async_fd.restype = ctypes.c_int
+merkle.merkle_async_fd.argtypes = [ctypes.c_void_p]
+
+# merkle_error_t merkle_async_wait(merkle_async_t *op) - blocks, with the GIL released
+merkle.merkle_async_wait.restype = ctypes.c_int
+merkle.merkle_async_wait.argtypes = [ctypes.c_void_p]
+
+# merkle_error_t merkle_async_cancel(merkle_async_t *op)
+merkle.merkle_async_cancel.restype = ctypes.c_int
+merkle.merkle_async_cancel.argtypes = [ctypes.c_void_p]
+
+# merkle_tree_t *merkle_async_take_tree(merkle_async_t *op)
+merkle.merkle_async_take_tree.restype = ctypes.c_void_p
+merkle.merkle_async_take_tree.argtypes = [ctypes.c_void_p]
+
+# merkle_proof_t *merkle_async_take_proof(merkle_async_t *op)
+merkle.merkle_async_take_proof.restype = ctypes.c_void_p
+merkle.merkle_async_take_proof.argtypes = [ctypes.c_void_p]
+
+# void merkle_async_release(merkle_async_t *op)
+merkle.merkle_async_release.restype = None
+merkle.merkle_async_release.argtypes = [ctypes.c_void_p]
+
+# void dealloc_merkle_proof(merkle_proof_t *proof)
+merkle.dealloc_merkle_proof.restype = None
+merkle.dealloc_merkle_proof.argtypes = [ctypes.c_void_p]
+
 # ==============================================================================
 # CONSTANTS
 # ==============================================================================
 
-# Merkle tree error codes (from Merkle.h)
+# Merkle tree error codes (merkle_error_t in Merkle.h)
 MERKLE_SUCCESS = 0
-MERKLE_NULL_ARG = -1
-MERKLE_BAD_ARG = -2
-MERKLE_BAD_LEN = -3
-MERKLE_FAILED_MEM_ALLOC = -4
-MERKLE_FAILED_TREE_BUILD = -5
-MERKLE_PROOF_INVALID = -6
+MERKLE_NULL_ARG = 1
+MERKLE_BAD_ARG = 2
+MERKLE_FAILED_MEM_ALLOC = 3
+MERKLE_BAD_LEN = 4
+MERKLE_FAILED_TREE_BUILD = 5
+MERKLE_INVALID_INDEX = 6
+MERKLE_PROOF_INVALID = 7
+MERKLE_NOT_FOUND = 8
+MERKLE_IO_ERROR = 9
+MERKLE_NOT_SUPPORTED = 10
+MERKLE_CANCELLED = 11
 
 # Hash size in bytes (SHA-256)
 HASH_SIZE = 32
@@ -117,6 +198,27 @@ def build_tree(data: List[bytes], branching_factor: int = 2) -> ctypes.c_void_p:
         if not isinstance(block, (bytes, bytearray)):
             raise TypeError(f"Element {i} must be bytes or bytearray, got {type(block)}")
     
+    data_ptrs, sizes, buffers = _marshal_blocks(data)
+
+    # Call the C function to create the Merkle tree
+    # The C function will copy the data, so our buffers can be freed after this call
+    tree = merkle.create_merkle_tree(data_ptrs, sizes, len(data), branching_factor)
+    
+    # Check if tree creation succeeded (NULL pointer indicates failure)
+    if not tree:
+        raise RuntimeError('Failed to create Merkle tree - likely out of memory or invalid parameters')
+    
+    return tree
+
+
+def _marshal_blocks(data: List[bytes]):
+    """
+    Convert byte strings into the data and size arrays the C API takes.
+
+    Returns:
+        (data_ptrs, sizes, buffers): the two C arrays, plus the buffers they
+        point into, which must be kept alive as long as C may read them.
+    """
     count = len(data)
     
     # Create ctypes array types for the required C arrays
@@ -141,15 +243,7 @@ def build_tree(data: List[bytes], branching_factor: int = 2) -> ctypes.c_void_p:
         data_ptrs[i] = ctypes.cast(buf, ctypes.c_void_p)
         sizes[i] = len(block)
 
-    # Call the C function to create the Merkle tree
-    # The C function will copy the data, so our buffers can be freed after this call
-    tree = merkle.create_merkle_tree(data_ptrs, sizes, count, branching_factor)
-    
-    # Check if tree creation succeeded (NULL pointer indicates failure)
-    if not tree:
-        raise RuntimeError('Failed to create Merkle tree - likely out of memory or invalid parameters')
-    
-    return tree
+    return data_ptrs, sizes, buffers
 
 
 def get_root_hash(tree: ctypes.c_void_p) -> bytes:
@@ -217,6 +311,131 @@ def cleanup_tree(tree: ctypes.c_void_p) -> None:
         merkle.dealloc_merkle_tree(tree)
 
 
+# ==============================================================================
+# ASYNCHRONOUS WRAPPERS
+# ==============================================================================
+
+async def _await_op(op: int) -> int:
+    """
+    Wait for an asynchronous operation without blocking the event loop.
+
+    The operation's eventfd becomes readable when the worker finishes; the
+    loop watches it like any socket. If the awaiting task is cancelled, the
+    C operation is cancelled too and still awaited, because the worker may
+    be reading buffers the caller is about to drop.
+
+    Returns:
+        int: The merkle_error_t status of the operation.
+    """
+    loop = asyncio.get_running_loop()
+    fd = merkle.merkle_async_fd(op)
+
+    try:
+        if fd >= 0:
+            finished = loop.create_future()
+            loop.add_reader(fd, lambda: finished.done() or finished.set_result(None))
+            try:
+                await finished
+            finally:
+                loop.remove_reader(fd)
+        else:
+            # No eventfd on this platform: block a helper thread instead (GIL released)
+            await loop.run_in_executor(None, merkle.merkle_async_wait, op)
+    except asyncio.CancelledError:
+        merkle.merkle_async_cancel(op)
+        await asyncio.shield(loop.run_in_executor(None, merkle.merkle_async_wait, op))
+        raise
+
+    # Already finished, so this returns at once
+    return merkle.merkle_async_wait(op)
+
+
+async def build_tree_async(data: List[bytes], branching_factor: int = 2, layout: int = 0) -> int:
+    """
+    Build a Merkle tree on the library's worker threads.
+
+    Args:
+        data: List of byte strings to include as leaf nodes in the tree.
+        branching_factor: Number of children each internal node can have.
+        layout: 0 for MERKLE_LAYOUT_POINTER, 1 for MERKLE_LAYOUT_FLAT.
+
+    Returns:
+        int: Opaque pointer to the tree; free it with cleanup_tree().
+
+    Raises:
+        RuntimeError: If the build could not be queued or failed.
+        asyncio.CancelledError: If the awaiting task was cancelled.
+    """
+    if not data:
+        raise ValueError("Data list cannot be empty")
+
+    data_ptrs, sizes, buffers = _marshal_blocks(data)
+    config = MerkleConfig()
+    merkle.merkle_config_init(ctypes.byref(config))
+    config.branching_factor = branching_factor
+    config.layout = layout
+
+    op = merkle.create_merkle_tree_async(data_ptrs, sizes, len(data), ctypes.byref(config), None, None)
+    if not op:
+        raise RuntimeError('Failed to queue the Merkle tree build')
+
+    try:
+        # The buffers stay referenced here until the worker is done with them
+        status = await _await_op(op)
+        if status != MERKLE_SUCCESS:
+            raise RuntimeError(f'Asynchronous build failed with error code {status}')
+        return merkle.merkle_async_take_tree(op)
+    finally:
+        merkle.merkle_async_release(op)
+        del buffers
+
+
+async def proof_async(tree: int, leaf_index: int) -> None:
+    """
+    Generate a proof on a worker thread, then free it.
+
+    A real service would serialize or verify the proof before freeing it;
+    the example only shows the round trip.
+
+    Raises:
+        RuntimeError: If the proof could not be queued or generated.
+    """
+    op = merkle.generate_proof_async(tree, leaf_index, None, None)
+    if not op:
+        raise RuntimeError('Failed to queue the proof')
+
+    try:
+        status = await _await_op(op)
+        if status != MERKLE_SUCCESS:
+            raise RuntimeError(f'Asynchronous proof failed with error code {status}')
+        merkle.dealloc_merkle_proof(merkle.merkle_async_take_proof(op))
+    finally:
+        merkle.merkle_async_release(op)
+
+
+async def async_demo() -> None:
+    """
+    Build a larger tree in the background while the loop keeps ticking.
+    """
+    ticks = 0
+
+    async def ticker():
+        nonlocal ticks
+        while True:
+            await asyncio.sleep(0.001)
+            ticks += 1
+
+    ticking = asyncio.create_task(ticker())
+    blocks = [i.to_bytes(8, 'little') for i in range(200000)]
+    tree = await build_tree_async(blocks, branching_factor=2, layout=1)
+    await asyncio.gather(*(proof_async(tree, i) for i in range(0, 200000, 20000)))
+    ticking.cancel()
+
+    print(f"✓ Async root hash: {get_root_hash(tree).hex()}")
+    print(f"✓ Event loop ran {ticks} ticks while building and proving")
+    cleanup_tree(tree)
+
+
 # ==============================================================================
 # EXAMPLE USAGE
 # ==============================================================================
@@ -252,6 +471,10 @@ if __name__ == '__main__':
         print("\nCleaning up...")
         cleanup_tree(tree)
         print("✓ Memory cleaned up")
+
+        # Build and prove without blocking an event loop
+        print("\nBuilding asynchronously...")
+        asyncio.run(async_demo())
         
     except Exception as e:
         print(f"✗ Error: {e}")
@@ -1,10 +1,11 @@
 /**
  * @file Merkle.h
- * @brief Public API for Merkle tree creation and destruction using SHA-256.
+ * @brief Public API for Merkle tree creation and destruction.
  *
  * This header defines the error codes, opaque types, and functions for
- * creating and destroying Merkle trees. The implementation uses SHA-256
- * and is suitable for cryptographic applications requiring data integrity
+ * creating and destroying Merkle trees. Trees hash with SHA-256 by default;
+ * the algorithm is chosen through merkle_config_t::hash. The implementation
+ * is suitable for cryptographic applications requiring data integrity
  * verification.
  *
  * @author Guy Alster
@@ -16,10 +17,14 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-/** Size in bytes of a SHA-256 hash digest. */
+/** Size in bytes of a node hash; every hash algorithm produces digests of this size. */
 #define HASH_SIZE (32)
 
+/** Largest context a hash algorithm's vtable may ask for. */
+#define MERKLE_HASH_MAX_CTX_SIZE (2048)
+
 /**
  * @enum merkle_error_t
  * @brief Error codes returned by Merkle tree operations.
@@ -33,7 +38,10 @@ typedef enum merkle_error_t {
   MERKLE_FAILED_TREE_BUILD,/**< Merkle tree construction failed. */
   MERKLE_INVALID_INDEX,    /**< Leaf index out of bounds. */
   MERKLE_PROOF_INVALID,    /**< Proof verification failed. */
-  MERKLE_NOT_FOUND         /**< Target value not found in tree. */
+  MERKLE_NOT_FOUND,        /**< Target value not found in tree. */
+  MERKLE_IO_ERROR,         /**< Reading or writing a file failed. */
+  MERKLE_NOT_SUPPORTED,    /**< Feature not compiled into this build. */
+  MERKLE_CANCELLED         /**< Asynchronous operation cancelled before it finished. */
 } merkle_error_t;
 
 /**
@@ -45,6 +53,152 @@ typedef enum merkle_error_t {
  */
 typedef bool (*value_finder)(void *value);
 
+/**
+ * @struct merkle_thread_pool
+ * @brief Opaque pool of worker threads used for parallel tree construction.
+ */
+struct merkle_thread_pool;
+
+/**
+ * @typedef merkle_thread_pool_t
+ * @brief Typedef for the opaque worker pool structure.
+ */
+typedef struct merkle_thread_pool merkle_thread_pool_t;
+
+/**
+ * @enum merkle_layout_t
+ * @brief Node storage layouts a tree can be built with.
+ */
+typedef enum merkle_layout_t {
+  MERKLE_LAYOUT_POINTER = 0, /**< One heap node per tree node, linked by parent/children pointers. */
+  MERKLE_LAYOUT_FLAT,        /**< Contiguous per-level hash arrays addressed by index arithmetic. */
+  MERKLE_LAYOUT_BLOCKED      /**< Flat storage ordered in page-sized subtree blocks for cache-friendly proof walks. */
+} merkle_layout_t;
+
+/**
+ * @enum merkle_leaf_storage_t
+ * @brief What a tree keeps of each leaf's data block.
+ *
+ * Hashes are always stored; only the retained leaf data differs.
+ */
+typedef enum merkle_leaf_storage_t {
+  MERKLE_LEAF_COPY = 0,  /**< Copy every block into the tree (default). */
+  MERKLE_LEAF_BORROW,    /**< Keep the caller's pointers; blocks must stay valid and unchanged until the tree is destroyed. */
+  MERKLE_LEAF_HASH_ONLY  /**< Keep no data at all, only the leaf hashes. */
+} merkle_leaf_storage_t;
+
+/**
+ * @enum merkle_input_check_t
+ * @brief How much a tree trusts the caller's data and size arrays.
+ *
+ * NULL blocks and empty sizes are rejected either way; the modes differ in
+ * whether unreadable memory is survivable.
+ */
+typedef enum merkle_input_check_t {
+  MERKLE_INPUT_GUARDED = 0, /**< Catch bad pointers and overlong counts with signal handlers (default). */
+  MERKLE_INPUT_TRUSTED      /**< No signal handlers or setjmp; bad memory crashes the process like any C API. */
+} merkle_input_check_t;
+
+/**
+ * @typedef merkle_leaf_lookup
+ * @brief Resolves a leaf index to its data for trees that do not retain leaf data.
+ *
+ * Used by generate_proof_by_finder() on MERKLE_LEAF_HASH_ONLY trees.
+ *
+ * @param leaf_index Index of the leaf being examined.
+ * @param ctx Context registered in merkle_config_t::leaf_lookup_ctx.
+ * @return Pointer handed to the finder, or NULL to skip the leaf.
+ */
+typedef void *(*merkle_leaf_lookup)(size_t leaf_index, void *ctx);
+
+/**
+ * @enum merkle_leaf_index_t
+ * @brief Content index a tree keeps for generate_proof_by_key().
+ */
+typedef enum merkle_leaf_index_t {
+  MERKLE_INDEX_NONE = 0,  /**< No index; generate_proof_by_key() is rejected (default). */
+  MERKLE_INDEX_LEAF_HASH, /**< Leaves are looked up by their data block, i.e. by leaf hash. */
+  MERKLE_INDEX_KEY        /**< Leaves are looked up by the key merkle_config_t::key_extractor returns. */
+} merkle_leaf_index_t;
+
+/**
+ * @typedef merkle_key_extractor
+ * @brief Returns the lookup key of a leaf for MERKLE_INDEX_KEY trees.
+ *
+ * Called for every leaf at construction and for every replaced leaf, possibly
+ * from build worker threads. The key only has to stay valid until the call
+ * returns, it is digested right away.
+ *
+ * @param data Leaf data block.
+ * @param size Size of @p data in bytes.
+ * @param key Receives the start of the key (may point into @p data).
+ * @param key_size Receives the size of the key; an empty key leaves the leaf unindexed.
+ * @param ctx Context registered in merkle_config_t::key_extractor_ctx.
+ * @return true to index the leaf under the key, false to leave it out.
+ */
+typedef bool (*merkle_key_extractor)(const void *data, size_t size, const void **key, size_t *key_size, void *ctx);
+
+/**
+ * @enum merkle_hash_id_t
+ * @brief Identifies the hash algorithm of a tree, stored in its proofs and files.
+ */
+typedef enum merkle_hash_id_t {
+  MERKLE_HASH_SHA256 = 0,        /**< SHA-256 (default), batched through the SIMD backends. */
+  MERKLE_HASH_BLAKE3 = 1,        /**< BLAKE3 with a 32-byte output; not for trees that must interoperate with SHA-256. */
+  MERKLE_HASH_CUSTOM_FIRST = 128 /**< First identifier available to merkle_hash_register(); the last is 255. */
+} merkle_hash_id_t;
+
+/**
+ * @struct merkle_hash_vtable_t
+ * @brief Hash algorithm used for leaves and nodes.
+ *
+ * Contexts are caller-provided, suitably aligned buffers of @ref ctx_size
+ * bytes, so hashing never allocates. All callbacks must be thread-safe for
+ * distinct contexts.
+ */
+typedef struct merkle_hash_vtable_t {
+  const char *name;   /**< Printable name. */
+  size_t digest_size; /**< Digest size in bytes (must be HASH_SIZE). */
+  size_t ctx_size;    /**< Context size in bytes (must be <= MERKLE_HASH_MAX_CTX_SIZE). */
+  void (*init)(void *ctx);                                  /**< Starts a digest. */
+  void (*update)(void *ctx, const void *data, size_t len);  /**< Absorbs bytes. */
+  void (*final)(void *ctx, unsigned char *digest);          /**< Writes the digest. */
+  /** Hashes @p count independent messages at once (optional; NULL hashes one message at a time). */
+  void (*batch)(const unsigned char *const *msgs, const size_t *lens, unsigned char *const *digests, size_t count);
+} merkle_hash_vtable_t;
+
+/**
+ * @struct merkle_allocator_t
+ * @brief Memory callbacks installed with merkle_set_allocator().
+ */
+typedef struct merkle_allocator_t {
+  void *(*alloc)(size_t size, void *ctx); /**< Returns @p size bytes aligned for any type, or NULL. */
+  void (*free)(void *ptr, void *ctx);     /**< Releases a block returned by @ref alloc (never NULL). */
+  void *ctx;                              /**< Context handed to both callbacks. */
+} merkle_allocator_t;
+
+/**
+ * @struct merkle_config_t
+ * @brief Construction options for create_merkle_tree_ex().
+ *
+ * Always initialize with merkle_config_init() before overriding fields so
+ * that options added in later versions pick up their defaults.
+ */
+typedef struct merkle_config_t {
+  size_t branching_factor; /**< Maximum number of children per node (must be >= 2 for more than one leaf). */
+  merkle_layout_t layout;  /**< Node storage layout. */
+  size_t thread_count;     /**< Worker threads for a parallel build; 0 or 1 builds serially. */
+  merkle_thread_pool_t *thread_pool; /**< Caller-owned pool to build on; overrides @ref thread_count when set. */
+  merkle_leaf_storage_t leaf_storage; /**< What the tree keeps of each leaf's data. */
+  merkle_leaf_lookup leaf_lookup;     /**< Finder data source when leaf data is not retained (may be NULL). */
+  void *leaf_lookup_ctx;              /**< Context handed to @ref leaf_lookup. */
+  merkle_leaf_index_t leaf_index;     /**< Content index built with the tree. */
+  merkle_key_extractor key_extractor; /**< Key of each leaf for MERKLE_INDEX_KEY. */
+  void *key_extractor_ctx;            /**< Context handed to @ref key_extractor. */
+  merkle_hash_id_t hash;              /**< Hash algorithm of leaves and nodes. */
+  merkle_input_check_t input_check;   /**< Protection of construction and later updates against bad input. */
+} merkle_config_t;
+
 /**
  * @struct merkle_tree
  * @brief Opaque structure representing a Merkle tree.
@@ -64,10 +218,112 @@ typedef struct merkle_proof_item merkle_proof_item_t;
 struct merkle_proof;
 typedef struct merkle_proof merkle_proof_t;
 
+/**
+ * @typedef merkle_multiproof_t
+ * @brief Opaque deduplicated proof for a set of leaves.
+ */
+typedef struct merkle_multiproof merkle_multiproof_t;
+
+/**
+ * @typedef merkle_range_proof_t
+ * @brief Opaque proof for a contiguous range of leaves.
+ */
+typedef struct merkle_range_proof merkle_range_proof_t;
+
+/**
+ * @brief Snapshot of the hot-path counters returned by merkle_get_stats().
+ *
+ * Times are in nanoseconds of a monotonic clock. Allocation counters are
+ * only kept globally since MMalloc() does not know which tree it serves;
+ * they read zero in a per-tree snapshot.
+ */
+typedef struct merkle_stats {
+  uint64_t leaf_hash_ns;       /**< Time spent hashing leaf blocks. */
+  uint64_t leaf_hashes;        /**< Leaf blocks hashed. */
+  uint64_t node_hash_ns;       /**< Time spent hashing internal nodes. */
+  uint64_t node_hashes;        /**< Internal nodes hashed. */
+  uint64_t bytes_hashed;       /**< Leaf and node bytes fed to the hash. */
+  uint64_t allocations;        /**< Library allocations. */
+  uint64_t allocated_bytes;    /**< Bytes requested by library allocations. */
+  uint64_t frees;              /**< Library frees. */
+  uint64_t read_lock_wait_ns;  /**< Time spent acquiring tree read locks. */
+  uint64_t read_locks;         /**< Tree read locks acquired. */
+  uint64_t write_lock_wait_ns; /**< Time spent acquiring tree write locks. */
+  uint64_t write_locks;        /**< Tree write locks acquired. */
+  uint64_t proofs_generated;   /**< Proofs successfully generated. */
+} merkle_stats_t;
+
+/**
+ * @struct merkle_builder
+ * @brief Opaque append-only builder computing a root without retaining leaves.
+ */
+struct merkle_builder;
+
+/**
+ * @typedef merkle_builder_t
+ * @brief Typedef for the opaque streaming builder structure.
+ */
+typedef struct merkle_builder merkle_builder_t;
+
+/**
+ * @brief Routes all library memory through caller-provided callbacks.
+ *
+ * Lets the library draw from jemalloc arenas, hugepage-backed regions or
+ * any other allocator. Blocks are zeroed by the library, so @c alloc need
+ * not clear them. Pointer-layout trees take their nodes from a few large
+ * blocks that are released together, so a tree costs the allocator a
+ * handful of calls rather than one per node. Install the allocator before
+ * creating any library object and keep it until all of them are destroyed;
+ * the callbacks may be invoked from build worker threads.
+ *
+ * @param allocator Callbacks to install, or NULL to restore calloc()/free().
+ * @return MERKLE_SUCCESS on success, MERKLE_BAD_ARG if a callback is missing.
+ */
+merkle_error_t merkle_set_allocator(const merkle_allocator_t *allocator);
+
+/**
+ * @brief Makes a hash algorithm available under a custom identifier.
+ *
+ * Trees select it through merkle_config_t::hash, and proofs and tree files
+ * record the identifier, so a process verifying them must register the same
+ * algorithm under the same identifier. Register before creating trees or
+ * verifying proofs that use it; a registration cannot be replaced.
+ *
+ * @param id Identifier in [MERKLE_HASH_CUSTOM_FIRST, 255].
+ * @param vtable Algorithm callbacks (must not be NULL; must outlive every user).
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG for a NULL vtable,
+ *         MERKLE_BAD_ARG for a reserved or taken identifier, a missing
+ *         callback, or a digest or context size the library cannot hold.
+ */
+merkle_error_t merkle_hash_register(merkle_hash_id_t id, const merkle_hash_vtable_t *vtable);
+
+/**
+ * @brief Returns the algorithm registered under an identifier.
+ * @param id Built-in or registered identifier.
+ * @return The algorithm, or NULL if none is known under @p id.
+ */
+const merkle_hash_vtable_t *merkle_hash_get(merkle_hash_id_t id);
+
+/**
+ * @brief Reads the hot-path counters of a tree or of the whole process.
+ *
+ * Counting is compiled in with -DMERKLE_STATS; other builds pay nothing
+ * for it and report MERKLE_NOT_SUPPORTED. Counters only grow, so callers
+ * measure a section of work by subtracting two snapshots.
+ *
+ * @param tree Tree whose counters to read, or NULL for the global ones.
+ * @param out Receives the snapshot (must not be NULL).
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG if @p out is NULL,
+ *         MERKLE_NOT_SUPPORTED if the library was built without MERKLE_STATS.
+ */
+merkle_error_t merkle_get_stats(const merkle_tree_t *tree, merkle_stats_t *out);
+
 /**
  * @brief Creates a Merkle tree from an array of data blocks.
  *
- * Constructs a Merkle tree using SHA-256 hashing with the specified branching factor.
+ * Constructs a Merkle tree with the specified branching factor, hashing with
+ * SHA-256, the default algorithm. Use create_merkle_tree_ex() to choose
+ * another one through merkle_config_t::hash.
  * The branching factor must be >= 2 and affects the tree's structure and height.
  *
  * @param data Array of pointers to data blocks (must not be NULL).
@@ -79,6 +335,129 @@ typedef struct merkle_proof merkle_proof_t;
 merkle_tree_t *create_merkle_tree(const void **data, const size_t *sizes,
                                   size_t count, size_t branching_factor);
 
+/**
+ * @brief Fills a configuration with the library defaults.
+ *
+ * Defaults are a binary tree (branching factor 2) using the pointer layout,
+ * i.e. the same tree create_merkle_tree() builds.
+ *
+ * @param config Configuration to initialize (NULL is ignored).
+ */
+void merkle_config_init(merkle_config_t *config);
+
+/**
+ * @brief Creates a Merkle tree from an array of data blocks using explicit options.
+ *
+ * With MERKLE_LAYOUT_FLAT every level is stored as one contiguous hash array
+ * and leaf data is copied into a single buffer, so building and freeing the
+ * tree costs a handful of allocations instead of several per node. The root
+ * hash and proofs are identical to those of the pointer layout.
+ *
+ * MERKLE_LAYOUT_BLOCKED stores the same nodes in another order: every band
+ * of a few levels is cut into subtrees of at most a page each, so a
+ * leaf-to-root walk touches one page per band instead of one per level.
+ * It suits trees far larger than the caches that serve many proofs; saved
+ * files keep the level order and reopen as MERKLE_LAYOUT_FLAT.
+ *
+ * MERKLE_LEAF_BORROW and MERKLE_LEAF_HASH_ONLY skip the per-leaf copy, so
+ * the data is read exactly once, to hash it. The root hash and proofs do not
+ * depend on the leaf storage mode.
+ *
+ * @param data Array of pointers to data blocks (must not be NULL).
+ * @param sizes Array of sizes for each data block (must not be NULL).
+ * @param count Number of data blocks (must be > 0).
+ * @param config Construction options (must not be NULL).
+ * @return Pointer to the created Merkle tree, or NULL on failure.
+ */
+merkle_tree_t *create_merkle_tree_ex(const void **data, const size_t *sizes,
+                                     size_t count, const merkle_config_t *config);
+
+/**
+ * @brief Creates a Merkle tree whose leaves are consecutive chunks of a file.
+ *
+ * Leaf i covers bytes [i * leaf_size, (i + 1) * leaf_size) of the file and
+ * only the last leaf may be shorter, so the tree equals the one
+ * create_merkle_tree_ex() builds over the same chunks. The file is read
+ * sequentially with pread() by a background thread, one window ahead of the
+ * hashing, so I/O overlaps hashing and no more than two windows of data
+ * (2 x 1 MiB by default) are held whatever the file size. The descriptor's
+ * offset is not used or moved.
+ *
+ * The tree keeps only leaf hashes, whatever merkle_config_t::leaf_storage
+ * says; finders need merkle_config_t::leaf_lookup. MERKLE_INDEX_KEY is
+ * rejected since it would need the data again.
+ *
+ * @param fd Descriptor of a non-empty regular file open for reading.
+ * @param leaf_size Bytes per leaf (must be > 0).
+ * @param config Construction options (must not be NULL).
+ * @return Pointer to the created Merkle tree, or NULL on bad arguments,
+ *         read errors or allocation failure.
+ */
+merkle_tree_t *create_merkle_tree_from_fd(int fd, size_t leaf_size, const merkle_config_t *config);
+
+/**
+ * @brief Opens @p path and builds a tree from it with create_merkle_tree_from_fd().
+ *
+ * @param path File to chunk (must not be NULL).
+ * @param leaf_size Bytes per leaf (must be > 0).
+ * @param config Construction options (must not be NULL).
+ * @return Pointer to the created Merkle tree, or NULL on failure.
+ */
+merkle_tree_t *create_merkle_tree_from_file(const char *path, size_t leaf_size, const merkle_config_t *config);
+
+/**
+ * @brief Starts a pool of worker threads for parallel tree construction.
+ *
+ * A pool can be shared by any number of builds, including concurrent ones,
+ * through merkle_config_t::thread_pool. Leaf hashing and the hashing of each
+ * tree level are partitioned across the workers; the resulting root is
+ * identical to a serial build.
+ *
+ * @param thread_count Number of worker threads to start (must be > 0).
+ * @return Pointer to the new pool, or NULL on failure.
+ */
+merkle_thread_pool_t *merkle_thread_pool_create(size_t thread_count);
+
+/**
+ * @brief Finishes queued work, joins all workers and frees the pool.
+ *
+ * Must not be called while a build is still using the pool.
+ *
+ * @param pool Pool to destroy (can be NULL).
+ */
+void merkle_thread_pool_destroy(merkle_thread_pool_t *pool);
+
+/**
+ * @brief Saves a built tree to a file that open_merkle_tree_mmap() can map.
+ *
+ * The file holds a 64-byte header (magic "MKLT", format version, hash
+ * algorithm, then little-endian branching factor, leaf count and level count)
+ * followed by every node hash, level after level from the leaves to the
+ * root. Leaf data is not saved. Either layout can be saved.
+ *
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param path Destination file, created or truncated (must not be NULL).
+ * @return MERKLE_SUCCESS on success, MERKLE_IO_ERROR if the file cannot be
+ *         written, MERKLE_NULL_ARG on NULL arguments,
+ *         MERKLE_FAILED_MEM_ALLOC on allocation failure.
+ */
+merkle_error_t save_merkle_tree(merkle_tree_t *const tree, const char *path);
+
+/**
+ * @brief Opens a saved tree without reading it.
+ *
+ * The file is mapped read-only and used in place as a flat-layout tree, so
+ * opening costs the same for any tree size and a proof only pages in the
+ * few hashes it touches on each level. The tree keeps no leaf data, so
+ * generate_proof_by_finder() fails with MERKLE_BAD_ARG, and leaves cannot be
+ * updated. The file must not be modified while the tree is open.
+ *
+ * @param path File written by save_merkle_tree() (must not be NULL).
+ * @return Pointer to the mapped tree, or NULL if the file cannot be mapped
+ *         or is not a valid tree file. Release with dealloc_merkle_tree().
+ */
+merkle_tree_t *open_merkle_tree_mmap(const char *path);
+
 /**
  * @brief Destroys a Merkle tree and frees all associated memory.
  *
@@ -102,6 +481,230 @@ void dealloc_merkle_tree(merkle_tree_t *tree);
  */
 merkle_error_t get_tree_hash(merkle_tree_t * const tree, unsigned char copy_into[HASH_SIZE]);
 
+/**
+ * @brief Replaces the data of one leaf and recomputes the root.
+ *
+ * Only the hashes on the path from the leaf to the root are recomputed, so an
+ * update costs O(log n) hashes instead of a rebuild. The tree's write lock is
+ * held for the duration of the update. What is kept of the new block follows
+ * the tree's merkle_leaf_storage_t: it is copied, borrowed (same lifetime
+ * contract as at creation) or only hashed.
+ *
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param leaf_index Index of the leaf to replace (must be < leaf count).
+ * @param data New data block (must not be NULL).
+ * @param size Size of the new data block (must be > 0).
+ * @return MERKLE_SUCCESS on success, MERKLE_INVALID_INDEX for an out of range
+ *         index, MERKLE_BAD_ARG for an invalid block, a tree opened with
+ *         open_merkle_tree_mmap() or a tree that shares nodes with versions
+ *         (see derive_merkle_tree()), MERKLE_FAILED_MEM_ALLOC if the copy
+ *         cannot be allocated. The tree is unchanged on failure.
+ */
+merkle_error_t update_leaf(merkle_tree_t *const tree, size_t leaf_index, const void *data, size_t size);
+
+/**
+ * @brief Replaces the data of several leaves and recomputes the root once.
+ *
+ * New leaf hashes are computed in batches, then every ancestor of the changed
+ * leaves is rehashed exactly once, level by level. When an index appears more
+ * than once, its last entry wins. Either all updates are applied or, on
+ * failure, none are.
+ *
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param leaf_indices Indices of the leaves to replace (must not be NULL).
+ * @param data New data blocks, one per index (must not be NULL).
+ * @param sizes Sizes of the new data blocks (must not be NULL).
+ * @param count Number of entries in the three arrays (0 is a no-op).
+ * @return MERKLE_SUCCESS on success, or the same errors as update_leaf().
+ */
+merkle_error_t update_leaves(merkle_tree_t *const tree, const size_t *leaf_indices, const void **data,
+                             const size_t *sizes, size_t count);
+
+/**
+ * @brief Creates a new version of a tree with some leaves replaced.
+ *
+ * The version is copy-on-write: only the nodes on the paths from the changed
+ * leaves to the root are new, every other subtree is shared with @p tree, so
+ * keeping many historical versions costs memory proportional to the changes
+ * rather than to the tree size. Leaves and errors follow update_leaves().
+ *
+ * Shared nodes are reference counted. Once a version has been derived from
+ * it, @p tree no longer accepts update_leaves() (new changes are made by
+ * deriving again), and the memory of the original tree stays allocated
+ * until it and every version derived from it are released with
+ * dealloc_merkle_tree(), in any order. Only MERKLE_LAYOUT_POINTER trees can
+ * be versioned.
+ *
+ * @param tree Tree or version to derive from (must not be NULL).
+ * @param leaf_indices Indices of the leaves to replace (must not be NULL).
+ * @param data New data blocks, one per index (must not be NULL).
+ * @param sizes Sizes of the new data blocks (must not be NULL).
+ * @param count Number of entries in the three arrays (must be > 0).
+ * @return The new version, or NULL on failure, in which case @p tree is
+ *         unchanged.
+ */
+merkle_tree_t *derive_merkle_tree(merkle_tree_t *const tree, const size_t *leaf_indices, const void **data,
+                                  const size_t *sizes, size_t count);
+
+/**
+ * @brief Returns the number of leaves of a tree.
+ * @param tree Tree to query (NULL yields 0).
+ */
+size_t merkle_tree_leaf_count(const merkle_tree_t *tree);
+
+/**
+ * @brief Returns the number of levels above the leaves, i.e. the root's level.
+ * @param tree Tree to query (NULL yields 0).
+ */
+size_t merkle_tree_level_count(const merkle_tree_t *tree);
+
+/**
+ * @brief Finds the leaves whose hashes differ between two trees.
+ *
+ * Both trees are walked from the root and only subtrees whose hashes differ
+ * are entered, so k differences cost O(k log n) node comparisons. The trees
+ * may use different layouts but must have the same shape.
+ *
+ * @param a First tree (must not be NULL).
+ * @param b Second tree (must not be NULL).
+ * @param leaf_indices Receives the differing leaves in ascending order, or
+ *        NULL when there are none; free with dealloc_merkle_diff().
+ * @param count Receives the number of differing leaves.
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments,
+ *         MERKLE_BAD_ARG if the leaf counts or branching factors differ,
+ *         MERKLE_FAILED_MEM_ALLOC on allocation failure.
+ */
+merkle_error_t merkle_tree_diff(merkle_tree_t *const a, merkle_tree_t *const b, size_t **leaf_indices,
+                                size_t *count);
+
+/**
+ * @brief Copies the hashes of some nodes of one tree level.
+ *
+ * The answering side of a remote diff: the peer sends node indices of a level
+ * and gets their hashes back, to feed merkle_tree_diff_level(). Level 0 holds
+ * the leaves and merkle_tree_level_count() is the root's level.
+ *
+ * @param tree Tree to read (must not be NULL).
+ * @param level Level of the nodes (must be <= merkle_tree_level_count()).
+ * @param nodes Node indices on that level.
+ * @param count Number of entries in @p nodes.
+ * @param hashes Receives one hash per node.
+ * @return MERKLE_SUCCESS on success, MERKLE_INVALID_INDEX for a node outside
+ *         the level, MERKLE_BAD_ARG for an invalid level, MERKLE_NULL_ARG on
+ *         NULL arguments.
+ */
+merkle_error_t merkle_tree_level_hashes(merkle_tree_t *const tree, size_t level, const size_t *nodes, size_t count,
+                                        unsigned char (*hashes)[HASH_SIZE]);
+
+/**
+ * @brief Compares one level of a tree against a peer's hashes.
+ *
+ * Runs one round of a remote diff over trees of the same shape. Starting with
+ * node 0 at the root's level, each round sends the returned indices to the
+ * peer, which answers with merkle_tree_level_hashes() one level down; at
+ * level 0 the returned indices are the differing leaves. Only hashes of
+ * differing subtrees and their siblings cross the wire.
+ *
+ * @param tree Local tree (must not be NULL).
+ * @param level Level of @p nodes.
+ * @param nodes Node indices the peer answered for.
+ * @param remote The peer's hashes for @p nodes.
+ * @param count Number of entries in @p nodes and @p remote.
+ * @param next Receives the nodes to query on level - 1 (the differing leaves
+ *        at level 0), or NULL when nothing differs; free with
+ *        dealloc_merkle_diff().
+ * @param next_count Receives the number of entries in @p next.
+ * @return MERKLE_SUCCESS on success, MERKLE_INVALID_INDEX for a node outside
+ *         the level, MERKLE_BAD_ARG for an invalid level, MERKLE_NULL_ARG on
+ *         NULL arguments, MERKLE_FAILED_MEM_ALLOC on allocation failure.
+ */
+merkle_error_t merkle_tree_diff_level(merkle_tree_t *const tree, size_t level, const size_t *nodes,
+                                      const unsigned char (*remote)[HASH_SIZE], size_t count, size_t **next,
+                                      size_t *next_count);
+
+/**
+ * @brief Frees an index array returned by the diff functions.
+ * @param indices Array to free (can be NULL).
+ */
+void dealloc_merkle_diff(size_t *indices);
+
+
+/**
+ * @brief Starts a streaming build for input whose size is not known up front.
+ *
+ * Leaves are appended one at a time or in chunks and only the frontier of
+ * incomplete sibling groups is kept, at most branching_factor hashes per
+ * tree level, so memory stays constant as the input grows. The resulting
+ * root equals the one create_merkle_tree() computes over the same blocks.
+ * A builder is not thread-safe.
+ *
+ * @param branching_factor Maximum number of children per node (must be >= 2).
+ * @return Pointer to the new builder, or NULL on failure.
+ */
+merkle_builder_t *merkle_builder_init(size_t branching_factor);
+
+/**
+ * @brief Starts a streaming build hashing with a chosen algorithm.
+ *
+ * The root equals the one of a tree created with the same merkle_config_t::hash.
+ *
+ * @param branching_factor Maximum number of children per node (must be >= 2).
+ * @param hash Built-in or registered hash algorithm.
+ * @return Pointer to the new builder, or NULL on failure.
+ */
+merkle_builder_t *merkle_builder_init_hash(size_t branching_factor, merkle_hash_id_t hash);
+
+/**
+ * @brief Appends one data block as the next leaf.
+ *
+ * @param builder Builder to append to (must not be NULL).
+ * @param data Data block (must not be NULL).
+ * @param size Size of the data block (must be > 0).
+ * @return MERKLE_SUCCESS on success, MERKLE_BAD_ARG for an invalid block,
+ *         MERKLE_FAILED_MEM_ALLOC if a new tree level could not be allocated.
+ */
+merkle_error_t merkle_builder_append(merkle_builder_t *builder, const void *data, size_t size);
+
+/**
+ * @brief Appends a chunk of data blocks as the next leaves, in order.
+ *
+ * NULL or empty blocks are rejected before anything is appended. A block
+ * that faults while being hashed stops the append; leaves hashed before it
+ * stay appended, as merkle_builder_leaf_count() reports.
+ *
+ * @param builder Builder to append to (must not be NULL).
+ * @param data Array of data blocks (must not be NULL).
+ * @param sizes Sizes of the data blocks (must not be NULL).
+ * @param count Number of blocks (0 is a no-op).
+ * @return MERKLE_SUCCESS on success, or the same errors as merkle_builder_append().
+ */
+merkle_error_t merkle_builder_append_n(merkle_builder_t *builder, const void **data,
+                                       const size_t *sizes, size_t count);
+
+/**
+ * @brief Computes the root over every leaf appended so far.
+ *
+ * The builder is left untouched, so more leaves can be appended and a new
+ * root computed later.
+ *
+ * @param builder Builder to finalize (must not be NULL).
+ * @param root Buffer receiving the root hash (must be HASH_SIZE bytes).
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments,
+ *         MERKLE_BAD_ARG if no leaf has been appended.
+ */
+merkle_error_t merkle_builder_finalize(const merkle_builder_t *builder, unsigned char root[HASH_SIZE]);
+
+/**
+ * @brief Returns the number of leaves appended to a builder.
+ * @param builder Builder to query (NULL yields 0).
+ */
+size_t merkle_builder_leaf_count(const merkle_builder_t *builder);
+
+/**
+ * @brief Frees a builder and its frontier.
+ * @param builder Builder to destroy (can be NULL).
+ */
+void merkle_builder_destroy(merkle_builder_t *builder);
 
 /**
  * @brief Generates a Merkle proof for a leaf at the specified index.
@@ -117,6 +720,12 @@ merkle_error_t get_tree_hash(merkle_tree_t * const tree, unsigned char copy_into
  */
 merkle_error_t generate_proof_from_index(merkle_tree_t *const tree, size_t leaf_index, merkle_proof_t **proof);
 
+/**
+ * @brief Frees a proof returned by any of the generate_proof functions.
+ * @param proof Proof to free (can be NULL).
+ */
+void dealloc_merkle_proof(merkle_proof_t *proof);
+
 /**
  * @brief Generates a Merkle proof for a leaf found using a custom finder function.
  *
@@ -124,6 +733,10 @@ merkle_error_t generate_proof_from_index(merkle_tree_t *const tree, size_t leaf_
  * then generates a proof path for the first matching leaf found. The search is
  * performed in leaf index order (0 to leaf_count-1).
  *
+ * Trees built with MERKLE_LEAF_HASH_ONLY hold no leaf data, so the finder is
+ * fed by the configured merkle_leaf_lookup instead; without one the search
+ * fails with MERKLE_BAD_ARG.
+ *
  * @param tree Pointer to the Merkle tree (must not be NULL).
  * @param finder Function pointer to locate the target leaf value (must not be NULL).
  * @param path_length Pointer to store the length of the proof path (must not be NULL).
@@ -132,5 +745,681 @@ merkle_error_t generate_proof_from_index(merkle_tree_t *const tree, size_t leaf_
  */
 merkle_error_t generate_proof_by_finder(merkle_tree_t *const tree, value_finder finder, size_t *path_length, merkle_proof_t** proof);
 
+/**
+ * @brief Generates the proof of the first leaf a finder accepts, scanning on several threads.
+ *
+ * The leaves are split into chunks that the pool's workers and the calling
+ * thread scan side by side; once a match is found, chunks past it stop, and
+ * the result is the lowest matching leaf, exactly as with
+ * generate_proof_by_finder(). The finder must be safe to call concurrently.
+ *
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param finder Function pointer to locate the target leaf value (must not be NULL).
+ * @param pool Pool to scan on (NULL scans on the calling thread only).
+ * @param proof Pointer to store the generated proof (must not be NULL).
+ * @return MERKLE_SUCCESS on success, MERKLE_NOT_FOUND if no leaf matches,
+ *         MERKLE_BAD_ARG for NULL arguments or a tree without leaf data.
+ */
+merkle_error_t generate_proof_by_finder_parallel(merkle_tree_t *const tree, value_finder finder,
+                                                 merkle_thread_pool_t *pool, merkle_proof_t **proof);
+
+/**
+ * @brief Generates the proof of a leaf looked up in the tree's content index.
+ *
+ * Costs one table probe instead of a scan. With MERKLE_INDEX_LEAF_HASH the
+ * key is the leaf's data block, with MERKLE_INDEX_KEY it is compared with
+ * what the key extractor returned for each leaf. The index follows
+ * update_leaves(); versions made by derive_merkle_tree() carry none. When
+ * several leaves share a key, the lowest of them is proven.
+ *
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param key Key to look up (must not be NULL).
+ * @param key_size Size of @p key in bytes (must be > 0).
+ * @param proof Pointer to store the generated proof (must not be NULL).
+ * @return MERKLE_SUCCESS on success, MERKLE_NOT_FOUND if no leaf has the key,
+ *         MERKLE_NULL_ARG on NULL arguments, MERKLE_BAD_ARG for an empty key
+ *         or a tree built without an index.
+ */
+merkle_error_t generate_proof_by_key(merkle_tree_t *const tree, const void *key, size_t key_size,
+                                     merkle_proof_t **proof);
+
+/**
+ * @brief Reports a buffer size that holds the serialized proof of any leaf.
+ *
+ * Lets callers reserve one fixed buffer per tree and pass it to
+ * generate_proof_into() for every leaf.
+ *
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param size Receives the size in bytes (must not be NULL).
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments,
+ *         MERKLE_BAD_LEN if the size does not fit in a size_t.
+ */
+merkle_error_t merkle_proof_max_size(merkle_tree_t *const tree, size_t *size);
+
+/**
+ * @brief Serializes the proof of one leaf into caller-provided memory.
+ *
+ * No memory is allocated. The buffer is self-contained and can be sent as is;
+ * all integers are little-endian:
+ *
+ * | Offset | Size | Field                                        |
+ * | ------ | ---- | -------------------------------------------- |
+ * | 0      | 4    | Magic "MKLP"                                 |
+ * | 4      | 1    | Format version (1)                           |
+ * | 5      | 1    | Hash algorithm (0 = SHA-256)                 |
+ * | 6      | 2    | Reserved, zero                               |
+ * | 8      | 8    | Leaf index                                   |
+ * | 16     | 8    | Branching factor                             |
+ * | 24     | 8    | Path length L                                |
+ * | 32     | 8 L  | Per level: u32 sibling count, u32 position   |
+ * | 32+8 L | ...  | Sibling hashes, level after level            |
+ *
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param leaf_index Index of the leaf to prove (must be < leaf count).
+ * @param buffer Destination (may be NULL when @p capacity is 0, to query the size).
+ * @param capacity Size of @p buffer in bytes.
+ * @param written Receives the proof size in bytes, also when the buffer is too small (must not be NULL).
+ * @return MERKLE_SUCCESS on success, MERKLE_BAD_LEN if @p capacity is too
+ *         small, MERKLE_INVALID_INDEX for an out of range leaf,
+ *         MERKLE_NULL_ARG on NULL arguments, MERKLE_BAD_ARG if the tree's
+ *         branching factor does not fit the format.
+ */
+merkle_error_t generate_proof_into(merkle_tree_t *const tree, size_t leaf_index, void *buffer, size_t capacity,
+                                   size_t *written);
+
+/**
+ * @brief Serializes the proofs of many leaves into one caller buffer.
+ *
+ * Equivalent to calling generate_proof_into() for every index, but the read
+ * lock is taken once for the whole batch, the tree is walked in ascending
+ * leaf order so neighbouring proofs share cached paths, and with a pool the
+ * proofs are written in parallel. Nothing is allocated unless the indices
+ * arrive unsorted. Proof i is laid out as generate_proof_into() writes it,
+ * at bytes [offsets[i], offsets[i + 1]) of @p buffer.
+ *
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param leaf_indices Leaves to prove, in any order, repeats allowed.
+ * @param count Number of leaf indices.
+ * @param pool Pool to write the proofs on (NULL writes them serially).
+ * @param buffer Destination (may be NULL when @p capacity is 0, to query the size).
+ * @param capacity Size of @p buffer in bytes.
+ * @param offsets Receives count + 1 byte offsets, also when the buffer is too small (must not be NULL).
+ * @param written Receives the total size in bytes, also when the buffer is too small (must not be NULL).
+ * @return MERKLE_SUCCESS on success, MERKLE_BAD_LEN if @p capacity is too
+ *         small, MERKLE_INVALID_INDEX for an out of range leaf,
+ *         MERKLE_NULL_ARG on NULL arguments, MERKLE_BAD_ARG if the tree's
+ *         branching factor does not fit the format, MERKLE_FAILED_MEM_ALLOC
+ *         on allocation failure.
+ */
+merkle_error_t generate_proofs_batch(merkle_tree_t *const tree, const size_t *leaf_indices, size_t count,
+                                     merkle_thread_pool_t *pool, void *buffer, size_t capacity, size_t *offsets,
+                                     size_t *written);
+
+/**
+ * @brief Generates one compact proof for a set of leaves.
+ *
+ * The proof holds only the sibling hashes that cannot be recomputed from the
+ * requested leaves themselves, so hashes shared by several single-leaf
+ * proofs appear once and clustered ranges need very few hashes. Indices may
+ * be given in any order and may repeat.
+ *
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param leaf_indices Leaves to prove (must not be NULL).
+ * @param count Number of entries in @p leaf_indices (must be > 0).
+ * @param proof Pointer to store the generated proof (must not be NULL).
+ * @return MERKLE_SUCCESS on success, MERKLE_INVALID_INDEX if an index is out
+ *         of range, MERKLE_BAD_ARG for invalid arguments,
+ *         MERKLE_FAILED_MEM_ALLOC on allocation failure.
+ */
+merkle_error_t generate_multiproof(merkle_tree_t *const tree, const size_t *leaf_indices, size_t count,
+                                   merkle_multiproof_t **proof);
+
+/**
+ * @brief Returns the number of sibling hashes carried by a multiproof.
+ * @param proof Proof to query (NULL yields 0).
+ */
+size_t merkle_multiproof_hash_count(const merkle_multiproof_t *proof);
+
+/**
+ * @brief Frees a multiproof.
+ * @param proof Proof to free (can be NULL).
+ */
+void dealloc_merkle_multiproof(merkle_multiproof_t *proof);
+
+/**
+ * @brief Generates one proof for the contiguous leaves [@p first, @p last].
+ *
+ * The leaves of a range share every ancestor between its edges, so only the
+ * siblings left of the range's left edge and right of its right edge are
+ * needed: at most 2 * (branching_factor - 1) hashes per level, O(log n)
+ * whatever the range's length. Generation reads only the two edge paths.
+ *
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param first Index of the first leaf of the range.
+ * @param last Index of the last leaf of the range (must be >= @p first).
+ * @param proof Pointer to store the generated proof (must not be NULL).
+ * @return MERKLE_SUCCESS on success, MERKLE_INVALID_INDEX if @p last is out
+ *         of range, MERKLE_BAD_ARG if @p first > @p last, MERKLE_NULL_ARG on
+ *         NULL arguments, MERKLE_FAILED_MEM_ALLOC on allocation failure.
+ */
+merkle_error_t generate_range_proof(merkle_tree_t *const tree, size_t first, size_t last,
+                                    merkle_range_proof_t **proof);
+
+/**
+ * @brief Returns the number of sibling hashes carried by a range proof.
+ * @param proof Proof to query (NULL yields 0).
+ */
+size_t merkle_range_proof_hash_count(const merkle_range_proof_t *proof);
+
+/**
+ * @brief Frees a range proof.
+ * @param proof Proof to free (can be NULL).
+ */
+void dealloc_merkle_range_proof(merkle_range_proof_t *proof);
+
+/**
+ * @brief Verifies that a leaf belongs to the tree with the given root.
+ *
+ * Recomputes the path from @p leaf_hash to the root using the sibling hashes
+ * in @p proof. The node positions recorded in the proof must agree with its
+ * leaf index, so a proof only verifies for the leaf it was generated for.
+ *
+ * @param root Expected root hash (must be HASH_SIZE bytes).
+ * @param leaf_hash Hash of the leaf's data block under the proof's hash algorithm (must be HASH_SIZE bytes).
+ * @param proof Proof produced by generate_proof_from_index() or generate_proof_by_finder().
+ * @return MERKLE_SUCCESS if the proof is valid, MERKLE_PROOF_INVALID if it
+ *         is malformed or does not lead to @p root, MERKLE_NULL_ARG on NULL arguments.
+ */
+merkle_error_t verify_proof(const unsigned char root[HASH_SIZE], const unsigned char leaf_hash[HASH_SIZE],
+                            const merkle_proof_t *proof);
+
+/**
+ * @brief Verifies many proofs against the same root.
+ *
+ * All proofs are replayed level by level. Proofs of leaves in the same
+ * subtree reconstruct identical parents, which are hashed only once, and the
+ * remaining parents are hashed in SIMD batches, so verifying a batch is much
+ * cheaper than calling verify_proof() for each entry.
+ *
+ * @param root Expected root hash (must be HASH_SIZE bytes).
+ * @param leaf_hashes Leaf hashes, one per proof (must not be NULL).
+ * @param proofs Proofs to verify (NULL entries count as invalid).
+ * @param count Number of proofs (0 is a no-op).
+ * @param results Optional per-proof outcome, true for a valid proof (can be NULL).
+ * @return MERKLE_SUCCESS if every proof is valid, MERKLE_PROOF_INVALID if at
+ *         least one is not, MERKLE_NULL_ARG on NULL arguments,
+ *         MERKLE_FAILED_MEM_ALLOC if the batch state could not be allocated.
+ */
+merkle_error_t verify_proofs_batch(const unsigned char root[HASH_SIZE], const unsigned char (*leaf_hashes)[HASH_SIZE],
+                                   const merkle_proof_t *const *proofs, size_t count, bool *results);
+
+/**
+ * @brief Verifies a proof serialized by generate_proof_into().
+ *
+ * The buffer is parsed in place and fully validated, so it can come straight
+ * from an untrusted peer.
+ *
+ * @param root Expected root hash (must be HASH_SIZE bytes).
+ * @param leaf_hash Hash of the leaf's data block under the proof's hash algorithm (must be HASH_SIZE bytes).
+ * @param buffer Serialized proof (must not be NULL).
+ * @param size Size of @p buffer in bytes.
+ * @return MERKLE_SUCCESS if the proof is valid, MERKLE_PROOF_INVALID if it is
+ *         malformed or does not lead to @p root, MERKLE_NULL_ARG on NULL arguments.
+ */
+merkle_error_t verify_proof_buffer(const unsigned char root[HASH_SIZE], const unsigned char leaf_hash[HASH_SIZE],
+                                   const void *buffer, size_t size);
+
+/**
+ * @brief Verifies a multiproof for a set of leaves against a root.
+ *
+ * The leaves may be given in any order and may repeat, but together they
+ * must be exactly the set the proof was generated for. Parents of a level
+ * are hashed in SIMD batches.
+ *
+ * @param root Expected root hash (must be HASH_SIZE bytes).
+ * @param leaf_indices Indices of the proven leaves (must not be NULL).
+ * @param leaf_hashes Leaf hashes, one per index (must not be NULL).
+ * @param count Number of leaves (must be > 0).
+ * @param proof Proof produced by generate_multiproof() (must not be NULL).
+ * @return MERKLE_SUCCESS if the proof is valid, MERKLE_PROOF_INVALID if it
+ *         does not match the leaves or @p root, MERKLE_NULL_ARG on NULL
+ *         arguments, MERKLE_BAD_ARG for an empty leaf set,
+ *         MERKLE_FAILED_MEM_ALLOC on allocation failure.
+ */
+merkle_error_t verify_multiproof(const unsigned char root[HASH_SIZE], const size_t *leaf_indices,
+                                 const unsigned char (*leaf_hashes)[HASH_SIZE], size_t count,
+                                 const merkle_multiproof_t *proof);
+
+/**
+ * @brief Verifies that a run of leaves is the range a proof covers.
+ *
+ * The range is rebuilt level by level from @p leaf_hashes and the edge
+ * siblings in @p proof, so verification hashes each node above the range
+ * once and needs no index list.
+ *
+ * @param root Expected root hash (must be HASH_SIZE bytes).
+ * @param first Index of the first leaf in @p leaf_hashes.
+ * @param leaf_hashes Hashes of the leaves first, first + 1, ... (must not be NULL).
+ * @param count Number of leaves (must be > 0).
+ * @param proof Proof produced by generate_range_proof() (must not be NULL).
+ * @return MERKLE_SUCCESS if the proof is valid, MERKLE_PROOF_INVALID if it
+ *         does not cover exactly these leaves or does not match @p root,
+ *         MERKLE_NULL_ARG on NULL arguments, MERKLE_BAD_ARG for an empty
+ *         range, MERKLE_FAILED_MEM_ALLOC on allocation failure.
+ */
+merkle_error_t verify_range_proof(const unsigned char root[HASH_SIZE], size_t first,
+                                  const unsigned char (*leaf_hashes)[HASH_SIZE], size_t count,
+                                  const merkle_range_proof_t *proof);
+
+/**
+ * @struct merkle_async
+ * @brief Opaque handle of a build or proof running in the background.
+ */
+struct merkle_async;
+
+/**
+ * @typedef merkle_async_t
+ * @brief Typedef for the opaque asynchronous operation handle.
+ */
+typedef struct merkle_async merkle_async_t;
+
+/**
+ * @typedef merkle_async_callback
+ * @brief Completion callback of an asynchronous operation.
+ *
+ * Runs on the worker thread that finished the operation, after its result
+ * is available to merkle_async_take_tree() / merkle_async_take_proof() and
+ * after its event descriptor became readable. The callback may release the
+ * handle.
+ *
+ * @param op Finished operation.
+ * @param status MERKLE_SUCCESS, MERKLE_CANCELLED, or the error of the operation.
+ * @param user_data Pointer given at submission.
+ */
+typedef void (*merkle_async_callback)(merkle_async_t *op, merkle_error_t status, void *user_data);
+
+/**
+ * @brief Starts create_merkle_tree_ex() on a background worker.
+ *
+ * The build runs on @p config's thread_pool when one is set, otherwise on a
+ * small pool the library starts on first use; either way the call returns
+ * at once. @p data, @p size and the blocks they describe must stay valid
+ * until the operation finished, the configuration is copied.
+ *
+ * Cancelling is cooperative: a build that has not started is skipped, one
+ * that is running stops at its next batch of leaves or level of nodes.
+ *
+ * @param data Array of pointers to data blocks (must not be NULL).
+ * @param size Array of sizes for each data block (must not be NULL).
+ * @param count Number of data blocks (must be > 0).
+ * @param config Build options (must not be NULL).
+ * @param callback Completion callback (can be NULL).
+ * @param user_data Passed to @p callback.
+ * @return Handle to release with merkle_async_release(), or NULL if the
+ *         operation could not be queued.
+ */
+merkle_async_t *create_merkle_tree_async(const void **data, const size_t *size, size_t count,
+                                         const merkle_config_t *config, merkle_async_callback callback,
+                                         void *user_data);
+
+/**
+ * @brief Starts generate_proof_from_index() on a background worker.
+ *
+ * @p tree must stay alive until the operation finished; concurrent updates
+ * are fine, the proof is taken from one consistent version.
+ *
+ * @param tree Tree to prove against (must not be NULL).
+ * @param leaf_index Index of the leaf to prove.
+ * @param callback Completion callback (can be NULL).
+ * @param user_data Passed to @p callback.
+ * @return Handle to release with merkle_async_release(), or NULL if the
+ *         operation could not be queued.
+ */
+merkle_async_t *generate_proof_async(merkle_tree_t *tree, size_t leaf_index, merkle_async_callback callback,
+                                     void *user_data);
+
+/**
+ * @brief Returns a descriptor that becomes readable when the operation finishes.
+ *
+ * Meant for poll()/epoll loops: the descriptor is an eventfd whose counter is
+ * set once and never reset, so it stays readable. It belongs to the handle
+ * and is closed by merkle_async_release().
+ *
+ * @param op Operation to watch.
+ * @return The descriptor, or -1 for a NULL handle or on platforms without eventfd.
+ */
+int merkle_async_fd(const merkle_async_t *op);
+
+/**
+ * @brief Reports whether an operation has finished, without blocking.
+ * @param op Operation to query (NULL yields false).
+ */
+bool merkle_async_done(const merkle_async_t *op);
+
+/**
+ * @brief Blocks until an operation has finished.
+ * @param op Operation to wait for.
+ * @return The status the callback receives, or MERKLE_NULL_ARG for a NULL handle.
+ */
+merkle_error_t merkle_async_wait(merkle_async_t *op);
+
+/**
+ * @brief Asks an operation to stop early.
+ *
+ * Returns immediately; the operation still completes, with MERKLE_CANCELLED
+ * unless it was past its last cancellation point.
+ *
+ * @param op Operation to cancel.
+ * @return MERKLE_SUCCESS, or MERKLE_NULL_ARG for a NULL handle.
+ */
+merkle_error_t merkle_async_cancel(merkle_async_t *op);
+
+/**
+ * @brief Takes the tree a finished create_merkle_tree_async() built.
+ *
+ * Ownership passes to the caller, who releases it with dealloc_merkle_tree().
+ *
+ * @param op Finished build.
+ * @return The tree, or NULL if the operation is not a finished, successful
+ *         build or the tree was already taken.
+ */
+merkle_tree_t *merkle_async_take_tree(merkle_async_t *op);
+
+/**
+ * @brief Takes the proof a finished generate_proof_async() produced.
+ *
+ * Ownership passes to the caller, who releases it with dealloc_merkle_proof().
+ *
+ * @param op Finished proof operation.
+ * @return The proof, or NULL if the operation is not a finished, successful
+ *         proof or the proof was already taken.
+ */
+merkle_proof_t *merkle_async_take_proof(merkle_async_t *op);
+
+/**
+ * @brief Releases the caller's handle.
+ *
+ * An operation that is still running is cancelled and cleans up after
+ * itself; a result that was never taken is freed.
+ *
+ * @param op Handle to release (can be NULL).
+ */
+void merkle_async_release(merkle_async_t *op);
+
+/** Depth of a sparse Merkle tree: one level per bit of a HASH_SIZE-byte key. */
+#define MERKLE_SPARSE_DEPTH (HASH_SIZE * 8)
+
+/**
+ * @struct merkle_sparse
+ * @brief Opaque sparse Merkle tree mapping HASH_SIZE-byte keys to values.
+ */
+struct merkle_sparse;
+
+/**
+ * @typedef merkle_sparse_t
+ * @brief Typedef for the opaque sparse Merkle tree structure.
+ */
+typedef struct merkle_sparse merkle_sparse_t;
+
+/**
+ * @struct merkle_sparse_proof
+ * @brief Opaque membership or non-membership proof of a sparse Merkle tree.
+ */
+struct merkle_sparse_proof;
+
+/**
+ * @typedef merkle_sparse_proof_t
+ * @brief Typedef for the opaque sparse proof structure.
+ */
+typedef struct merkle_sparse_proof merkle_sparse_proof_t;
+
+/**
+ * @brief Creates an empty sparse Merkle tree.
+ *
+ * The tree has one leaf for each of the 2^MERKLE_SPARSE_DEPTH possible keys,
+ * the leaf at a key's bit path holding the hash of its value and every
+ * absent key an all-zero leaf. A node is the hash of its two children, so an
+ * empty subtree has a fixed hash per height; those defaults are precomputed
+ * and only subtrees holding keys are stored, one node per key plus one per
+ * point where two key paths fork. A sparse tree is not thread-safe.
+ *
+ * @param hash Hash algorithm of leaves and nodes.
+ * @return Pointer to the new tree, or NULL on failure.
+ */
+merkle_sparse_t *merkle_sparse_create(merkle_hash_id_t hash);
+
+/**
+ * @brief Frees a sparse Merkle tree and every value it holds.
+ * @param tree Tree to free (can be NULL).
+ */
+void merkle_sparse_destroy(merkle_sparse_t *tree);
+
+/**
+ * @brief Sets the value of one key, inserting the key if it is absent.
+ * @return As merkle_sparse_insert_batch().
+ */
+merkle_error_t merkle_sparse_insert(merkle_sparse_t *tree, const unsigned char key[HASH_SIZE], const void *value,
+                                    size_t size);
+
+/**
+ * @brief Sets the values of several keys with one rehash of the tree.
+ *
+ * The structure is updated for every key first and each node whose subtree
+ * changed is then rehashed once, however many of the keys lie below it. A
+ * key given more than once takes its last value. The values are copied, and
+ * nothing is modified unless the whole batch can be applied.
+ *
+ * @param tree Tree to update.
+ * @param keys Keys to set.
+ * @param values Value of each key (entries must not be NULL).
+ * @param sizes Size of each value (entries must be > 0).
+ * @param count Number of keys.
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments,
+ *         MERKLE_BAD_ARG for an empty or unreadable value,
+ *         MERKLE_FAILED_MEM_ALLOC on allocation failure.
+ */
+merkle_error_t merkle_sparse_insert_batch(merkle_sparse_t *tree, const unsigned char (*keys)[HASH_SIZE],
+                                          const void **values, const size_t *sizes, size_t count);
+
+/**
+ * @brief Removes a key, returning its leaf to the empty default.
+ * @return MERKLE_SUCCESS on success, MERKLE_NOT_FOUND if the key is absent,
+ *         MERKLE_NULL_ARG on NULL arguments.
+ */
+merkle_error_t merkle_sparse_remove(merkle_sparse_t *tree, const unsigned char key[HASH_SIZE]);
+
+/**
+ * @brief Looks up the value of a key.
+ *
+ * @param value Receives a pointer to the stored value, valid until the key
+ *        is next set or removed.
+ * @param size Receives the size of the value.
+ * @return MERKLE_SUCCESS on success, MERKLE_NOT_FOUND if the key is absent,
+ *         MERKLE_NULL_ARG on NULL arguments.
+ */
+merkle_error_t merkle_sparse_get(const merkle_sparse_t *tree, const unsigned char key[HASH_SIZE],
+                                 const void **value, size_t *size);
+
+/**
+ * @brief Returns the number of keys a sparse tree holds (0 for NULL).
+ */
+size_t merkle_sparse_count(const merkle_sparse_t *tree);
+
+/**
+ * @brief Copies the root hash of a sparse tree.
+ *
+ * An empty tree has the default hash of a subtree of height MERKLE_SPARSE_DEPTH.
+ *
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments.
+ */
+merkle_error_t merkle_sparse_root(const merkle_sparse_t *tree, unsigned char root[HASH_SIZE]);
+
+/**
+ * @brief Generates the proof of a key, whether it is present or absent.
+ *
+ * The proof holds one sibling per level, but siblings that are empty
+ * subtrees are only marked in a bitmap since the verifier knows their
+ * default hashes; with n keys spread over the key space about log2(n)
+ * siblings remain. For a present key it proves the value, for an absent key
+ * that its leaf is empty.
+ *
+ * @param tree Tree to prove against.
+ * @param key Key to prove.
+ * @param proof Receives the proof; free with dealloc_merkle_sparse_proof().
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments,
+ *         MERKLE_FAILED_MEM_ALLOC on allocation failure.
+ */
+merkle_error_t merkle_sparse_prove(const merkle_sparse_t *tree, const unsigned char key[HASH_SIZE],
+                                   merkle_sparse_proof_t **proof);
+
+/**
+ * @brief Returns the number of non-default siblings a sparse proof carries (0 for NULL).
+ */
+size_t merkle_sparse_proof_sibling_count(const merkle_sparse_proof_t *proof);
+
+/**
+ * @brief Frees a proof returned by merkle_sparse_prove().
+ * @param proof Proof to free (can be NULL).
+ */
+void dealloc_merkle_sparse_proof(merkle_sparse_proof_t *proof);
+
+/**
+ * @brief Verifies that a key holds a value, or is absent, under a sparse root.
+ *
+ * @param root Expected root hash.
+ * @param key Key the proof was generated for.
+ * @param value Value to check, or NULL to check that the key is absent.
+ * @param size Size of @p value (ignored when @p value is NULL).
+ * @param proof Proof from merkle_sparse_prove().
+ * @return MERKLE_SUCCESS if the proof holds, MERKLE_PROOF_INVALID if it does
+ *         not or was generated for another key, MERKLE_BAD_ARG for an empty
+ *         value or a proof of an unknown hash, MERKLE_NULL_ARG on NULL arguments.
+ */
+merkle_error_t merkle_sparse_verify(const unsigned char root[HASH_SIZE], const unsigned char key[HASH_SIZE],
+                                    const void *value, size_t size, const merkle_sparse_proof_t *proof);
+
+/** Bytes of a shard description written by merkle_shard_encode(). */
+#define MERKLE_SHARD_ENCODED_SIZE (80)
+
+/**
+ * @brief Root and position of one shard of a tree built on several machines.
+ *
+ * A shard is an ordinary tree over the leaves
+ * [first_leaf, first_leaf + leaf_count) of a larger tree. Every shard but
+ * the last holds exactly branching_factor^height leaves, so its root is the
+ * node of the whole tree at level @ref height. The structure is plain data;
+ * merkle_shard_encode() gives it a portable byte form.
+ */
+typedef struct merkle_shard_info {
+  size_t first_leaf;             /**< Index of the shard's first leaf in the whole tree. */
+  size_t leaf_count;             /**< Leaves of the shard. */
+  size_t height;                 /**< Levels of a full shard; every shard of a tree has the same. */
+  size_t levels;                 /**< Levels of the shard's own tree (< height only for a short last shard). */
+  size_t branching_factor;       /**< Branching factor of the shard. */
+  merkle_hash_id_t hash_id;      /**< Hash algorithm of the shard. */
+  unsigned char root[HASH_SIZE]; /**< Root hash of the shard's own tree. */
+} merkle_shard_info_t;
+
+/**
+ * @struct merkle_shard_set
+ * @brief Opaque upper tree joining the roots of all shards of one tree.
+ */
+struct merkle_shard_set;
+
+/**
+ * @typedef merkle_shard_set_t
+ * @brief Typedef for the opaque shard set structure.
+ */
+typedef struct merkle_shard_set merkle_shard_set_t;
+
+/**
+ * @brief Describes a tree built over one leaf range as a shard of a larger tree.
+ *
+ * The shard is built as usual, with create_merkle_tree_ex() or
+ * create_merkle_tree_from_file(), from the blocks of its range only. The
+ * range must start at a multiple of branching_factor^height and hold at most
+ * that many leaves.
+ *
+ * @param shard Tree over the shard's leaves.
+ * @param first_leaf Index of the shard's first leaf in the whole tree.
+ * @param height Levels of a full shard, the same for every shard.
+ * @param info Receives the shard's description.
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments,
+ *         MERKLE_BAD_ARG if the range is misaligned or too long for @p height.
+ */
+merkle_error_t merkle_shard_export(merkle_tree_t *const shard, size_t first_leaf, size_t height,
+                                   merkle_shard_info_t *info);
+
+/**
+ * @brief Writes a shard description in a fixed, little-endian byte form.
+ * @param info Description to encode.
+ * @param out Receives MERKLE_SHARD_ENCODED_SIZE bytes.
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments.
+ */
+merkle_error_t merkle_shard_encode(const merkle_shard_info_t *info, unsigned char out[MERKLE_SHARD_ENCODED_SIZE]);
+
+/**
+ * @brief Reads a shard description written by merkle_shard_encode().
+ * @param in Encoded bytes.
+ * @param size Number of bytes at @p in.
+ * @param info Receives the description.
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments,
+ *         MERKLE_BAD_ARG if the bytes are not an encoded shard.
+ */
+merkle_error_t merkle_shard_decode(const void *in, size_t size, merkle_shard_info_t *info);
+
+/**
+ * @brief Joins the roots of all shards of a tree into its upper levels.
+ *
+ * The shards may come in any order but must cover the leaves without gaps:
+ * one shard per multiple of branching_factor^height, all full but the last.
+ * The resulting root equals the one of create_merkle_tree() over all leaves.
+ *
+ * @param shards Descriptions of every shard.
+ * @param count Number of shards.
+ * @param set Receives the upper tree; free with merkle_shard_set_destroy().
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments,
+ *         MERKLE_BAD_ARG if the shards disagree on their shape, overlap or
+ *         leave a gap, or use a hash unknown to this process,
+ *         MERKLE_FAILED_MEM_ALLOC on allocation failure.
+ */
+merkle_error_t merkle_shard_combine(const merkle_shard_info_t *shards, size_t count, merkle_shard_set_t **set);
+
+/**
+ * @brief Copies the root hash of the whole tree.
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments.
+ */
+merkle_error_t merkle_shard_set_root(const merkle_shard_set_t *set, unsigned char root[HASH_SIZE]);
+
+/**
+ * @brief Returns the number of leaves of the whole tree (0 for NULL).
+ */
+size_t merkle_shard_set_leaf_count(const merkle_shard_set_t *set);
+
+/**
+ * @brief Proves a leaf of the whole tree from the tree of its shard.
+ *
+ * The shard's own proof is extended by the levels a short last shard lacks
+ * and by the path through the upper tree. The result equals the proof
+ * generate_proof_from_index() gives on a tree built over all leaves, and
+ * verifies with verify_proof() against the root of @p set.
+ *
+ * @param set Upper tree of all shards.
+ * @param shard Tree of the shard holding @p leaf_index.
+ * @param leaf_index Index of the leaf in the whole tree.
+ * @param proof Receives the proof; free with dealloc_merkle_proof().
+ * @return MERKLE_SUCCESS on success, MERKLE_NULL_ARG on NULL arguments,
+ *         MERKLE_INVALID_INDEX if @p leaf_index is out of range,
+ *         MERKLE_BAD_ARG if @p shard is not the shard holding the leaf,
+ *         MERKLE_FAILED_MEM_ALLOC on allocation failure.
+ */
+merkle_error_t merkle_shard_prove(const merkle_shard_set_t *set, merkle_tree_t *const shard, size_t leaf_index,
+                                  merkle_proof_t **proof);
+
+/**
+ * @brief Frees an upper tree returned by merkle_shard_combine().
+ * @param set Set to free (can be NULL).
+ */
+void merkle_shard_set_destroy(merkle_shard_set_t *set);
 
 #endif // MERKLE_H
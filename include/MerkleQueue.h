@@ -5,7 +5,8 @@
  * This header file provides a queue data structure implementation specifically
  * designed for use in the Merkle tree construction process. It includes
  * functions for initialization, memory management, and basic queue operations.
- * The queue uses a sentinel node design for efficient operations.
+ * The queue is a growable ring buffer, so pushing and popping never allocate
+ * once the buffer has reached its working size.
  *
  * @author Guy Alster
  * @date May 24, 2025
@@ -46,22 +47,31 @@ typedef struct queue queue_t;
 /**
  * @brief Initializes a new queue and returns a pointer to it.
  * 
- * Creates a new queue with a sentinel node for efficient operations.
- * The queue starts empty but ready for use.
+ * Creates an empty queue with a small initial buffer that grows on demand.
  * 
  * @return Pointer to the newly created queue, or NULL if allocation fails.
  * 
  * @note The returned queue must be freed using free_queue() when no longer needed.
  * 
- * @see free_queue()
+ * @see init_queue_with_capacity(), free_queue()
  */
 queue_t *init_queue(void);
 
+/**
+ * @brief Initializes a new queue able to hold @p capacity elements without growing.
+ * 
+ * @param capacity Number of elements to reserve room for (rounded up to a power of two).
+ * @return Pointer to the newly created queue, or NULL if allocation fails.
+ * 
+ * @see init_queue(), free_queue()
+ */
+queue_t *init_queue_with_capacity(size_t capacity);
+
 /**
  * @brief Frees all memory associated with the queue, including its elements.
  * 
- * Deallocates the queue structure and all nodes. If a deallocator function
- * is provided, it will be called for each element's data before freeing the node.
+ * Deallocates the queue structure and its buffer. If a deallocator function
+ * is provided, it will be called for each remaining element's data first.
  * 
  * @param q Pointer to the queue to free. Can be NULL (no-op).
  * @param dealloc Function to call for deallocating element data, or NULL if
@@ -84,7 +94,7 @@ void free_queue(queue_t *q, deallocator dealloc);
  * @return QUEUE_OK on success, error code otherwise.
  * @retval QUEUE_OK Operation successful.
  * @retval QUEUE_NULL_PTR Queue pointer is NULL.
- * @retval QUEUE_OUT_OF_MEMORY Memory allocation failed.
+ * @retval QUEUE_OUT_OF_MEMORY The full buffer could not be grown.
  * 
  * @note The queue stores the pointer value, not a copy of the data.
  * 
@@ -102,7 +112,6 @@ queue_result_t push_queue(queue_t *q, void *data);
  * @return Pointer to the data of the removed element, or NULL if queue is empty or NULL.
  * 
  * @warning The caller is responsible for freeing the returned data if needed.
- * @note This function only frees the queue node, not the element data.
  * 
  * @see push_queue(), front_queue()
  */
@@ -147,24 +156,24 @@ void *back_queue(queue_t *q);
 size_t get_queue_size(queue_t *q);
 
 /**
- * @brief Removes up to n elements from the front of the queue.
+ * @brief Removes up to n elements from the front of the queue as one slice.
  * 
- * Dequeues up to the requested number of elements and returns them in an array.
- * If the queue contains fewer elements than requested, returns all available elements.
- * The count parameter is updated to reflect the actual number of elements returned.
+ * Hands out the removed elements in place, as a pointer into the queue's
+ * buffer, so nothing is allocated or copied. A slice never wraps around the
+ * end of the buffer, so fewer elements than requested may be returned even
+ * when more are queued; call again for the rest. The count parameter is
+ * updated to reflect the actual number of elements returned.
  * 
  * @param q Pointer to the queue.
  * @param count Pointer to the requested number of elements. Updated with actual count returned.
- * @param result Pointer to store the allocated array of element pointers.
+ * @param result Pointer to store the slice of element pointers.
  * @return QUEUE_OK on success, error code otherwise.
  * @retval QUEUE_OK Operation successful.
- * @retval QUEUE_NULL_PTR count parameter is NULL.
- * @retval QUEUE_OUT_OF_MEMORY Memory allocation for result array failed.
- * 
- * @note The caller is responsible for freeing the returned array and its elements.
- * @note If allocation fails, *count is set to 0 and *result is undefined.
+ * @retval QUEUE_NULL_PTR Queue, count or result is NULL.
  * 
- * @warning The returned array and element ownership transfers to the caller.
+ * @note The slice stays valid until the next push_queue() or free_queue();
+ *       it must not be freed by the caller.
+ * @note Element ownership transfers to the caller.
  * 
  * @see pop_queue(), get_queue_size()
  */
@@ -3,7 +3,7 @@
 
 /**
  * @file locking.h
- * @brief Cross-platform read/write lock abstraction.
+ * @brief Cross-platform read/write lock and thread yield abstraction.
  *
  * This header defines a minimal wrapper around platform specific
  * read/write lock primitives. It allows the rest of the codebase to use
@@ -19,8 +19,10 @@ typedef SRWLOCK rw_lock_t;
 #define RW_READ_UNLOCK(lock) ReleaseSRWLockShared(lock)     /**< Release read lock */
 #define RW_WRITE_UNLOCK(lock) ReleaseSRWLockExclusive(lock) /**< Release write lock */
 #define RW_DESTROY_LOCK(lock)                               /**< SRW locks do not need destruction */
+#define THREAD_YIELD() SwitchToThread()                     /**< Let another runnable thread go first */
 #else
 #include <pthread.h>
+#include <sched.h>
 typedef pthread_rwlock_t rw_lock_t;
 #define RW_LOCK_INIT(lock) pthread_rwlock_init(lock, NULL) /**< Initialize lock */
 #define RW_READ_LOCK(lock) pthread_rwlock_rdlock(lock)      /**< Acquire read lock */
@@ -28,6 +30,7 @@ typedef pthread_rwlock_t rw_lock_t;
 #define RW_READ_UNLOCK(lock) pthread_rwlock_unlock(lock)    /**< Release read lock */
 #define RW_WRITE_UNLOCK(lock) pthread_rwlock_unlock(lock)   /**< Release write lock */
 #define RW_DESTROY_LOCK(lock) pthread_rwlock_destroy(lock)  /**< Destroy lock */
+#define THREAD_YIELD() sched_yield()                        /**< Let another runnable thread go first */
 #endif
 
 #endif /* LOCKING_H */
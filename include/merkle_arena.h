@@ -0,0 +1,56 @@
+/**
+ * @file merkle_arena.h
+ * @brief Bump allocator for objects that share one lifetime.
+ *
+ * An arena hands out zeroed blocks carved from a few large chunks and frees
+ * them all at once, so structures made of many small objects are released
+ * without visiting each of them. Chunks are obtained through MMalloc() and
+ * therefore honour the allocator installed with merkle_set_allocator().
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#ifndef MERKLE_ARENA_H
+#define MERKLE_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Opaque arena handle. */
+typedef struct merkle_arena merkle_arena_t;
+
+/**
+ * @brief Creates an empty arena.
+ *
+ * @param chunk_size Bytes reserved by each chunk. Sizing the first chunk to
+ *        the expected total keeps everything in a single allocation.
+ * @return New arena, or NULL if it could not be allocated.
+ */
+merkle_arena_t *merkle_arena_create(size_t chunk_size);
+
+/**
+ * @brief Allocates a zeroed block suitably aligned for any type.
+ *
+ * Not thread-safe: callers serialize access or reserve blocks up front and
+ * share them out.
+ *
+ * @param arena Arena to draw from.
+ * @param size Number of bytes.
+ * @return Pointer into the arena, or NULL on failure or a zero @p size.
+ */
+void *merkle_arena_alloc(merkle_arena_t *arena, size_t size);
+
+/**
+ * @brief Tells whether a pointer lies inside one of the arena's blocks.
+ */
+bool merkle_arena_owns(const merkle_arena_t *arena, const void *ptr);
+
+/**
+ * @brief Releases the arena and every block it handed out.
+ *
+ * @param arena Arena to destroy (NULL is ignored).
+ */
+void merkle_arena_destroy(merkle_arena_t *arena);
+
+#endif // MERKLE_ARENA_H
@@ -0,0 +1,38 @@
+/**
+ * @file merkle_async.h
+ * @brief Internal entry point shared by the synchronous and asynchronous builds.
+ *
+ * create_merkle_tree_ex() and create_merkle_tree_async() both end up in
+ * merkle_build_tree(); the asynchronous side passes the flag that
+ * merkle_async_cancel() raises, the synchronous side passes NULL.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#ifndef MERKLE_ASYNC_H
+#define MERKLE_ASYNC_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "Merkle.h"
+
+/**
+ * @brief Builds a tree like create_merkle_tree_ex(), reporting why it failed.
+ *
+ * @param data Array of pointers to data blocks.
+ * @param size Array of sizes for each data block.
+ * @param count Number of data blocks.
+ * @param config Build options.
+ * @param cancel Polled between leaf batches and node levels (may be NULL).
+ * @param out Receives the tree, or NULL on failure.
+ * @return MERKLE_SUCCESS, MERKLE_CANCELLED once @p cancel was seen raised,
+ *         MERKLE_NULL_ARG / MERKLE_BAD_ARG for rejected arguments, or the
+ *         error of the failed build stage.
+ */
+merkle_error_t merkle_build_tree(const void **data, const size_t *size, size_t count,
+                                 const merkle_config_t *config, const atomic_bool *cancel,
+                                 merkle_tree_t **out);
+
+#endif // MERKLE_ASYNC_H
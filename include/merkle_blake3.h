@@ -0,0 +1,56 @@
+/**
+ * @file merkle_blake3.h
+ * @brief Internal portable BLAKE3 used as an alternative tree hash.
+ *
+ * Implements the unkeyed BLAKE3 hash with a 32-byte output. Inputs of up to
+ * one 1 KiB chunk, which covers every parent node of a tree with a
+ * branching factor of at most 32, cost one compression per 64 bytes and no
+ * padding block.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#ifndef MERKLE_BLAKE3_H
+#define MERKLE_BLAKE3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Bytes of one BLAKE3 chunk. */
+#define MERKLE_BLAKE3_CHUNK_LEN (1024)
+
+/** Deepest stack of subtree chaining values a 64-bit input length can need. */
+#define MERKLE_BLAKE3_MAX_DEPTH (54)
+
+/**
+ * @brief Incremental BLAKE3 state.
+ */
+typedef struct merkle_blake3 {
+  uint32_t cv[8];                                 /**< Chaining value of the current chunk. */
+  uint64_t chunk_counter;                         /**< Index of the current chunk. */
+  unsigned char block[64];                        /**< Buffered bytes of the current block. */
+  uint8_t block_len;                              /**< Bytes held in @ref block. */
+  uint8_t blocks_compressed;                      /**< Blocks of the current chunk already compressed. */
+  uint8_t cv_stack_len;                           /**< Entries in @ref cv_stack. */
+  uint32_t cv_stack[MERKLE_BLAKE3_MAX_DEPTH][8];  /**< Chaining values of completed subtrees. */
+} merkle_blake3_t;
+
+/**
+ * @brief Starts a new hash.
+ */
+void merkle_blake3_init(merkle_blake3_t *state);
+
+/**
+ * @brief Absorbs @p len bytes of input.
+ */
+void merkle_blake3_update(merkle_blake3_t *state, const void *data, size_t len);
+
+/**
+ * @brief Writes the 32-byte digest of everything absorbed so far.
+ *
+ * The state is left untouched, so more input may follow.
+ */
+void merkle_blake3_final(const merkle_blake3_t *state, unsigned char digest[32]);
+
+#endif // MERKLE_BLAKE3_H
@@ -0,0 +1,56 @@
+/**
+ * @file merkle_hash.h
+ * @brief Internal dispatch to a tree's hash algorithm.
+ *
+ * Every leaf and node digest goes through the vtable the tree was created
+ * with. Algorithms with a batch entry get whole groups of messages at once,
+ * the others are driven one message at a time through a stack context.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#ifndef MERKLE_HASH_H
+#define MERKLE_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Merkle.h"
+
+/**
+ * @brief Stack storage for any algorithm's context.
+ */
+typedef union merkle_hash_ctx {
+  unsigned char bytes[MERKLE_HASH_MAX_CTX_SIZE]; /**< Context bytes. */
+  uint64_t align_u64;                            /**< Forces 64-bit alignment. */
+  void *align_ptr;                               /**< Forces pointer alignment. */
+} merkle_hash_ctx_t;
+
+/**
+ * @brief Hashes @p count independent messages with @p hash.
+ *
+ * @param msgs Message pointers (entries may only be NULL for empty messages).
+ * @param lens Message lengths in bytes.
+ * @param digests Output buffers of HASH_SIZE bytes, one per message.
+ * @param count Number of messages.
+ */
+void merkle_hash_batch(const merkle_hash_vtable_t *hash, const unsigned char *const *msgs, const size_t *lens,
+                       unsigned char *const *digests, size_t count);
+
+/**
+ * @brief merkle_hash_batch() for messages that all are @p len bytes long.
+ *
+ * Full parents of one level are such a batch. SHA-256 trees use
+ * merkle_sha256_batch_fixed(); other algorithms get a plain batch.
+ */
+void merkle_hash_batch_fixed(const merkle_hash_vtable_t *hash, const unsigned char *const *msgs, size_t len,
+                             unsigned char *const *digests, size_t count);
+
+/**
+ * @brief Hashes the concatenation of @p count byte spans into @p digest.
+ */
+void merkle_hash_spans(const merkle_hash_vtable_t *hash, const unsigned char *const *parts, const size_t *lens,
+                       size_t count, unsigned char digest[HASH_SIZE]);
+
+#endif // MERKLE_HASH_H
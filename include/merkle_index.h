@@ -0,0 +1,57 @@
+/**
+ * @file merkle_index.h
+ * @brief Table from a leaf's key digest to its index.
+ *
+ * Backs generate_proof_by_key(). Every leaf has at most one entry, keyed by a
+ * SHA-256 digest, so the digest's leading bytes serve as the hash directly.
+ * The table uses linear probing and is sized for at most half occupancy, so
+ * it never resizes and inserting never fails.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#ifndef MERKLE_INDEX_H
+#define MERKLE_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "Merkle.h"
+
+/** Opaque index handle. */
+typedef struct merkle_index merkle_index_t;
+
+/**
+ * @brief Creates an empty index for a tree of @p leaf_count leaves.
+ *
+ * @return New index, or NULL if it could not be allocated.
+ */
+merkle_index_t *merkle_index_create(size_t leaf_count);
+
+/**
+ * @brief Files a leaf under @p digest, replacing its previous entry.
+ */
+void merkle_index_set(merkle_index_t *index, size_t leaf_index, const unsigned char digest[HASH_SIZE]);
+
+/**
+ * @brief Removes a leaf's entry, if it has one.
+ */
+void merkle_index_remove(merkle_index_t *index, size_t leaf_index);
+
+/**
+ * @brief Looks a digest up.
+ *
+ * @param leaf_index Receives the lowest leaf filed under @p digest.
+ * @return true if some leaf is filed under @p digest.
+ */
+bool merkle_index_find(const merkle_index_t *index, const unsigned char digest[HASH_SIZE], size_t *leaf_index);
+
+/**
+ * @brief Frees an index.
+ *
+ * @param index Index to destroy (NULL is ignored).
+ */
+void merkle_index_destroy(merkle_index_t *index);
+
+#endif // MERKLE_INDEX_H
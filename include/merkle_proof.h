@@ -0,0 +1,161 @@
+/**
+ * @file merkle_proof.h
+ * @brief Internal layout of Merkle proofs.
+ *
+ * Shared by proof generation in merkle_tree.c and proof verification in
+ * merkle_proof.c. The structures stay opaque to library users.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#ifndef MERKLE_PROOF_H
+#define MERKLE_PROOF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Merkle.h"
+
+/** Leading bytes of every serialized proof. */
+#define MERKLE_PROOF_MAGIC "MKLP"
+
+/** Serialized proof format revision. */
+#define MERKLE_PROOF_VERSION (1)
+
+/** Bytes of a serialized proof before its level records. */
+#define MERKLE_PROOF_HEADER_SIZE (32)
+
+/** Bytes of one serialized level record: sibling count and node position. */
+#define MERKLE_PROOF_LEVEL_SIZE (8)
+
+/** Offsets of the serialized header fields. */
+#define MERKLE_PROOF_OFFSET_VERSION (4)
+#define MERKLE_PROOF_OFFSET_HASH_ID (5)
+#define MERKLE_PROOF_OFFSET_LEAF_INDEX (8)
+#define MERKLE_PROOF_OFFSET_BRANCHING (16)
+#define MERKLE_PROOF_OFFSET_PATH_LENGTH (24)
+
+/**
+ * @brief Stores a 32-bit value in little-endian byte order.
+ */
+static inline void merkle_store_le32(unsigned char *out, uint32_t value) {
+  for (size_t i = 0; i < 4; ++i) {
+    out[i] = (unsigned char)(value >> (8 * i));
+  }
+}
+
+/**
+ * @brief Stores a 64-bit value in little-endian byte order.
+ */
+static inline void merkle_store_le64(unsigned char *out, uint64_t value) {
+  for (size_t i = 0; i < 8; ++i) {
+    out[i] = (unsigned char)(value >> (8 * i));
+  }
+}
+
+/**
+ * @brief Loads a little-endian 32-bit value.
+ */
+static inline uint32_t merkle_load_le32(const unsigned char *in) {
+  uint32_t value = 0;
+
+  for (size_t i = 0; i < 4; ++i) {
+    value |= (uint32_t)in[i] << (8 * i);
+  }
+
+  return value;
+}
+
+/**
+ * @brief Loads a little-endian 64-bit value.
+ */
+static inline uint64_t merkle_load_le64(const unsigned char *in) {
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < 8; ++i) {
+    value |= (uint64_t)in[i] << (8 * i);
+  }
+
+  return value;
+}
+
+/**
+ * @brief Represents a single item in a Merkle proof path.
+ */
+struct merkle_proof_item {
+    unsigned char (*sibling_hashes)[HASH_SIZE]; /**< Arrays of sibling hashes at this level. */
+    size_t sibling_count;           /**< Number of siblings at this level. */
+    size_t node_position;           /**< Position of our node among siblings. */
+};
+
+/**
+ * @brief Represents a complete Merkle proof.
+ */
+struct merkle_proof{
+    merkle_proof_item_t **path;  /**< Array of proof items from leaf to root. */
+    size_t path_length;          /**< Length of the proof path. */
+    size_t leaf_index;           /**< Index of the leaf being proven. */
+    size_t branching_factor;     /**< Branching factor of the tree. */
+    merkle_hash_id_t hash_id;    /**< Hash algorithm of the tree. */
+};
+
+/**
+ * @brief Deduplicated proof for a set of leaves.
+ *
+ * Describes the walk that both generation and verification perform: the
+ * known nodes of a level are grouped by parent, and every child of such a
+ * parent that is not known is taken from @ref hashes in order. Levels are
+ * walked from the leaves up and parents from left to right, so the stream
+ * holds exactly the hashes that cannot be derived from the proven leaves.
+ *
+ * The structure, its indices and its hashes live in one allocation.
+ */
+struct merkle_multiproof {
+    size_t leaf_count;                  /**< Number of leaves in the tree. */
+    size_t branching_factor;            /**< Branching factor of the tree. */
+    merkle_hash_id_t hash_id;           /**< Hash algorithm of the tree. */
+    size_t index_count;                 /**< Number of proven leaves. */
+    size_t *leaf_indices;               /**< Proven leaves, sorted and unique. */
+    size_t hash_count;                  /**< Number of hashes in @ref hashes. */
+    unsigned char (*hashes)[HASH_SIZE]; /**< Underivable sibling hashes in walk order. */
+};
+
+/**
+ * @brief Allocates a multiproof with room for its indices and hashes.
+ *
+ * @param index_count Number of proven leaves.
+ * @param hash_count Number of sibling hashes.
+ * @return Zeroed proof whose arrays point into the same block, or NULL.
+ */
+merkle_multiproof_t *merkle_multiproof_alloc(size_t index_count, size_t hash_count);
+
+/**
+ * @brief Proof for the contiguous leaves [first, last].
+ *
+ * Walking up from the leaves, the known nodes of every level stay one
+ * contiguous run. Each level contributes the children of the run's first
+ * parent that lie left of the run, then the children of its last parent
+ * that lie right of it, in index order.
+ *
+ * The structure and its hashes live in one allocation.
+ */
+struct merkle_range_proof {
+    size_t leaf_count;                  /**< Number of leaves in the tree. */
+    size_t branching_factor;            /**< Branching factor of the tree. */
+    merkle_hash_id_t hash_id;           /**< Hash algorithm of the tree. */
+    size_t first;                       /**< First proven leaf. */
+    size_t last;                        /**< Last proven leaf. */
+    size_t hash_count;                  /**< Number of hashes in @ref hashes. */
+    unsigned char (*hashes)[HASH_SIZE]; /**< Edge sibling hashes in walk order. */
+};
+
+/**
+ * @brief Allocates a range proof with room for its hashes.
+ *
+ * @param hash_count Number of sibling hashes.
+ * @return Zeroed proof whose hashes follow it in the same block, or NULL.
+ */
+merkle_range_proof_t *merkle_range_proof_alloc(size_t hash_count);
+
+#endif // MERKLE_PROOF_H
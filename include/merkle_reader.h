@@ -0,0 +1,60 @@
+/**
+ * @file merkle_reader.h
+ * @brief Double-buffered sequential reader feeding file-backed tree builds.
+ *
+ * A background thread pread()s the next window of a file while the caller
+ * hashes the current one, so I/O and hashing overlap and no more than two
+ * windows of data are ever held. Windows are whole multiples of the leaf
+ * size, so leaves never straddle two of them.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#ifndef MERKLE_READER_H
+#define MERKLE_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Merkle.h"
+
+/** Default bytes per read window; two are in memory at a time. */
+#define MERKLE_READ_WINDOW (1u << 20)
+
+/** Opaque reader handle. */
+typedef struct merkle_chunk_reader merkle_chunk_reader_t;
+
+/**
+ * @brief Starts reading @p length bytes of @p fd from offset 0.
+ *
+ * The file offset of @p fd is left untouched.
+ *
+ * @param fd Readable descriptor supporting pread().
+ * @param length Number of bytes to read (must be > 0).
+ * @param leaf_size Size of one leaf; windows hold a whole number of them.
+ * @param window_bytes Requested window size, rounded down to whole leaves
+ *        (a window always holds at least one leaf).
+ * @return New reader, or NULL on bad arguments or allocation failure.
+ */
+merkle_chunk_reader_t *merkle_chunk_reader_create(int fd, uint64_t length, size_t leaf_size, size_t window_bytes);
+
+/**
+ * @brief Returns the next window, releasing the previous one to the reader.
+ *
+ * @param reader Reader to take from.
+ * @param data Receives the window; valid until the next call or destruction.
+ * @param bytes Receives the window size, 0 once the whole length was returned.
+ * @return MERKLE_SUCCESS on success, MERKLE_IO_ERROR if reading failed or the
+ *         file ended early.
+ */
+merkle_error_t merkle_chunk_reader_next(merkle_chunk_reader_t *reader, const unsigned char **data, size_t *bytes);
+
+/**
+ * @brief Stops the reader thread and frees its windows.
+ *
+ * @param reader Reader to destroy (NULL is ignored).
+ */
+void merkle_chunk_reader_destroy(merkle_chunk_reader_t *reader);
+
+#endif // MERKLE_READER_H
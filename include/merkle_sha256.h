@@ -0,0 +1,122 @@
+/**
+ * @file merkle_sha256.h
+ * @brief Internal batched SHA-256 used for leaf and node hashing.
+ *
+ * Hashes many independent messages per call so SIMD backends can process
+ * several of them side by side, one message per vector lane. The backend is
+ * picked once at runtime from the CPU's capabilities; the digests are always
+ * plain SHA-256 and identical across backends.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#ifndef MERKLE_SHA256_H
+#define MERKLE_SHA256_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Merkle.h"
+
+/** Widest batch a single backend kernel consumes; callers batch in multiples of this. */
+#define MERKLE_SHA256_MAX_LANES (16)
+
+/**
+ * @enum merkle_sha256_backend_t
+ * @brief Available SHA-256 implementations.
+ */
+typedef enum merkle_sha256_backend_t {
+  MERKLE_SHA256_AUTO = 0, /**< Best backend supported by the running CPU. */
+  MERKLE_SHA256_SCALAR,   /**< One message at a time through OpenSSL's EVP interface. */
+  MERKLE_SHA256_SHANI,    /**< x86 SHA extensions, one message at a time without call overhead. */
+  MERKLE_SHA256_AVX2,     /**< Eight messages per pass in AVX2 lanes. */
+  MERKLE_SHA256_AVX512,   /**< Sixteen messages per pass in AVX-512 lanes. */
+  MERKLE_SHA256_ARMV8     /**< ARMv8 cryptography extensions, one message at a time. */
+} merkle_sha256_backend_t;
+
+/**
+ * @brief Hashes @p count independent messages.
+ *
+ * Messages of equal block count share SIMD passes best, which is the common
+ * case for a tree level, but any mix of lengths is accepted.
+ *
+ * @param msgs Message pointers (entries may only be NULL for empty messages).
+ * @param lens Message lengths in bytes.
+ * @param digests Output buffers of HASH_SIZE bytes, one per message.
+ * @param count Number of messages.
+ */
+void merkle_sha256_batch(const unsigned char *const *msgs, const size_t *lens,
+                         unsigned char *const *digests, size_t count);
+
+/**
+ * @brief Hashes @p count messages that all have the same length.
+ *
+ * This is the shape of every full tree level: each parent hashes exactly
+ * branching_factor child digests. When @p len is a whole number of 64-byte
+ * blocks, as for even branching factors, the padding block is the same for
+ * every message, so its schedule is computed once and the data blocks are
+ * read in place. Other lengths take the merkle_sha256_batch() path.
+ *
+ * @param msgs Message pointers, none NULL.
+ * @param len Length in bytes shared by every message (at least 1).
+ * @param digests Output buffers of HASH_SIZE bytes, one per message.
+ * @param count Number of messages.
+ */
+void merkle_sha256_batch_fixed(const unsigned char *const *msgs, size_t len,
+                               unsigned char *const *digests, size_t count);
+
+/**
+ * @brief Streaming SHA-256 state for a message fed in several pieces.
+ *
+ * Holds the midstate and at most one partial block, so contexts live on the
+ * stack and need no cleanup.
+ */
+typedef struct merkle_sha256_ctx {
+  uint32_t state[8];        /**< Chaining value after the compressed blocks. */
+  uint64_t length;          /**< Message bytes seen so far. */
+  unsigned char block[64];  /**< Bytes of the current, incomplete block. */
+  size_t block_len;         /**< Bytes held in @ref block. */
+} merkle_sha256_ctx_t;
+
+/**
+ * @brief Starts a new message.
+ */
+void merkle_sha256_init(merkle_sha256_ctx_t *ctx);
+
+/**
+ * @brief Appends @p len bytes to the message.
+ */
+void merkle_sha256_update(merkle_sha256_ctx_t *ctx, const void *data, size_t len);
+
+/**
+ * @brief Pads the message and writes its digest; the context must be re-initialized before reuse.
+ */
+void merkle_sha256_final(merkle_sha256_ctx_t *ctx, unsigned char digest[HASH_SIZE]);
+
+/**
+ * @brief Returns the backend merkle_sha256_batch() currently runs on.
+ */
+merkle_sha256_backend_t merkle_sha256_active_backend(void);
+
+/**
+ * @brief Reports whether the running CPU can execute a backend.
+ * @param backend Backend to check (MERKLE_SHA256_AUTO is always supported).
+ */
+bool merkle_sha256_backend_supported(merkle_sha256_backend_t backend);
+
+/**
+ * @brief Forces a backend, mainly for tests and benchmarks.
+ *
+ * @param backend Backend to use, or MERKLE_SHA256_AUTO to restore detection.
+ * @return MERKLE_SUCCESS, or MERKLE_BAD_ARG if the CPU lacks the backend.
+ */
+merkle_error_t merkle_sha256_select_backend(merkle_sha256_backend_t backend);
+
+/**
+ * @brief Returns a short printable name for a backend.
+ */
+const char *merkle_sha256_backend_name(merkle_sha256_backend_t backend);
+
+#endif // MERKLE_SHA256_H
@@ -0,0 +1,29 @@
+/**
+ * @file merkle_shard.h
+ * @brief Internal view of a tree's shape for sharded builds.
+ *
+ * merkle_shard.c describes trees built by merkle_tree.c without reaching
+ * into their structure; the few fields the public API does not report are
+ * read through this accessor.
+ *
+ * @author Guy Alster
+ * @date 2026-10-15
+ */
+
+#ifndef MERKLE_SHARD_H
+#define MERKLE_SHARD_H
+
+#include <stddef.h>
+
+#include "Merkle.h"
+
+/**
+ * @brief Reports the branching factor and hash algorithm of a tree.
+ *
+ * @param tree Tree to query (must not be NULL).
+ * @param branching_factor Receives the tree's branching factor.
+ * @param hash_id Receives the identifier of the tree's hash algorithm.
+ */
+void merkle_tree_shape(const merkle_tree_t *tree, size_t *branching_factor, merkle_hash_id_t *hash_id);
+
+#endif // MERKLE_SHARD_H
@@ -0,0 +1,98 @@
+/**
+ * @file merkle_stats.h
+ * @brief Internal hot-path counters behind merkle_get_stats().
+ *
+ * Counting is compiled in only when MERKLE_STATS is defined. Without it the
+ * macros below expand to nothing, so instrumented code costs exactly what
+ * it did before. With it every event is added, with relaxed atomics, to the
+ * global counters and to those of the tree it belongs to, if any.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#ifndef MERKLE_STATS_H
+#define MERKLE_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "Merkle.h"
+#include "locking.h"
+
+/**
+ * @brief Live counters; the fields mirror merkle_stats_t.
+ */
+typedef struct merkle_stat_counters {
+  atomic_uint_fast64_t leaf_hash_ns;       /**< Time spent hashing leaf blocks. */
+  atomic_uint_fast64_t leaf_hashes;        /**< Leaf blocks hashed. */
+  atomic_uint_fast64_t node_hash_ns;       /**< Time spent hashing internal nodes. */
+  atomic_uint_fast64_t node_hashes;        /**< Internal nodes hashed. */
+  atomic_uint_fast64_t bytes_hashed;       /**< Leaf and node bytes fed to the hash. */
+  atomic_uint_fast64_t allocations;        /**< MMalloc() calls. */
+  atomic_uint_fast64_t allocated_bytes;    /**< Bytes requested through MMalloc(). */
+  atomic_uint_fast64_t frees;              /**< MFree() calls with a non-NULL block. */
+  atomic_uint_fast64_t read_lock_wait_ns;  /**< Time spent acquiring tree read locks. */
+  atomic_uint_fast64_t read_locks;         /**< Tree read locks acquired. */
+  atomic_uint_fast64_t write_lock_wait_ns; /**< Time spent acquiring tree write locks. */
+  atomic_uint_fast64_t write_locks;        /**< Tree write locks acquired. */
+  atomic_uint_fast64_t proofs_generated;   /**< Proofs successfully generated. */
+} merkle_stat_counters_t;
+
+/** Process-wide counters. */
+extern merkle_stat_counters_t merkle_global_stats;
+
+/**
+ * @brief Monotonic clock in nanoseconds.
+ */
+uint64_t merkle_stat_now(void);
+
+/**
+ * @brief Copies @p counters into the public snapshot @p out.
+ */
+void merkle_stat_snapshot(const merkle_stat_counters_t *counters, merkle_stats_t *out);
+
+#ifdef MERKLE_STATS
+
+/** Adds @p amount to @p field globally and, unless @p counters is NULL, there. */
+#define MERKLE_STAT_ADD(counters, field, amount)                                          \
+  do {                                                                                    \
+    merkle_stat_counters_t *merkle_stat_target_ = (counters);                             \
+    uint_fast64_t merkle_stat_amount_ = (uint_fast64_t)(amount);                          \
+    atomic_fetch_add_explicit(&merkle_global_stats.field, merkle_stat_amount_, memory_order_relaxed); \
+    if (merkle_stat_target_) {                                                            \
+      atomic_fetch_add_explicit(&merkle_stat_target_->field, merkle_stat_amount_, memory_order_relaxed); \
+    }                                                                                     \
+  } while (0)
+
+/** Declares @p name holding the current time, for a later MERKLE_STAT_ADD. */
+#define MERKLE_STAT_START(name) uint64_t name = merkle_stat_now()
+
+/** RW_READ_LOCK that books the wait under @p counters. */
+#define MERKLE_STAT_READ_LOCK(counters, lock)                                             \
+  do {                                                                                    \
+    MERKLE_STAT_START(merkle_stat_lock_start_);                                           \
+    RW_READ_LOCK(lock);                                                                   \
+    MERKLE_STAT_ADD(counters, read_lock_wait_ns, merkle_stat_now() - merkle_stat_lock_start_); \
+    MERKLE_STAT_ADD(counters, read_locks, 1);                                             \
+  } while (0)
+
+/** RW_WRITE_LOCK that books the wait under @p counters. */
+#define MERKLE_STAT_WRITE_LOCK(counters, lock)                                            \
+  do {                                                                                    \
+    MERKLE_STAT_START(merkle_stat_lock_start_);                                           \
+    RW_WRITE_LOCK(lock);                                                                  \
+    MERKLE_STAT_ADD(counters, write_lock_wait_ns, merkle_stat_now() - merkle_stat_lock_start_); \
+    MERKLE_STAT_ADD(counters, write_locks, 1);                                            \
+  } while (0)
+
+#else
+
+#define MERKLE_STAT_ADD(counters, field, amount) ((void)0)
+#define MERKLE_STAT_START(name) ((void)0)
+#define MERKLE_STAT_READ_LOCK(counters, lock) RW_READ_LOCK(lock)
+#define MERKLE_STAT_WRITE_LOCK(counters, lock) RW_WRITE_LOCK(lock)
+
+#endif // MERKLE_STATS
+
+#endif // MERKLE_STATS_H
@@ -0,0 +1,71 @@
+/**
+ * @file merkle_thread_pool.h
+ * @brief Internal worker pool used to parallelize tree construction.
+ *
+ * Declares the task submission and range-splitting helpers that the tree
+ * implementation runs on a ::merkle_thread_pool_t. Creation and destruction
+ * of pools are part of the public API in Merkle.h so callers can share one
+ * pool across many builds.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#ifndef MERKLE_THREAD_POOL_H
+#define MERKLE_THREAD_POOL_H
+
+#include <stddef.h>
+
+#include "Merkle.h"
+
+/**
+ * @typedef merkle_task_fn
+ * @brief Unit of work executed by a pool worker.
+ * @param arg Argument supplied at submission time.
+ */
+typedef void (*merkle_task_fn)(void *arg);
+
+/**
+ * @typedef merkle_range_fn
+ * @brief Processes the half-open item range [begin, end) of a parallel loop.
+ * @param ctx Caller context passed to merkle_parallel_for().
+ * @param begin First item of the range.
+ * @param end One past the last item of the range.
+ */
+typedef void (*merkle_range_fn)(void *ctx, size_t begin, size_t end);
+
+/**
+ * @brief Queues a task for execution on one of the pool's workers.
+ *
+ * @param pool Pool to run the task on (must not be NULL).
+ * @param fn Function to execute (must not be NULL).
+ * @param arg Argument handed to @p fn.
+ * @return MERKLE_SUCCESS on success, MERKLE_FAILED_MEM_ALLOC if the task
+ *         could not be queued, MERKLE_NULL_ARG on NULL arguments.
+ */
+merkle_error_t merkle_thread_pool_submit(merkle_thread_pool_t *pool, merkle_task_fn fn, void *arg);
+
+/**
+ * @brief Returns the number of worker threads owned by a pool.
+ * @param pool Pool to query (NULL yields 0).
+ */
+size_t merkle_thread_pool_size(const merkle_thread_pool_t *pool);
+
+/**
+ * @brief Splits [0, count) into chunks and processes them on the pool.
+ *
+ * The calling thread works on chunks too and the call returns once every
+ * item has been processed, so it is safe to call from inside a pool task.
+ * Without a pool, or when @p count does not exceed @p grain, the whole
+ * range runs inline on the calling thread.
+ *
+ * @param pool Pool to spread the work over (may be NULL).
+ * @param count Number of items to process.
+ * @param grain Minimum number of items per chunk (0 is treated as 1).
+ * @param fn Range function invoked for every chunk (must not be NULL).
+ * @param ctx Context handed to @p fn.
+ */
+void merkle_parallel_for(merkle_thread_pool_t *pool, size_t count, size_t grain,
+                         merkle_range_fn fn, void *ctx);
+
+#endif // MERKLE_THREAD_POOL_H
@@ -58,6 +58,7 @@
 
 // Cross-platform signal handling for graceful failure
 #include <setjmp.h>
+#include <stdbool.h>
 #include <signal.h>
 
 /**
@@ -68,6 +69,9 @@ extern __thread volatile int merkle_segv_occurred;
 
 /**
  * @brief Initialize signal protection for current thread
+ *
+ * The handlers are process-wide and reference counted, so concurrent callers
+ * on different threads may nest init/cleanup pairs freely.
  */
 void merkle_init_signal_protection(void);
 
@@ -86,6 +90,24 @@ void merkle_cleanup_signal_protection(void);
     merkle_segv_occurred = 0;                                                  \
     if (setjmp(merkle_segv_buf) == 0) {
 
+/**
+ * @brief SAFE_ACCESS_TRY that only arms the jump when @p guarded is true
+ *
+ * Unguarded blocks run without setjmp, for callers that skipped
+ * merkle_init_signal_protection() because they trust their input. Pairs with
+ * SAFE_ACCESS_CATCH and SAFE_ACCESS_END like SAFE_ACCESS_TRY.
+ */
+#define SAFE_ACCESS_TRY_IF(guarded)                                            \
+  do {                                                                         \
+    bool merkle_caught_ = false;                                               \
+    if (guarded) {                                                             \
+      merkle_segv_occurred = 0;                                                \
+      if (setjmp(merkle_segv_buf) != 0) {                                      \
+        merkle_caught_ = true;                                                 \
+      }                                                                        \
+    }                                                                          \
+    if (!merkle_caught_) {
+
 #define SAFE_ACCESS_CATCH                                                      \
   }                                                                            \
   else {                                                                       \
@@ -0,0 +1,132 @@
+/**
+ * @file merkle_arena.c
+ * @brief Chunked bump allocator with bulk release.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "merkle_arena.h"
+#include "merkle_utils.h"
+
+/** Alignment of every block, enough for any scalar type. */
+#define ARENA_ALIGN (alignof(max_align_t))
+
+/**
+ * @brief One contiguous region blocks are carved from.
+ */
+typedef struct merkle_arena_chunk {
+  struct merkle_arena_chunk *next; /**< Previously filled chunk. */
+  size_t capacity;                 /**< Usable bytes in @ref data. */
+  size_t used;                     /**< Bytes already handed out. */
+  alignas(max_align_t) unsigned char data[]; /**< Block storage. */
+} merkle_arena_chunk_t;
+
+/**
+ * @brief Arena state.
+ */
+struct merkle_arena {
+  merkle_arena_chunk_t *current; /**< Chunk new blocks come from, head of the chunk list. */
+  size_t chunk_size;             /**< Capacity of regular chunks. */
+};
+
+/**
+ * @brief Allocates a zeroed chunk able to hold @p capacity bytes.
+ */
+static merkle_arena_chunk_t *arena_chunk_create(size_t capacity) {
+  if (capacity > SIZE_MAX - sizeof(merkle_arena_chunk_t)) {
+    return NULL;
+  }
+
+  merkle_arena_chunk_t *chunk = MMalloc(sizeof(merkle_arena_chunk_t) + capacity);
+
+  if (chunk) {
+    chunk->capacity = capacity;
+  }
+
+  return chunk;
+}
+
+merkle_arena_t *merkle_arena_create(size_t chunk_size) {
+  ALLOC_AND_INIT(merkle_arena_t, arena, 1);
+
+  if (!arena) {
+    return NULL;
+  }
+
+  arena->chunk_size = chunk_size ? chunk_size : ARENA_ALIGN;
+  return arena;
+}
+
+void *merkle_arena_alloc(merkle_arena_t *arena, size_t size) {
+  if (!arena || size == 0 || size > SIZE_MAX - ARENA_ALIGN) {
+    return NULL;
+  }
+
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  merkle_arena_chunk_t *chunk = arena->current;
+
+  if (chunk && chunk->capacity - chunk->used >= size) {
+    void *block = chunk->data + chunk->used;
+    chunk->used += size;
+    return block;
+  }
+
+  // Oversized blocks get a private chunk so the current one keeps filling
+  bool oversized = size > arena->chunk_size;
+  merkle_arena_chunk_t *fresh = arena_chunk_create(oversized ? size : arena->chunk_size);
+
+  if (!fresh) {
+    return NULL;
+  }
+
+  fresh->used = size;
+
+  if (oversized && chunk) {
+    fresh->next = chunk->next;
+    chunk->next = fresh;
+  } else {
+    fresh->next = chunk;
+    arena->current = fresh;
+  }
+
+  return fresh->data;
+}
+
+bool merkle_arena_owns(const merkle_arena_t *arena, const void *ptr) {
+  if (!arena || !ptr) {
+    return false;
+  }
+
+  uintptr_t address = (uintptr_t)ptr;
+
+  for (const merkle_arena_chunk_t *chunk = arena->current; chunk; chunk = chunk->next) {
+    uintptr_t start = (uintptr_t)chunk->data;
+
+    if (address >= start && address - start < chunk->used) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void merkle_arena_destroy(merkle_arena_t *arena) {
+  if (!arena) {
+    return;
+  }
+
+  merkle_arena_chunk_t *chunk = arena->current;
+
+  while (chunk) {
+    merkle_arena_chunk_t *next = chunk->next;
+    MFree(chunk);
+    chunk = next;
+  }
+
+  MFree(arena);
+}
@@ -0,0 +1,320 @@
+/**
+ * @file merkle_async.c
+ * @brief Background builds and proofs with callback, eventfd and cancellation.
+ *
+ * Each operation is a reference-counted handle shared by the caller and the
+ * worker running it. The worker publishes the result under the handle's
+ * mutex, makes the eventfd readable, then invokes the callback; whichever
+ * side drops the last reference frees the handle together with any result
+ * nobody took.
+ *
+ * Operations run on the caller's pool when the configuration names one and
+ * otherwise on a library pool started on first use and kept for the life of
+ * the process.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+#include "Merkle.h"
+#include "merkle_async.h"
+#include "merkle_thread_pool.h"
+#include "merkle_utils.h"
+
+/** Fewest workers of the library pool, so one long build does not hold up every proof. */
+#define ASYNC_MIN_WORKERS (2)
+
+/** Most workers of the library pool; builds parallelize through their own configuration. */
+#define ASYNC_MAX_WORKERS (8)
+
+/**
+ * @brief What an operation produces.
+ */
+typedef enum merkle_async_kind {
+  ASYNC_BUILD, /**< create_merkle_tree_async(). */
+  ASYNC_PROOF  /**< generate_proof_async(). */
+} merkle_async_kind_t;
+
+/**
+ * @brief Asynchronous operation shared by its submitter and its worker.
+ */
+struct merkle_async {
+  merkle_async_kind_t kind;        /**< Operation type. */
+  const void **data;               /**< Caller data blocks (builds). */
+  const size_t *size;              /**< Caller block sizes (builds). */
+  size_t count;                    /**< Number of blocks (builds). */
+  merkle_config_t config;          /**< Copy of the build options (builds). */
+  merkle_tree_t *tree;             /**< Tree to prove against (proofs). */
+  size_t leaf_index;               /**< Leaf to prove (proofs). */
+  merkle_async_callback callback;  /**< Completion callback (may be NULL). */
+  void *user_data;                 /**< Passed to @ref callback. */
+  atomic_bool cancel;              /**< Raised by merkle_async_cancel() and merkle_async_release(). */
+  atomic_size_t refs;              /**< The caller's handle plus the queued or running worker. */
+  int event_fd;                    /**< Readable once finished (-1 without eventfd). */
+  pthread_mutex_t mutex;           /**< Guards the results and waiting on @ref finished. */
+  pthread_cond_t finished;         /**< Signalled when @ref done is set. */
+  atomic_bool done;                /**< The worker has published its status. */
+  merkle_error_t status;           /**< Outcome, valid once @ref done. */
+  merkle_tree_t *result_tree;      /**< Built tree until taken. */
+  merkle_proof_t *result_proof;    /**< Generated proof until taken. */
+};
+
+/** Library pool for operations without a caller pool. */
+static merkle_thread_pool_t *async_pool;
+
+/** Starts @ref async_pool exactly once. */
+static pthread_once_t async_pool_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Starts the library pool with one worker per CPU, within bounds.
+ */
+static void start_async_pool(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t workers = cpus < ASYNC_MIN_WORKERS ? ASYNC_MIN_WORKERS
+                   : cpus > ASYNC_MAX_WORKERS ? ASYNC_MAX_WORKERS : (size_t)cpus;
+
+  async_pool = merkle_thread_pool_create(workers);
+}
+
+/**
+ * @brief Frees an operation's resources and any result left in it.
+ */
+static void destroy_op(merkle_async_t *op) {
+  dealloc_merkle_tree(op->result_tree);
+  dealloc_merkle_proof(op->result_proof);
+
+  if (op->event_fd >= 0) {
+    close(op->event_fd);
+  }
+
+  pthread_cond_destroy(&op->finished);
+  pthread_mutex_destroy(&op->mutex);
+  MFree(op);
+}
+
+/**
+ * @brief Drops one reference, destroying the operation with the last one.
+ */
+static void unref_op(merkle_async_t *op) {
+  if (atomic_fetch_sub_explicit(&op->refs, 1, memory_order_acq_rel) == 1) {
+    destroy_op(op);
+  }
+}
+
+/**
+ * @brief merkle_task_fn running one operation and publishing its outcome.
+ */
+static void run_op(void *arg) {
+  merkle_async_t *op = arg;
+  merkle_error_t status = MERKLE_CANCELLED;
+  merkle_tree_t *tree = NULL;
+  merkle_proof_t *proof = NULL;
+
+  // An operation cancelled while queued never starts
+  if (!atomic_load(&op->cancel)) {
+    if (op->kind == ASYNC_BUILD) {
+      status = merkle_build_tree(op->data, op->size, op->count, &op->config, &op->cancel, &tree);
+    } else {
+      status = generate_proof_from_index(op->tree, op->leaf_index, &proof);
+    }
+  }
+
+  pthread_mutex_lock(&op->mutex);
+  op->status = status;
+  op->result_tree = tree;
+  op->result_proof = proof;
+  atomic_store(&op->done, true);
+  pthread_cond_broadcast(&op->finished);
+  pthread_mutex_unlock(&op->mutex);
+
+  if (op->event_fd >= 0) {
+    uint64_t one = 1;
+    ssize_t written;
+
+    do {
+      written = write(op->event_fd, &one, sizeof(one));
+    } while (written < 0 && errno == EINTR);
+  }
+
+  if (op->callback) {
+    op->callback(op, status, op->user_data);
+  }
+
+  unref_op(op);
+}
+
+/**
+ * @brief Allocates an operation holding the caller's and the worker's references.
+ */
+static merkle_async_t *new_op(merkle_async_kind_t kind, merkle_async_callback callback, void *user_data) {
+  ALLOC_AND_INIT(merkle_async_t, op, 1);
+
+  if (!op) {
+    return NULL;
+  }
+
+  op->kind = kind;
+  op->callback = callback;
+  op->user_data = user_data;
+  op->event_fd = -1;
+  atomic_init(&op->cancel, false);
+  atomic_init(&op->done, false);
+  atomic_init(&op->refs, 2);
+
+#if defined(__linux__)
+  op->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (op->event_fd < 0) {
+    MFree(op);
+    return NULL;
+  }
+#endif
+
+  pthread_mutex_init(&op->mutex, NULL);
+  pthread_cond_init(&op->finished, NULL);
+  return op;
+}
+
+/**
+ * @brief Queues @p op on @p pool, or on the library pool when @p pool is NULL.
+ *
+ * @return @p op, or NULL (with @p op destroyed) if it could not be queued.
+ */
+static merkle_async_t *submit_op(merkle_async_t *op, merkle_thread_pool_t *pool) {
+  if (!pool) {
+    pthread_once(&async_pool_once, start_async_pool);
+    pool = async_pool;
+  }
+
+  if (!pool || merkle_thread_pool_submit(pool, run_op, op) != MERKLE_SUCCESS) {
+    destroy_op(op);
+    return NULL;
+  }
+
+  return op;
+}
+
+merkle_async_t *create_merkle_tree_async(const void **data, const size_t *size, size_t count,
+                                         const merkle_config_t *config, merkle_async_callback callback,
+                                         void *user_data) {
+  // Validate input parameters
+  if (!data || !size || !config || count == 0) {
+    return NULL;
+  }
+
+  merkle_async_t *op = new_op(ASYNC_BUILD, callback, user_data);
+
+  if (!op) {
+    return NULL;
+  }
+
+  op->data = data;
+  op->size = size;
+  op->count = count;
+  op->config = *config;
+  return submit_op(op, config->thread_pool);
+}
+
+merkle_async_t *generate_proof_async(merkle_tree_t *tree, size_t leaf_index, merkle_async_callback callback,
+                                     void *user_data) {
+  // Validate input parameters
+  if (!tree) {
+    return NULL;
+  }
+
+  merkle_async_t *op = new_op(ASYNC_PROOF, callback, user_data);
+
+  if (!op) {
+    return NULL;
+  }
+
+  op->tree = tree;
+  op->leaf_index = leaf_index;
+  return submit_op(op, NULL);
+}
+
+int merkle_async_fd(const merkle_async_t *op) {
+  return op ? op->event_fd : -1;
+}
+
+bool merkle_async_done(const merkle_async_t *op) {
+  return op && atomic_load(&op->done);
+}
+
+merkle_error_t merkle_async_wait(merkle_async_t *op) {
+  if (!op) {
+    return MERKLE_NULL_ARG;
+  }
+
+  pthread_mutex_lock(&op->mutex);
+
+  while (!atomic_load(&op->done)) {
+    pthread_cond_wait(&op->finished, &op->mutex);
+  }
+
+  merkle_error_t status = op->status;
+  pthread_mutex_unlock(&op->mutex);
+  return status;
+}
+
+merkle_error_t merkle_async_cancel(merkle_async_t *op) {
+  if (!op) {
+    return MERKLE_NULL_ARG;
+  }
+
+  atomic_store(&op->cancel, true);
+  return MERKLE_SUCCESS;
+}
+
+merkle_tree_t *merkle_async_take_tree(merkle_async_t *op) {
+  if (!op) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&op->mutex);
+  merkle_tree_t *tree = op->result_tree;
+
+  if (tree) {
+    op->result_tree = NULL;
+  }
+
+  pthread_mutex_unlock(&op->mutex);
+  return tree;
+}
+
+merkle_proof_t *merkle_async_take_proof(merkle_async_t *op) {
+  if (!op) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&op->mutex);
+  merkle_proof_t *proof = op->result_proof;
+
+  if (proof) {
+    op->result_proof = NULL;
+  }
+
+  pthread_mutex_unlock(&op->mutex);
+  return proof;
+}
+
+void merkle_async_release(merkle_async_t *op) {
+  if (!op) {
+    return;
+  }
+
+  // Nobody is left to want the result, so a running operation may as well stop
+  atomic_store(&op->cancel, true);
+  unref_op(op);
+}
@@ -0,0 +1,207 @@
+/**
+ * @file merkle_blake3.c
+ * @brief Portable BLAKE3 following the specification's reference design.
+ *
+ * Input is split into 1 KiB chunks compressed 64 bytes at a time. Every
+ * finished chunk's chaining value is pushed on a stack and merged with its
+ * left neighbours as long as the number of chunks so far is even, which
+ * keeps the stack a binary counter of completed subtrees. Finalization
+ * folds the stack into the root node, compressed with the ROOT flag.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <string.h>
+
+#include "merkle_blake3.h"
+
+/** Bytes of one compression block. */
+#define BLAKE3_BLOCK_LEN (64)
+
+/** Domain separation flags. */
+#define BLAKE3_CHUNK_START (1u << 0)
+#define BLAKE3_CHUNK_END (1u << 1)
+#define BLAKE3_PARENT (1u << 2)
+#define BLAKE3_ROOT (1u << 3)
+
+/** Initial chaining value, shared with SHA-256. */
+static const uint32_t BLAKE3_IV[8] = {
+  0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+/** Message word order of each round, applied cumulatively. */
+static const uint8_t BLAKE3_MSG_SCHEDULE[7][16] = {
+  {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+  {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+  {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+  {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+  {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+  {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+  {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}
+};
+
+static inline uint32_t rotr32(uint32_t x, unsigned n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t load_le32(const unsigned char *in) {
+  return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+/**
+ * @brief The quarter-round mixing two message words into one column or diagonal.
+ */
+static inline void blake3_g(uint32_t *s, size_t a, size_t b, size_t c, size_t d, uint32_t x, uint32_t y) {
+  s[a] = s[a] + s[b] + x;
+  s[d] = rotr32(s[d] ^ s[a], 16);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32(s[b] ^ s[c], 12);
+  s[a] = s[a] + s[b] + y;
+  s[d] = rotr32(s[d] ^ s[a], 8);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32(s[b] ^ s[c], 7);
+}
+
+/**
+ * @brief Compresses one block into a new chaining value.
+ *
+ * Only the first half of the compression output is ever needed for a
+ * 32-byte digest, so only that half is produced.
+ */
+static void blake3_compress(const uint32_t cv[8], const unsigned char block[BLAKE3_BLOCK_LEN], uint8_t block_len,
+                            uint64_t counter, uint32_t flags, uint32_t out[8]) {
+  uint32_t m[16];
+  uint32_t s[16];
+
+  for (size_t i = 0; i < 16; ++i) {
+    m[i] = load_le32(block + 4 * i);
+  }
+
+  memcpy(s, cv, 8 * sizeof(uint32_t));
+  memcpy(s + 8, BLAKE3_IV, 4 * sizeof(uint32_t));
+  s[12] = (uint32_t)counter;
+  s[13] = (uint32_t)(counter >> 32);
+  s[14] = block_len;
+  s[15] = flags;
+
+  for (size_t r = 0; r < 7; ++r) {
+    const uint8_t *w = BLAKE3_MSG_SCHEDULE[r];
+    blake3_g(s, 0, 4, 8, 12, m[w[0]], m[w[1]]);
+    blake3_g(s, 1, 5, 9, 13, m[w[2]], m[w[3]]);
+    blake3_g(s, 2, 6, 10, 14, m[w[4]], m[w[5]]);
+    blake3_g(s, 3, 7, 11, 15, m[w[6]], m[w[7]]);
+    blake3_g(s, 0, 5, 10, 15, m[w[8]], m[w[9]]);
+    blake3_g(s, 1, 6, 11, 12, m[w[10]], m[w[11]]);
+    blake3_g(s, 2, 7, 8, 13, m[w[12]], m[w[13]]);
+    blake3_g(s, 3, 4, 9, 14, m[w[14]], m[w[15]]);
+  }
+
+  for (size_t i = 0; i < 8; ++i) {
+    out[i] = s[i] ^ s[i + 8];
+  }
+}
+
+/**
+ * @brief Chaining value of the parent of two subtrees.
+ */
+static void blake3_parent_cv(const uint32_t left[8], const uint32_t right[8], uint32_t flags, uint32_t out[8]) {
+  unsigned char block[BLAKE3_BLOCK_LEN];
+
+  for (size_t i = 0; i < 8; ++i) {
+    for (size_t b = 0; b < 4; ++b) {
+      block[4 * i + b] = (unsigned char)(left[i] >> (8 * b));
+      block[32 + 4 * i + b] = (unsigned char)(right[i] >> (8 * b));
+    }
+  }
+
+  blake3_compress(BLAKE3_IV, block, BLAKE3_BLOCK_LEN, 0, BLAKE3_PARENT | flags, out);
+}
+
+/**
+ * @brief Flags of the next block of the current chunk, the chunk end excluded.
+ */
+static inline uint32_t chunk_start_flag(const merkle_blake3_t *state) {
+  return state->blocks_compressed == 0 ? BLAKE3_CHUNK_START : 0;
+}
+
+void merkle_blake3_init(merkle_blake3_t *state) {
+  memset(state, 0, sizeof(*state));
+  memcpy(state->cv, BLAKE3_IV, sizeof(state->cv));
+}
+
+/**
+ * @brief Pushes a finished chunk, merging every subtree it completes.
+ *
+ * @param total_chunks Chunks finished so far, this one included; each
+ *        trailing zero bit of it is one completed pair of subtrees.
+ */
+static void push_chunk_cv(merkle_blake3_t *state, uint32_t cv[8], uint64_t total_chunks) {
+  while ((total_chunks & 1) == 0) {
+    state->cv_stack_len--;
+    blake3_parent_cv(state->cv_stack[state->cv_stack_len], cv, 0, cv);
+    total_chunks >>= 1;
+  }
+
+  memcpy(state->cv_stack[state->cv_stack_len++], cv, 8 * sizeof(uint32_t));
+}
+
+void merkle_blake3_update(merkle_blake3_t *state, const void *data, size_t len) {
+  const unsigned char *in = data;
+
+  while (len > 0) {
+    // A full chunk is only closed once more input proves it is not the last
+    if (state->blocks_compressed * BLAKE3_BLOCK_LEN + state->block_len == MERKLE_BLAKE3_CHUNK_LEN) {
+      uint32_t cv[8];
+      blake3_compress(state->cv, state->block, BLAKE3_BLOCK_LEN, state->chunk_counter,
+                      chunk_start_flag(state) | BLAKE3_CHUNK_END, cv);
+      push_chunk_cv(state, cv, state->chunk_counter + 1);
+      memcpy(state->cv, BLAKE3_IV, sizeof(state->cv));
+      state->chunk_counter++;
+      state->blocks_compressed = 0;
+      state->block_len = 0;
+    }
+
+    // Likewise a full block waits for more input before it is compressed
+    if (state->block_len == BLAKE3_BLOCK_LEN) {
+      blake3_compress(state->cv, state->block, BLAKE3_BLOCK_LEN, state->chunk_counter, chunk_start_flag(state),
+                      state->cv);
+      state->blocks_compressed++;
+      state->block_len = 0;
+    }
+
+    size_t take = BLAKE3_BLOCK_LEN - state->block_len;
+    take = take < len ? take : len;
+    memcpy(state->block + state->block_len, in, take);
+    state->block_len += (uint8_t)take;
+    in += take;
+    len -= take;
+  }
+}
+
+void merkle_blake3_final(const merkle_blake3_t *state, unsigned char digest[32]) {
+  unsigned char block[BLAKE3_BLOCK_LEN] = {0};
+  uint32_t out[8];
+  memcpy(block, state->block, state->block_len);
+
+  uint32_t flags = chunk_start_flag(state) | BLAKE3_CHUNK_END;
+
+  if (state->cv_stack_len == 0) {
+    // The whole input fits one chunk, whose last block is the root
+    blake3_compress(state->cv, block, state->block_len, state->chunk_counter, flags | BLAKE3_ROOT, out);
+  } else {
+    uint32_t cv[8];
+    blake3_compress(state->cv, block, state->block_len, state->chunk_counter, flags, cv);
+
+    // Fold the stack into the right edge of the tree; the last parent is the root
+    for (size_t i = state->cv_stack_len; i-- > 0;) {
+      blake3_parent_cv(state->cv_stack[i], cv, i == 0 ? BLAKE3_ROOT : 0, i == 0 ? out : cv);
+    }
+  }
+
+  for (size_t i = 0; i < 8; ++i) {
+    for (size_t b = 0; b < 4; ++b) {
+      digest[4 * i + b] = (unsigned char)(out[i] >> (8 * b));
+    }
+  }
+}
@@ -0,0 +1,268 @@
+/**
+ * @file merkle_builder.c
+ * @brief Append-only streaming construction of a Merkle root.
+ *
+ * The builder never holds the leaves. For every tree level it keeps only the
+ * hashes of the current, still incomplete group of siblings; as soon as a
+ * group reaches the branching factor it is hashed into its parent one level
+ * up. Memory is therefore bounded by branching_factor hashes per level,
+ * whatever the number of leaves, and the root produced by
+ * merkle_builder_finalize() equals the one of create_merkle_tree() over the
+ * same blocks.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Merkle.h"
+#include "merkle_hash.h"
+#include "merkle_sha256.h"
+#include "merkle_utils.h"
+
+/** Deepest tree a size_t leaf count can produce with a branching factor of 2. */
+#define BUILDER_MAX_LEVELS (sizeof(size_t) * CHAR_BIT)
+
+/**
+ * @brief Frontier of one tree level.
+ */
+typedef struct merkle_builder_level {
+  unsigned char (*pending)[HASH_SIZE]; /**< Siblings waiting for their group to fill (lazily allocated). */
+  size_t pending_count;                /**< Hashes held in @ref pending (< branching factor). */
+  size_t emitted;                      /**< Nodes produced on this level so far. */
+} merkle_builder_level_t;
+
+/**
+ * @brief Streaming builder state.
+ */
+struct merkle_builder {
+  const merkle_hash_vtable_t *hash;                 /**< Algorithm of leaves and nodes. */
+  size_t branching_factor;                          /**< Children per parent. */
+  size_t leaf_count;                                /**< Leaves appended so far. */
+  merkle_builder_level_t levels[BUILDER_MAX_LEVELS]; /**< Level 0 holds leaf hashes. */
+};
+
+/**
+ * @brief Adds a finished node to a level, carrying full groups upwards.
+ *
+ * Every level the carry can reach is allocated before anything is modified,
+ * so a failed allocation leaves the frontier exactly as it was.
+ *
+ * @return MERKLE_SUCCESS, or MERKLE_FAILED_MEM_ALLOC if a level's frontier
+ *         could not be allocated.
+ */
+static merkle_error_t push_node(merkle_builder_t *builder, size_t level, const unsigned char hash[HASH_SIZE]) {
+  size_t branching_factor = builder->branching_factor;
+  size_t top = level;
+
+  // Only levels one node short of a full group pass the carry on
+  while (top < BUILDER_MAX_LEVELS - 1 && builder->levels[top].pending_count + 1 == branching_factor) {
+    top++;
+  }
+
+  for (size_t i = level; i <= top; ++i) {
+    if (!builder->levels[i].pending) {
+      ALLOC_AND_INIT_SIMPLE(builder->levels[i].pending, branching_factor);
+
+      if (!builder->levels[i].pending) {
+        return MERKLE_FAILED_MEM_ALLOC;
+      }
+    }
+  }
+
+  unsigned char node[HASH_SIZE];
+  memcpy(node, hash, HASH_SIZE);
+
+  for (size_t i = level; i <= top; ++i) {
+    merkle_builder_level_t *lvl = &builder->levels[i];
+
+    memcpy(lvl->pending[lvl->pending_count++], node, HASH_SIZE);
+    lvl->emitted++;
+
+    if (lvl->pending_count < branching_factor) {
+      break;
+    }
+
+    // The group is complete whatever comes next, so its parent is final
+    const unsigned char *msg = lvl->pending[0];
+    size_t len = branching_factor * HASH_SIZE;
+    unsigned char *digest = node;
+    merkle_hash_batch(builder->hash, &msg, &len, &digest, 1);
+    lvl->pending_count = 0;
+  }
+
+  return MERKLE_SUCCESS;
+}
+
+merkle_builder_t *merkle_builder_init(size_t branching_factor) {
+  return merkle_builder_init_hash(branching_factor, MERKLE_HASH_SHA256);
+}
+
+merkle_builder_t *merkle_builder_init_hash(size_t branching_factor, merkle_hash_id_t hash) {
+  const merkle_hash_vtable_t *vtable = merkle_hash_get(hash);
+
+  if (branching_factor < 2 || !vtable) {
+    return NULL;
+  }
+
+  ALLOC_AND_INIT(merkle_builder_t, builder, 1);
+
+  if (!builder) {
+    return NULL;
+  }
+
+  builder->hash = vtable;
+  builder->branching_factor = branching_factor;
+  return builder;
+}
+
+void merkle_builder_destroy(merkle_builder_t *builder) {
+  if (!builder) {
+    return;
+  }
+
+  for (size_t i = 0; i < BUILDER_MAX_LEVELS; ++i) {
+    MFree(builder->levels[i].pending);
+  }
+
+  MFree(builder);
+}
+
+size_t merkle_builder_leaf_count(const merkle_builder_t *builder) {
+  return builder ? builder->leaf_count : 0;
+}
+
+merkle_error_t merkle_builder_append(merkle_builder_t *builder, const void *data, size_t size) {
+  return merkle_builder_append_n(builder, &data, &size, 1);
+}
+
+/**
+ * @brief Checks that block @p i can be read and is not empty.
+ *
+ * The jump target lives in this call alone, so no caller local is written
+ * between setjmp and a longjmp back to it.
+ */
+static bool block_readable(const void **data, const size_t *sizes, size_t i) {
+  volatile bool readable = false;
+
+  SAFE_ACCESS_TRY {
+    readable = data[i] && sizes[i];
+  } SAFE_ACCESS_CATCH {
+    // Segfault occurred - count parameter is incorrect
+    readable = false;
+  } SAFE_ACCESS_END;
+
+  return readable;
+}
+
+/**
+ * @brief Hashes @p batch blocks into @p digests under signal protection.
+ * @return false if a block could not be read.
+ */
+static bool hash_blocks(const merkle_builder_t *builder, const void **data, const size_t *sizes,
+                        unsigned char **digests, size_t batch) {
+  volatile bool hashed = false;
+
+  SAFE_ACCESS_TRY {
+    merkle_hash_batch(builder->hash, (const unsigned char *const *)data, sizes, digests, batch);
+    hashed = true;
+  } SAFE_ACCESS_CATCH {
+    // Segfault occurred during data access
+    hashed = false;
+  } SAFE_ACCESS_END;
+
+  return hashed;
+}
+
+merkle_error_t merkle_builder_append_n(merkle_builder_t *builder, const void **data,
+                                       const size_t *sizes, size_t count) {
+  // Validate input parameters
+  if (!builder || !data || !sizes) {
+    return MERKLE_NULL_ARG;
+  }
+
+  if (count > SIZE_MAX - builder->leaf_count) {
+    return MERKLE_BAD_LEN;
+  }
+
+  merkle_error_t ret = MERKLE_SUCCESS;
+
+  // Initialize signal protection to catch segfaults gracefully
+  merkle_init_signal_protection();
+
+  // Reject obviously bad blocks before anything is appended
+  for (size_t i = 0; i < count && ret == MERKLE_SUCCESS; ++i) {
+    if (!block_readable(data, sizes, i)) {
+      ret = MERKLE_BAD_ARG;
+    }
+  }
+
+  /* Leaves are hashed in SIMD-sized batches and only pushed once the whole
+   * batch hashed cleanly, so a fault leaves the frontier consistent. */
+  for (size_t first = 0; first < count && ret == MERKLE_SUCCESS; first += MERKLE_SHA256_MAX_LANES) {
+    size_t batch = count - first < MERKLE_SHA256_MAX_LANES ? count - first : MERKLE_SHA256_MAX_LANES;
+    unsigned char leaf_hashes[MERKLE_SHA256_MAX_LANES][HASH_SIZE];
+    unsigned char *digests[MERKLE_SHA256_MAX_LANES];
+
+    for (size_t k = 0; k < batch; ++k) {
+      digests[k] = leaf_hashes[k];
+    }
+
+    if (!hash_blocks(builder, data + first, sizes + first, digests, batch)) {
+      ret = MERKLE_BAD_ARG;
+    }
+
+    for (size_t k = 0; k < batch && ret == MERKLE_SUCCESS; ++k) {
+      ret = push_node(builder, 0, leaf_hashes[k]);
+
+      if (ret == MERKLE_SUCCESS) {
+        builder->leaf_count++;
+      }
+    }
+  }
+
+  merkle_cleanup_signal_protection();
+  return ret;
+}
+
+merkle_error_t merkle_builder_finalize(const merkle_builder_t *builder, unsigned char root[HASH_SIZE]) {
+  // Validate input parameters
+  if (!builder || !root) {
+    return MERKLE_NULL_ARG;
+  }
+
+  if (builder->leaf_count == 0) {
+    return MERKLE_BAD_ARG;
+  }
+
+  /* Close every incomplete group bottom-up without touching the frontier:
+   * the parent of level l's trailing group is carried as the last node of
+   * level l + 1 until a level is left with a single node, which is the root. */
+  unsigned char carry[HASH_SIZE];
+  bool has_carry = false;
+
+  for (size_t level = 0; level < BUILDER_MAX_LEVELS; ++level) {
+    const merkle_builder_level_t *lvl = &builder->levels[level];
+    size_t width = lvl->emitted + (has_carry ? 1 : 0);
+
+    if (width == 1) {
+      memcpy(root, has_carry ? carry : lvl->pending[0], HASH_SIZE);
+      return MERKLE_SUCCESS;
+    }
+
+    if (lvl->pending_count == 0 && !has_carry) {
+      continue;
+    }
+
+    const unsigned char *parts[2] = {(const unsigned char *)lvl->pending, carry};
+    size_t lens[2] = {lvl->pending_count * HASH_SIZE, has_carry ? HASH_SIZE : 0};
+    merkle_hash_spans(builder->hash, parts, lens, 2, carry);
+    has_carry = true;
+  }
+
+  return MERKLE_FAILED_TREE_BUILD;
+}
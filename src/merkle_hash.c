@@ -0,0 +1,143 @@
+/**
+ * @file merkle_hash.c
+ * @brief Registry of hash algorithms and the built-in SHA-256 and BLAKE3 entries.
+ *
+ * Built-in identifiers resolve to static vtables. Custom identifiers are
+ * stored in an atomic table, so lookups from any thread need no lock and see
+ * a registration completely or not at all.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "Merkle.h"
+#include "merkle_blake3.h"
+#include "merkle_hash.h"
+#include "merkle_sha256.h"
+
+/** Number of identifiers a tree or proof can record in its one-byte field. */
+#define HASH_ID_COUNT (256)
+
+static void sha256_init(void *ctx) {
+  merkle_sha256_init(ctx);
+}
+
+static void sha256_update(void *ctx, const void *data, size_t len) {
+  merkle_sha256_update(ctx, data, len);
+}
+
+static void sha256_final(void *ctx, unsigned char *digest) {
+  merkle_sha256_final(ctx, digest);
+}
+
+static void blake3_init(void *ctx) {
+  merkle_blake3_init(ctx);
+}
+
+static void blake3_update(void *ctx, const void *data, size_t len) {
+  merkle_blake3_update(ctx, data, len);
+}
+
+static void blake3_final(void *ctx, unsigned char *digest) {
+  merkle_blake3_final(ctx, digest);
+}
+
+/** SHA-256, batched through the multi-buffer backends. */
+static const merkle_hash_vtable_t sha256_vtable = {
+  "sha256", HASH_SIZE, sizeof(merkle_sha256_ctx_t), sha256_init, sha256_update, sha256_final, merkle_sha256_batch
+};
+
+/** BLAKE3; tree messages are short, so one message at a time is already close to optimal. */
+static const merkle_hash_vtable_t blake3_vtable = {
+  "blake3", HASH_SIZE, sizeof(merkle_blake3_t), blake3_init, blake3_update, blake3_final, NULL
+};
+
+/** Algorithms registered under custom identifiers. */
+static _Atomic(const merkle_hash_vtable_t *) custom_hashes[HASH_ID_COUNT - MERKLE_HASH_CUSTOM_FIRST];
+
+merkle_error_t merkle_hash_register(merkle_hash_id_t id, const merkle_hash_vtable_t *vtable) {
+  if (!vtable) {
+    return MERKLE_NULL_ARG;
+  }
+
+  if (id < MERKLE_HASH_CUSTOM_FIRST || id >= HASH_ID_COUNT || !vtable->init || !vtable->update ||
+      !vtable->final || vtable->digest_size != HASH_SIZE || vtable->ctx_size > MERKLE_HASH_MAX_CTX_SIZE) {
+    return MERKLE_BAD_ARG;
+  }
+
+  const merkle_hash_vtable_t *expected = NULL;
+
+  // Trees and proofs may already rely on a registration, so it is never replaced
+  if (!atomic_compare_exchange_strong(&custom_hashes[id - MERKLE_HASH_CUSTOM_FIRST], &expected, vtable)) {
+    return MERKLE_BAD_ARG;
+  }
+
+  return MERKLE_SUCCESS;
+}
+
+const merkle_hash_vtable_t *merkle_hash_get(merkle_hash_id_t id) {
+  switch (id) {
+  case MERKLE_HASH_SHA256:
+    return &sha256_vtable;
+  case MERKLE_HASH_BLAKE3:
+    return &blake3_vtable;
+  default:
+    break;
+  }
+
+  if (id < MERKLE_HASH_CUSTOM_FIRST || id >= HASH_ID_COUNT) {
+    return NULL;
+  }
+
+  return atomic_load(&custom_hashes[id - MERKLE_HASH_CUSTOM_FIRST]);
+}
+
+void merkle_hash_batch(const merkle_hash_vtable_t *hash, const unsigned char *const *msgs, const size_t *lens,
+                       unsigned char *const *digests, size_t count) {
+  if (hash->batch) {
+    hash->batch(msgs, lens, digests, count);
+    return;
+  }
+
+  merkle_hash_ctx_t ctx;
+
+  for (size_t i = 0; i < count; ++i) {
+    hash->init(&ctx);
+    hash->update(&ctx, msgs[i], lens[i]);
+    hash->final(&ctx, digests[i]);
+  }
+}
+
+void merkle_hash_batch_fixed(const merkle_hash_vtable_t *hash, const unsigned char *const *msgs, size_t len,
+                             unsigned char *const *digests, size_t count) {
+  if (hash == &sha256_vtable) {
+    merkle_sha256_batch_fixed(msgs, len, digests, count);
+    return;
+  }
+
+  size_t lens[MERKLE_SHA256_MAX_LANES];
+
+  for (size_t l = 0; l < MERKLE_SHA256_MAX_LANES; ++l) {
+    lens[l] = len;
+  }
+
+  for (size_t first = 0; first < count; first += MERKLE_SHA256_MAX_LANES) {
+    size_t group = count - first < MERKLE_SHA256_MAX_LANES ? count - first : MERKLE_SHA256_MAX_LANES;
+    merkle_hash_batch(hash, msgs + first, lens, digests + first, group);
+  }
+}
+
+void merkle_hash_spans(const merkle_hash_vtable_t *hash, const unsigned char *const *parts, const size_t *lens,
+                       size_t count, unsigned char digest[HASH_SIZE]) {
+  merkle_hash_ctx_t ctx;
+  hash->init(&ctx);
+
+  for (size_t i = 0; i < count; ++i) {
+    hash->update(&ctx, parts[i], lens[i]);
+  }
+
+  hash->final(&ctx, digest);
+}
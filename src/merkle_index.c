@@ -0,0 +1,138 @@
+/**
+ * @file merkle_index.c
+ * @brief Linear-probing table from key digests to leaf indices.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "merkle_index.h"
+#include "merkle_utils.h"
+
+/**
+ * @brief Index state.
+ */
+struct merkle_index {
+  size_t *slots;                       /**< Leaf index + 1 of each slot's entry, 0 when empty. */
+  size_t mask;                         /**< Slot count - 1; the slot count is a power of two. */
+  unsigned char (*digests)[HASH_SIZE]; /**< Digest each leaf is filed under. */
+  unsigned char *filed;                /**< Whether each leaf has an entry. */
+};
+
+/**
+ * @brief First slot probed for a digest.
+ */
+static inline size_t home_slot(const merkle_index_t *index, const unsigned char digest[HASH_SIZE]) {
+  uint64_t bits;
+  memcpy(&bits, digest, sizeof(bits));
+  return (size_t)bits & index->mask;
+}
+
+merkle_index_t *merkle_index_create(size_t leaf_count) {
+  if (leaf_count == 0 || leaf_count > SIZE_MAX / 4 / sizeof(size_t)) {
+    return NULL;
+  }
+
+  size_t capacity = 2;
+
+  while (capacity < 2 * leaf_count) {
+    capacity *= 2;
+  }
+
+  ALLOC_AND_INIT(merkle_index_t, index, 1);
+
+  if (!index) {
+    return NULL;
+  }
+
+  ALLOC_AND_INIT_SIMPLE(index->slots, capacity);
+  ALLOC_AND_INIT_SIMPLE(index->digests, leaf_count);
+  ALLOC_AND_INIT_SIMPLE(index->filed, leaf_count);
+
+  if (!index->slots || !index->digests || !index->filed) {
+    merkle_index_destroy(index);
+    return NULL;
+  }
+
+  index->mask = capacity - 1;
+  return index;
+}
+
+void merkle_index_set(merkle_index_t *index, size_t leaf_index, const unsigned char digest[HASH_SIZE]) {
+  if (index->filed[leaf_index]) {
+    if (memcmp(index->digests[leaf_index], digest, HASH_SIZE) == 0) {
+      return;
+    }
+
+    merkle_index_remove(index, leaf_index);
+  }
+
+  memcpy(index->digests[leaf_index], digest, HASH_SIZE);
+  index->filed[leaf_index] = 1;
+
+  // At most half the slots are taken, so an empty one is always close
+  size_t slot = home_slot(index, digest);
+
+  while (index->slots[slot]) {
+    slot = (slot + 1) & index->mask;
+  }
+
+  index->slots[slot] = leaf_index + 1;
+}
+
+void merkle_index_remove(merkle_index_t *index, size_t leaf_index) {
+  if (!index->filed[leaf_index]) {
+    return;
+  }
+
+  size_t hole = home_slot(index, index->digests[leaf_index]);
+
+  while (index->slots[hole] != leaf_index + 1) {
+    hole = (hole + 1) & index->mask;
+  }
+
+  index->filed[leaf_index] = 0;
+  index->slots[hole] = 0;
+
+  /* Shift later entries of the run back into the hole so every entry stays
+   * reachable from its home slot without tombstones. */
+  for (size_t slot = (hole + 1) & index->mask; index->slots[slot]; slot = (slot + 1) & index->mask) {
+    size_t home = home_slot(index, index->digests[index->slots[slot] - 1]);
+
+    if (((slot - home) & index->mask) >= ((slot - hole) & index->mask)) {
+      index->slots[hole] = index->slots[slot];
+      index->slots[slot] = 0;
+      hole = slot;
+    }
+  }
+}
+
+bool merkle_index_find(const merkle_index_t *index, const unsigned char digest[HASH_SIZE], size_t *leaf_index) {
+  bool found = false;
+
+  // Equal digests share a run, so the whole run is checked for the lowest leaf
+  for (size_t slot = home_slot(index, digest); index->slots[slot]; slot = (slot + 1) & index->mask) {
+    size_t leaf = index->slots[slot] - 1;
+
+    if (memcmp(index->digests[leaf], digest, HASH_SIZE) == 0 && (!found || leaf < *leaf_index)) {
+      *leaf_index = leaf;
+      found = true;
+    }
+  }
+
+  return found;
+}
+
+void merkle_index_destroy(merkle_index_t *index) {
+  if (!index) {
+    return;
+  }
+
+  MFree(index->slots);
+  MFree(index->digests);
+  MFree(index->filed);
+  MFree(index);
+}
@@ -0,0 +1,750 @@
+/**
+ * @file merkle_proof.c
+ * @brief Verification of Merkle proofs against a known root.
+ *
+ * A proof is replayed from the leaf hash upwards: at every level the node's
+ * hash is spliced in among its siblings at the recorded position and the
+ * concatenation is hashed into the parent. Batched verification replays
+ * proofs of neighbouring leaves level by level, hashes identical parent
+ * messages only once and feeds the remaining ones to the multi-buffer
+ * SHA-256 backend.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Merkle.h"
+#include "merkle_hash.h"
+#include "merkle_proof.h"
+#include "merkle_sha256.h"
+#include "merkle_utils.h"
+
+/** Widest node whose message verify_proof() assembles on the stack. */
+#define VERIFY_STACK_CHILDREN (16)
+
+/** Proofs of neighbouring leaves replayed together by verify_proofs_batch(). */
+#define VERIFY_BLOCK_PROOFS (256)
+
+/**
+ * @brief Checks that a proof is well formed for the leaf it claims.
+ *
+ * Every level must hold fewer siblings than the branching factor and place
+ * the node at the position its index implies, and the index must reach 0 at
+ * the root. Proofs failing this cannot be valid, so they are rejected before
+ * any hashing.
+ */
+static bool proof_shape_valid(const merkle_proof_t *proof) {
+  if (!proof || (proof->path_length && (!proof->path || proof->branching_factor < 2))) {
+    return false;
+  }
+
+  size_t index = proof->leaf_index;
+
+  for (size_t level = 0; level < proof->path_length; ++level) {
+    const merkle_proof_item_t *item = proof->path[level];
+
+    if (!item || item->sibling_count >= proof->branching_factor ||
+        item->node_position > item->sibling_count ||
+        item->node_position != index % proof->branching_factor ||
+        (item->sibling_count && !item->sibling_hashes)) {
+      return false;
+    }
+
+    index /= proof->branching_factor;
+  }
+
+  return index == 0;
+}
+
+/**
+ * @brief Writes a parent's message: the siblings with @p node spliced in.
+ * @return Length of the message in bytes.
+ */
+static size_t assemble_parent(const unsigned char *siblings, size_t sibling_count, size_t position,
+                              const unsigned char node[HASH_SIZE], unsigned char *msg) {
+  size_t before = position * HASH_SIZE;
+  size_t after = (sibling_count - position) * HASH_SIZE;
+
+  if (before) {
+    memcpy(msg, siblings, before);
+  }
+
+  memcpy(msg + before, node, HASH_SIZE);
+
+  if (after) {
+    memcpy(msg + before + HASH_SIZE, siblings + before, after);
+  }
+
+  return before + HASH_SIZE + after;
+}
+
+/**
+ * @brief Replaces @p node with the hash of its parent.
+ *
+ * Narrow nodes go through the batched hasher, wide ones are streamed.
+ */
+static void hash_path_level(const merkle_hash_vtable_t *hash, unsigned char node[HASH_SIZE],
+                            const unsigned char *siblings, size_t sibling_count, size_t position) {
+  if (sibling_count < VERIFY_STACK_CHILDREN) {
+    unsigned char msg[VERIFY_STACK_CHILDREN * HASH_SIZE];
+    const unsigned char *msgs[1] = {msg};
+    size_t len = assemble_parent(siblings, sibling_count, position, node, msg);
+    unsigned char *digests[1] = {node};
+    merkle_hash_batch(hash, msgs, &len, digests, 1);
+    return;
+  }
+
+  const unsigned char *parts[3] = {siblings, node, siblings + position * HASH_SIZE};
+  size_t lens[3] = {position * HASH_SIZE, HASH_SIZE, (sibling_count - position) * HASH_SIZE};
+  merkle_hash_spans(hash, parts, lens, 3, node);
+}
+
+merkle_error_t verify_proof(const unsigned char root[HASH_SIZE], const unsigned char leaf_hash[HASH_SIZE],
+                            const merkle_proof_t *proof) {
+  // Validate input parameters
+  if (!root || !leaf_hash || !proof) {
+    return MERKLE_NULL_ARG;
+  }
+
+  const merkle_hash_vtable_t *hash = merkle_hash_get(proof->hash_id);
+
+  if (!hash || !proof_shape_valid(proof)) {
+    return MERKLE_PROOF_INVALID;
+  }
+
+  unsigned char node[HASH_SIZE];
+  memcpy(node, leaf_hash, HASH_SIZE);
+
+  for (size_t level = 0; level < proof->path_length; ++level) {
+    const merkle_proof_item_t *item = proof->path[level];
+    hash_path_level(hash, node, (const unsigned char *)item->sibling_hashes, item->sibling_count,
+                    item->node_position);
+  }
+
+  return memcmp(node, root, HASH_SIZE) == 0 ? MERKLE_SUCCESS : MERKLE_PROOF_INVALID;
+}
+
+merkle_error_t verify_proof_buffer(const unsigned char root[HASH_SIZE], const unsigned char leaf_hash[HASH_SIZE],
+                                   const void *buffer, size_t size) {
+  // Validate input parameters
+  if (!root || !leaf_hash || !buffer) {
+    return MERKLE_NULL_ARG;
+  }
+
+  const unsigned char *in = buffer;
+
+  if (size < MERKLE_PROOF_HEADER_SIZE || memcmp(in, MERKLE_PROOF_MAGIC, 4) != 0 ||
+      in[MERKLE_PROOF_OFFSET_VERSION] != MERKLE_PROOF_VERSION) {
+    return MERKLE_PROOF_INVALID;
+  }
+
+  // The proof names its algorithm, which must be known to this process
+  const merkle_hash_vtable_t *hash = merkle_hash_get((merkle_hash_id_t)in[MERKLE_PROOF_OFFSET_HASH_ID]);
+
+  if (!hash) {
+    return MERKLE_PROOF_INVALID;
+  }
+
+  uint64_t leaf_index = merkle_load_le64(in + MERKLE_PROOF_OFFSET_LEAF_INDEX);
+  uint64_t branching_factor = merkle_load_le64(in + MERKLE_PROOF_OFFSET_BRANCHING);
+  uint64_t path_length = merkle_load_le64(in + MERKLE_PROOF_OFFSET_PATH_LENGTH);
+  size_t available = size - MERKLE_PROOF_HEADER_SIZE;
+
+  if (path_length > available / MERKLE_PROOF_LEVEL_SIZE || (path_length && branching_factor < 2)) {
+    return MERKLE_PROOF_INVALID;
+  }
+
+  const unsigned char *record = in + MERKLE_PROOF_HEADER_SIZE;
+  const unsigned char *siblings = record + path_length * MERKLE_PROOF_LEVEL_SIZE;
+  size_t remaining = available - path_length * MERKLE_PROOF_LEVEL_SIZE;
+  unsigned char node[HASH_SIZE];
+  memcpy(node, leaf_hash, HASH_SIZE);
+
+  // Same shape rules as for merkle_proof_t, checked while replaying
+  for (uint64_t level = 0; level < path_length; ++level) {
+    uint32_t sibling_count = merkle_load_le32(record);
+    uint32_t position = merkle_load_le32(record + 4);
+
+    if (sibling_count >= branching_factor || position > sibling_count ||
+        position != leaf_index % branching_factor || sibling_count > remaining / HASH_SIZE) {
+      return MERKLE_PROOF_INVALID;
+    }
+
+    hash_path_level(hash, node, siblings, sibling_count, position);
+    siblings += (size_t)sibling_count * HASH_SIZE;
+    remaining -= (size_t)sibling_count * HASH_SIZE;
+    record += MERKLE_PROOF_LEVEL_SIZE;
+    leaf_index /= branching_factor;
+  }
+
+  if (leaf_index != 0 || remaining != 0) {
+    return MERKLE_PROOF_INVALID;
+  }
+
+  return memcmp(node, root, HASH_SIZE) == 0 ? MERKLE_SUCCESS : MERKLE_PROOF_INVALID;
+}
+
+/**
+ * @brief A proof of a batch, ordered by the leaf it proves.
+ */
+typedef struct verify_entry {
+  size_t leaf_index; /**< Leaf proven by the proof. */
+  size_t id;         /**< Position of the proof in the caller's arrays. */
+} verify_entry_t;
+
+/**
+ * @brief qsort() order for batch entries: by leaf, then by caller order.
+ */
+static int compare_verify_entries(const void *a, const void *b) {
+  const verify_entry_t *x = a;
+  const verify_entry_t *y = b;
+
+  if (x->leaf_index != y->leaf_index) {
+    return x->leaf_index < y->leaf_index ? -1 : 1;
+  }
+
+  return (x->id > y->id) - (x->id < y->id);
+}
+
+/**
+ * @brief Pending distinct parent messages of one level of a batch.
+ *
+ * Slot @c s is the message shared by active proofs [begin[s], end[s]); one
+ * extra slot holds a candidate while the full set is being hashed.
+ */
+typedef struct verify_slots {
+  const merkle_hash_vtable_t *hash;                 /**< Algorithm shared by the batch. */
+  unsigned char *msgs[MERKLE_SHA256_MAX_LANES + 1]; /**< Message buffers. */
+  size_t lens[MERKLE_SHA256_MAX_LANES + 1];         /**< Message lengths. */
+  size_t begin[MERKLE_SHA256_MAX_LANES];            /**< First active proof sharing the slot. */
+  size_t end[MERKLE_SHA256_MAX_LANES];              /**< One past the last such proof. */
+  size_t used;                                      /**< Slots filled. */
+} verify_slots_t;
+
+/**
+ * @brief Hashes the filled slots and hands each digest to the proofs sharing it.
+ */
+static void flush_verify_slots(verify_slots_t *slots, const size_t *active, unsigned char (*nodes)[HASH_SIZE]) {
+  unsigned char digests[MERKLE_SHA256_MAX_LANES][HASH_SIZE];
+  unsigned char *outs[MERKLE_SHA256_MAX_LANES];
+
+  for (size_t s = 0; s < slots->used; ++s) {
+    outs[s] = digests[s];
+  }
+
+  merkle_hash_batch(slots->hash, (const unsigned char *const *)slots->msgs, slots->lens, outs, slots->used);
+
+  for (size_t s = 0; s < slots->used; ++s) {
+    for (size_t k = slots->begin[s]; k < slots->end[s]; ++k) {
+      memcpy(nodes[active[k]], digests[s], HASH_SIZE);
+    }
+  }
+
+  slots->used = 0;
+}
+
+merkle_error_t verify_proofs_batch(const unsigned char root[HASH_SIZE], const unsigned char (*leaf_hashes)[HASH_SIZE],
+                                   const merkle_proof_t *const *proofs, size_t count, bool *results) {
+  // Validate input parameters
+  if (!root || !leaf_hashes || !proofs) {
+    return MERKLE_NULL_ARG;
+  }
+
+  if (count == 0) {
+    return MERKLE_SUCCESS;
+  }
+
+  merkle_error_t ret = MERKLE_FAILED_MEM_ALLOC;
+  verify_entry_t *entries = NULL;
+  size_t *active = NULL;
+  unsigned char (*nodes)[HASH_SIZE] = NULL;
+  bool *valid = NULL;
+  unsigned char *slot_buffer = NULL;
+
+  TRY {
+    ALLOC_AND_INIT_SIMPLE(entries, count);
+    ALLOC_AND_INIT_SIMPLE(active, count < VERIFY_BLOCK_PROOFS ? count : VERIFY_BLOCK_PROOFS);
+    ALLOC_AND_INIT_SIMPLE(nodes, count);
+    ALLOC_AND_INIT_SIMPLE(valid, count);
+
+    if (!entries || !active || !nodes || !valid) {
+      THROW;
+    }
+
+    /* Malformed proofs are settled up front and never hashed. One root
+     * means one tree, so proofs of another algorithm than the first
+     * well-formed one cannot match it either. */
+    size_t widest = 1;
+    size_t shaped = 0;
+    const merkle_hash_vtable_t *hash = NULL;
+
+    for (size_t i = 0; i < count; ++i) {
+      if (!proof_shape_valid(proofs[i]) || (shaped && proofs[i]->hash_id != proofs[entries[0].id]->hash_id)) {
+        continue;
+      }
+
+      if (shaped == 0 && !(hash = merkle_hash_get(proofs[i]->hash_id))) {
+        continue;
+      }
+
+      valid[i] = true;
+      memcpy(nodes[i], leaf_hashes[i], HASH_SIZE);
+      entries[shaped].leaf_index = proofs[i]->leaf_index;
+      entries[shaped].id = i;
+      shaped++;
+
+      for (size_t level = 0; level < proofs[i]->path_length; ++level) {
+        size_t width = proofs[i]->path[level]->sibling_count + 1;
+        widest = width > widest ? width : widest;
+      }
+    }
+
+    if (widest > SIZE_MAX / (HASH_SIZE * (MERKLE_SHA256_MAX_LANES + 1))) {
+      THROW;
+    }
+
+    slot_buffer = MMalloc(widest * HASH_SIZE * (MERKLE_SHA256_MAX_LANES + 1));
+
+    if (!slot_buffer) {
+      THROW;
+    }
+
+    verify_slots_t slots = {.hash = hash, .used = 0};
+
+    for (size_t s = 0; s <= MERKLE_SHA256_MAX_LANES; ++s) {
+      slots.msgs[s] = slot_buffer + s * widest * HASH_SIZE;
+    }
+
+    /* Proofs of leaves in the same subtree share their upper parents, and
+     * sorting by leaf keeps such proofs adjacent on every level. */
+    qsort(entries, shaped, sizeof(*entries), compare_verify_entries);
+
+    /* Proofs are replayed in blocks of neighbouring leaves, all levels of a
+     * block at a time, so the block's proofs stay in cache while sharing
+     * between neighbours is kept. */
+    for (size_t block = 0; block < shaped; block += VERIFY_BLOCK_PROOFS) {
+      size_t active_count = shaped - block < VERIFY_BLOCK_PROOFS ? shaped - block : VERIFY_BLOCK_PROOFS;
+
+      for (size_t k = 0; k < active_count; ++k) {
+        active[k] = entries[block + k].id;
+      }
+
+      for (size_t level = 0; active_count; ++level) {
+        size_t kept = 0;
+
+        // Proofs whose path ends here are done, the order of the rest is kept
+        for (size_t k = 0; k < active_count; ++k) {
+          if (level < proofs[active[k]]->path_length) {
+            active[kept++] = active[k];
+          }
+        }
+
+        active_count = kept;
+
+        for (size_t k = 0; k < active_count; ++k) {
+          size_t id = active[k];
+          size_t slot = slots.used < MERKLE_SHA256_MAX_LANES ? slots.used : MERKLE_SHA256_MAX_LANES;
+          const merkle_proof_item_t *item = proofs[id]->path[level];
+          size_t len = assemble_parent((const unsigned char *)item->sibling_hashes, item->sibling_count,
+                                       item->node_position, nodes[id], slots.msgs[slot]);
+
+          // An identical message to the previous proof's yields the same parent
+          if (slots.used && len == slots.lens[slots.used - 1] &&
+              memcmp(slots.msgs[slot], slots.msgs[slots.used - 1], len) == 0) {
+            slots.end[slots.used - 1] = k + 1;
+            continue;
+          }
+
+          if (slots.used == MERKLE_SHA256_MAX_LANES) {
+            flush_verify_slots(&slots, active, nodes);
+            memcpy(slots.msgs[0], slots.msgs[MERKLE_SHA256_MAX_LANES], len);
+          }
+
+          slots.lens[slots.used] = len;
+          slots.begin[slots.used] = k;
+          slots.end[slots.used] = k + 1;
+          slots.used++;
+        }
+
+        flush_verify_slots(&slots, active, nodes);
+      }
+    }
+
+    ret = MERKLE_SUCCESS;
+
+    for (size_t i = 0; i < count; ++i) {
+      valid[i] = valid[i] && memcmp(nodes[i], root, HASH_SIZE) == 0;
+
+      if (!valid[i]) {
+        ret = MERKLE_PROOF_INVALID;
+      }
+
+      if (results) {
+        results[i] = valid[i];
+      }
+    }
+
+  } CATCH();
+
+  MFree(slot_buffer);
+  MFree(valid);
+  MFree(nodes);
+  MFree(active);
+  MFree(entries);
+  return ret;
+}
+
+merkle_multiproof_t *merkle_multiproof_alloc(size_t index_count, size_t hash_count) {
+  size_t header = sizeof(merkle_multiproof_t);
+
+  if (index_count > (SIZE_MAX - header) / sizeof(size_t) ||
+      hash_count > (SIZE_MAX - header - index_count * sizeof(size_t)) / HASH_SIZE) {
+    return NULL;
+  }
+
+  unsigned char *block = MMalloc(header + index_count * sizeof(size_t) + hash_count * HASH_SIZE);
+
+  if (!block) {
+    return NULL;
+  }
+
+  merkle_multiproof_t *proof = (merkle_multiproof_t *)block;
+  memset(proof, 0, header);
+  proof->index_count = index_count;
+  proof->leaf_indices = (size_t *)(block + header);
+  proof->hash_count = hash_count;
+  proof->hashes = (unsigned char (*)[HASH_SIZE])(block + header + index_count * sizeof(size_t));
+  return proof;
+}
+
+size_t merkle_multiproof_hash_count(const merkle_multiproof_t *proof) {
+  return proof ? proof->hash_count : 0;
+}
+
+void dealloc_merkle_multiproof(merkle_multiproof_t *proof) {
+  MFree(proof);
+}
+
+/**
+ * @brief Parents of one multiproof level waiting to be hashed together.
+ */
+typedef struct multiproof_slots {
+  const merkle_hash_vtable_t *hash;             /**< Algorithm of the proof. */
+  unsigned char *msgs[MERKLE_SHA256_MAX_LANES]; /**< Parent messages. */
+  size_t lens[MERKLE_SHA256_MAX_LANES];         /**< Message lengths. */
+  unsigned char *outs[MERKLE_SHA256_MAX_LANES]; /**< Where each parent hash goes. */
+  size_t used;                                  /**< Slots filled. */
+} multiproof_slots_t;
+
+/**
+ * @brief Hashes the filled slots into their destinations.
+ */
+static void flush_multiproof_slots(multiproof_slots_t *slots) {
+  merkle_hash_batch(slots->hash, (const unsigned char *const *)slots->msgs, slots->lens, slots->outs, slots->used);
+  slots->used = 0;
+}
+
+/**
+ * @brief Sorts the caller's leaves and checks they are the set the proof covers.
+ *
+ * @param known Receives the sorted unique leaf indices.
+ * @param hashes Receives the matching leaf hashes.
+ * @return true if the leaves match the proof and repeated leaves agree.
+ */
+static bool load_multiproof_leaves(const merkle_multiproof_t *proof, const size_t *leaf_indices,
+                                   const unsigned char (*leaf_hashes)[HASH_SIZE], size_t count,
+                                   verify_entry_t *entries, size_t *known, unsigned char (*hashes)[HASH_SIZE]) {
+  for (size_t i = 0; i < count; ++i) {
+    entries[i].leaf_index = leaf_indices[i];
+    entries[i].id = i;
+  }
+
+  qsort(entries, count, sizeof(*entries), compare_verify_entries);
+
+  size_t unique = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    const unsigned char *hash = leaf_hashes[entries[i].id];
+
+    // A repeated leaf must be claimed with the same hash every time
+    if (unique && known[unique - 1] == entries[i].leaf_index) {
+      if (memcmp(hashes[unique - 1], hash, HASH_SIZE) != 0) {
+        return false;
+      }
+
+      continue;
+    }
+
+    if (unique == proof->index_count || proof->leaf_indices[unique] != entries[i].leaf_index) {
+      return false;
+    }
+
+    known[unique] = entries[i].leaf_index;
+    memcpy(hashes[unique], hash, HASH_SIZE);
+    unique++;
+  }
+
+  return unique == proof->index_count;
+}
+
+merkle_error_t verify_multiproof(const unsigned char root[HASH_SIZE], const size_t *leaf_indices,
+                                 const unsigned char (*leaf_hashes)[HASH_SIZE], size_t count,
+                                 const merkle_multiproof_t *proof) {
+  // Validate input parameters
+  if (!root || !leaf_indices || !leaf_hashes || !proof) {
+    return MERKLE_NULL_ARG;
+  }
+
+  if (count == 0) {
+    return MERKLE_BAD_ARG;
+  }
+
+  size_t branching_factor = proof->branching_factor;
+
+  const merkle_hash_vtable_t *hash = merkle_hash_get(proof->hash_id);
+
+  if (!hash || proof->index_count == 0 || proof->leaf_count == 0 || (proof->leaf_count > 1 && branching_factor < 2) ||
+      branching_factor > SIZE_MAX / (HASH_SIZE * MERKLE_SHA256_MAX_LANES)) {
+    return MERKLE_PROOF_INVALID;
+  }
+
+  merkle_error_t ret = MERKLE_FAILED_MEM_ALLOC;
+  verify_entry_t *entries = NULL;
+  size_t *known = NULL;
+  unsigned char (*hashes)[HASH_SIZE] = NULL;
+  unsigned char *slot_buffer = NULL;
+
+  TRY {
+    ALLOC_AND_INIT_SIMPLE(entries, count);
+    ALLOC_AND_INIT_SIMPLE(known, count);
+    ALLOC_AND_INIT_SIMPLE(hashes, count);
+    slot_buffer = MMalloc(branching_factor * HASH_SIZE * MERKLE_SHA256_MAX_LANES);
+
+    if (!entries || !known || !hashes || !slot_buffer) {
+      THROW;
+    }
+
+    ret = MERKLE_PROOF_INVALID;
+
+    if (!load_multiproof_leaves(proof, leaf_indices, leaf_hashes, count, entries, known, hashes) ||
+        known[proof->index_count - 1] >= proof->leaf_count) {
+      THROW;
+    }
+
+    multiproof_slots_t slots = {.hash = hash, .used = 0};
+
+    for (size_t s = 0; s < MERKLE_SHA256_MAX_LANES; ++s) {
+      slots.msgs[s] = slot_buffer + s * branching_factor * HASH_SIZE;
+    }
+
+    size_t width = proof->leaf_count;
+    size_t known_count = proof->index_count;
+    size_t cursor = 0;
+    bool success = true;
+
+    /* Same walk as generation: every parent of a known node is rebuilt from
+     * its known children and the next hashes of the stream. Parents land
+     * at or before the known entries they were built from, so each level
+     * is rewritten in place. */
+    while (width > 1 && success) {
+      size_t parents = 0;
+
+      for (size_t i = 0; i < known_count && success;) {
+        size_t parent = known[i] / branching_factor;
+        size_t first = parent * branching_factor;
+        size_t last = width - first < branching_factor ? width : first + branching_factor;
+        unsigned char *msg = slots.msgs[slots.used];
+
+        for (size_t child = first; child < last; ++child) {
+          const unsigned char *hash;
+
+          if (i < known_count && known[i] == child) {
+            hash = hashes[i++];
+          } else if (cursor < proof->hash_count) {
+            hash = proof->hashes[cursor++];
+          } else {
+            success = false;
+            break;
+          }
+
+          memcpy(msg + (child - first) * HASH_SIZE, hash, HASH_SIZE);
+        }
+
+        known[parents] = parent;
+        slots.lens[slots.used] = (last - first) * HASH_SIZE;
+        slots.outs[slots.used] = hashes[parents];
+        parents++;
+
+        if (++slots.used == MERKLE_SHA256_MAX_LANES) {
+          flush_multiproof_slots(&slots);
+        }
+      }
+
+      if (slots.used) {
+        flush_multiproof_slots(&slots);
+      }
+
+      known_count = parents;
+      width = (width + branching_factor - 1) / branching_factor;
+    }
+
+    // Every shipped hash must have been consumed on the way to the root
+    if (!success || cursor != proof->hash_count || memcmp(hashes[0], root, HASH_SIZE) != 0) {
+      THROW;
+    }
+
+    ret = MERKLE_SUCCESS;
+
+  } CATCH();
+
+  MFree(slot_buffer);
+  MFree(hashes);
+  MFree(known);
+  MFree(entries);
+  return ret;
+}
+
+merkle_range_proof_t *merkle_range_proof_alloc(size_t hash_count) {
+  size_t header = sizeof(merkle_range_proof_t);
+
+  if (hash_count > (SIZE_MAX - header) / HASH_SIZE) {
+    return NULL;
+  }
+
+  unsigned char *block = MMalloc(header + hash_count * HASH_SIZE);
+
+  if (!block) {
+    return NULL;
+  }
+
+  merkle_range_proof_t *proof = (merkle_range_proof_t *)block;
+  memset(proof, 0, header);
+  proof->hash_count = hash_count;
+  proof->hashes = (unsigned char (*)[HASH_SIZE])(block + header);
+  return proof;
+}
+
+size_t merkle_range_proof_hash_count(const merkle_range_proof_t *proof) {
+  return proof ? proof->hash_count : 0;
+}
+
+void dealloc_merkle_range_proof(merkle_range_proof_t *proof) {
+  MFree(proof);
+}
+
+merkle_error_t verify_range_proof(const unsigned char root[HASH_SIZE], size_t first,
+                                  const unsigned char (*leaf_hashes)[HASH_SIZE], size_t count,
+                                  const merkle_range_proof_t *proof) {
+  // Validate input parameters
+  if (!root || !leaf_hashes || !proof) {
+    return MERKLE_NULL_ARG;
+  }
+
+  if (count == 0) {
+    return MERKLE_BAD_ARG;
+  }
+
+  size_t branching_factor = proof->branching_factor;
+
+  const merkle_hash_vtable_t *hash = merkle_hash_get(proof->hash_id);
+
+  if (!hash || proof->leaf_count == 0 || (proof->leaf_count > 1 && branching_factor < 2) ||
+      branching_factor > SIZE_MAX / (HASH_SIZE * MERKLE_SHA256_MAX_LANES)) {
+    return MERKLE_PROOF_INVALID;
+  }
+
+  // The leaves must be exactly the range the proof was generated for
+  if (proof->first != first || proof->last < first || proof->last - first != count - 1 ||
+      proof->last >= proof->leaf_count) {
+    return MERKLE_PROOF_INVALID;
+  }
+
+  merkle_error_t ret = MERKLE_FAILED_MEM_ALLOC;
+  unsigned char (*hashes)[HASH_SIZE] = NULL;
+  unsigned char *slot_buffer = NULL;
+
+  TRY {
+    ALLOC_AND_INIT_SIMPLE(hashes, count);
+    slot_buffer = MMalloc(branching_factor * HASH_SIZE * MERKLE_SHA256_MAX_LANES);
+
+    if (!hashes || !slot_buffer) {
+      THROW;
+    }
+
+    memcpy(hashes, leaf_hashes, count * HASH_SIZE);
+    ret = MERKLE_PROOF_INVALID;
+
+    multiproof_slots_t slots = {.hash = hash, .used = 0};
+
+    for (size_t s = 0; s < MERKLE_SHA256_MAX_LANES; ++s) {
+      slots.msgs[s] = slot_buffer + s * branching_factor * HASH_SIZE;
+    }
+
+    size_t width = proof->leaf_count;
+    size_t lo = first;
+    size_t hi = proof->last;
+    size_t cursor = 0;
+    bool success = true;
+
+    /* The known nodes of a level are the run [lo, hi]; only its first and
+     * last parent take children from the stream. Parents are written at or
+     * before the children they were built from, as in verify_multiproof(). */
+    while (width > 1 && success) {
+      size_t first_parent = lo / branching_factor;
+      size_t last_parent = hi / branching_factor;
+
+      for (size_t parent = first_parent; parent <= last_parent && success; ++parent) {
+        size_t begin = parent * branching_factor;
+        size_t end = width - begin < branching_factor ? width : begin + branching_factor;
+        unsigned char *msg = slots.msgs[slots.used];
+
+        for (size_t child = begin; child < end; ++child) {
+          const unsigned char *hash;
+
+          if (child >= lo && child <= hi) {
+            hash = hashes[child - lo];
+          } else if (cursor < proof->hash_count) {
+            hash = proof->hashes[cursor++];
+          } else {
+            success = false;
+            break;
+          }
+
+          memcpy(msg + (child - begin) * HASH_SIZE, hash, HASH_SIZE);
+        }
+
+        slots.lens[slots.used] = (end - begin) * HASH_SIZE;
+        slots.outs[slots.used] = hashes[parent - first_parent];
+
+        if (++slots.used == MERKLE_SHA256_MAX_LANES) {
+          flush_multiproof_slots(&slots);
+        }
+      }
+
+      if (slots.used) {
+        flush_multiproof_slots(&slots);
+      }
+
+      lo = first_parent;
+      hi = last_parent;
+      width = (width + branching_factor - 1) / branching_factor;
+    }
+
+    // Every shipped hash must have been consumed on the way to the root
+    if (!success || cursor != proof->hash_count || memcmp(hashes[0], root, HASH_SIZE) != 0) {
+      THROW;
+    }
+
+    ret = MERKLE_SUCCESS;
+
+  } CATCH();
+
+  MFree(slot_buffer);
+  MFree(hashes);
+  return ret;
+}
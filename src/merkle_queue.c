@@ -5,13 +5,14 @@
  * This file contains the implementation of a queue_t data structure
  * specifically designed for use in the Merkle tree construction process. It
  * includes functions for initialization, memory management, and basic queue_t
- * operations. The implementation uses a sentinel node design for efficient
- * queue operations.
+ * operations. The implementation is a ring buffer whose capacity is a power of
+ * two, so positions wrap with a mask and elements never need their own node.
  *
  * @author Guy Alster
  * @date May 24, 2025
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include "MerkleQueue.h"
 #include "merkle_utils.h"
@@ -24,68 +25,72 @@
  */
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
-/**
- * @struct queue_node
- * @brief Internal structure representing a node in the queue.
- */
-typedef struct queue_node {
-  void *value;              /**< Pointer to the stored data. */
-  struct queue_node *next;  /**< Pointer to the next node in the queue. */
-} queue_node;
+/** Slots reserved by init_queue(). */
+#define QUEUE_INITIAL_CAPACITY (16)
 
 /**
  * @struct queue
  * @brief Internal structure representing the queue.
  * 
- * Uses a sentinel node design where head points to a dummy node,
- * and the actual queue elements start from head->next.
+ * Elements occupy slots [head, head + queue_size) modulo the capacity.
  */
 struct queue {
-  queue_node *head;    /**< Pointer to sentinel node. */
-  queue_node *tail;    /**< Pointer to the last actual node (or sentinel if empty). */
+  void **slots;        /**< Ring buffer of element pointers. */
+  size_t capacity;     /**< Number of slots, always a power of two. */
+  size_t head;         /**< Slot of the front element. */
   size_t queue_size;   /**< Current number of elements in the queue. */
 };
 
 /**
- * @brief Initializes a new queue with a sentinel node and returns a pointer to it.
- * 
- * Creates a new queue using the sentinel node pattern for efficient operations.
- * The sentinel node simplifies insertion and deletion logic by eliminating
- * special cases for empty queues.
+ * @brief Initializes a new queue with a small ring buffer and returns a pointer to it.
  * 
  * @return Pointer to the newly created queue, or NULL if memory allocation fails.
- * 
- * @note The queue starts empty with head and tail both pointing to the sentinel node.
  */
 queue_t *init_queue(void) {
-  queue_node *sent_node = MMalloc(sizeof *sent_node);
-  queue_t *q = NULL;
+  return init_queue_with_capacity(QUEUE_INITIAL_CAPACITY);
+}
 
-  if (!sent_node) {
-    return NULL;
+/**
+ * @brief Initializes a new queue whose buffer holds at least @p capacity elements.
+ * 
+ * @param capacity Requested number of slots, rounded up to a power of two.
+ * @return Pointer to the newly created queue, or NULL if memory allocation fails.
+ */
+queue_t *init_queue_with_capacity(size_t capacity) {
+  size_t slots = 1;
+
+  while (slots < capacity) {
+    if (slots > SIZE_MAX / (2 * sizeof(void *))) {
+      return NULL;
+    }
+
+    slots <<= 1;
   }
 
-  q = MMalloc(sizeof *q);
+  queue_t *q = MMalloc(sizeof *q);
 
   if (!q) {
-    MFree(sent_node); // Fix memory leak
     return NULL;
   }
 
-  q->head = q->tail = sent_node;
+  q->slots = MMalloc(slots * sizeof(void *));
+
+  if (!q->slots) {
+    MFree(q);
+    return NULL;
+  }
+
+  q->capacity = slots;
+  q->head = 0;
   q->queue_size = 0;
-  sent_node->next = NULL;
-  sent_node->value = NULL;
-  
   return q;
 }
 
 /**
- * @brief Frees all memory associated with the queue, including its nodes and their values.
+ * @brief Frees all memory associated with the queue, including its elements' values.
  * 
- * Iterates through all nodes in the queue (excluding the sentinel) and frees them.
- * If a deallocator function is provided, it's called for each element's data.
- * Finally frees the sentinel node and queue structure.
+ * If a deallocator function is provided, it's called for each element's data
+ * in queue order. Finally frees the buffer and queue structure.
  * 
  * @param q Pointer to the queue to free. Safe to pass NULL.
  * @param dealloc Optional deallocator function for element data. Can be NULL.
@@ -96,31 +101,53 @@ void free_queue(queue_t *q, deallocator dealloc) {
     return;
   }
 
-  queue_node *head = q->head;
-  queue_node *d = head->next;  // Skip sentinel node
-
-  // Free all data nodes
-  while (d) {
-    queue_node *next = d->next;
+  // Free the data of every element still queued
+  for (size_t i = 0; dealloc && i < q->queue_size; ++i) {
+    void *value = q->slots[(q->head + i) & (q->capacity - 1)];
 
-    if (dealloc && d->value) {
-      dealloc(d->value);
+    if (value) {
+      dealloc(value);
     }
-
-    MFree(d);
-    d = next;
   }
 
-  // Free sentinel node and queue structure
-  MFree(head);
+  MFree(q->slots);
   MFree(q);
 }
 
+/**
+ * @brief Doubles the ring buffer, unwrapping the elements to its start.
+ * 
+ * @param q Pointer to a full queue.
+ * @return QUEUE_OK on success, QUEUE_OUT_OF_MEMORY if the buffer cannot grow.
+ */
+static queue_result_t grow_queue(queue_t *q) {
+  if (q->capacity > SIZE_MAX / (2 * sizeof(void *))) {
+    return QUEUE_OUT_OF_MEMORY;
+  }
+
+  void **slots = MMalloc(2 * q->capacity * sizeof(void *));
+
+  if (!slots) {
+    return QUEUE_OUT_OF_MEMORY;
+  }
+
+  // The front run ends at the buffer's end, the rest wrapped to its start
+  size_t front_run = q->capacity - q->head;
+  memcpy(slots, q->slots + q->head, front_run * sizeof(void *));
+  memcpy(slots + front_run, q->slots, q->head * sizeof(void *));
+
+  MFree(q->slots);
+  q->slots = slots;
+  q->capacity *= 2;
+  q->head = 0;
+  return QUEUE_OK;
+}
+
 /**
  * @brief Adds a new element to the end of the queue.
  * 
- * Creates a new node and links it after the current tail.
- * Updates the tail pointer and increments the queue size.
+ * Stores the pointer in the slot after the current tail, growing the buffer
+ * first when it is full.
  * 
  * @param q Pointer to the queue.
  * @param data Pointer to the data to store. Can be NULL.
@@ -132,18 +159,15 @@ queue_result_t push_queue(queue_t *q, void *data) {
     return QUEUE_NULL_PTR;
   }
 
-  queue_node *ins = MMalloc(sizeof *ins);
+  if (q->queue_size == q->capacity) {
+    queue_result_t grown = grow_queue(q);
 
-  if (!ins) {
-    return QUEUE_OUT_OF_MEMORY;
+    if (grown != QUEUE_OK) {
+      return grown;
+    }
   }
 
-  ins->next = NULL;
-  ins->value = data;
-
-  // Link the new node after current tail
-  q->tail->next = ins;
-  q->tail = ins;
+  q->slots[(q->head + q->queue_size) & (q->capacity - 1)] = data;
   q->queue_size++;
   
   return QUEUE_OK;
@@ -152,30 +176,16 @@ queue_result_t push_queue(queue_t *q, void *data) {
 /**
  * @brief Removes the front element from the queue and returns its value.
  * 
- * Removes the first actual data node (head->next) and returns its value.
- * Updates head->next to point to the following node. If this was the last
- * element, resets tail to point back to the sentinel node.
- * 
  * @param q Pointer to the queue.
  * @return Pointer to the data of the removed element, or NULL if queue is empty/NULL.
  */
 void *pop_queue(queue_t *q) {
-  if (!q || q->tail == q->head) {  // Empty queue check
+  if (!q || !q->queue_size) {  // Empty queue check
     return NULL;
   }
 
-  void *result = q->head->next->value;
-  queue_node *to_free = q->head->next;
-
-  // Update head to skip the removed node
-  q->head->next = to_free->next;
-  
-  // If we removed the last element, reset tail to sentinel
-  if (!to_free->next) {
-    q->tail = q->head;
-  }
-
-  MFree(to_free); // Only free the node, not the data
+  void *result = q->slots[q->head];
+  q->head = (q->head + 1) & (q->capacity - 1);
   q->queue_size--;
   
   return result;
@@ -184,45 +194,31 @@ void *pop_queue(queue_t *q) {
 /**
  * @brief Returns the value of the front element in the queue without removing it.
  * 
- * Peeks at the first actual data element (head->next) without modifying
- * the queue structure.
- * 
  * @param q Pointer to the queue.
  * @return Pointer to the front element's data, or NULL if queue is empty/NULL.
  */
 void *front_queue(queue_t *q) {
 
-  if (!q) {
-    return NULL;
-  }
-
-  if (!q->head->next) {  // Check if queue is empty
+  if (!q || !q->queue_size) {
     return NULL;
   }
 
-  return q->head->next->value;
+  return q->slots[q->head];
 }
 
 /**
  * @brief Returns the value of the last element in the queue without removing it.
  * 
- * Returns the data stored in the tail node. If the queue is empty,
- * tail points to the sentinel node and we return NULL.
- * 
  * @param q Pointer to the queue.
  * @return Pointer to the rear element's data, or NULL if queue is empty/NULL.
  */
 void *back_queue(queue_t *q) {
 
-  if (!q) {
-    return NULL;
-  }
-
-  if (q->tail == q->head) {  // Empty queue check
+  if (!q || !q->queue_size) {
     return NULL;
   }
 
-  return q->tail->value;
+  return q->slots[(q->head + q->queue_size - 1) & (q->capacity - 1)];
 }
 
 /**
@@ -244,42 +240,29 @@ size_t get_queue_size(queue_t *q) {
 }
 
 /**
- * @brief Removes up to n elements from the front of the queue.
+ * @brief Removes up to n elements from the front of the queue as a slice.
  * 
- * Dequeues the minimum of the requested count and available elements.
- * Allocates an array to hold the pointers and populates it by calling
- * pop_queue() repeatedly. Updates the count parameter with the actual
- * number of elements returned.
+ * Dequeues the minimum of the requested count, the queued elements and the
+ * slots left before the buffer wraps, and points @p result at them in place.
  * 
  * @param q Pointer to the queue.
  * @param count Pointer to requested count (input) and actual count (output).
- * @param result Pointer to store the allocated array of element pointers.
+ * @param result Pointer to store the slice of element pointers.
  * @return QUEUE_OK on success, error code on failure.
  * 
- * @note Caller is responsible for freeing the returned array and managing
- *       the element data according to their ownership model.
- * @note If memory allocation fails, *count is set to 0.
+ * @note The slice lives in the queue's buffer and is valid until the next
+ *       push_queue() or free_queue().
  */
 queue_result_t deque_n(queue_t *q, size_t *count, void ***result){
-  if(!count){
+  if(!q || !count || !result){
     return QUEUE_NULL_PTR;
   }
 
-  size_t size = get_queue_size(q);
-  size_t deque = min((*count), size);
+  size_t deque = min(min((*count), q->queue_size), q->capacity - q->head);
 
-  // Allocate array to hold the dequeued element pointers
-  *result = MMalloc(deque * sizeof(void *));
-  
-  if(!*result){
-    *count = 0;
-    return QUEUE_OUT_OF_MEMORY;
-  }
-
-  // Dequeue elements and store in result array
-  for(size_t i = 0; i < deque; ++i){
-    (*result)[i] = pop_queue(q); 
-  }
+  *result = q->slots + q->head;
+  q->head = (q->head + deque) & (q->capacity - 1);
+  q->queue_size -= deque;
 
   // Update count with actual number dequeued
   (*count) = deque;
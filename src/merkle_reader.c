@@ -0,0 +1,234 @@
+/**
+ * @file merkle_reader.c
+ * @brief Double-buffered sequential reader feeding file-backed tree builds.
+ *
+ * The reader thread and the caller hand two windows back and forth under a
+ * mutex: the thread fills a window as soon as the caller has released it,
+ * and the caller waits only when hashing outpaces the disk.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "merkle_reader.h"
+#include "merkle_utils.h"
+
+/** Windows in flight: one being hashed, one being read. */
+#define READER_SLOTS (2)
+
+/**
+ * @brief Reader state shared by the caller and the reader thread.
+ */
+struct merkle_chunk_reader {
+  int fd;                                /**< Descriptor being read. */
+  uint64_t length;                       /**< Bytes to read from offset 0. */
+  size_t window;                         /**< Bytes per full window. */
+  size_t window_count;                   /**< Windows covering @ref length. */
+  unsigned char *buffers[READER_SLOTS];  /**< Window storage. */
+  size_t filled[READER_SLOTS];           /**< Bytes held by each window. */
+  size_t produced;                       /**< Windows filled by the thread. */
+  size_t consumed;                       /**< Windows released by the caller. */
+  bool holding;                          /**< The caller still holds window @ref consumed. */
+  bool stopping;                         /**< Set by destruction to end the thread early. */
+  merkle_error_t error;                  /**< First read failure, reported after the filled windows. */
+  pthread_t thread;                      /**< Thread running read_windows(). */
+  pthread_mutex_t mutex;                 /**< Guards the counters and flags. */
+  pthread_cond_t changed;                /**< Signalled whenever a window changes hands. */
+};
+
+/**
+ * @brief pread()s exactly @p bytes at @p offset, retrying short reads.
+ */
+static merkle_error_t read_fully(int fd, unsigned char *out, size_t bytes, uint64_t offset) {
+  while (bytes) {
+    ssize_t got = pread(fd, out, bytes, (off_t)offset);
+
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+
+    // A file that shrank since it was sized cannot be hashed consistently
+    if (got <= 0) {
+      return MERKLE_IO_ERROR;
+    }
+
+    out += got;
+    bytes -= (size_t)got;
+    offset += (uint64_t)got;
+  }
+
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Reader thread: fills windows in order as slots become free.
+ */
+static void *read_windows(void *arg) {
+  merkle_chunk_reader_t *reader = arg;
+
+  for (size_t w = 0; w < reader->window_count; ++w) {
+    pthread_mutex_lock(&reader->mutex);
+
+    while (reader->produced - reader->consumed == READER_SLOTS && !reader->stopping) {
+      pthread_cond_wait(&reader->changed, &reader->mutex);
+    }
+
+    bool stopping = reader->stopping;
+    pthread_mutex_unlock(&reader->mutex);
+
+    if (stopping) {
+      break;
+    }
+
+    // The slot is free, so it is read without holding the lock
+    size_t slot = w % READER_SLOTS;
+    uint64_t offset = (uint64_t)w * reader->window;
+    size_t bytes = reader->length - offset < reader->window ? (size_t)(reader->length - offset) : reader->window;
+    merkle_error_t ret = read_fully(reader->fd, reader->buffers[slot], bytes, offset);
+
+    pthread_mutex_lock(&reader->mutex);
+
+    if (ret == MERKLE_SUCCESS) {
+      reader->filled[slot] = bytes;
+      reader->produced++;
+    } else {
+      reader->error = ret;
+    }
+
+    pthread_cond_broadcast(&reader->changed);
+    pthread_mutex_unlock(&reader->mutex);
+
+    if (ret != MERKLE_SUCCESS) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+merkle_chunk_reader_t *merkle_chunk_reader_create(int fd, uint64_t length, size_t leaf_size, size_t window_bytes) {
+  // Validate input parameters
+  if (fd < 0 || length == 0 || leaf_size == 0) {
+    return NULL;
+  }
+
+  size_t window = window_bytes / leaf_size > 1 ? window_bytes / leaf_size * leaf_size : leaf_size;
+
+  // Never allocate more than the file needs
+  if (length < window) {
+    window = (size_t)length;
+  }
+
+  ALLOC_AND_INIT(merkle_chunk_reader_t, reader, 1);
+
+  if (!reader) {
+    return NULL;
+  }
+
+  reader->fd = fd;
+  reader->length = length;
+  reader->window = window;
+  reader->window_count = (size_t)((length + window - 1) / window);
+  reader->error = MERKLE_SUCCESS;
+
+  for (size_t s = 0; s < READER_SLOTS; ++s) {
+    reader->buffers[s] = MMalloc(window);
+
+    if (!reader->buffers[s]) {
+      for (size_t k = 0; k < s; ++k) {
+        MFree(reader->buffers[k]);
+      }
+
+      MFree(reader);
+      return NULL;
+    }
+  }
+
+  // Let the kernel read ahead aggressively; the access is strictly sequential
+  posix_fadvise(fd, 0, (off_t)length, POSIX_FADV_SEQUENTIAL);
+
+  pthread_mutex_init(&reader->mutex, NULL);
+  pthread_cond_init(&reader->changed, NULL);
+
+  if (pthread_create(&reader->thread, NULL, read_windows, reader) != 0) {
+    pthread_cond_destroy(&reader->changed);
+    pthread_mutex_destroy(&reader->mutex);
+
+    for (size_t s = 0; s < READER_SLOTS; ++s) {
+      MFree(reader->buffers[s]);
+    }
+
+    MFree(reader);
+    return NULL;
+  }
+
+  return reader;
+}
+
+merkle_error_t merkle_chunk_reader_next(merkle_chunk_reader_t *reader, const unsigned char **data, size_t *bytes) {
+  // Validate input parameters
+  if (!reader || !data || !bytes) {
+    return MERKLE_NULL_ARG;
+  }
+
+  pthread_mutex_lock(&reader->mutex);
+
+  // Hand the previous window back so the thread can refill it
+  if (reader->holding) {
+    reader->consumed++;
+    reader->holding = false;
+    pthread_cond_broadcast(&reader->changed);
+  }
+
+  if (reader->consumed == reader->window_count) {
+    pthread_mutex_unlock(&reader->mutex);
+    *data = NULL;
+    *bytes = 0;
+    return MERKLE_SUCCESS;
+  }
+
+  while (reader->produced == reader->consumed && reader->error == MERKLE_SUCCESS) {
+    pthread_cond_wait(&reader->changed, &reader->mutex);
+  }
+
+  merkle_error_t ret = MERKLE_SUCCESS;
+
+  if (reader->produced == reader->consumed) {
+    ret = reader->error;
+  } else {
+    size_t slot = reader->consumed % READER_SLOTS;
+    *data = reader->buffers[slot];
+    *bytes = reader->filled[slot];
+    reader->holding = true;
+  }
+
+  pthread_mutex_unlock(&reader->mutex);
+  return ret;
+}
+
+void merkle_chunk_reader_destroy(merkle_chunk_reader_t *reader) {
+  if (!reader) {
+    return;
+  }
+
+  pthread_mutex_lock(&reader->mutex);
+  reader->stopping = true;
+  pthread_cond_broadcast(&reader->changed);
+  pthread_mutex_unlock(&reader->mutex);
+
+  pthread_join(reader->thread, NULL);
+  pthread_cond_destroy(&reader->changed);
+  pthread_mutex_destroy(&reader->mutex);
+
+  for (size_t s = 0; s < READER_SLOTS; ++s) {
+    MFree(reader->buffers[s]);
+  }
+
+  MFree(reader);
+}
@@ -0,0 +1,1191 @@
+/**
+ * @file merkle_sha256.c
+ * @brief Multi-buffer SHA-256 kernels with runtime CPU dispatch.
+ *
+ * The AVX2 and AVX-512 kernels keep one message per 32-bit vector lane and
+ * run the compression function on 8 or 16 messages in lockstep. Messages
+ * that need fewer blocks than the longest one in their group simply stop
+ * being recorded once their last block is done. The SHA-NI and ARMv8
+ * kernels hash one message at a time with the dedicated instructions, which
+ * mainly saves the per-call overhead of the OpenSSL one-shot API on the
+ * short inputs a Merkle tree is made of.
+ *
+ * Without SHA instructions single messages go through OpenSSL's EVP
+ * interface. The digest is fetched from the provider once and every thread
+ * reuses one EVP_MD_CTX, so no call pays for a provider lookup or a context
+ * allocation. Messages assembled from several spans use a streaming context
+ * that keeps the SHA-256 midstate itself and compresses whole blocks.
+ *
+ * Every kernel is compiled with a per-function target attribute, so the
+ * library does not need special compiler flags and still runs on CPUs that
+ * lack the extensions.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "merkle_sha256.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MERKLE_SHA256_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+#define MERKLE_SHA256_ARM 1
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#endif
+#endif
+
+/** SHA-256 block size in bytes. */
+#define SHA256_BLOCK (64)
+
+/** SHA-256 round constants. */
+static const uint32_t K256[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/** SHA-256 initial hash value. */
+static const uint32_t IV256[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/** Block fed to lanes that carry no message. */
+static const unsigned char zero_block[SHA256_BLOCK];
+
+/**
+ * @brief A message split into the blocks the compression function consumes.
+ *
+ * Full blocks are read straight from the message; the padded tail (one or
+ * two blocks) is materialized in @ref tail.
+ */
+typedef struct sha256_lane {
+  const unsigned char *data;         /**< Start of the message. */
+  size_t full_blocks;                /**< Blocks taken directly from @ref data. */
+  size_t total_blocks;               /**< Full blocks plus padded tail blocks. */
+  unsigned char tail[2 * SHA256_BLOCK]; /**< Remaining bytes, padding and bit length. */
+} sha256_lane_t;
+
+/** Backend chosen by detection or merkle_sha256_select_backend(); 0 until detected. */
+static atomic_int active_backend = MERKLE_SHA256_AUTO;
+
+/**
+ * @brief Splits a message into full blocks and its padded tail.
+ */
+static void prepare_lane(sha256_lane_t *lane, const unsigned char *msg, size_t len) {
+  size_t rem = len % SHA256_BLOCK;
+  size_t tail_blocks = rem + 9 <= SHA256_BLOCK ? 1 : 2;
+  uint64_t bits = (uint64_t)len * 8;
+
+  lane->data = msg;
+  lane->full_blocks = len / SHA256_BLOCK;
+  lane->total_blocks = lane->full_blocks + tail_blocks;
+
+  memset(lane->tail, 0, tail_blocks * SHA256_BLOCK);
+
+  if (rem) {
+    memcpy(lane->tail, msg + len - rem, rem);
+  }
+
+  lane->tail[rem] = 0x80;
+
+  for (size_t i = 0; i < 8; ++i) {
+    lane->tail[tail_blocks * SHA256_BLOCK - 1 - i] = (unsigned char)(bits >> (8 * i));
+  }
+}
+
+/**
+ * @brief Returns block @p b of a prepared message.
+ */
+static inline const unsigned char *lane_block(const sha256_lane_t *lane, size_t b) {
+  return b < lane->full_blocks ? lane->data + b * SHA256_BLOCK
+                               : lane->tail + (b - lane->full_blocks) * SHA256_BLOCK;
+}
+
+/** Digest fetched once by evp_setup(). */
+static const EVP_MD *evp_sha256;
+
+/** Frees each thread's context when the thread exits. */
+static pthread_key_t evp_ctx_key;
+
+/** Whether @ref evp_ctx_key could be created. */
+static bool evp_key_ready;
+
+static pthread_once_t evp_once = PTHREAD_ONCE_INIT;
+
+/** Context reused by every EVP digest of the calling thread. */
+static _Thread_local EVP_MD_CTX *evp_ctx;
+
+/**
+ * @brief Fetches the SHA-256 implementation and creates the context key.
+ */
+static void evp_setup(void) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  // The fetched digest is kept for the life of the process
+  evp_sha256 = EVP_MD_fetch(NULL, "SHA256", NULL);
+#endif
+  if (!evp_sha256) {
+    evp_sha256 = EVP_sha256();
+  }
+
+  evp_key_ready = pthread_key_create(&evp_ctx_key, (void (*)(void *))EVP_MD_CTX_free) == 0;
+}
+
+/**
+ * @brief Hashes one message through EVP with the thread's reusable context.
+ */
+static void sha256_evp(const unsigned char *msg, size_t len, unsigned char out[HASH_SIZE]) {
+  pthread_once(&evp_once, evp_setup);
+
+  if (!evp_ctx && evp_key_ready) {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+
+    if (ctx && pthread_setspecific(evp_ctx_key, ctx) != 0) {
+      EVP_MD_CTX_free(ctx);
+      ctx = NULL;
+    }
+
+    evp_ctx = ctx;
+  }
+
+  unsigned int written = 0;
+
+  if (evp_ctx && EVP_DigestInit_ex(evp_ctx, evp_sha256, NULL) == 1 &&
+      EVP_DigestUpdate(evp_ctx, msg, len) == 1 && EVP_DigestFinal_ex(evp_ctx, out, &written) == 1) {
+    return;
+  }
+
+  // Without a context the one-shot API still gives the right digest, only slower
+  SHA256(msg, len, out);
+}
+
+/**
+ * @brief Writes a state vector out as a big-endian digest.
+ */
+static void store_digest(const uint32_t state[8], unsigned char out[HASH_SIZE]) {
+  for (size_t i = 0; i < 8; ++i) {
+    out[4 * i] = (unsigned char)(state[i] >> 24);
+    out[4 * i + 1] = (unsigned char)(state[i] >> 16);
+    out[4 * i + 2] = (unsigned char)(state[i] >> 8);
+    out[4 * i + 3] = (unsigned char)state[i];
+  }
+}
+
+#ifdef MERKLE_SHA256_X86
+
+/**
+ * @brief Reads the XCR0 register to see which vector states the OS saves.
+ */
+static uint64_t read_xcr0(void) {
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((uint64_t)edx << 32) | eax;
+}
+
+/**
+ * @brief Queries CPUID and XCR0 for the x86 backends.
+ */
+static bool x86_supports(merkle_sha256_backend_t backend) {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+
+  bool ssse3 = ecx & bit_SSSE3;
+  bool sse41 = ecx & bit_SSE4_1;
+  bool osxsave = ecx & bit_OSXSAVE;
+
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+
+  uint64_t xcr0 = osxsave ? read_xcr0() : 0;
+  bool avx_state = (xcr0 & 0x6) == 0x6;
+  bool avx512_state = (xcr0 & 0xe6) == 0xe6;
+
+  switch (backend) {
+  case MERKLE_SHA256_SHANI:
+    return ssse3 && sse41 && (ebx & bit_SHA);
+  case MERKLE_SHA256_AVX2:
+    return avx_state && (ebx & bit_AVX2);
+  case MERKLE_SHA256_AVX512:
+    return avx512_state && (ebx & bit_AVX512F) && (ebx & bit_AVX512BW);
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief Runs the SHA extension compression function over @p blocks blocks.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_shani_compress(uint32_t state[8], const unsigned char *data, size_t blocks) {
+  const __m128i bswap_mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  // The instructions want the state as ABEF / CDGH
+  __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+  __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+  for (size_t b = 0; b < blocks; ++b, data += SHA256_BLOCK) {
+    __m128i abef_save = state0;
+    __m128i cdgh_save = state1;
+    __m128i msgs[4];
+
+    /* Four rounds per group; the schedule for group g + 1 is finished while
+     * group g runs, and msg1 starts the one for group g + 3. */
+    for (int g = 0; g < 16; ++g) {
+      if (g < 4) {
+        msgs[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * g)), bswap_mask);
+      }
+
+      __m128i msg = _mm_add_epi32(msgs[g & 3], _mm_loadu_si128((const __m128i *)&K256[4 * g]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+
+      if (g >= 3 && g <= 14) {
+        __m128i carry = _mm_alignr_epi8(msgs[g & 3], msgs[(g - 1) & 3], 4);
+        msgs[(g + 1) & 3] = _mm_add_epi32(msgs[(g + 1) & 3], carry);
+        msgs[(g + 1) & 3] = _mm_sha256msg2_epu32(msgs[(g + 1) & 3], msgs[g & 3]);
+      }
+
+      msg = _mm_shuffle_epi32(msg, 0x0E);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+      if (g >= 1 && g <= 12) {
+        msgs[(g - 1) & 3] = _mm_sha256msg1_epu32(msgs[(g - 1) & 3], msgs[g & 3]);
+      }
+    }
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+  }
+
+  // Back from ABEF / CDGH to ABCD / EFGH
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+  _mm_storeu_si128((__m128i *)&state[0], state0);
+  _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+/**
+ * @brief Runs the SHA extension rounds over one block given as words plus constants.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_shani_compress_wk(uint32_t state[8], const uint32_t wk[64]) {
+  __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+  __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+  __m128i abef_save = state0;
+  __m128i cdgh_save = state1;
+
+  // The schedule is known, so only the round instructions remain
+  for (int g = 0; g < 16; ++g) {
+    __m128i msg = _mm_loadu_si128((const __m128i *)&wk[4 * g]);
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0E);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+  }
+
+  state0 = _mm_add_epi32(state0, abef_save);
+  state1 = _mm_add_epi32(state1, cdgh_save);
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+  _mm_storeu_si128((__m128i *)&state[0], state0);
+  _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+/**
+ * @brief Hashes one message with the SHA extensions.
+ */
+static void sha256_shani_one(const unsigned char *msg, size_t len, unsigned char out[HASH_SIZE]) {
+  sha256_lane_t lane;
+  uint32_t state[8];
+
+  prepare_lane(&lane, msg, len);
+  memcpy(state, IV256, sizeof(state));
+  sha256_shani_compress(state, lane.data, lane.full_blocks);
+  sha256_shani_compress(state, lane.tail, lane.total_blocks - lane.full_blocks);
+  store_digest(state, out);
+}
+
+/** Lanes of the AVX2 kernel. */
+#define AVX2_LANES (8)
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_rotr(__m256i x, int n) {
+  return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+/**
+ * @brief Loads 8 words of each of 8 blocks and transposes them into 8 word vectors.
+ */
+__attribute__((target("avx2")))
+static void avx2_load_words(const unsigned char *const blocks[AVX2_LANES], size_t offset, __m256i w[8]) {
+  const __m256i bswap_mask = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                             12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  __m256i r[8], t[8], u[8];
+
+  for (int l = 0; l < AVX2_LANES; ++l) {
+    r[l] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(blocks[l] + offset)), bswap_mask);
+  }
+
+  for (int i = 0; i < 4; ++i) {
+    t[2 * i] = _mm256_unpacklo_epi32(r[2 * i], r[2 * i + 1]);
+    t[2 * i + 1] = _mm256_unpackhi_epi32(r[2 * i], r[2 * i + 1]);
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    u[4 * i] = _mm256_unpacklo_epi64(t[4 * i], t[4 * i + 2]);
+    u[4 * i + 1] = _mm256_unpackhi_epi64(t[4 * i], t[4 * i + 2]);
+    u[4 * i + 2] = _mm256_unpacklo_epi64(t[4 * i + 1], t[4 * i + 3]);
+    u[4 * i + 3] = _mm256_unpackhi_epi64(t[4 * i + 1], t[4 * i + 3]);
+  }
+
+  for (int j = 0; j < 4; ++j) {
+    w[j] = _mm256_permute2x128_si256(u[j], u[4 + j], 0x20);
+    w[4 + j] = _mm256_permute2x128_si256(u[j], u[4 + j], 0x31);
+  }
+}
+
+/**
+ * @brief Runs one compression in AVX2 lanes; see avx512_compress() for @p wk.
+ */
+__attribute__((target("avx2")))
+static inline void avx2_compress(__m256i s[8], __m256i w[16], const uint32_t *wk) {
+  __m256i a = s[0], bb = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+  for (int t = 0; t < 64; ++t) {
+    __m256i kw;
+
+    if (wk) {
+      kw = _mm256_set1_epi32((int)wk[t]);
+    } else {
+      if (t >= 16) {
+        __m256i w15 = w[(t - 15) & 15];
+        __m256i w2 = w[(t - 2) & 15];
+        __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(avx2_rotr(w15, 7), avx2_rotr(w15, 18)),
+                                      _mm256_srli_epi32(w15, 3));
+        __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(avx2_rotr(w2, 17), avx2_rotr(w2, 19)),
+                                      _mm256_srli_epi32(w2, 10));
+        w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0),
+                                     _mm256_add_epi32(w[(t - 7) & 15], s1));
+      }
+
+      kw = _mm256_add_epi32(_mm256_set1_epi32((int)K256[t]), w[t & 15]);
+    }
+
+    __m256i big_s1 = _mm256_xor_si256(_mm256_xor_si256(avx2_rotr(e, 6), avx2_rotr(e, 11)), avx2_rotr(e, 25));
+    __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+    __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, big_s1), _mm256_add_epi32(ch, kw));
+    __m256i big_s0 = _mm256_xor_si256(_mm256_xor_si256(avx2_rotr(a, 2), avx2_rotr(a, 13)), avx2_rotr(a, 22));
+    __m256i maj = _mm256_or_si256(_mm256_and_si256(a, bb), _mm256_and_si256(c, _mm256_or_si256(a, bb)));
+
+    h = g;
+    g = f;
+    f = e;
+    e = _mm256_add_epi32(d, t1);
+    d = c;
+    c = bb;
+    bb = a;
+    a = _mm256_add_epi32(t1, _mm256_add_epi32(big_s0, maj));
+  }
+
+  s[0] = _mm256_add_epi32(s[0], a);
+  s[1] = _mm256_add_epi32(s[1], bb);
+  s[2] = _mm256_add_epi32(s[2], c);
+  s[3] = _mm256_add_epi32(s[3], d);
+  s[4] = _mm256_add_epi32(s[4], e);
+  s[5] = _mm256_add_epi32(s[5], f);
+  s[6] = _mm256_add_epi32(s[6], g);
+  s[7] = _mm256_add_epi32(s[7], h);
+}
+
+/**
+ * @brief Hashes up to 8 prepared messages in AVX2 lanes.
+ */
+__attribute__((target("avx2")))
+static void sha256_avx2_x8(const sha256_lane_t *lanes, size_t lane_count, unsigned char *const *digests) {
+  __m256i s[8];
+  size_t max_blocks = 0;
+
+  for (int i = 0; i < 8; ++i) {
+    s[i] = _mm256_set1_epi32((int)IV256[i]);
+  }
+
+  for (size_t l = 0; l < lane_count; ++l) {
+    max_blocks = lanes[l].total_blocks > max_blocks ? lanes[l].total_blocks : max_blocks;
+  }
+
+  for (size_t b = 0; b < max_blocks; ++b) {
+    const unsigned char *blocks[AVX2_LANES];
+    bool finishing = false;
+
+    for (size_t l = 0; l < AVX2_LANES; ++l) {
+      bool live = l < lane_count && b < lanes[l].total_blocks;
+      blocks[l] = live ? lane_block(&lanes[l], b) : zero_block;
+      finishing |= live && b + 1 == lanes[l].total_blocks;
+    }
+
+    __m256i w[16];
+    avx2_load_words(blocks, 0, w);
+    avx2_load_words(blocks, 32, w + 8);
+    avx2_compress(s, w, NULL);
+
+    if (!finishing) {
+      continue;
+    }
+
+    uint32_t words[8][AVX2_LANES];
+
+    for (int i = 0; i < 8; ++i) {
+      _mm256_storeu_si256((__m256i *)words[i], s[i]);
+    }
+
+    for (size_t l = 0; l < lane_count; ++l) {
+      if (b + 1 == lanes[l].total_blocks) {
+        uint32_t state[8];
+
+        for (int i = 0; i < 8; ++i) {
+          state[i] = words[i][l];
+        }
+
+        store_digest(state, digests[l]);
+      }
+    }
+  }
+}
+
+/**
+ * @brief AVX2 counterpart of sha256_avx512_fixed() for up to 8 messages.
+ */
+__attribute__((target("avx2")))
+static void sha256_avx2_fixed(const unsigned char *const *msgs, size_t blocks, const uint32_t pad_wk[64],
+                              unsigned char *const *digests, size_t lane_count) {
+  __m256i s[8];
+
+  for (int i = 0; i < 8; ++i) {
+    s[i] = _mm256_set1_epi32((int)IV256[i]);
+  }
+
+  for (size_t b = 0; b < blocks; ++b) {
+    const unsigned char *lane_blocks[AVX2_LANES];
+
+    for (size_t l = 0; l < AVX2_LANES; ++l) {
+      lane_blocks[l] = l < lane_count ? msgs[l] + b * SHA256_BLOCK : zero_block;
+    }
+
+    __m256i w[16];
+    avx2_load_words(lane_blocks, 0, w);
+    avx2_load_words(lane_blocks, 32, w + 8);
+    avx2_compress(s, w, NULL);
+  }
+
+  avx2_compress(s, NULL, pad_wk);
+
+  uint32_t words[8][AVX2_LANES];
+
+  for (int i = 0; i < 8; ++i) {
+    _mm256_storeu_si256((__m256i *)words[i], s[i]);
+  }
+
+  for (size_t l = 0; l < lane_count; ++l) {
+    uint32_t state[8];
+
+    for (int i = 0; i < 8; ++i) {
+      state[i] = words[i][l];
+    }
+
+    store_digest(state, digests[l]);
+  }
+}
+
+/** Lanes of the AVX-512 kernel. */
+#define AVX512_LANES (16)
+
+/**
+ * @brief Loads 16 blocks and transposes them into 16 word vectors.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void avx512_load_words(const unsigned char *const blocks[AVX512_LANES], __m512i w[16]) {
+  const __m512i bswap_mask = _mm512_set4_epi32(0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203);
+  __m512i r[16], t[16], u[16];
+
+  for (int l = 0; l < AVX512_LANES; ++l) {
+    r[l] = _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)blocks[l]), bswap_mask);
+  }
+
+  for (int i = 0; i < 8; ++i) {
+    t[2 * i] = _mm512_unpacklo_epi32(r[2 * i], r[2 * i + 1]);
+    t[2 * i + 1] = _mm512_unpackhi_epi32(r[2 * i], r[2 * i + 1]);
+  }
+
+  for (int i = 0; i < 4; ++i) {
+    u[4 * i] = _mm512_unpacklo_epi64(t[4 * i], t[4 * i + 2]);
+    u[4 * i + 1] = _mm512_unpackhi_epi64(t[4 * i], t[4 * i + 2]);
+    u[4 * i + 2] = _mm512_unpacklo_epi64(t[4 * i + 1], t[4 * i + 3]);
+    u[4 * i + 3] = _mm512_unpackhi_epi64(t[4 * i + 1], t[4 * i + 3]);
+  }
+
+  // u[4g + j] holds word 4k + j of rows 4g..4g+3 in its 128-bit chunk k
+  for (int j = 0; j < 4; ++j) {
+    __m512i v0 = _mm512_shuffle_i32x4(u[j], u[4 + j], 0x44);
+    __m512i v1 = _mm512_shuffle_i32x4(u[j], u[4 + j], 0xEE);
+    __m512i v2 = _mm512_shuffle_i32x4(u[8 + j], u[12 + j], 0x44);
+    __m512i v3 = _mm512_shuffle_i32x4(u[8 + j], u[12 + j], 0xEE);
+    w[j] = _mm512_shuffle_i32x4(v0, v2, 0x88);
+    w[4 + j] = _mm512_shuffle_i32x4(v0, v2, 0xDD);
+    w[8 + j] = _mm512_shuffle_i32x4(v1, v3, 0x88);
+    w[12 + j] = _mm512_shuffle_i32x4(v1, v3, 0xDD);
+  }
+}
+
+/**
+ * @brief Runs one compression in AVX-512 lanes.
+ *
+ * With @p wk NULL the schedule is expanded from the words in @p w. Otherwise
+ * every lane compresses the same block, whose words plus round constants are
+ * given in @p wk, and the schedule work is skipped entirely.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static inline void avx512_compress(__m512i s[8], __m512i w[16], const uint32_t *wk) {
+  __m512i a = s[0], bb = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+  for (int t = 0; t < 64; ++t) {
+    __m512i kw;
+
+    if (wk) {
+      kw = _mm512_set1_epi32((int)wk[t]);
+    } else {
+      if (t >= 16) {
+        __m512i w15 = w[(t - 15) & 15];
+        __m512i w2 = w[(t - 2) & 15];
+        __m512i s0 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(w15, 7), _mm512_ror_epi32(w15, 18),
+                                               _mm512_srli_epi32(w15, 3), 0x96);
+        __m512i s1 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(w2, 17), _mm512_ror_epi32(w2, 19),
+                                               _mm512_srli_epi32(w2, 10), 0x96);
+        w[t & 15] = _mm512_add_epi32(_mm512_add_epi32(w[t & 15], s0),
+                                     _mm512_add_epi32(w[(t - 7) & 15], s1));
+      }
+
+      kw = _mm512_add_epi32(_mm512_set1_epi32((int)K256[t]), w[t & 15]);
+    }
+
+    __m512i big_s1 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(e, 6), _mm512_ror_epi32(e, 11),
+                                               _mm512_ror_epi32(e, 25), 0x96);
+    __m512i ch = _mm512_ternarylogic_epi32(e, f, g, 0xCA);
+    __m512i t1 = _mm512_add_epi32(_mm512_add_epi32(h, big_s1), _mm512_add_epi32(ch, kw));
+    __m512i big_s0 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(a, 2), _mm512_ror_epi32(a, 13),
+                                               _mm512_ror_epi32(a, 22), 0x96);
+    __m512i maj = _mm512_ternarylogic_epi32(a, bb, c, 0xE8);
+
+    h = g;
+    g = f;
+    f = e;
+    e = _mm512_add_epi32(d, t1);
+    d = c;
+    c = bb;
+    bb = a;
+    a = _mm512_add_epi32(t1, _mm512_add_epi32(big_s0, maj));
+  }
+
+  s[0] = _mm512_add_epi32(s[0], a);
+  s[1] = _mm512_add_epi32(s[1], bb);
+  s[2] = _mm512_add_epi32(s[2], c);
+  s[3] = _mm512_add_epi32(s[3], d);
+  s[4] = _mm512_add_epi32(s[4], e);
+  s[5] = _mm512_add_epi32(s[5], f);
+  s[6] = _mm512_add_epi32(s[6], g);
+  s[7] = _mm512_add_epi32(s[7], h);
+}
+
+/**
+ * @brief Hashes up to 16 prepared messages in AVX-512 lanes.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void sha256_avx512_x16(const sha256_lane_t *lanes, size_t lane_count, unsigned char *const *digests) {
+  __m512i s[8];
+  size_t max_blocks = 0;
+
+  for (int i = 0; i < 8; ++i) {
+    s[i] = _mm512_set1_epi32((int)IV256[i]);
+  }
+
+  for (size_t l = 0; l < lane_count; ++l) {
+    max_blocks = lanes[l].total_blocks > max_blocks ? lanes[l].total_blocks : max_blocks;
+  }
+
+  for (size_t b = 0; b < max_blocks; ++b) {
+    const unsigned char *blocks[AVX512_LANES];
+    bool finishing = false;
+
+    for (size_t l = 0; l < AVX512_LANES; ++l) {
+      bool live = l < lane_count && b < lanes[l].total_blocks;
+      blocks[l] = live ? lane_block(&lanes[l], b) : zero_block;
+      finishing |= live && b + 1 == lanes[l].total_blocks;
+    }
+
+    __m512i w[16];
+    avx512_load_words(blocks, w);
+    avx512_compress(s, w, NULL);
+
+    if (!finishing) {
+      continue;
+    }
+
+    uint32_t words[8][AVX512_LANES];
+
+    for (int i = 0; i < 8; ++i) {
+      _mm512_storeu_si512((void *)words[i], s[i]);
+    }
+
+    for (size_t l = 0; l < lane_count; ++l) {
+      if (b + 1 == lanes[l].total_blocks) {
+        uint32_t state[8];
+
+        for (int i = 0; i < 8; ++i) {
+          state[i] = words[i][l];
+        }
+
+        store_digest(state, digests[l]);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Hashes up to 16 messages of @p blocks whole blocks in AVX-512 lanes.
+ *
+ * The data blocks are read straight from the messages and the shared
+ * padding block is compressed from its precomputed schedule @p pad_wk.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void sha256_avx512_fixed(const unsigned char *const *msgs, size_t blocks, const uint32_t pad_wk[64],
+                                unsigned char *const *digests, size_t lane_count) {
+  __m512i s[8];
+
+  for (int i = 0; i < 8; ++i) {
+    s[i] = _mm512_set1_epi32((int)IV256[i]);
+  }
+
+  for (size_t b = 0; b < blocks; ++b) {
+    const unsigned char *lane_blocks[AVX512_LANES];
+
+    for (size_t l = 0; l < AVX512_LANES; ++l) {
+      lane_blocks[l] = l < lane_count ? msgs[l] + b * SHA256_BLOCK : zero_block;
+    }
+
+    __m512i w[16];
+    avx512_load_words(lane_blocks, w);
+    avx512_compress(s, w, NULL);
+  }
+
+  avx512_compress(s, NULL, pad_wk);
+
+  uint32_t words[8][AVX512_LANES];
+
+  for (int i = 0; i < 8; ++i) {
+    _mm512_storeu_si512((void *)words[i], s[i]);
+  }
+
+  for (size_t l = 0; l < lane_count; ++l) {
+    uint32_t state[8];
+
+    for (int i = 0; i < 8; ++i) {
+      state[i] = words[i][l];
+    }
+
+    store_digest(state, digests[l]);
+  }
+}
+
+#endif // MERKLE_SHA256_X86
+
+#ifdef MERKLE_SHA256_ARM
+
+/**
+ * @brief Runs the ARMv8 SHA-256 compression function over @p blocks blocks.
+ */
+static void sha256_armv8_compress(uint32_t state[8], const unsigned char *data, size_t blocks) {
+  uint32x4_t state0 = vld1q_u32(&state[0]);
+  uint32x4_t state1 = vld1q_u32(&state[4]);
+
+  for (size_t b = 0; b < blocks; ++b, data += SHA256_BLOCK) {
+    uint32x4_t abcd_save = state0;
+    uint32x4_t efgh_save = state1;
+    uint32x4_t msgs[4];
+
+    for (int i = 0; i < 4; ++i) {
+      msgs[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+    }
+
+    // Four rounds per group, extending the schedule four words at a time
+    for (int g = 0; g < 16; ++g) {
+      uint32x4_t wk = vaddq_u32(msgs[g & 3], vld1q_u32(&K256[4 * g]));
+      uint32x4_t abcd = state0;
+
+      if (g < 12) {
+        msgs[g & 3] = vsha256su0q_u32(msgs[g & 3], msgs[(g + 1) & 3]);
+      }
+
+      state0 = vsha256hq_u32(state0, state1, wk);
+      state1 = vsha256h2q_u32(state1, abcd, wk);
+
+      if (g < 12) {
+        msgs[g & 3] = vsha256su1q_u32(msgs[g & 3], msgs[(g + 2) & 3], msgs[(g + 3) & 3]);
+      }
+    }
+
+    state0 = vaddq_u32(state0, abcd_save);
+    state1 = vaddq_u32(state1, efgh_save);
+  }
+
+  vst1q_u32(&state[0], state0);
+  vst1q_u32(&state[4], state1);
+}
+
+/**
+ * @brief Hashes one message with the ARMv8 cryptography extensions.
+ */
+static void sha256_armv8_one(const unsigned char *msg, size_t len, unsigned char out[HASH_SIZE]) {
+  sha256_lane_t lane;
+  uint32_t state[8];
+
+  prepare_lane(&lane, msg, len);
+  memcpy(state, IV256, sizeof(state));
+  sha256_armv8_compress(state, lane.data, lane.full_blocks);
+  sha256_armv8_compress(state, lane.tail, lane.total_blocks - lane.full_blocks);
+  store_digest(state, out);
+}
+
+#endif // MERKLE_SHA256_ARM
+
+bool merkle_sha256_backend_supported(merkle_sha256_backend_t backend) {
+  switch (backend) {
+  case MERKLE_SHA256_AUTO:
+  case MERKLE_SHA256_SCALAR:
+    return true;
+#ifdef MERKLE_SHA256_X86
+  case MERKLE_SHA256_SHANI:
+  case MERKLE_SHA256_AVX2:
+  case MERKLE_SHA256_AVX512:
+    return x86_supports(backend);
+#endif
+#ifdef MERKLE_SHA256_ARM
+  case MERKLE_SHA256_ARMV8:
+#if defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#else
+    // Compiled with the extensions enabled, e.g. every Apple arm64 target
+    return true;
+#endif
+#endif
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief Picks the fastest backend the running CPU supports.
+ */
+static merkle_sha256_backend_t detect_backend(void) {
+  static const merkle_sha256_backend_t preferred[] = {
+    MERKLE_SHA256_AVX512, MERKLE_SHA256_AVX2, MERKLE_SHA256_SHANI, MERKLE_SHA256_ARMV8
+  };
+
+  for (size_t i = 0; i < sizeof(preferred) / sizeof(preferred[0]); ++i) {
+    if (merkle_sha256_backend_supported(preferred[i])) {
+      return preferred[i];
+    }
+  }
+
+  return MERKLE_SHA256_SCALAR;
+}
+
+merkle_sha256_backend_t merkle_sha256_active_backend(void) {
+  int backend = atomic_load_explicit(&active_backend, memory_order_relaxed);
+
+  if (backend == MERKLE_SHA256_AUTO) {
+    // Detection is idempotent, so racing first calls may both run it
+    backend = detect_backend();
+    atomic_store_explicit(&active_backend, backend, memory_order_relaxed);
+  }
+
+  return (merkle_sha256_backend_t)backend;
+}
+
+merkle_error_t merkle_sha256_select_backend(merkle_sha256_backend_t backend) {
+  if (!merkle_sha256_backend_supported(backend)) {
+    return MERKLE_BAD_ARG;
+  }
+
+  int chosen = backend == MERKLE_SHA256_AUTO ? detect_backend() : backend;
+  atomic_store_explicit(&active_backend, chosen, memory_order_relaxed);
+  return MERKLE_SUCCESS;
+}
+
+const char *merkle_sha256_backend_name(merkle_sha256_backend_t backend) {
+  switch (backend) {
+  case MERKLE_SHA256_AUTO:
+    return "auto";
+  case MERKLE_SHA256_SCALAR:
+    return "scalar";
+  case MERKLE_SHA256_SHANI:
+    return "sha-ni";
+  case MERKLE_SHA256_AVX2:
+    return "avx2";
+  case MERKLE_SHA256_AVX512:
+    return "avx512";
+  case MERKLE_SHA256_ARMV8:
+    return "armv8";
+  default:
+    return "unknown";
+  }
+}
+
+#ifdef MERKLE_SHA256_X86
+/**
+ * @brief Reports, from a cached CPUID query, whether the SHA extensions exist.
+ */
+static bool shani_available(void) {
+  static atomic_int shani = -1;
+  int has_shani = atomic_load_explicit(&shani, memory_order_relaxed);
+
+  if (has_shani < 0) {
+    has_shani = x86_supports(MERKLE_SHA256_SHANI);
+    atomic_store_explicit(&shani, has_shani, memory_order_relaxed);
+  }
+
+  return has_shani;
+}
+#endif
+
+/**
+ * @brief Hashes one message with the best single-stream implementation.
+ */
+static void sha256_one(merkle_sha256_backend_t backend, const unsigned char *msg, size_t len,
+                       unsigned char out[HASH_SIZE]) {
+#ifdef MERKLE_SHA256_X86
+  // A forced scalar backend really means OpenSSL, e.g. as a test reference
+  if (backend != MERKLE_SHA256_SCALAR && shani_available()) {
+    sha256_shani_one(msg, len, out);
+    return;
+  }
+#endif
+#ifdef MERKLE_SHA256_ARM
+  if (backend == MERKLE_SHA256_ARMV8) {
+    sha256_armv8_one(msg, len, out);
+    return;
+  }
+#endif
+  sha256_evp(msg ? msg : zero_block, len, out);
+}
+
+static inline uint32_t rotr32(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+/**
+ * @brief Portable SHA-256 compression function over @p blocks blocks.
+ */
+static void sha256_scalar_compress(uint32_t state[8], const unsigned char *data, size_t blocks) {
+  for (size_t b = 0; b < blocks; ++b, data += SHA256_BLOCK) {
+    uint32_t w[64];
+
+    for (size_t i = 0; i < 16; ++i) {
+      w[i] = (uint32_t)data[4 * i] << 24 | (uint32_t)data[4 * i + 1] << 16 |
+             (uint32_t)data[4 * i + 2] << 8 | (uint32_t)data[4 * i + 3];
+    }
+
+    for (size_t i = 16; i < 64; ++i) {
+      uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b2 = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (size_t i = 0; i < 64; ++i) {
+      uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) + K256[i] + w[i];
+      uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b2) ^ (a & c) ^ (b2 & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b2;
+      b2 = a;
+      a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b2;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+/**
+ * @brief Compresses whole blocks with the fastest single-stream kernel.
+ */
+static void sha256_compress(uint32_t state[8], const unsigned char *data, size_t blocks) {
+#if defined(MERKLE_SHA256_X86) || defined(MERKLE_SHA256_ARM)
+  merkle_sha256_backend_t backend = merkle_sha256_active_backend();
+#endif
+
+#ifdef MERKLE_SHA256_X86
+  if (backend != MERKLE_SHA256_SCALAR && shani_available()) {
+    sha256_shani_compress(state, data, blocks);
+    return;
+  }
+#endif
+#ifdef MERKLE_SHA256_ARM
+  if (backend == MERKLE_SHA256_ARMV8) {
+    sha256_armv8_compress(state, data, blocks);
+    return;
+  }
+#endif
+  sha256_scalar_compress(state, data, blocks);
+}
+
+void merkle_sha256_init(merkle_sha256_ctx_t *ctx) {
+  memcpy(ctx->state, IV256, sizeof(ctx->state));
+  ctx->length = 0;
+  ctx->block_len = 0;
+}
+
+void merkle_sha256_update(merkle_sha256_ctx_t *ctx, const void *data, size_t len) {
+  const unsigned char *in = data;
+  ctx->length += len;
+
+  // Top up a partially filled block first
+  if (ctx->block_len) {
+    size_t take = SHA256_BLOCK - ctx->block_len < len ? SHA256_BLOCK - ctx->block_len : len;
+    memcpy(ctx->block + ctx->block_len, in, take);
+    ctx->block_len += take;
+    in += take;
+    len -= take;
+
+    if (ctx->block_len < SHA256_BLOCK) {
+      return;
+    }
+
+    sha256_compress(ctx->state, ctx->block, 1);
+    ctx->block_len = 0;
+  }
+
+  // Whole blocks are compressed straight from the caller's buffer
+  if (len >= SHA256_BLOCK) {
+    sha256_compress(ctx->state, in, len / SHA256_BLOCK);
+    in += len - len % SHA256_BLOCK;
+    len %= SHA256_BLOCK;
+  }
+
+  if (len) {
+    memcpy(ctx->block, in, len);
+    ctx->block_len = len;
+  }
+}
+
+void merkle_sha256_final(merkle_sha256_ctx_t *ctx, unsigned char digest[HASH_SIZE]) {
+  unsigned char tail[2 * SHA256_BLOCK] = {0};
+  size_t tail_blocks = ctx->block_len + 9 <= SHA256_BLOCK ? 1 : 2;
+  uint64_t bits = ctx->length * 8;
+
+  memcpy(tail, ctx->block, ctx->block_len);
+  tail[ctx->block_len] = 0x80;
+
+  for (size_t i = 0; i < 8; ++i) {
+    tail[tail_blocks * SHA256_BLOCK - 1 - i] = (unsigned char)(bits >> (8 * i));
+  }
+
+  sha256_compress(ctx->state, tail, tail_blocks);
+  store_digest(ctx->state, digest);
+}
+
+#ifdef MERKLE_SHA256_X86
+/**
+ * @brief Runs one group of messages through a multi-lane kernel.
+ */
+static void sha256_lanes(merkle_sha256_backend_t backend, const unsigned char *const *msgs, const size_t *lens,
+                         unsigned char *const *digests, size_t count) {
+  sha256_lane_t lanes[MERKLE_SHA256_MAX_LANES];
+
+  for (size_t l = 0; l < count; ++l) {
+    prepare_lane(&lanes[l], msgs[l] ? msgs[l] : zero_block, lens[l]);
+  }
+
+  if (backend == MERKLE_SHA256_AVX512) {
+    sha256_avx512_x16(lanes, count, digests);
+  } else {
+    sha256_avx2_x8(lanes, count, digests);
+  }
+}
+#endif
+
+void merkle_sha256_batch(const unsigned char *const *msgs, const size_t *lens,
+                         unsigned char *const *digests, size_t count) {
+  merkle_sha256_backend_t backend = merkle_sha256_active_backend();
+  size_t i = 0;
+
+#ifdef MERKLE_SHA256_X86
+  /* Fill whole vectors while there are enough messages; a half-empty vector
+   * still beats hashing its messages one by one. */
+  if (backend == MERKLE_SHA256_AVX512) {
+    while (count - i >= AVX512_LANES / 2) {
+      size_t group = count - i < AVX512_LANES ? count - i : AVX512_LANES;
+      sha256_lanes(backend, msgs + i, lens + i, digests + i, group);
+      i += group;
+    }
+  }
+
+  if (backend == MERKLE_SHA256_AVX512 || backend == MERKLE_SHA256_AVX2) {
+    while (count - i >= AVX2_LANES / 2) {
+      size_t group = count - i < AVX2_LANES ? count - i : AVX2_LANES;
+      sha256_lanes(MERKLE_SHA256_AVX2, msgs + i, lens + i, digests + i, group);
+      i += group;
+    }
+  }
+#endif
+
+  for (; i < count; ++i) {
+    sha256_one(backend, msgs[i], lens[i], digests[i]);
+  }
+}
+
+/**
+ * @brief Returns the padding-block schedule of messages of @p len bytes.
+ *
+ * When @p len is a whole number of blocks the final block holds only the
+ * 0x80 marker and the bit length, so it is identical for every message of
+ * that length. Its words plus round constants are kept per thread for the
+ * last length asked for.
+ */
+static const uint32_t *padding_schedule(size_t len) {
+  static _Thread_local size_t cached_len;
+  static _Thread_local uint32_t wk[64];
+
+  if (cached_len != len) {
+    uint64_t bits = (uint64_t)len * 8;
+    uint32_t w[64] = {0x80000000};
+
+    w[14] = (uint32_t)(bits >> 32);
+    w[15] = (uint32_t)bits;
+
+    for (size_t i = 16; i < 64; ++i) {
+      uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    for (size_t i = 0; i < 64; ++i) {
+      wk[i] = w[i] + K256[i];
+    }
+
+    cached_len = len;
+  }
+
+  return wk;
+}
+
+/**
+ * @brief Hashes one message of @p blocks whole blocks with the best single-stream kernel.
+ */
+static void sha256_fixed_one(merkle_sha256_backend_t backend, const unsigned char *msg, size_t blocks,
+                             const uint32_t pad_wk[64], unsigned char out[HASH_SIZE]) {
+#ifdef MERKLE_SHA256_X86
+  if (backend != MERKLE_SHA256_SCALAR && shani_available()) {
+    uint32_t state[8];
+
+    memcpy(state, IV256, sizeof(state));
+    sha256_shani_compress(state, msg, blocks);
+    sha256_shani_compress_wk(state, pad_wk);
+    store_digest(state, out);
+    return;
+  }
+#endif
+  (void)pad_wk;
+  sha256_one(backend, msg, blocks * SHA256_BLOCK, out);
+}
+
+void merkle_sha256_batch_fixed(const unsigned char *const *msgs, size_t len,
+                               unsigned char *const *digests, size_t count) {
+  // Lengths ending inside a block have message bytes in the padding block
+  if (len == 0 || len % SHA256_BLOCK) {
+    size_t lens[MERKLE_SHA256_MAX_LANES];
+
+    for (size_t l = 0; l < MERKLE_SHA256_MAX_LANES; ++l) {
+      lens[l] = len;
+    }
+
+    for (size_t first = 0; first < count; first += MERKLE_SHA256_MAX_LANES) {
+      size_t group = count - first < MERKLE_SHA256_MAX_LANES ? count - first : MERKLE_SHA256_MAX_LANES;
+      merkle_sha256_batch(msgs + first, lens, digests + first, group);
+    }
+
+    return;
+  }
+
+  merkle_sha256_backend_t backend = merkle_sha256_active_backend();
+  size_t blocks = len / SHA256_BLOCK;
+  const uint32_t *pad_wk = padding_schedule(len);
+  size_t i = 0;
+
+#ifdef MERKLE_SHA256_X86
+  // Same grouping as merkle_sha256_batch(), minus all per-lane preparation
+  if (backend == MERKLE_SHA256_AVX512) {
+    while (count - i >= AVX512_LANES / 2) {
+      size_t group = count - i < AVX512_LANES ? count - i : AVX512_LANES;
+      sha256_avx512_fixed(msgs + i, blocks, pad_wk, digests + i, group);
+      i += group;
+    }
+  }
+
+  if (backend == MERKLE_SHA256_AVX512 || backend == MERKLE_SHA256_AVX2) {
+    while (count - i >= AVX2_LANES / 2) {
+      size_t group = count - i < AVX2_LANES ? count - i : AVX2_LANES;
+      sha256_avx2_fixed(msgs + i, blocks, pad_wk, digests + i, group);
+      i += group;
+    }
+  }
+#endif
+
+  for (; i < count; ++i) {
+    sha256_fixed_one(backend, msgs[i], blocks, pad_wk, digests[i]);
+  }
+}
@@ -0,0 +1,508 @@
+/**
+ * @file merkle_shard.c
+ * @brief Joining trees built independently over leaf ranges into one tree.
+ *
+ * A tree of N leaves can be cut at level h: every node there roots the
+ * leaves [i * bf^h, (i + 1) * bf^h), and only the last range can be short.
+ * Each range is built as an ordinary tree, possibly on another machine, and
+ * described by merkle_shard_export(). A full range yields exactly the node
+ * of level h. A short last range yields a lower tree, whose root reaches
+ * level h through parents with a single child, each the hash of its one
+ * child's hash; merkle_shard_combine() adds those levels before hashing the
+ * upper tree over the level h nodes. The root and every proof then equal
+ * the ones of a tree built over all N leaves in one place.
+ *
+ * @author Guy Alster
+ * @date 2026-10-15
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Merkle.h"
+#include "merkle_hash.h"
+#include "merkle_proof.h"
+#include "merkle_shard.h"
+#include "merkle_utils.h"
+
+/** Leading bytes of every encoded shard description. */
+#define SHARD_MAGIC "MKLS"
+
+/** Encoded shard description format revision. */
+#define SHARD_VERSION (1)
+
+/** Offsets of the encoded fields; integers are little-endian 64-bit. */
+#define SHARD_OFFSET_VERSION (4)
+#define SHARD_OFFSET_HASH_ID (5)
+#define SHARD_OFFSET_FIRST_LEAF (8)
+#define SHARD_OFFSET_LEAF_COUNT (16)
+#define SHARD_OFFSET_HEIGHT (24)
+#define SHARD_OFFSET_LEVELS (32)
+#define SHARD_OFFSET_BRANCHING (40)
+#define SHARD_OFFSET_ROOT (48)
+
+/**
+ * @brief Upper tree over the level @ref height nodes of all shards.
+ *
+ * Level 0 holds one node per shard, level @ref levels the root; the children
+ * of node @c i of a level are nodes [i * branching_factor,
+ * (i + 1) * branching_factor) of the level below, as in the flat layout.
+ */
+struct merkle_shard_set {
+  const merkle_hash_vtable_t *hash;   /**< Algorithm of every shard. */
+  merkle_hash_id_t hash_id;           /**< Identifier of @ref hash for proofs. */
+  size_t branching_factor;            /**< Children per parent. */
+  size_t height;                      /**< Levels of a full shard. */
+  size_t span;                        /**< Leaves of a full shard (0 when past SIZE_MAX, i.e. a single shard). */
+  size_t leaf_count;                  /**< Leaves of the whole tree. */
+  size_t shard_count;                 /**< Number of shards. */
+  merkle_shard_info_t *shards;        /**< Shard descriptions, by position. */
+  size_t levels;                      /**< Levels above the shard nodes. */
+  size_t *level_offsets;              /**< levels + 2 entries: first node of each level, then the node total. */
+  unsigned char (*hashes)[HASH_SIZE]; /**< Every node hash, level after level. */
+};
+
+/**
+ * @brief Counts the parent levels needed to reduce @p width nodes to one root.
+ */
+static size_t shard_level_count(size_t width, size_t branching_factor) {
+  size_t levels = 0;
+
+  for (; width > 1; width = (width + branching_factor - 1) / branching_factor) {
+    levels++;
+  }
+
+  return levels;
+}
+
+/**
+ * @brief Hashes @p count contiguous child hashes into @p parent.
+ */
+static void hash_children(const merkle_hash_vtable_t *hash, const unsigned char *children, size_t count,
+                          unsigned char parent[HASH_SIZE]) {
+  const unsigned char *msg = children;
+  size_t len = count * HASH_SIZE;
+  unsigned char *digest = parent;
+  merkle_hash_batch(hash, &msg, &len, &digest, 1);
+}
+
+merkle_error_t merkle_shard_export(merkle_tree_t *const shard, size_t first_leaf, size_t height,
+                                   merkle_shard_info_t *info) {
+  // Validate input parameters
+  if (!shard || !info) {
+    return MERKLE_NULL_ARG;
+  }
+
+  merkle_shard_info_t exported = {
+    .first_leaf = first_leaf,
+    .leaf_count = merkle_tree_leaf_count(shard),
+    .height = height,
+    .levels = merkle_tree_level_count(shard),
+  };
+
+  merkle_tree_shape(shard, &exported.branching_factor, &exported.hash_id);
+
+  if (get_tree_hash(shard, exported.root) != MERKLE_SUCCESS || exported.levels > height) {
+    return MERKLE_BAD_ARG;
+  }
+
+  // A span past SIZE_MAX only fits a single shard starting at leaf 0
+  size_t span = 1;
+
+  for (size_t level = 0; level < height && span; ++level) {
+    span = span <= SIZE_MAX / exported.branching_factor ? span * exported.branching_factor : 0;
+  }
+
+  if (span ? first_leaf % span != 0 || first_leaf > SIZE_MAX - exported.leaf_count : first_leaf != 0) {
+    return MERKLE_BAD_ARG;
+  }
+
+  *info = exported;
+  return MERKLE_SUCCESS;
+}
+
+merkle_error_t merkle_shard_encode(const merkle_shard_info_t *info, unsigned char out[MERKLE_SHARD_ENCODED_SIZE]) {
+  // Validate input parameters
+  if (!info || !out) {
+    return MERKLE_NULL_ARG;
+  }
+
+  memset(out, 0, MERKLE_SHARD_ENCODED_SIZE);
+  memcpy(out, SHARD_MAGIC, 4);
+  out[SHARD_OFFSET_VERSION] = SHARD_VERSION;
+  out[SHARD_OFFSET_HASH_ID] = (unsigned char)info->hash_id;
+  merkle_store_le64(out + SHARD_OFFSET_FIRST_LEAF, info->first_leaf);
+  merkle_store_le64(out + SHARD_OFFSET_LEAF_COUNT, info->leaf_count);
+  merkle_store_le64(out + SHARD_OFFSET_HEIGHT, info->height);
+  merkle_store_le64(out + SHARD_OFFSET_LEVELS, info->levels);
+  merkle_store_le64(out + SHARD_OFFSET_BRANCHING, info->branching_factor);
+  memcpy(out + SHARD_OFFSET_ROOT, info->root, HASH_SIZE);
+  return MERKLE_SUCCESS;
+}
+
+merkle_error_t merkle_shard_decode(const void *in, size_t size, merkle_shard_info_t *info) {
+  // Validate input parameters
+  if (!in || !info) {
+    return MERKLE_NULL_ARG;
+  }
+
+  const unsigned char *bytes = in;
+
+  if (size < MERKLE_SHARD_ENCODED_SIZE || memcmp(bytes, SHARD_MAGIC, 4) != 0 ||
+      bytes[SHARD_OFFSET_VERSION] != SHARD_VERSION) {
+    return MERKLE_BAD_ARG;
+  }
+
+  uint64_t values[5];
+
+  for (size_t i = 0; i < 5; ++i) {
+    values[i] = merkle_load_le64(bytes + SHARD_OFFSET_FIRST_LEAF + 8 * i);
+
+    if ((size_t)values[i] != values[i]) {
+      return MERKLE_BAD_ARG;
+    }
+  }
+
+  merkle_shard_info_t decoded = {
+    .first_leaf = (size_t)values[0],
+    .leaf_count = (size_t)values[1],
+    .height = (size_t)values[2],
+    .levels = (size_t)values[3],
+    .branching_factor = (size_t)values[4],
+    .hash_id = (merkle_hash_id_t)bytes[SHARD_OFFSET_HASH_ID],
+  };
+
+  if (decoded.leaf_count == 0 || decoded.branching_factor < 2 || decoded.levels > decoded.height) {
+    return MERKLE_BAD_ARG;
+  }
+
+  memcpy(decoded.root, bytes + SHARD_OFFSET_ROOT, HASH_SIZE);
+  *info = decoded;
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Checks that every shard has the shape of the first one.
+ *
+ * @param span Receives the leaves of a full shard, or 0 past SIZE_MAX.
+ */
+static bool shards_agree(const merkle_shard_info_t *shards, size_t count, size_t *span) {
+  const merkle_shard_info_t *first = &shards[0];
+
+  if (first->branching_factor < 2) {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    const merkle_shard_info_t *shard = &shards[i];
+
+    if (shard->branching_factor != first->branching_factor || shard->height != first->height ||
+        shard->hash_id != first->hash_id || shard->leaf_count == 0 ||
+        shard->levels != shard_level_count(shard->leaf_count, shard->branching_factor) ||
+        shard->levels > shard->height) {
+      return false;
+    }
+  }
+
+  *span = 1;
+
+  for (size_t level = 0; level < first->height && *span; ++level) {
+    *span = *span <= SIZE_MAX / first->branching_factor ? *span * first->branching_factor : 0;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Puts every shard at its position, checking that they tile the leaves.
+ */
+static bool place_shards(merkle_shard_set_t *set, const merkle_shard_info_t *shards, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    const merkle_shard_info_t *shard = &shards[i];
+    size_t slot = set->span ? shard->first_leaf / set->span : 0;
+
+    if ((set->span ? shard->first_leaf % set->span != 0 : shard->first_leaf != 0) || slot >= count ||
+        set->shards[slot].leaf_count) {
+      return false;
+    }
+
+    // Only the last shard may be short
+    if (slot + 1 < count && shard->leaf_count != set->span) {
+      return false;
+    }
+
+    set->shards[slot] = *shard;
+  }
+
+  const merkle_shard_info_t *last = &set->shards[count - 1];
+
+  if (last->first_leaf > SIZE_MAX - last->leaf_count) {
+    return false;
+  }
+
+  set->leaf_count = last->first_leaf + last->leaf_count;
+  return true;
+}
+
+/**
+ * @brief Fills the shard level and hashes the upper levels of a placed set.
+ */
+static merkle_error_t hash_shard_levels(merkle_shard_set_t *set) {
+  size_t count = set->shard_count;
+  size_t levels = shard_level_count(count, set->branching_factor);
+
+  ALLOC_AND_INIT_SIMPLE(set->level_offsets, levels + 2);
+
+  if (!set->level_offsets) {
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  size_t total = 0;
+  size_t width = count;
+
+  for (size_t level = 0; level <= levels; ++level) {
+    set->level_offsets[level] = total;
+    total += width;
+    width = (width + set->branching_factor - 1) / set->branching_factor;
+  }
+
+  set->level_offsets[levels + 1] = total;
+  set->levels = levels;
+  ALLOC_AND_INIT_SIMPLE(set->hashes, total);
+
+  if (!set->hashes) {
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  // A short last shard climbs to the shard level through single-child parents
+  for (size_t i = 0; i < count; ++i) {
+    unsigned char node[HASH_SIZE];
+    memcpy(set->hashes[i], set->shards[i].root, HASH_SIZE);
+
+    for (size_t level = set->shards[i].levels; count > 1 && level < set->height; ++level) {
+      memcpy(node, set->hashes[i], HASH_SIZE);
+      hash_children(set->hash, node, 1, set->hashes[i]);
+    }
+  }
+
+  for (size_t level = 0; level < levels; ++level) {
+    size_t child_width = set->level_offsets[level + 1] - set->level_offsets[level];
+    unsigned char (*children)[HASH_SIZE] = set->hashes + set->level_offsets[level];
+    unsigned char (*parents)[HASH_SIZE] = set->hashes + set->level_offsets[level + 1];
+
+    for (size_t p = 0, child = 0; child < child_width; ++p, child += set->branching_factor) {
+      size_t child_count = child_width - child < set->branching_factor ? child_width - child
+                                                                       : set->branching_factor;
+      hash_children(set->hash, children[child], child_count, parents[p]);
+    }
+  }
+
+  return MERKLE_SUCCESS;
+}
+
+merkle_error_t merkle_shard_combine(const merkle_shard_info_t *shards, size_t count, merkle_shard_set_t **set) {
+  // Validate input parameters
+  if (!shards || !set) {
+    return MERKLE_NULL_ARG;
+  }
+
+  *set = NULL;
+  size_t span = 0;
+
+  if (count == 0 || !shards_agree(shards, count, &span) || !merkle_hash_get(shards[0].hash_id)) {
+    return MERKLE_BAD_ARG;
+  }
+
+  merkle_error_t ret = MERKLE_SUCCESS;
+  merkle_shard_set_t *result = NULL;
+
+  TRY {
+    ALLOC_AND_INIT_SIMPLE(result, 1);
+
+    if (!result) {
+      ret = MERKLE_FAILED_MEM_ALLOC;
+      THROW;
+    }
+
+    result->hash = merkle_hash_get(shards[0].hash_id);
+    result->hash_id = shards[0].hash_id;
+    result->branching_factor = shards[0].branching_factor;
+    result->height = shards[0].height;
+    result->span = span;
+    result->shard_count = count;
+    ALLOC_AND_INIT_SIMPLE(result->shards, count);
+
+    if (!result->shards) {
+      ret = MERKLE_FAILED_MEM_ALLOC;
+      THROW;
+    }
+
+    if (!place_shards(result, shards, count)) {
+      ret = MERKLE_BAD_ARG;
+      THROW;
+    }
+
+    ret = hash_shard_levels(result);
+
+    if (ret != MERKLE_SUCCESS) {
+      THROW;
+    }
+
+    *set = result;
+    return MERKLE_SUCCESS;
+
+  } CATCH();
+
+  merkle_shard_set_destroy(result);
+  return ret;
+}
+
+merkle_error_t merkle_shard_set_root(const merkle_shard_set_t *set, unsigned char root[HASH_SIZE]) {
+  // Validate input parameters
+  if (!set || !root) {
+    return MERKLE_NULL_ARG;
+  }
+
+  memcpy(root, set->hashes[set->level_offsets[set->levels]], HASH_SIZE);
+  return MERKLE_SUCCESS;
+}
+
+size_t merkle_shard_set_leaf_count(const merkle_shard_set_t *set) {
+  return set ? set->leaf_count : 0;
+}
+
+/**
+ * @brief Fills the proof level of node @p index of upper level @p level.
+ */
+static merkle_error_t add_upper_level(const merkle_shard_set_t *set, size_t level, size_t index,
+                                      merkle_proof_item_t *item) {
+  size_t branching_factor = set->branching_factor;
+  size_t width = set->level_offsets[level + 1] - set->level_offsets[level];
+  size_t first = index - index % branching_factor;
+  size_t child_count = width - first < branching_factor ? width - first : branching_factor;
+  size_t position = index - first;
+  const unsigned char (*group)[HASH_SIZE] =
+      (const unsigned char (*)[HASH_SIZE])(set->hashes + set->level_offsets[level] + first);
+
+  item->sibling_count = child_count - 1;
+  item->node_position = position;
+
+  if (child_count == 1) {
+    return MERKLE_SUCCESS;
+  }
+
+  ALLOC_AND_INIT_SIMPLE(item->sibling_hashes, child_count - 1);
+
+  if (!item->sibling_hashes) {
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  // The siblings are the two runs around our node
+  memcpy(item->sibling_hashes[0], group[0], position * HASH_SIZE);
+  memcpy(item->sibling_hashes[position], group[position + 1], (child_count - position - 1) * HASH_SIZE);
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Checks that @p shard is the tree described at position @p slot.
+ */
+static bool shard_matches(const merkle_shard_set_t *set, size_t slot, merkle_tree_t *const shard) {
+  const merkle_shard_info_t *info = &set->shards[slot];
+  unsigned char root[HASH_SIZE];
+
+  return merkle_tree_leaf_count(shard) == info->leaf_count && merkle_tree_level_count(shard) == info->levels &&
+         get_tree_hash(shard, root) == MERKLE_SUCCESS && memcmp(root, info->root, HASH_SIZE) == 0;
+}
+
+merkle_error_t merkle_shard_prove(const merkle_shard_set_t *set, merkle_tree_t *const shard, size_t leaf_index,
+                                  merkle_proof_t **proof) {
+  // Validate input parameters
+  if (!set || !shard || !proof) {
+    return MERKLE_NULL_ARG;
+  }
+
+  *proof = NULL;
+
+  if (leaf_index >= set->leaf_count) {
+    return MERKLE_INVALID_INDEX;
+  }
+
+  size_t slot = set->span ? leaf_index / set->span : 0;
+  const merkle_shard_info_t *info = &set->shards[slot];
+
+  if (!shard_matches(set, slot, shard)) {
+    return MERKLE_BAD_ARG;
+  }
+
+  merkle_proof_t *result = NULL;
+  merkle_error_t ret = generate_proof_from_index(shard, leaf_index - info->first_leaf, &result);
+
+  if (ret != MERKLE_SUCCESS) {
+    return ret;
+  }
+
+  TRY {
+    if (result->branching_factor != set->branching_factor || result->hash_id != set->hash_id) {
+      ret = MERKLE_BAD_ARG;
+      THROW;
+    }
+
+    // The shard's own levels, then its single-child climb, then the upper tree
+    size_t padding = set->shard_count > 1 ? set->height - info->levels : 0;
+    size_t total = result->path_length + padding + set->levels;
+    merkle_proof_item_t **path = NULL;
+    ALLOC_AND_INIT_SIMPLE(path, total);
+
+    if (!path) {
+      ret = MERKLE_FAILED_MEM_ALLOC;
+      THROW;
+    }
+
+    if (result->path_length) {
+      memcpy(path, result->path, result->path_length * sizeof(*path));
+    }
+
+    MFree(result->path);
+    result->path = path;
+    result->leaf_index = leaf_index;
+
+    for (size_t level = result->path_length; level < total && ret == MERKLE_SUCCESS; ++level) {
+      ALLOC_AND_INIT_SIMPLE(path[level], 1);
+
+      if (!path[level]) {
+        ret = MERKLE_FAILED_MEM_ALLOC;
+        break;
+      }
+
+      result->path_length = level + 1;
+
+      if (level >= total - set->levels) {
+        ret = add_upper_level(set, level - (total - set->levels), slot, path[level]);
+        slot /= set->branching_factor;
+      }
+    }
+
+    if (ret != MERKLE_SUCCESS) {
+      THROW;
+    }
+
+    *proof = result;
+    return MERKLE_SUCCESS;
+
+  } CATCH();
+
+  dealloc_merkle_proof(result);
+  return ret;
+}
+
+void merkle_shard_set_destroy(merkle_shard_set_t *set) {
+  if (!set) {
+    return;
+  }
+
+  MFree(set->shards);
+  MFree(set->level_offsets);
+  MFree(set->hashes);
+  MFree(set);
+}
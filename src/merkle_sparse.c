@@ -0,0 +1,638 @@
+/**
+ * @file merkle_sparse.c
+ * @brief Sparse Merkle tree over HASH_SIZE-byte keys with compact proofs.
+ *
+ * The logical tree is a full binary tree of MERKLE_SPARSE_DEPTH levels whose
+ * leaves are addressed by the bits of a key, most significant first. Almost
+ * all of it is empty, and an empty subtree of height h always hashes to the
+ * same default, so only a crit-bit trie of the keys is stored: one node per
+ * key and one per bit where two key paths fork. Between two stored nodes the
+ * path runs through subtrees whose other child is empty; those levels are
+ * hashed against the precomputed defaults when the lower node changes.
+ *
+ * Every stored node caches its subtree's hash both at its own height and at
+ * the top of the edge from its parent, which is exactly the sibling a proof
+ * needs where the paths fork. Proofs of present keys therefore cost no
+ * hashing at all, and proofs of absent keys at most one partial edge.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Merkle.h"
+#include "merkle_hash.h"
+#include "merkle_sha256.h"
+#include "merkle_utils.h"
+
+/** Size of a sparse proof's sibling bitmap, one bit per level. */
+#define SPARSE_BITMAP_SIZE (MERKLE_SPARSE_DEPTH / 8)
+
+/**
+ * @brief Stored node: a key's leaf or a fork of two key paths.
+ *
+ * A node at depth d roots the subtree of the keys sharing its first d bits;
+ * a leaf has depth MERKLE_SPARSE_DEPTH.
+ */
+typedef struct sparse_node {
+  struct sparse_node *child[2];  /**< Subtrees by the key bit at @ref depth (branches only). */
+  unsigned char *value;          /**< Copy of the value (leaves only). */
+  size_t value_size;             /**< Size of @ref value. */
+  unsigned char key[HASH_SIZE];  /**< The key of a leaf; for a branch any key below it. */
+  unsigned char own[HASH_SIZE];  /**< Subtree hash at @ref depth (the value hash for leaves). */
+  unsigned char hash[HASH_SIZE]; /**< Subtree hash at the top of the edge from the parent. */
+  uint16_t depth;                /**< Bit at which a branch forks, or MERKLE_SPARSE_DEPTH. */
+  bool dirty;                    /**< The hashes are stale; set on every ancestor of a change. */
+} sparse_node_t;
+
+/**
+ * @brief Sparse tree state.
+ */
+struct merkle_sparse {
+  const merkle_hash_vtable_t *hash;                           /**< Algorithm of leaves and nodes. */
+  merkle_hash_id_t hash_id;                                   /**< Identifier of @ref hash for proofs. */
+  sparse_node_t *root;                                        /**< Trie root (NULL when empty). */
+  size_t count;                                               /**< Keys stored. */
+  unsigned char defaults[MERKLE_SPARSE_DEPTH + 1][HASH_SIZE]; /**< Empty subtree hash per height. */
+};
+
+/**
+ * @brief Proof of one key.
+ *
+ * Heights count from the leaves: the sibling at height h is the child of the
+ * key's ancestor at depth MERKLE_SPARSE_DEPTH - h - 1 not on the key's path.
+ */
+struct merkle_sparse_proof {
+  merkle_hash_id_t hash;                    /**< Algorithm the proof was hashed with. */
+  unsigned char key[HASH_SIZE];             /**< Key the proof is for. */
+  unsigned char bitmap[SPARSE_BITMAP_SIZE]; /**< Bit h set when the sibling at height h is not empty. */
+  size_t sibling_count;                     /**< Entries in @ref siblings. */
+  unsigned char (*siblings)[HASH_SIZE];     /**< Non-empty siblings, lowest height first. */
+};
+
+/**
+ * @brief Returns bit @p i of @p key, bit 0 being the most significant.
+ */
+static inline int key_bit(const unsigned char *key, size_t i) {
+  return (key[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+/**
+ * @brief Returns the first bit at or after @p from where @p a and @p b
+ *        differ, or MERKLE_SPARSE_DEPTH if none does.
+ */
+static size_t first_diff_bit(const unsigned char *a, const unsigned char *b, size_t from) {
+  for (size_t byte = from >> 3; byte < HASH_SIZE; ++byte) {
+    unsigned diff = (unsigned)(a[byte] ^ b[byte]);
+
+    // Bits of the first byte that lie before @p from do not count
+    if (byte == from >> 3) {
+      diff &= 0xffu >> (from & 7);
+    }
+
+    if (diff) {
+      return byte * 8 + (size_t)(__builtin_clz(diff) - (int)(sizeof(unsigned) * 8 - 8));
+    }
+  }
+
+  return MERKLE_SPARSE_DEPTH;
+}
+
+/**
+ * @brief Hashes the pair @p left || @p right into @p out (which may alias either).
+ */
+static void hash_pair(const merkle_hash_vtable_t *hash, const unsigned char *left, const unsigned char *right,
+                      unsigned char out[HASH_SIZE]) {
+  unsigned char msg[2 * HASH_SIZE];
+  const unsigned char *msgs[1] = {msg};
+  unsigned char *digests[1] = {out};
+
+  memcpy(msg, left, HASH_SIZE);
+  memcpy(msg + HASH_SIZE, right, HASH_SIZE);
+  merkle_hash_batch_fixed(hash, msgs, sizeof(msg), digests, 1);
+}
+
+/**
+ * @brief Fills @p defaults with the hash of an empty subtree of every height.
+ */
+static void compute_defaults(const merkle_hash_vtable_t *hash,
+                             unsigned char defaults[MERKLE_SPARSE_DEPTH + 1][HASH_SIZE]) {
+  memset(defaults[0], 0, HASH_SIZE);
+
+  for (size_t h = 1; h <= MERKLE_SPARSE_DEPTH; ++h) {
+    hash_pair(hash, defaults[h - 1], defaults[h - 1], defaults[h]);
+  }
+}
+
+/**
+ * @brief Raises @p node, the subtree hash at depth @p from of the path
+ *        @p key, to depth @p to through levels whose other child is empty.
+ */
+static void lift_hash(const merkle_sparse_t *tree, const unsigned char *key, size_t from, size_t to,
+                      unsigned char node[HASH_SIZE]) {
+  for (size_t depth = from; depth > to; --depth) {
+    const unsigned char *empty = tree->defaults[MERKLE_SPARSE_DEPTH - depth];
+
+    if (key_bit(key, depth - 1)) {
+      hash_pair(tree->hash, empty, node, node);
+    } else {
+      hash_pair(tree->hash, node, empty, node);
+    }
+  }
+}
+
+/**
+ * @brief Recomputes the hashes of every dirty node of the subtree @p node,
+ *        whose edge from its parent starts at depth @p top.
+ */
+static void rehash_node(const merkle_sparse_t *tree, sparse_node_t *node, size_t top) {
+  if (!node->dirty) {
+    return;
+  }
+
+  if (node->depth < MERKLE_SPARSE_DEPTH) {
+    rehash_node(tree, node->child[0], node->depth + 1u);
+    rehash_node(tree, node->child[1], node->depth + 1u);
+    hash_pair(tree->hash, node->child[0]->hash, node->child[1]->hash, node->own);
+  }
+
+  memcpy(node->hash, node->own, HASH_SIZE);
+  lift_hash(tree, node->key, node->depth, top, node->hash);
+  node->dirty = false;
+}
+
+/**
+ * @brief Frees a node, its value and its whole subtree.
+ */
+static void free_nodes(sparse_node_t *node) {
+  if (!node) {
+    return;
+  }
+
+  if (node->depth < MERKLE_SPARSE_DEPTH) {
+    free_nodes(node->child[0]);
+    free_nodes(node->child[1]);
+  }
+
+  MFree(node->value);
+  MFree(node);
+}
+
+/**
+ * @brief Links a prepared leaf into the trie, or moves its value into the
+ *        existing leaf of the same key.
+ *
+ * Only marks the changed nodes and their ancestors dirty; hashing is left to
+ * rehash_node() so that ancestors shared by a batch are hashed once.
+ *
+ * @param leaf Unlinked leaf with its key, value and value hash set.
+ * @param branch Spare node used if the leaf forks off an existing path.
+ * @param leaf_used Set when @p leaf was linked (otherwise its value was moved out).
+ * @param branch_used Set when @p branch was linked.
+ */
+static void place_leaf(merkle_sparse_t *tree, sparse_node_t *leaf, sparse_node_t *branch, bool *leaf_used,
+                       bool *branch_used) {
+  sparse_node_t *path[MERKLE_SPARSE_DEPTH + 1];
+  size_t path_len = 0;
+  sparse_node_t **slot = &tree->root;
+  size_t top = 0;
+
+  leaf->dirty = true;
+
+  while (*slot) {
+    sparse_node_t *node = *slot;
+    size_t fork = first_diff_bit(leaf->key, node->key, top);
+
+    if (fork < node->depth) {
+      // The key leaves the node's path on its incoming edge: fork it there
+      int bit = key_bit(leaf->key, fork);
+      memcpy(branch->key, leaf->key, HASH_SIZE);
+      branch->depth = (uint16_t)fork;
+      branch->child[bit] = leaf;
+      branch->child[!bit] = node;
+      branch->dirty = true;
+      node->dirty = true;
+      *slot = branch;
+      *leaf_used = true;
+      *branch_used = true;
+      tree->count++;
+      break;
+    }
+
+    if (node->depth == MERKLE_SPARSE_DEPTH) {
+      // Same key: the existing leaf takes over the new value
+      MFree(node->value);
+      node->value = leaf->value;
+      node->value_size = leaf->value_size;
+      memcpy(node->own, leaf->own, HASH_SIZE);
+      node->dirty = true;
+      leaf->value = NULL;
+      break;
+    }
+
+    path[path_len++] = node;
+    slot = &node->child[key_bit(leaf->key, node->depth)];
+    top = node->depth + 1u;
+  }
+
+  if (!*slot) {
+    *slot = leaf;
+    *leaf_used = true;
+    tree->count++;
+  }
+
+  // Ancestors of a dirty node are dirty already, so the walk stops at the first one
+  while (path_len > 0 && !path[path_len - 1]->dirty) {
+    path[--path_len]->dirty = true;
+  }
+}
+
+merkle_sparse_t *merkle_sparse_create(merkle_hash_id_t hash) {
+  const merkle_hash_vtable_t *vtable = merkle_hash_get(hash);
+
+  if (!vtable) {
+    return NULL;
+  }
+
+  ALLOC_AND_INIT(merkle_sparse_t, tree, 1);
+
+  if (!tree) {
+    return NULL;
+  }
+
+  tree->hash = vtable;
+  tree->hash_id = hash;
+  compute_defaults(vtable, tree->defaults);
+  return tree;
+}
+
+void merkle_sparse_destroy(merkle_sparse_t *tree) {
+  if (!tree) {
+    return;
+  }
+
+  free_nodes(tree->root);
+  MFree(tree);
+}
+
+size_t merkle_sparse_count(const merkle_sparse_t *tree) {
+  return tree ? tree->count : 0;
+}
+
+merkle_error_t merkle_sparse_insert(merkle_sparse_t *tree, const unsigned char key[HASH_SIZE], const void *value,
+                                    size_t size) {
+  // Validate input parameters
+  if (!key) {
+    return MERKLE_NULL_ARG;
+  }
+
+  return merkle_sparse_insert_batch(tree, (const unsigned char(*)[HASH_SIZE])key, &value, &size, 1);
+}
+
+merkle_error_t merkle_sparse_insert_batch(merkle_sparse_t *tree, const unsigned char (*keys)[HASH_SIZE],
+                                          const void **values, const size_t *sizes, size_t count) {
+  // Validate input parameters
+  if (!tree || !keys || !values || !sizes) {
+    return MERKLE_NULL_ARG;
+  }
+
+  if (count == 0) {
+    return MERKLE_SUCCESS;
+  }
+
+  if (count > SIZE_MAX / (2 * sizeof(sparse_node_t *))) {
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  // Leaves first, then one spare branch per key: the most a key can add
+  ALLOC_AND_INIT(sparse_node_t *, nodes, 2 * count);
+
+  if (!nodes) {
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  sparse_node_t **leaves = nodes;
+  sparse_node_t **branches = nodes + count;
+
+  // Written inside the protected copy below and read after a jump out of it
+  volatile merkle_error_t ret = MERKLE_SUCCESS;
+
+  for (size_t i = 0; i < 2 * count && ret == MERKLE_SUCCESS; ++i) {
+    ALLOC_AND_INIT_SIMPLE(nodes[i], 1);
+
+    if (!nodes[i]) {
+      ret = MERKLE_FAILED_MEM_ALLOC;
+    }
+  }
+
+  // Initialize signal protection to catch segfaults gracefully
+  merkle_init_signal_protection();
+
+  // Copy keys and values so that nothing is linked before all of them are safe
+  for (size_t i = 0; i < count && ret == MERKLE_SUCCESS; ++i) {
+    sparse_node_t *leaf = leaves[i];
+
+    SAFE_ACCESS_TRY {
+      if (!values[i] || !sizes[i]) {
+        ret = MERKLE_BAD_ARG;
+      } else {
+        leaf->value = MMalloc(sizes[i]);
+
+        if (!leaf->value) {
+          ret = MERKLE_FAILED_MEM_ALLOC;
+        } else {
+          memcpy(leaf->value, values[i], sizes[i]);
+          memcpy(leaf->key, keys[i], HASH_SIZE);
+          leaf->value_size = sizes[i];
+          leaf->depth = MERKLE_SPARSE_DEPTH;
+        }
+      }
+    } SAFE_ACCESS_CATCH {
+      // Segfault occurred during data access
+      ret = MERKLE_BAD_ARG;
+    } SAFE_ACCESS_END;
+  }
+
+  merkle_cleanup_signal_protection();
+
+  // Value hashes go through the SIMD batch; the copies are known to be readable
+  for (size_t first = 0; first < count && ret == MERKLE_SUCCESS; first += MERKLE_SHA256_MAX_LANES) {
+    size_t batch = count - first < MERKLE_SHA256_MAX_LANES ? count - first : MERKLE_SHA256_MAX_LANES;
+    const unsigned char *msgs[MERKLE_SHA256_MAX_LANES];
+    size_t lens[MERKLE_SHA256_MAX_LANES];
+    unsigned char *digests[MERKLE_SHA256_MAX_LANES];
+
+    for (size_t k = 0; k < batch; ++k) {
+      msgs[k] = leaves[first + k]->value;
+      lens[k] = leaves[first + k]->value_size;
+      digests[k] = leaves[first + k]->own;
+    }
+
+    merkle_hash_batch(tree->hash, msgs, lens, digests, batch);
+  }
+
+  if (ret == MERKLE_SUCCESS) {
+    size_t spare = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+      bool leaf_used = false;
+      bool branch_used = false;
+
+      place_leaf(tree, leaves[i], branches[spare], &leaf_used, &branch_used);
+
+      if (leaf_used) {
+        leaves[i] = NULL;
+      }
+
+      if (branch_used) {
+        branches[spare++] = NULL;
+      }
+    }
+
+    rehash_node(tree, tree->root, 0);
+  }
+
+  // Whatever was not linked, including every node after a failure
+  for (size_t i = 0; i < 2 * count; ++i) {
+    if (nodes[i]) {
+      MFree(nodes[i]->value);
+      MFree(nodes[i]);
+    }
+  }
+
+  MFree(nodes);
+  return ret;
+}
+
+merkle_error_t merkle_sparse_remove(merkle_sparse_t *tree, const unsigned char key[HASH_SIZE]) {
+  // Validate input parameters
+  if (!tree || !key) {
+    return MERKLE_NULL_ARG;
+  }
+
+  sparse_node_t *path[MERKLE_SPARSE_DEPTH + 1];
+  size_t path_len = 0;
+  sparse_node_t **parent_slot = NULL;
+  sparse_node_t **slot = &tree->root;
+
+  while (*slot && (*slot)->depth < MERKLE_SPARSE_DEPTH) {
+    path[path_len++] = *slot;
+    parent_slot = slot;
+    slot = &(*slot)->child[key_bit(key, (*slot)->depth)];
+  }
+
+  sparse_node_t *leaf = *slot;
+
+  if (!leaf || memcmp(leaf->key, key, HASH_SIZE) != 0) {
+    return MERKLE_NOT_FOUND;
+  }
+
+  if (!parent_slot) {
+    tree->root = NULL;
+  } else {
+    // The sibling takes the parent's place, its edge now reaching up to the grandparent
+    sparse_node_t *parent = *parent_slot;
+    sparse_node_t *sibling = parent->child[parent->child[0] == leaf];
+
+    sibling->dirty = true;
+    *parent_slot = sibling;
+    MFree(parent);
+    path_len--;
+
+    while (path_len > 0) {
+      path[--path_len]->dirty = true;
+    }
+
+    rehash_node(tree, tree->root, 0);
+  }
+
+  MFree(leaf->value);
+  MFree(leaf);
+  tree->count--;
+  return MERKLE_SUCCESS;
+}
+
+merkle_error_t merkle_sparse_get(const merkle_sparse_t *tree, const unsigned char key[HASH_SIZE],
+                                 const void **value, size_t *size) {
+  // Validate input parameters
+  if (!tree || !key || !value || !size) {
+    return MERKLE_NULL_ARG;
+  }
+
+  const sparse_node_t *node = tree->root;
+
+  while (node && node->depth < MERKLE_SPARSE_DEPTH) {
+    node = node->child[key_bit(key, node->depth)];
+  }
+
+  if (!node || memcmp(node->key, key, HASH_SIZE) != 0) {
+    return MERKLE_NOT_FOUND;
+  }
+
+  *value = node->value;
+  *size = node->value_size;
+  return MERKLE_SUCCESS;
+}
+
+merkle_error_t merkle_sparse_root(const merkle_sparse_t *tree, unsigned char root[HASH_SIZE]) {
+  // Validate input parameters
+  if (!tree || !root) {
+    return MERKLE_NULL_ARG;
+  }
+
+  memcpy(root, tree->root ? tree->root->hash : tree->defaults[MERKLE_SPARSE_DEPTH], HASH_SIZE);
+  return MERKLE_SUCCESS;
+}
+
+merkle_error_t merkle_sparse_prove(const merkle_sparse_t *tree, const unsigned char key[HASH_SIZE],
+                                   merkle_sparse_proof_t **proof) {
+  // Validate input parameters
+  if (!tree || !key || !proof) {
+    return MERKLE_NULL_ARG;
+  }
+
+  // Collected top-down, while the proof lists them bottom-up
+  unsigned char found[MERKLE_SPARSE_DEPTH][HASH_SIZE];
+  size_t heights[MERKLE_SPARSE_DEPTH];
+  size_t found_count = 0;
+  const sparse_node_t *node = tree->root;
+  size_t top = 0;
+
+  while (node) {
+    size_t fork = first_diff_bit(key, node->key, top);
+
+    if (fork < node->depth) {
+      // The key is absent: the whole subtree is the sibling where the paths part
+      memcpy(found[found_count], node->own, HASH_SIZE);
+      lift_hash(tree, node->key, node->depth, fork + 1, found[found_count]);
+      heights[found_count++] = MERKLE_SPARSE_DEPTH - fork - 1;
+      break;
+    }
+
+    if (node->depth == MERKLE_SPARSE_DEPTH) {
+      break;
+    }
+
+    int bit = key_bit(key, node->depth);
+    memcpy(found[found_count], node->child[!bit]->hash, HASH_SIZE);
+    heights[found_count++] = MERKLE_SPARSE_DEPTH - node->depth - 1u;
+    top = node->depth + 1u;
+    node = node->child[bit];
+  }
+
+  ALLOC_AND_INIT(merkle_sparse_proof_t, out, 1);
+
+  if (!out) {
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  if (found_count > 0) {
+    ALLOC_AND_INIT_SIMPLE(out->siblings, found_count);
+
+    if (!out->siblings) {
+      MFree(out);
+      return MERKLE_FAILED_MEM_ALLOC;
+    }
+  }
+
+  out->hash = tree->hash_id;
+  memcpy(out->key, key, HASH_SIZE);
+  out->sibling_count = found_count;
+
+  for (size_t k = 0; k < found_count; ++k) {
+    size_t h = heights[found_count - 1 - k];
+    memcpy(out->siblings[k], found[found_count - 1 - k], HASH_SIZE);
+    out->bitmap[h >> 3] |= (unsigned char)(1u << (h & 7));
+  }
+
+  *proof = out;
+  return MERKLE_SUCCESS;
+}
+
+size_t merkle_sparse_proof_sibling_count(const merkle_sparse_proof_t *proof) {
+  return proof ? proof->sibling_count : 0;
+}
+
+void dealloc_merkle_sparse_proof(merkle_sparse_proof_t *proof) {
+  if (!proof) {
+    return;
+  }
+
+  MFree(proof->siblings);
+  MFree(proof);
+}
+
+/**
+ * @brief Returns the default hashes of @p hash, cached per thread.
+ *
+ * Verifiers rarely switch algorithms, so one table is kept and only
+ * recomputed when a proof of another algorithm comes along.
+ */
+static const unsigned char (*verify_defaults(const merkle_hash_vtable_t *hash))[HASH_SIZE] {
+  static _Thread_local const merkle_hash_vtable_t *cached_hash;
+  static _Thread_local unsigned char defaults[MERKLE_SPARSE_DEPTH + 1][HASH_SIZE];
+
+  if (cached_hash != hash) {
+    compute_defaults(hash, defaults);
+    cached_hash = hash;
+  }
+
+  return (const unsigned char(*)[HASH_SIZE])defaults;
+}
+
+merkle_error_t merkle_sparse_verify(const unsigned char root[HASH_SIZE], const unsigned char key[HASH_SIZE],
+                                    const void *value, size_t size, const merkle_sparse_proof_t *proof) {
+  // Validate input parameters
+  if (!root || !key || !proof) {
+    return MERKLE_NULL_ARG;
+  }
+
+  const merkle_hash_vtable_t *hash = merkle_hash_get(proof->hash);
+
+  if (!hash || (value && size == 0)) {
+    return MERKLE_BAD_ARG;
+  }
+
+  if (memcmp(proof->key, key, HASH_SIZE) != 0) {
+    return MERKLE_PROOF_INVALID;
+  }
+
+  const unsigned char (*defaults)[HASH_SIZE] = verify_defaults(hash);
+  unsigned char node[HASH_SIZE];
+  size_t next = 0;
+
+  if (value) {
+    const unsigned char *msgs[1] = {value};
+    unsigned char *digests[1] = {node};
+    merkle_hash_batch(hash, msgs, &size, digests, 1);
+  } else {
+    memcpy(node, defaults[0], HASH_SIZE);
+  }
+
+  for (size_t h = 0; h < MERKLE_SPARSE_DEPTH; ++h) {
+    const unsigned char *sibling = defaults[h];
+
+    if (proof->bitmap[h >> 3] & (1u << (h & 7))) {
+      if (next == proof->sibling_count) {
+        return MERKLE_PROOF_INVALID;
+      }
+
+      sibling = proof->siblings[next++];
+    }
+
+    if (key_bit(key, MERKLE_SPARSE_DEPTH - h - 1)) {
+      hash_pair(hash, sibling, node, node);
+    } else {
+      hash_pair(hash, node, sibling, node);
+    }
+  }
+
+  if (next != proof->sibling_count || memcmp(node, root, HASH_SIZE) != 0) {
+    return MERKLE_PROOF_INVALID;
+  }
+
+  return MERKLE_SUCCESS;
+}
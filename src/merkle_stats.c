@@ -0,0 +1,36 @@
+/**
+ * @file merkle_stats.c
+ * @brief Global counters and snapshots for merkle_get_stats().
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <time.h>
+
+#include "merkle_stats.h"
+
+merkle_stat_counters_t merkle_global_stats;
+
+uint64_t merkle_stat_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void merkle_stat_snapshot(const merkle_stat_counters_t *counters, merkle_stats_t *out) {
+  // Counters move independently, so a snapshot is a set of relaxed reads
+  out->leaf_hash_ns = atomic_load_explicit(&counters->leaf_hash_ns, memory_order_relaxed);
+  out->leaf_hashes = atomic_load_explicit(&counters->leaf_hashes, memory_order_relaxed);
+  out->node_hash_ns = atomic_load_explicit(&counters->node_hash_ns, memory_order_relaxed);
+  out->node_hashes = atomic_load_explicit(&counters->node_hashes, memory_order_relaxed);
+  out->bytes_hashed = atomic_load_explicit(&counters->bytes_hashed, memory_order_relaxed);
+  out->allocations = atomic_load_explicit(&counters->allocations, memory_order_relaxed);
+  out->allocated_bytes = atomic_load_explicit(&counters->allocated_bytes, memory_order_relaxed);
+  out->frees = atomic_load_explicit(&counters->frees, memory_order_relaxed);
+  out->read_lock_wait_ns = atomic_load_explicit(&counters->read_lock_wait_ns, memory_order_relaxed);
+  out->read_locks = atomic_load_explicit(&counters->read_locks, memory_order_relaxed);
+  out->write_lock_wait_ns = atomic_load_explicit(&counters->write_lock_wait_ns, memory_order_relaxed);
+  out->write_locks = atomic_load_explicit(&counters->write_locks, memory_order_relaxed);
+  out->proofs_generated = atomic_load_explicit(&counters->proofs_generated, memory_order_relaxed);
+}
@@ -0,0 +1,300 @@
+/**
+ * @file merkle_thread_pool.c
+ * @brief Fixed-size worker pool and parallel range loop.
+ *
+ * Workers pull tasks from a ::queue_t guarded by a mutex and condition
+ * variable. merkle_parallel_for() hands the pool a shared job descriptor
+ * whose chunks are claimed with an atomic counter, so workers and the
+ * calling thread balance the load between themselves.
+ *
+ * @author Guy Alster
+ * @date 2026-10-14
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "Merkle.h"
+#include "MerkleQueue.h"
+#include "merkle_thread_pool.h"
+#include "merkle_utils.h"
+
+/** Chunks handed out per worker, so uneven chunks still balance out. */
+#define CHUNKS_PER_WORKER (4)
+
+/**
+ * @brief A queued unit of work.
+ */
+typedef struct merkle_pool_task {
+  merkle_task_fn fn; /**< Function to run. */
+  void *arg;         /**< Argument for @ref fn. */
+} merkle_pool_task_t;
+
+/**
+ * @brief Worker pool state.
+ */
+struct merkle_thread_pool {
+  pthread_t *threads;      /**< Worker thread handles. */
+  size_t thread_count;     /**< Number of started workers. */
+  queue_t *tasks;          /**< Pending merkle_pool_task_t entries. */
+  pthread_mutex_t mutex;   /**< Protects @ref tasks and @ref shutting_down. */
+  pthread_cond_t has_work; /**< Signalled when a task is queued or on shutdown. */
+  bool shutting_down;      /**< Set once destruction has started. */
+};
+
+/**
+ * @brief Shared state of one merkle_parallel_for() call.
+ *
+ * Reference counted because helper tasks may still be queued after the
+ * caller has seen every chunk complete and returned.
+ */
+typedef struct merkle_parallel_job {
+  merkle_range_fn fn;         /**< Range function to run. */
+  void *ctx;                  /**< Context for @ref fn. */
+  size_t count;               /**< Total number of items. */
+  size_t chunk;               /**< Items per chunk. */
+  size_t chunk_total;         /**< Number of chunks. */
+  atomic_size_t next_chunk;   /**< Next unclaimed chunk. */
+  atomic_size_t chunks_done;  /**< Chunks fully processed. */
+  atomic_size_t refs;         /**< Caller plus queued helpers. */
+  pthread_mutex_t mutex;      /**< Guards waiting on @ref done. */
+  pthread_cond_t done;        /**< Signalled when the last chunk completes. */
+} merkle_parallel_job_t;
+
+/**
+ * @brief Queue deallocator for tasks still pending at shutdown.
+ */
+static void free_task(void *task) {
+  MFree(task);
+}
+
+/**
+ * @brief Worker thread main loop: run tasks until shutdown drains the queue.
+ */
+static void *pool_worker(void *arg) {
+  merkle_thread_pool_t *pool = arg;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->mutex);
+
+    while (!get_queue_size(pool->tasks) && !pool->shutting_down) {
+      pthread_cond_wait(&pool->has_work, &pool->mutex);
+    }
+
+    merkle_pool_task_t *task = pop_queue(pool->tasks);
+    pthread_mutex_unlock(&pool->mutex);
+
+    // Only an empty queue during shutdown yields no task
+    if (!task) {
+      return NULL;
+    }
+
+    task->fn(task->arg);
+    MFree(task);
+  }
+}
+
+/**
+ * @brief Stops and joins the first @p started workers, then frees the pool.
+ */
+static void shutdown_pool(merkle_thread_pool_t *pool, size_t started) {
+  pthread_mutex_lock(&pool->mutex);
+  pool->shutting_down = true;
+  pthread_cond_broadcast(&pool->has_work);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (size_t i = 0; i < started; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  free_queue(pool->tasks, free_task);
+  pthread_cond_destroy(&pool->has_work);
+  pthread_mutex_destroy(&pool->mutex);
+  MFree(pool->threads);
+  MFree(pool);
+}
+
+merkle_thread_pool_t *merkle_thread_pool_create(size_t thread_count) {
+  if (thread_count == 0) {
+    return NULL;
+  }
+
+  merkle_thread_pool_t *pool;
+  ALLOC_AND_INIT_SIMPLE(pool, 1);
+
+  if (!pool) {
+    return NULL;
+  }
+
+  ALLOC_AND_INIT_SIMPLE(pool->threads, thread_count);
+  pool->tasks = init_queue();
+
+  if (!pool->threads || !pool->tasks) {
+    free_queue(pool->tasks, NULL);
+    MFree(pool->threads);
+    MFree(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->has_work, NULL);
+
+  for (size_t i = 0; i < thread_count; ++i) {
+    if (pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0) {
+      shutdown_pool(pool, i);
+      return NULL;
+    }
+  }
+
+  pool->thread_count = thread_count;
+  return pool;
+}
+
+void merkle_thread_pool_destroy(merkle_thread_pool_t *pool) {
+  if (!pool) {
+    return;
+  }
+
+  shutdown_pool(pool, pool->thread_count);
+}
+
+size_t merkle_thread_pool_size(const merkle_thread_pool_t *pool) {
+  return pool ? pool->thread_count : 0;
+}
+
+merkle_error_t merkle_thread_pool_submit(merkle_thread_pool_t *pool, merkle_task_fn fn, void *arg) {
+  if (!pool || !fn) {
+    return MERKLE_NULL_ARG;
+  }
+
+  ALLOC_AND_INIT(merkle_pool_task_t, task, 1);
+
+  if (!task) {
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  task->fn = fn;
+  task->arg = arg;
+
+  pthread_mutex_lock(&pool->mutex);
+  queue_result_t pushed = push_queue(pool->tasks, task);
+
+  if (pushed == QUEUE_OK) {
+    pthread_cond_signal(&pool->has_work);
+  }
+
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (pushed != QUEUE_OK) {
+    MFree(task);
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Drops one reference to a job, freeing it with the last one.
+ */
+static void release_job(merkle_parallel_job_t *job) {
+  if (atomic_fetch_sub(&job->refs, 1) != 1) {
+    return;
+  }
+
+  pthread_cond_destroy(&job->done);
+  pthread_mutex_destroy(&job->mutex);
+  MFree(job);
+}
+
+/**
+ * @brief Claims and processes chunks until none are left.
+ */
+static void run_job_chunks(merkle_parallel_job_t *job) {
+  for (;;) {
+    size_t chunk = atomic_fetch_add(&job->next_chunk, 1);
+
+    if (chunk >= job->chunk_total) {
+      return;
+    }
+
+    size_t begin = chunk * job->chunk;
+    size_t end = job->count - begin < job->chunk ? job->count : begin + job->chunk;
+    job->fn(job->ctx, begin, end);
+
+    if (atomic_fetch_add(&job->chunks_done, 1) + 1 == job->chunk_total) {
+      pthread_mutex_lock(&job->mutex);
+      pthread_cond_broadcast(&job->done);
+      pthread_mutex_unlock(&job->mutex);
+    }
+  }
+}
+
+/**
+ * @brief Pool task body of a merkle_parallel_for() helper.
+ */
+static void parallel_helper(void *arg) {
+  merkle_parallel_job_t *job = arg;
+  run_job_chunks(job);
+  release_job(job);
+}
+
+void merkle_parallel_for(merkle_thread_pool_t *pool, size_t count, size_t grain,
+                         merkle_range_fn fn, void *ctx) {
+  if (!fn || count == 0) {
+    return;
+  }
+
+  grain = grain ? grain : 1;
+  size_t workers = merkle_thread_pool_size(pool);
+
+  if (workers == 0 || count <= grain) {
+    fn(ctx, 0, count);
+    return;
+  }
+
+  ALLOC_AND_INIT(merkle_parallel_job_t, job, 1);
+
+  // Without a job descriptor the work still gets done, just serially
+  if (!job) {
+    fn(ctx, 0, count);
+    return;
+  }
+
+  size_t target_chunks = (workers + 1) * CHUNKS_PER_WORKER;
+  size_t chunk = (count + target_chunks - 1) / target_chunks;
+
+  job->fn = fn;
+  job->ctx = ctx;
+  job->count = count;
+  job->chunk = chunk < grain ? grain : chunk;
+  job->chunk_total = (count + job->chunk - 1) / job->chunk;
+  atomic_init(&job->next_chunk, 0);
+  atomic_init(&job->chunks_done, 0);
+  atomic_init(&job->refs, 1);
+  pthread_mutex_init(&job->mutex, NULL);
+  pthread_cond_init(&job->done, NULL);
+
+  size_t helpers = job->chunk_total - 1 < workers ? job->chunk_total - 1 : workers;
+
+  for (size_t i = 0; i < helpers; ++i) {
+    atomic_fetch_add(&job->refs, 1);
+
+    if (merkle_thread_pool_submit(pool, parallel_helper, job) != MERKLE_SUCCESS) {
+      // Fewer helpers only means the caller processes more chunks itself
+      atomic_fetch_sub(&job->refs, 1);
+      break;
+    }
+  }
+
+  run_job_chunks(job);
+
+  pthread_mutex_lock(&job->mutex);
+  while (atomic_load(&job->chunks_done) < job->chunk_total) {
+    pthread_cond_wait(&job->done, &job->mutex);
+  }
+  pthread_mutex_unlock(&job->mutex);
+
+  release_job(job);
+}
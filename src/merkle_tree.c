@@ -1,35 +1,86 @@
 /**
  * @file merkle_tree.c
- * @brief Implementation of a Merkle tree using SHA-256 and a queue-based
- * approach.
+ * @brief Implementation of a Merkle tree using SHA-256, built level by level.
  *
  * This file provides the implementation for creating, destroying, and managing
- * Merkle trees. It includes utility functions for hashing, memory management,
- * and queue operations, as well as internal data structures for Merkle nodes,
- * proofs, and queue elements.
+ * Merkle trees. It includes utility functions for hashing and memory
+ * management, as well as internal data structures for Merkle nodes and
+ * proofs.
  *
  * @author Guy Alster
  * @date 2025-05-25
  */
 
+#include <limits.h>
 #include <openssl/sha.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "Merkle.h"
-#include "MerkleQueue.h"
+#include "merkle_arena.h"
+#include "merkle_async.h"
+#include "merkle_hash.h"
+#include "merkle_index.h"
+#include "merkle_proof.h"
+#include "merkle_reader.h"
+#include "merkle_shard.h"
+#include "merkle_sha256.h"
+#include "merkle_stats.h"
+#include "merkle_thread_pool.h"
 #include "merkle_utils.h"
 #include "locking.h"
 
 
-/** True if there is only one element left in the queue. */
-#define IS_LAST_ELEMENT(size) (size) == 1
+/** Minimum leaves per chunk when leaf hashing is split across threads. */
+#define PARALLEL_LEAF_GRAIN (1024)
 
-/** True if we're processing the leaf nodes level (level 0). */
-#define IS_LEAF_NODES_LEVEL(tree_lvl) (tree_lvl) == 0
+/** Minimum parents per chunk when a tree level is split across threads. */
+#define PARALLEL_NODE_GRAIN (512)
+
+/** Minimum proofs per chunk when a proof batch is split across threads. */
+#define PARALLEL_PROOF_GRAIN (256)
+
+
+/** Leading bytes of a saved tree file. */
+#define MERKLE_FILE_MAGIC "MKLT"
+
+/** Saved tree format revision. */
+#define MERKLE_FILE_VERSION (1)
+
+/** Bytes before the first hash of a saved tree; keeps the hash arrays 64-byte aligned. */
+#define MERKLE_FILE_HEADER_SIZE (64)
+
+/** Offsets of the saved tree header fields. */
+#define MERKLE_FILE_OFFSET_VERSION (4)
+#define MERKLE_FILE_OFFSET_HASH_ID (5)
+#define MERKLE_FILE_OFFSET_BRANCHING (8)
+#define MERKLE_FILE_OFFSET_LEAF_COUNT (16)
+#define MERKLE_FILE_OFFSET_LEVELS (24)
+
+/** Hashes buffered per level while saving a pointer-layout tree. */
+#define SAVE_BUFFER_HASHES (256)
+
+/** Deepest tree a size_t leaf count can produce with a branching factor of 2. */
+#define POINTER_MAX_LEVELS (sizeof(size_t) * CHAR_BIT)
+
+/** Most bytes of one MERKLE_LAYOUT_BLOCKED block: a page, so a block costs one TLB entry. */
+#define FLAT_BLOCK_BYTES (4096)
+
+/** Most levels of one MERKLE_LAYOUT_BLOCKED block (a binary tree fits 6 in a page). */
+#define FLAT_BLOCK_MAX_LEVELS (8)
+
+/** Hashes per 64-byte cache line, the smallest alignment of a blocked subtree. */
+#define FLAT_LINE_SLOTS (64 / HASH_SIZE)
 
 /**
  * @brief Represents a node in the Merkle tree.
@@ -38,41 +89,100 @@ typedef struct merkle_node {
     unsigned char hash[HASH_SIZE];   /**< SHA-256 hash of this node. */
     void *data;                      /**< Data stored in leaf nodes (NULL for internal nodes). */
     struct merkle_node **children;   /**< Array of child node pointers. */
-    struct merkle_node *parent;      /**< Pointer to parent node (NULL for root). */
-    size_t index_in_parent;          /**< Index of this node in parent's children array. */
+    unsigned char (*child_hashes)[HASH_SIZE]; /**< Children's hashes in order, refreshed whenever this node is hashed. */
+    struct merkle_node *parent;      /**< Pointer to parent node (NULL for root; unset in versions). */
+    atomic_size_t refs;              /**< Owners of a node allocated by derive_merkle_tree(); 0 for arena nodes. */
     size_t child_count;              /**< Number of children this node has. */
 } merkle_node_t;
 
+/**
+ * @brief Subtree-blocked node order of a MERKLE_LAYOUT_BLOCKED tree.
+ *
+ * Levels are cut into bands of @ref levels levels counted from the leaves.
+ * Each node on the level just above a band roots one block holding its
+ * descendants within the band, row by row, so a block is at most a page and
+ * a leaf-to-root walk touches one block per band. Every row of a block is a
+ * run of whole sibling groups, which keeps the children of any node
+ * contiguous as in level order. The root is stored last.
+ */
+typedef struct flat_block_map {
+  size_t levels;                                  /**< Levels per full band (0 for plain level order). */
+  size_t root_level;                              /**< Level of the root. */
+  size_t row_span[FLAT_BLOCK_MAX_LEVELS + 1];     /**< Nodes of row r below one block root: bf^r. */
+  size_t row_start[FLAT_BLOCK_MAX_LEVELS + 2];    /**< First slot of row r within a block. */
+  size_t band_base[POINTER_MAX_LEVELS + 1];       /**< First slot of each band; the last entry is the root's. */
+  size_t band_stride[POINTER_MAX_LEVELS];         /**< Slots from one block of a band to the next. */
+} flat_block_map_t;
+
+/**
+ * @brief Contiguous node storage used by MERKLE_LAYOUT_FLAT and MERKLE_LAYOUT_BLOCKED.
+ *
+ * Level 0 holds the leaf hashes and level @c levels holds the root. The
+ * children of node @c i on level @c l are nodes
+ * [i * branching_factor, (i + 1) * branching_factor) of level @c l - 1, so no
+ * parent or children pointers are stored. Nodes are reached through
+ * flat_node(), which knows the order they are stored in.
+ */
+typedef struct merkle_flat_storage {
+  unsigned char (*hashes)[HASH_SIZE]; /**< Every node hash, in level order or subtree-blocked order. */
+  size_t *level_offsets;              /**< levels + 2 entries: first node of each level, then the node total. */
+  flat_block_map_t blocks;            /**< Blocked order, when @ref blocks.levels is not 0. */
+  void *hash_block;                   /**< Allocation holding a page-aligned @ref hashes (blocked order only). */
+  unsigned char *leaf_data;           /**< NUL-terminated copies of all leaf blocks, back to back. */
+  size_t *leaf_offsets;               /**< leaf_count + 1 offsets into @ref leaf_data. */
+  unsigned char **leaf_overrides;     /**< Per-leaf replacement copies whose size no longer fits their slot (lazily allocated). */
+} merkle_flat_storage_t;
+
 /**
  * @brief Represents a Merkle tree.
  */
 struct merkle_tree {
   rw_lock_t lock;
-  merkle_node_t *root;    /**< Root node of the tree. */
-  merkle_node_t **leaves; /**< Array of leaf nodes. */
+  merkle_node_t *root;    /**< Root node of the tree (pointer layout). */
+  merkle_node_t **leaves; /**< Array of leaf nodes (pointer layout). */
   size_t leaf_count;      /**< Number of leaves. */
   size_t levels;          /**< Number of levels in the tree. */
   size_t branching_factor;
+  merkle_layout_t layout;     /**< Storage layout chosen at creation; blocked trees are MERKLE_LAYOUT_FLAT. */
+  merkle_flat_storage_t flat; /**< Node storage when layout is MERKLE_LAYOUT_FLAT. */
+  merkle_leaf_storage_t leaf_storage; /**< What is kept of each leaf's data. */
+  const void **borrowed;              /**< Caller block pointers (MERKLE_LEAF_BORROW). */
+  merkle_leaf_lookup leaf_lookup;     /**< Finder data source when no data is retained. */
+  void *leaf_lookup_ctx;              /**< Context for @ref leaf_lookup. */
+  void *mapping;                      /**< Read-only file mapping backing flat.hashes (open_merkle_tree_mmap). */
+  size_t mapping_size;                /**< Length of @ref mapping in bytes. */
+  merkle_arena_t *arena;              /**< Every pointer-layout node, child array and leaf copy. */
+  atomic_size_t version;              /**< Snapshot version of the hashes; odd while an update is publishing. */
+  size_t detached_leaves;             /**< Pointer-layout leaves whose data moved to a heap copy. */
+  merkle_tree_t *origin;              /**< Tree whose arena a version's shared nodes live in (NULL unless a version). */
+  atomic_size_t refs;                 /**< The caller's handle plus every version sharing the arena. */
+  bool frozen;                        /**< Nodes are shared with versions, so the tree no longer updates in place. */
+  merkle_leaf_index_t index_kind;     /**< What @ref index is keyed by. */
+  merkle_index_t *index;              /**< Content index for generate_proof_by_key() (NULL without one). */
+  merkle_key_extractor key_extractor; /**< Leaf keys of a MERKLE_INDEX_KEY index. */
+  void *key_extractor_ctx;            /**< Context for @ref key_extractor. */
+  merkle_hash_id_t hash_id;           /**< Identifier of @ref hash, recorded in proofs and files. */
+  const merkle_hash_vtable_t *hash;   /**< Algorithm of every leaf and node hash. */
+  bool guarded;                       /**< Caller arrays are read under signal protection. */
+  merkle_stat_counters_t stats;       /**< Hot-path counters (only updated with MERKLE_STATS). */
+  const atomic_bool *cancel;          /**< Raised to abandon the build in progress (NULL when not cancellable). */
 };
 
+
 /**
- * @brief Represents a single item in a Merkle proof path.
+ * @brief Counters of @p tree; they are atomics, so readers may book too.
  */
-struct merkle_proof_item {
-    unsigned char (*sibling_hashes)[HASH_SIZE]; /**< Arrays of sibling hashes at this level. */
-    size_t sibling_count;           /**< Number of siblings at this level. */
-    size_t node_position;           /**< Position of our node among siblings. */
-};
+static inline merkle_stat_counters_t *tree_stats(const merkle_tree_t *tree){
+  return (merkle_stat_counters_t *)&tree->stats;
+}
 
 /**
- * @brief Represents a complete Merkle proof.
+ * @brief Reports whether the caller of an asynchronous build asked to abandon it.
  */
-struct merkle_proof{
-    merkle_proof_item_t **path;  /**< Array of proof items from leaf to root. */
-    size_t path_length;          /**< Length of the proof path. */
-    size_t leaf_index;           /**< Index of the leaf being proven. */
-    size_t branching_factor;     /**< Branching factor of the tree. */
-};
+static inline bool build_cancelled(const merkle_tree_t *tree){
+  return tree->cancel && atomic_load_explicit(tree->cancel, memory_order_relaxed);
+}
+
 
 /**
  * @brief Destroys a Merkle tree and frees all associated memory.
@@ -119,17 +229,88 @@ merkle_error_t generate_proof_from_index(merkle_tree_t *const tree, size_t leaf_
  merkle_error_t generate_proof_by_finder(merkle_tree_t *const tree, value_finder finder, size_t *path_length, merkle_proof_t** proof);
 
 /**
- * @brief Recursively deallocates a Merkle tree node and its children.
- * @param e Pointer to the Merkle node to deallocate.
+ * @brief Replaces one leaf's data and rehashes its path to the root.
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param leaf_index Index of the leaf to replace.
+ * @param data New data block.
+ * @param size Size of the new data block.
+ * @return MERKLE_SUCCESS on success, error code on failure.
+ */
+merkle_error_t update_leaf(merkle_tree_t *const tree, size_t leaf_index, const void *data, size_t size);
+
+/**
+ * @brief Replaces several leaves and rehashes each affected ancestor once.
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param leaf_indices Indices of the leaves to replace.
+ * @param data New data blocks.
+ * @param sizes Sizes of the new data blocks.
+ * @param count Number of replacements.
+ * @return MERKLE_SUCCESS on success, error code on failure.
+ */
+merkle_error_t update_leaves(merkle_tree_t *const tree, const size_t *leaf_indices, const void **data,
+                             const size_t *sizes, size_t count);
+
+/**
+ * @brief Reports a buffer size able to hold any leaf's serialized proof.
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param size Pointer to store the size in bytes.
+ * @return MERKLE_SUCCESS on success, error code on failure.
+ */
+merkle_error_t merkle_proof_max_size(merkle_tree_t *const tree, size_t *size);
+
+/**
+ * @brief Serializes one leaf's proof into a caller-provided buffer.
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param leaf_index Index of the leaf to prove.
+ * @param buffer Destination buffer.
+ * @param capacity Size of the destination buffer.
+ * @param written Pointer to store the proof size.
+ * @return MERKLE_SUCCESS on success, error code on failure.
+ */
+merkle_error_t generate_proof_into(merkle_tree_t *const tree, size_t leaf_index, void *buffer, size_t capacity,
+                                   size_t *written);
+
+/**
+ * @brief Serializes many leaves' proofs into one buffer under one read lock.
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param leaf_indices Leaves to prove.
+ * @param count Number of leaf indices.
+ * @param pool Pool to write on (NULL writes serially).
+ * @param buffer Destination buffer.
+ * @param capacity Size of the destination buffer.
+ * @param offsets Pointer to store count + 1 proof offsets.
+ * @param written Pointer to store the total size.
+ * @return MERKLE_SUCCESS on success, error code on failure.
+ */
+merkle_error_t generate_proofs_batch(merkle_tree_t *const tree, const size_t *leaf_indices, size_t count,
+                                     merkle_thread_pool_t *pool, void *buffer, size_t capacity, size_t *offsets,
+                                     size_t *written);
+
+/**
+ * @brief Writes a tree's hashes and shape to a file.
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param path Destination file.
+ * @return MERKLE_SUCCESS on success, error code on failure.
+ */
+merkle_error_t save_merkle_tree(merkle_tree_t *const tree, const char *path);
+
+/**
+ * @brief Opens a saved tree as a read-only memory mapping.
+ * @param path File written by save_merkle_tree().
+ * @return Pointer to the mapped tree, or NULL on failure.
  */
-static void dealloc_hash_node(void *e);
+merkle_tree_t *open_merkle_tree_mmap(const char *path);
 
 /**
- * @brief Cleans up next level array and deallocates all nodes.
- * @param next_level Pointer to pointer to the next level array.
- * @param num_of_nodes Number of nodes in the array.
+ * @brief Generates one deduplicated proof for a set of leaves.
+ * @param tree Pointer to the Merkle tree (must not be NULL).
+ * @param leaf_indices Leaves to prove.
+ * @param count Number of leaf indices.
+ * @param proof Pointer to store the generated proof.
+ * @return MERKLE_SUCCESS on success, error code on failure.
  */
-static void clean_up_next_level(merkle_node_t ***next_level, size_t num_of_nodes);
+merkle_error_t generate_multiproof(merkle_tree_t *const tree, const size_t *leaf_indices, size_t count,
+                                   merkle_multiproof_t **proof);
 
 /**
  * @brief Cleans up tree structure and deallocates memory.
@@ -138,300 +319,767 @@ static void clean_up_next_level(merkle_node_t ***next_level, size_t num_of_nodes
 static void clean_up_tree(merkle_tree_t **tree_ptr);
 
 /**
- * @brief Hashes a data block using SHA-256.
- * @param data Pointer to the data.
- * @param size Size of the data.
- * @param out Output buffer for the hash (must be HASH_SIZE bytes).
+ * @brief Hashes a batch of independent data blocks using SHA-256.
+ *
+ * The batch is handed to the SIMD backend in one call, so blocks of similar
+ * size are hashed side by side.
+ *
+ * @param hash Algorithm of the tree being hashed.
+ * @param data Pointers to the data blocks.
+ * @param size Sizes of the data blocks.
+ * @param out Output buffers for the hashes (each HASH_SIZE bytes).
+ * @param count Number of blocks in the batch.
  * @return MERKLE_SUCCESS on success, error code otherwise.
  */
-static merkle_error_t hash_data_block(const void *data, size_t size,
-                                      unsigned char out[HASH_SIZE]);
+static merkle_error_t hash_data_blocks(const merkle_hash_vtable_t *hash, const void *const *data, const size_t *size,
+                                       unsigned char *const *out, size_t count);
+
+/**
+ * @brief hash_data_blocks() over leaf blocks, booked as leaf hashing.
+ * @param stats Counters of the tree being hashed (NULL books globally only).
+ */
+static merkle_error_t hash_leaf_blocks(merkle_stat_counters_t *stats, const merkle_hash_vtable_t *hash,
+                                       const void *const *data, const size_t *size,
+                                       unsigned char *const *out, size_t count);
+
+/**
+ * @brief hash_data_blocks() over child hash runs, booked as node hashing.
+ * @param stats Counters of the tree being hashed (NULL books globally only).
+ */
+static merkle_error_t hash_node_blocks(merkle_stat_counters_t *stats, const merkle_hash_vtable_t *hash,
+                                       const void *const *data, const size_t *size,
+                                       unsigned char *const *out, size_t count);
 
 /**
  * @brief Hashes a Merkle node by combining the hashes of its children.
+ * @param stats Counters of the tree being hashed (NULL books globally only).
+ * @param hash Algorithm of the tree being hashed.
  * @param parent Pointer to the Merkle node to hash.
  * @return MERKLE_SUCCESS on success, error code otherwise.
  **/
-static merkle_error_t hash_merkle_node(merkle_node_t *parent);
+static merkle_error_t hash_merkle_node(merkle_stat_counters_t *stats, const merkle_hash_vtable_t *hash,
+                                       merkle_node_t *parent);
 
 /**
- * @brief Builds a Merkle tree from a queue of elements.
- * @param queue Pointer to the queue.
- * @param result Output pointer to the resulting Merkle tree.
+ * @brief Builds the levels above the leaves of a pointer-layout tree.
+ * @param tree Tree whose leaves are filled and hashed.
+ * @param pool Pool to hash each level on (NULL hashes serially).
  * @return MERKLE_SUCCESS on success, error code otherwise.
  */
-static merkle_error_t build_tree_from_queue(queue_t *queue, merkle_tree_t *tree);
+static merkle_error_t build_tree_levels(merkle_tree_t *tree, merkle_thread_pool_t *pool);
 
 /**
  * @brief Adds proof path information for a node and its siblings.
  * @param parent Parent node containing siblings.
- * @param node The current node in the proof path.
+ * @param position Index of the current node among the parent's children.
+ * @param proof_item Proof item to populate with sibling information.
+ * @return MERKLE_SUCCESS on success, error code otherwise.
+ */
+static merkle_error_t add_proof_path(const merkle_node_t *parent, size_t position, merkle_proof_item_t *proof_item);
+
+/**
+ * @brief Adds proof path information for a node of a flat-layout tree.
+ * @param tree Tree using MERKLE_LAYOUT_FLAT.
+ * @param level Level of the node in the proof path (0 for leaves).
+ * @param index Index of the node on @p level.
  * @param proof_item Proof item to populate with sibling information.
  * @return MERKLE_SUCCESS on success, error code otherwise.
  */
-static merkle_error_t add_proof_path(merkle_node_t *parent, merkle_node_t *node, merkle_proof_item_t *proof_item);
+static merkle_error_t add_flat_proof_path(const merkle_tree_t *tree, size_t level, size_t index, merkle_proof_item_t *proof_item);
 
 static merkle_error_t generate_proof(merkle_tree_t *const tree, size_t leaf_index, merkle_proof_t **proof);
 
 /**
- * @brief Initializes a new Merkle tree structure.
- * @param tree Pointer to tree pointer to initialize.
- * @param leafs Number of leaf nodes the tree will contain.
- * @return MERKLE_SUCCESS on success, error code otherwise.
+ * @brief Frees a proof built by generate_proof(), including partially built ones.
+ * @param proof Proof to free (can be NULL).
  */
-static merkle_error_t init_tree(merkle_tree_t **tree, size_t leafs, size_t branching_factor){
-  // Validate input parameters
-  if(!tree){
-    return MERKLE_NULL_ARG;
-  }
+static void free_proof(merkle_proof_t *proof);
 
-  // Initialize output pointer
-  *tree = NULL;
-  merkle_tree_t *tr;
-  ALLOC_AND_INIT_SIMPLE(tr, 1);
-  
-  if(!tr){
-    return MERKLE_FAILED_MEM_ALLOC;
-  }
+/**
+ * @brief Drops one owner of a node allocated by derive_merkle_tree().
+ * @param node Node to release (NULL and arena nodes are ignored).
+ */
+static void release_node(merkle_node_t *node);
 
-  ALLOC_AND_INIT_SIMPLE(tr->leaves, leafs);
+/**
+ * @brief Builds a pointer-layout tree with its nodes carved from one arena.
+ * @param tree Initialized tree to populate.
+ * @param data Array of pointers to data blocks.
+ * @param size Array of sizes for each data block.
+ * @param pool Pool to build on (NULL builds serially).
+ * @return MERKLE_SUCCESS on success, error code otherwise.
+ */
+static merkle_error_t build_pointer_tree(merkle_tree_t *tree, const void **data, const size_t *size,
+                                         merkle_thread_pool_t *pool);
 
-  if(tr->leaves == NULL){
-      MFree(tr);
-      return MERKLE_FAILED_MEM_ALLOC;
-  }
+/**
+ * @brief Builds a flat-layout tree into contiguous per-level hash arrays.
+ * @param tree Initialized tree to populate.
+ * @param data Array of pointers to data blocks.
+ * @param size Array of sizes for each data block.
+ * @param pool Pool to build on (NULL builds serially).
+ * @return MERKLE_SUCCESS on success, error code otherwise.
+ */
+static merkle_error_t build_flat_tree(merkle_tree_t *tree, const void **data, const size_t *size,
+                                      merkle_thread_pool_t *pool);
 
-  // Set leaf count and return initialized tree
-  tr->leaf_count = leafs;
-  tr->branching_factor = branching_factor;
-  RW_LOCK_INIT(&tr->lock);
-  *tree = tr;
-  return MERKLE_SUCCESS;
-}
+/**
+ * @brief Fills the content index of a freshly built tree, if it asked for one.
+ * @param tree Built tree.
+ * @param data Array of pointers to data blocks.
+ * @param size Array of sizes for each data block.
+ * @param pool Pool to extract keys on (NULL works serially).
+ * @return MERKLE_SUCCESS on success, error code otherwise.
+ */
+static merkle_error_t build_leaf_index(merkle_tree_t *tree, const void **data, const size_t *size,
+                                       merkle_thread_pool_t *pool);
 
-static void dealloc_hash_node(void *e) {
-  // Check for null pointer
-  if (!e) {
-    return;
-  }
+/**
+ * @brief Checks every data block and sums their sizes.
+ *
+ * Runs on the calling thread under signal protection, when @p guarded, so
+ * that a @p count larger than the arrays is reported instead of crashing.
+ *
+ * @param data Array of pointers to data blocks.
+ * @param size Array of sizes for each data block.
+ * @param count Number of data blocks.
+ * @param guarded Whether signal protection is armed.
+ * @param total_bytes Output for the combined size of all blocks.
+ * @return MERKLE_SUCCESS when every block is non-NULL and non-empty,
+ *         MERKLE_BAD_ARG otherwise.
+ */
+static merkle_error_t validate_leaf_blocks(const void **data, const size_t *size, size_t count, bool guarded,
+                                           size_t *total_bytes);
 
-  merkle_node_t *node = e;
+/**
+ * @brief Frees the contiguous storage of a flat-layout tree.
+ * @param flat Storage to release; its pointers are reset to NULL.
+ * @param leaf_count Number of leaves, used to release replaced leaf copies.
+ */
+static void dealloc_flat_storage(merkle_flat_storage_t *flat, size_t leaf_count);
 
-  // Recursively deallocate all children
-  if(node->children){
-    for(size_t i = 0; i < node->child_count; ++i){
-        dealloc_hash_node(node->children[i]);
-    }
+/**
+ * @brief Picks the band height of blocked trees: as many levels as fit a block in a page.
+ * @param branching_factor Children per node.
+ * @return Levels per block, at least 1.
+ */
+static size_t flat_block_levels(size_t branching_factor){
+  size_t levels = 1;
+  size_t row = branching_factor;
+  size_t slots = branching_factor;
 
-    MFree(node->children);
+  while(levels < FLAT_BLOCK_MAX_LEVELS && row <= FLAT_BLOCK_BYTES / HASH_SIZE / branching_factor &&
+        slots + row * branching_factor <= FLAT_BLOCK_BYTES / HASH_SIZE){
+    row *= branching_factor;
+    slots += row;
+    levels++;
   }
 
-  // Free data if it exists (only for leaf nodes)
-  if(node->data) {
-      MFree(node->data);
-  }
-  
-  // Free the node itself
-  MFree(node);
+  return levels;
 }
 
-static void clean_up_next_level(merkle_node_t ***next_level, size_t num_of_nodes) {
-  // Check for null pointers
-  if (!next_level || !(*next_level)) {
-    return;
-  }
+/**
+ * @brief Counts the parent levels needed to reduce @p leaf_count nodes to one root.
+ * @param leaf_count Number of leaves.
+ * @param branching_factor Maximum number of children per node (>= 2 unless leaf_count is 1).
+ * @return Number of levels above the leaves.
+ */
+static size_t count_tree_levels(size_t leaf_count, size_t branching_factor){
+  size_t levels = 0;
 
-  // Deallocate all nodes in the array
-  for (size_t nd = 0; nd < num_of_nodes; ++nd) {
-    if ((*next_level)[nd]) {
-      dealloc_hash_node((*next_level)[nd]);
-    }
+  for(size_t width = leaf_count; width > 1; width = (width + branching_factor - 1) / branching_factor){
+    levels++;
   }
 
-  // Free the array and null the pointer
-  MFree(*next_level);
-  *next_level = NULL;
+  return levels;
 }
 
-static void clean_up_tree(merkle_tree_t **tree_ptr) {
-  // Check for null pointers
-  if (!tree_ptr || !(*tree_ptr)) {
-    return;
-  }
-
-  RW_DESTROY_LOCK(&(*tree_ptr)->lock);
-  // Free the leaves array and tree structure
-  MFree((*tree_ptr)->leaves);
-  MFree(*tree_ptr);
-  *tree_ptr = NULL;
+/**
+ * @brief Number of nodes stored on one level of a flat-layout tree.
+ */
+static inline size_t flat_level_width(const merkle_flat_storage_t *flat, size_t level){
+  return flat->level_offsets[level + 1] - flat->level_offsets[level];
 }
 
-static merkle_error_t hash_data_block(const void *data, size_t size,
-                                      unsigned char out[HASH_SIZE]) {
-  // Validate input parameters
-  if (!data || !out) {
-    return MERKLE_NULL_ARG;
+/**
+ * @brief Slot of node @p index of @p level in subtree-blocked order.
+ */
+static size_t flat_blocked_slot(const flat_block_map_t *map, size_t level, size_t index){
+  if(level == map->root_level){
+    return map->band_base[(map->root_level + map->levels - 1) / map->levels];
   }
 
-  if (size == 0) {
-    return MERKLE_BAD_LEN;
+  size_t band = level / map->levels;
+  size_t top = (band + 1) * map->levels < map->root_level ? (band + 1) * map->levels : map->root_level;
+  size_t row = top - level;
+  size_t block = index / map->row_span[row];
+
+  return map->band_base[band] + block * map->band_stride[band] + map->row_start[row] +
+         (index - block * map->row_span[row]);
+}
+
+/**
+ * @brief Returns node @p index of @p level of flat storage.
+ *
+ * The nodes of one sibling group are contiguous in either order, so callers
+ * may step through a group from its first node.
+ */
+static inline unsigned char *flat_node(const merkle_flat_storage_t *flat, size_t level, size_t index){
+  if(!flat->blocks.levels){
+    return flat->hashes[flat->level_offsets[level] + index];
   }
 
-  // Compute SHA-256 hash of the data
-  SHA256((const unsigned char *)data, size, out);
-  return MERKLE_SUCCESS; 
+  return flat->hashes[flat_blocked_slot(&flat->blocks, level, index)];
 }
 
+/**
+ * @brief Finds the sibling group of every node on a leaf's path to the root.
+ *
+ * Blocked slots are derived from the path's own ancestors, so a walk costs
+ * no more divisions than in level order.
+ *
+ * @param groups Receives, for each level below the root, the first node of
+ *               the group holding the path's node.
+ */
+static void flat_path_groups(const merkle_flat_storage_t *flat, size_t branching_factor, size_t levels,
+                             size_t leaf_index, const unsigned char **groups){
+  const flat_block_map_t *map = &flat->blocks;
+  size_t ancestors[POINTER_MAX_LEVELS + 1];
 
-static merkle_error_t hash_merkle_node(merkle_node_t *parent){
-  // Validate input parameter
-  if (!parent) {
-    return MERKLE_NULL_ARG;
-  }
+  ancestors[0] = leaf_index;
 
-  // Handle case where node has no children
-  if(parent->child_count == 0 || !parent->children) {
-    return MERKLE_SUCCESS; // No children to hash
+  for(size_t level = 0; level < levels; ++level){
+    ancestors[level + 1] = ancestors[level] / branching_factor;
   }
 
-  // Initialize SHA-256 context for combining child hashes
-  SHA256_CTX ctx;
-  SHA256_Init(&ctx);
-  
-  // Update hash with each child's hash
-  for(size_t i = 0; i < parent->child_count; ++i){
-    if(!parent->children[i]){
-      return MERKLE_NULL_ARG;
+  if(!map->levels){
+    for(size_t level = 0; level < levels; ++level){
+      groups[level] = flat->hashes[flat->level_offsets[level] + ancestors[level + 1] * branching_factor];
     }
 
-    SHA256_Update(&ctx, parent->children[i]->hash,HASH_SIZE);      
+    return;
   }
-   
-  // Finalize the hash computation
-  SHA256_Final(parent->hash,&ctx);
-  return MERKLE_SUCCESS;
-}
 
-static merkle_error_t build_tree_from_queue(queue_t *queue, merkle_tree_t *tree) {
-  // Local variables for managing the next level construction
-  size_t next_level_alloc_count = 0;
-  merkle_node_t **next_level = NULL;
+  // Each band's block is rooted at the path's ancestor on the level above the band
+  for(size_t band = 0, bottom = 0; bottom < levels; ++band, bottom += map->levels){
+    size_t top = bottom + map->levels < levels ? bottom + map->levels : levels;
+    size_t block = ancestors[top];
+    size_t base = map->band_base[band] + block * map->band_stride[band];
 
-  // Validate input parameters
-  if (!queue || !tree) {
-    return MERKLE_NULL_ARG;
+    for(size_t level = bottom; level < top; ++level){
+      size_t row = top - level;
+      groups[level] = flat->hashes[base + map->row_start[row] +
+                                   (ancestors[level + 1] * branching_factor - block * map->row_span[row])];
+    }
   }
+}
 
-
-  if(tree->branching_factor == 0){
-    return MERKLE_FAILED_TREE_BUILD;
+/**
+ * @brief Returns the root hash of a tree whatever its layout, or NULL if unbuilt.
+ */
+static const unsigned char *tree_root_hash(const merkle_tree_t *tree){
+  if(tree->layout == MERKLE_LAYOUT_FLAT){
+    return tree->flat.hashes ? flat_node(&tree->flat, tree->levels, 0) : NULL;
   }
 
-  size_t branching_factor = tree->branching_factor;
-
-  /*
-   * Process the queue level by level until a single node remains.
-   * Each iteration collapses one tree level by combining up to
-   * @p branching_factor child nodes under a newly allocated parent.
-   */
-  for (size_t tree_lvl = 0; get_queue_size(queue); tree_lvl++) {
+  return tree->root ? tree->root->hash : NULL;
+}
 
-    merkle_node_t *merkle_node = front_queue(queue);
-    size_t queue_size = get_queue_size(queue);
+/**
+ * @brief Waits for a stable snapshot of the tree's hashes and returns its version.
+ *
+ * Together with snapshot_unchanged() this is a sequence lock: readers never
+ * write shared memory, so any number of them can copy hashes out side by
+ * side. The tree's shape never changes after the build, only hash bytes, so
+ * a read that overlapped an update is detected and simply repeated.
+ */
+static inline size_t snapshot_begin(const merkle_tree_t *tree){
+  size_t version;
 
-    if(!merkle_node){
-      return MERKLE_FAILED_TREE_BUILD;
-    }
-      
-    if (IS_LAST_ELEMENT(queue_size)) {
+  while((version = atomic_load_explicit(&((merkle_tree_t *)tree)->version, memory_order_acquire)) & 1){
+    THREAD_YIELD();
+  }
 
-      if(pop_queue(queue) != merkle_node){
-        clean_up_next_level(&next_level, next_level_alloc_count);
-        return MERKLE_FAILED_TREE_BUILD;
-      }
+  return version;
+}
 
-      tree->root = merkle_node;
-      clean_up_next_level(&next_level, next_level_alloc_count);
-      return MERKLE_SUCCESS;
-    }
-      
-    /* Number of parent nodes to create for this level. Each parent will
-     * combine up to @p branching_factor children. */
-    size_t full_nodes = (queue_size + branching_factor - 1)/branching_factor;
-    tree->levels++;
+/**
+ * @brief Tells whether the hashes read since snapshot_begin() all belong to @p version.
+ */
+static inline bool snapshot_unchanged(const merkle_tree_t *tree, size_t version){
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&((merkle_tree_t *)tree)->version, memory_order_relaxed) == version;
+}
 
-    if(IS_LEAF_NODES_LEVEL(tree_lvl)) {
-      ALLOC_AND_INIT_SIMPLE(next_level, full_nodes);
+/**
+ * @brief Marks the start of an update; readers of the old version will retry.
+ *
+ * Callers hold the write lock, which serializes updates.
+ */
+static inline void snapshot_publish_begin(merkle_tree_t *tree){
+  size_t version = atomic_load_explicit(&tree->version, memory_order_relaxed);
+  atomic_store_explicit(&tree->version, version + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
 
-      if(!next_level){
-        return MERKLE_FAILED_MEM_ALLOC;
-      }
+/**
+ * @brief Publishes the hashes written since snapshot_publish_begin() as a new version.
+ */
+static inline void snapshot_publish_end(merkle_tree_t *tree){
+  size_t version = atomic_load_explicit(&tree->version, memory_order_relaxed);
+  atomic_store_explicit(&tree->version, version + 1, memory_order_release);
+}
 
-      next_level_alloc_count = full_nodes;
-    }
+/**
+ * @brief Collects the nodes from a pointer-layout leaf up to the root.
+ *
+ * Nodes shared between versions have no single parent, so the path is found
+ * from the root down: on level @c l the leaf lies under the child
+ * (leaf_index / branching_factor^l) % branching_factor.
+ *
+ * @param path Receives tree->levels + 1 nodes, the leaf first and the root last.
+ */
+static void pointer_leaf_path(const merkle_tree_t *tree, size_t leaf_index, merkle_node_t **path){
+  size_t branching_factor = tree->branching_factor;
+  size_t span = 1;
 
-    // clear all the pointers in next_level to be prepared to process the queue
-    memset(next_level, 0, full_nodes * sizeof(merkle_node_t *));
+  for(size_t lvl = 1; lvl < tree->levels; ++lvl){
+    span *= branching_factor;
+  }
 
+  path[tree->levels] = tree->root;
 
-    /* Build the next level of the tree by grouping children under new parents */
-    for(size_t i = 0; i < full_nodes; ++i) {
-      merkle_node_t *parent_node;
-      ALLOC_AND_INIT_SIMPLE(parent_node, 1);
+  for(size_t lvl = tree->levels; lvl > 0; --lvl){
+    path[lvl - 1] = path[lvl]->children[(leaf_index / span) % branching_factor];
+    span /= branching_factor;
+  }
+}
 
-      if(!parent_node){
-        clean_up_next_level(&next_level, next_level_alloc_count);
-        return MERKLE_FAILED_MEM_ALLOC;
-      }
+/**
+ * @brief Returns the data of a leaf as retained by the tree, or NULL if it has none.
+ */
+static void *tree_leaf_data(const merkle_tree_t *tree, size_t leaf_index){
+  if(tree->leaf_storage == MERKLE_LEAF_BORROW && tree->borrowed){
+    return (void *)tree->borrowed[leaf_index];
+  }
 
-      next_level[i] = parent_node;
+  if(tree->leaf_storage == MERKLE_LEAF_HASH_ONLY){
+    return tree->leaf_lookup ? tree->leaf_lookup(leaf_index, tree->leaf_lookup_ctx) : NULL;
+  }
 
-      /* Request up to branching_factor children from the queue.  The actual
-       * number dequeued is returned in @p dequed. */
-      size_t dequed = branching_factor;
+  if(tree->layout == MERKLE_LAYOUT_FLAT){
+    if(tree->flat.leaf_overrides && tree->flat.leaf_overrides[leaf_index]){
+      return tree->flat.leaf_overrides[leaf_index];
+    }
 
-      queue_result_t combo_result = deque_n(
-        queue,
-        &dequed,
-        (void ***)&(parent_node->children));
+    return tree->flat.leaf_data + tree->flat.leaf_offsets[leaf_index];
+  }
 
-      if(combo_result != QUEUE_OK){
-        clean_up_next_level(&next_level, next_level_alloc_count);
-        return MERKLE_FAILED_TREE_BUILD;
-      }
+  if(tree->leaves){
+    return tree->leaves[leaf_index]->data;
+  }
 
-      parent_node->child_count = dequed;
+  // Versions keep no leaves array; the borrowed blocks they share are the origin's
+  merkle_node_t *path[POINTER_MAX_LEVELS + 1];
+  pointer_leaf_path(tree, leaf_index, path);
 
-      /* Compute the parent's hash from its children. */
-      merkle_error_t ret_code = hash_merkle_node(parent_node);
+  if(!path[0]->data && tree->leaf_storage == MERKLE_LEAF_BORROW){
+    return (void *)tree->origin->borrowed[leaf_index];
+  }
 
-      for(size_t child_idx = 0; child_idx < dequed; ++child_idx) {
-        parent_node->children[child_idx]->index_in_parent = child_idx;
-        parent_node->children[child_idx]->parent = parent_node;
-      }
+  return path[0]->data;
+}
 
-      if (ret_code != MERKLE_SUCCESS) {
-        clean_up_next_level(&next_level, next_level_alloc_count);
-        return ret_code;
-      }
-    }
+/**
+ * @brief Initializes a new Merkle tree structure.
+ * @param tree Pointer to tree pointer to initialize.
+ * @param leafs Number of leaf nodes the tree will contain.
+ * @param config Construction options (branching factor, layout and a registered hash).
+ * @return MERKLE_SUCCESS on success, error code otherwise.
+ */
+static merkle_error_t init_tree(merkle_tree_t **tree, size_t leafs, const merkle_config_t *config){
+  // Validate input parameters
+  if(!tree){
+    return MERKLE_NULL_ARG;
+  }
 
-    for(size_t i = 0; i < next_level_alloc_count; ++i){
+  // Initialize output pointer
+  *tree = NULL;
+  merkle_tree_t *tr;
+  ALLOC_AND_INIT_SIMPLE(tr, 1);
+  
+  if(!tr){
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
 
-      /* Enqueue the newly created parent for processing in the next level. */
-      if(next_level[i] && push_queue(queue, next_level[i]) != QUEUE_OK){
-        clean_up_next_level(&next_level, next_level_alloc_count);
-        return MERKLE_FAILED_TREE_BUILD;
-      }
+  // Flat trees address leaves by index, only the pointer layout keeps nodes
+  if(config->layout == MERKLE_LAYOUT_POINTER){
+    ALLOC_AND_INIT_SIMPLE(tr->leaves, leafs);
 
-      //next_level[i] should be NULLified since the ownership of the pointer has moved to the queue
-      next_level[i] = NULL;
+    if(tr->leaves == NULL){
+        MFree(tr);
+        return MERKLE_FAILED_MEM_ALLOC;
     }
   }
 
-  clean_up_next_level(&next_level, next_level_alloc_count);
-  return MERKLE_SUCCESS;
-}
+  // Borrowed trees remember the caller's pointers instead of copying the blocks
+  if(config->leaf_storage == MERKLE_LEAF_BORROW){
+    ALLOC_AND_INIT_SIMPLE(tr->borrowed, leafs);
+
+    if(tr->borrowed == NULL){
+        MFree(tr->leaves);
+        MFree(tr);
+        return MERKLE_FAILED_MEM_ALLOC;
+    }
+  }
+
+  // Set leaf count and return initialized tree
+  tr->leaf_count = leafs;
+  tr->branching_factor = config->branching_factor;
+  // Blocked trees are flat trees that store their nodes in another order
+  tr->layout = config->layout == MERKLE_LAYOUT_POINTER ? MERKLE_LAYOUT_POINTER : MERKLE_LAYOUT_FLAT;
+  tr->flat.blocks.levels = config->layout == MERKLE_LAYOUT_BLOCKED ? flat_block_levels(config->branching_factor) : 0;
+  tr->leaf_storage = config->leaf_storage;
+  tr->leaf_lookup = config->leaf_lookup;
+  tr->leaf_lookup_ctx = config->leaf_lookup_ctx;
+  tr->index_kind = config->leaf_index;
+  tr->key_extractor = config->key_extractor;
+  tr->key_extractor_ctx = config->key_extractor_ctx;
+  tr->hash_id = config->hash;
+  tr->hash = merkle_hash_get(config->hash);
+  tr->guarded = config->input_check == MERKLE_INPUT_GUARDED;
+  atomic_init(&tr->refs, 1);
+  RW_LOCK_INIT(&tr->lock);
+  *tree = tr;
+  return MERKLE_SUCCESS;
+}
+
+static void clean_up_tree(merkle_tree_t **tree_ptr) {
+  // Check for null pointers
+  if (!tree_ptr || !(*tree_ptr)) {
+    return;
+  }
+
+  merkle_tree_t *tree = *tree_ptr;
+  RW_DESTROY_LOCK(&tree->lock);
+
+  // Replaced leaf data lives on the heap, everything else goes with the arena
+  for(size_t i = 0; tree->detached_leaves && i < tree->leaf_count; ++i){
+    if(tree->leaves[i] && !merkle_arena_owns(tree->arena, tree->leaves[i]->data)){
+      MFree(tree->leaves[i]->data);
+    }
+  }
+
+  merkle_arena_destroy(tree->arena);
+  merkle_index_destroy(tree->index);
+
+  // Free the leaves array and tree structure
+  MFree((*tree_ptr)->leaves);
+  MFree((void *)(*tree_ptr)->borrowed);
+  MFree(*tree_ptr);
+  *tree_ptr = NULL;
+}
+
+static merkle_error_t hash_data_blocks(const merkle_hash_vtable_t *hash, const void *const *data, const size_t *size,
+                                       unsigned char *const *out, size_t count) {
+  // Validate input parameters
+  if (!data || !size || !out) {
+    return MERKLE_NULL_ARG;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    if (!data[i] || !out[i]) {
+      return MERKLE_NULL_ARG;
+    }
+
+    if (size[i] == 0) {
+      return MERKLE_BAD_LEN;
+    }
+  }
+
+  // Compute the hashes of all blocks at once
+  merkle_hash_batch(hash, (const unsigned char *const *)data, size, out, count);
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Sums the sizes of a batch for the bytes_hashed counter.
+ */
+static inline uint64_t batch_bytes(const size_t *size, size_t count){
+  uint64_t bytes = 0;
+
+  for(size_t i = 0; i < count; ++i){
+    bytes += size[i];
+  }
+
+  return bytes;
+}
+
+static merkle_error_t hash_leaf_blocks(merkle_stat_counters_t *stats, const merkle_hash_vtable_t *hash,
+                                       const void *const *data, const size_t *size,
+                                       unsigned char *const *out, size_t count){
+  (void)stats;
+  MERKLE_STAT_START(start);
+  merkle_error_t ret = hash_data_blocks(hash, data, size, out, count);
+
+  if(ret == MERKLE_SUCCESS){
+    MERKLE_STAT_ADD(stats, leaf_hash_ns, merkle_stat_now() - start);
+    MERKLE_STAT_ADD(stats, leaf_hashes, count);
+    MERKLE_STAT_ADD(stats, bytes_hashed, batch_bytes(size, count));
+  }
+
+  return ret;
+}
+
+static merkle_error_t hash_node_blocks(merkle_stat_counters_t *stats, const merkle_hash_vtable_t *hash,
+                                       const void *const *data, const size_t *size,
+                                       unsigned char *const *out, size_t count){
+  (void)stats;
+  MERKLE_STAT_START(start);
+  merkle_error_t ret = hash_data_blocks(hash, data, size, out, count);
+
+  if(ret == MERKLE_SUCCESS){
+    MERKLE_STAT_ADD(stats, node_hash_ns, merkle_stat_now() - start);
+    MERKLE_STAT_ADD(stats, node_hashes, count);
+    MERKLE_STAT_ADD(stats, bytes_hashed, batch_bytes(size, count));
+  }
+
+  return ret;
+}
+
+/**
+ * @brief Hashes @p count parents whose child runs are all @p len bytes, booked as node hashing.
+ *
+ * The runs are built by the tree itself, so they skip the checks of
+ * hash_data_blocks() and go to the equal-length batch kernel.
+ */
+static void hash_node_run(merkle_stat_counters_t *stats, const merkle_hash_vtable_t *hash,
+                          const unsigned char *const *data, size_t len, unsigned char *const *out, size_t count){
+  (void)stats;
+  MERKLE_STAT_START(start);
+  merkle_hash_batch_fixed(hash, data, len, out, count);
+  MERKLE_STAT_ADD(stats, node_hash_ns, merkle_stat_now() - start);
+  MERKLE_STAT_ADD(stats, node_hashes, count);
+  MERKLE_STAT_ADD(stats, bytes_hashed, (uint64_t)len * count);
+}
+
+/**
+ * @brief Body of hash_merkle_node(), without the bookkeeping.
+ */
+static merkle_error_t hash_node_children(const merkle_hash_vtable_t *hash, merkle_node_t *parent){
+  // Validate input parameter
+  if (!parent) {
+    return MERKLE_NULL_ARG;
+  }
+
+  // Handle case where node has no children
+  if(parent->child_count == 0 || !parent->children) {
+    return MERKLE_SUCCESS; // No children to hash
+  }
+
+  // The children's hashes are gathered into the node's own copy, which proofs read as is
+  for(size_t c = 0; c < parent->child_count; ++c){
+    if(!parent->children[c]){
+      return MERKLE_NULL_ARG;
+    }
+
+    memcpy(parent->child_hashes[c], parent->children[c]->hash, HASH_SIZE);
+  }
+
+  const unsigned char *msg = parent->child_hashes[0];
+  size_t len = parent->child_count * HASH_SIZE;
+  unsigned char *digest = parent->hash;
+  merkle_hash_batch(hash, &msg, &len, &digest, 1);
+  return MERKLE_SUCCESS;
+}
+
+static merkle_error_t hash_merkle_node(merkle_stat_counters_t *stats, const merkle_hash_vtable_t *hash,
+                                       merkle_node_t *parent){
+  (void)stats;
+  MERKLE_STAT_START(start);
+  merkle_error_t ret = hash_node_children(hash, parent);
+
+  if(ret == MERKLE_SUCCESS && parent->child_count && parent->children){
+    MERKLE_STAT_ADD(stats, node_hash_ns, merkle_stat_now() - start);
+    MERKLE_STAT_ADD(stats, node_hashes, 1);
+    MERKLE_STAT_ADD(stats, bytes_hashed, parent->child_count * HASH_SIZE);
+  }
+
+  return ret;
+}
+
+/**
+ * @brief Shared state for hashing one level of parents in parallel.
+ */
+typedef struct parent_hash_ctx {
+  const merkle_hash_vtable_t *hash; /**< Algorithm of the tree. */
+  merkle_stat_counters_t *stats;    /**< Counters of the tree. */
+  merkle_node_t **parents;  /**< Parents of the level being built. */
+  merkle_node_t **children; /**< Nodes of the level below, in order (linking only). */
+  unsigned char (*child_hashes)[HASH_SIZE]; /**< Hash copies of @ref children, one each (linking only). */
+  size_t width;             /**< Number of entries in @ref children (linking only). */
+  size_t branching_factor;  /**< Children per full parent (linking only). */
+  atomic_bool failed;       /**< Set by any chunk that fails to hash a parent. */
+} parent_hash_ctx_t;
+
+/**
+ * @brief merkle_range_fn hashing parents [begin, end) from their children.
+ */
+static void hash_parent_range(void *arg, size_t begin, size_t end){
+  parent_hash_ctx_t *ctx = arg;
+
+  /* Child hashes live in separate nodes, so each parent copies theirs into
+   * its own contiguous child_hashes and those messages are hashed as a batch. */
+  for(size_t first = begin; first < end; first += MERKLE_SHA256_MAX_LANES){
+    size_t batch = end - first < MERKLE_SHA256_MAX_LANES ? end - first : MERKLE_SHA256_MAX_LANES;
+    const unsigned char *blocks[MERKLE_SHA256_MAX_LANES];
+    size_t sizes[MERKLE_SHA256_MAX_LANES];
+    unsigned char *hashes[MERKLE_SHA256_MAX_LANES];
+    size_t gathered = 0;
+    bool uniform = true;
+
+    for(size_t k = 0; k < batch; ++k){
+      merkle_node_t *parent = ctx->parents[first + k];
+
+      if(parent->child_count == 0){
+        continue;
+      }
+
+      for(size_t c = 0; c < parent->child_count; ++c){
+        if(!parent->children[c]){
+          atomic_store(&ctx->failed, true);
+          return;
+        }
+
+        memcpy(parent->child_hashes[c], parent->children[c]->hash, HASH_SIZE);
+      }
+
+      blocks[gathered] = parent->child_hashes[0];
+      sizes[gathered] = parent->child_count * HASH_SIZE;
+      hashes[gathered] = parent->hash;
+      uniform &= sizes[gathered] == sizes[0];
+      gathered++;
+    }
+
+    // Only the last parent of a level can be short, so batches are nearly always uniform
+    if(gathered && uniform){
+      hash_node_run(ctx->stats, ctx->hash, blocks, sizes[0], hashes, gathered);
+      continue;
+    }
+
+    if(gathered && hash_node_blocks(ctx->stats, ctx->hash, (const void *const *)blocks, sizes, hashes,
+                                    gathered) != MERKLE_SUCCESS){
+      atomic_store(&ctx->failed, true);
+      return;
+    }
+  }
+}
+
+/**
+ * @brief merkle_range_fn linking parents [begin, end) to their run of children, then hashing them.
+ */
+static void link_parent_range(void *arg, size_t begin, size_t end){
+  parent_hash_ctx_t *ctx = arg;
+  size_t branching_factor = ctx->branching_factor;
+
+  for(size_t i = begin; i < end; ++i){
+    merkle_node_t *parent = ctx->parents[i];
+    size_t first_child = i * branching_factor;
+
+    parent->children = ctx->children + first_child;
+    parent->child_hashes = ctx->child_hashes + first_child;
+    parent->child_count = ctx->width - first_child < branching_factor ? ctx->width - first_child : branching_factor;
+
+    for(size_t c = 0; c < parent->child_count; ++c){
+      parent->children[c]->parent = parent;
+    }
+  }
+
+  hash_parent_range(arg, begin, end);
+}
+
+static merkle_error_t build_tree_levels(merkle_tree_t *tree, merkle_thread_pool_t *pool) {
+  // Validate input parameters
+  if (!tree || !tree->leaves) {
+    return MERKLE_NULL_ARG;
+  }
+
+  if(tree->branching_factor == 0){
+    return MERKLE_FAILED_TREE_BUILD;
+  }
+
+  /*
+   * Collapse one level per iteration until a single node remains. A level's
+   * array of node pointers doubles as the children arrays of the level
+   * above, so parents only point into it and nothing is queued or copied.
+   */
+  merkle_node_t **level = tree->leaves;
+  size_t width = tree->leaf_count;
+
+  while (width > 1) {
+    if(build_cancelled(tree)){
+      return MERKLE_CANCELLED;
+    }
+
+    size_t parent_count = (width + tree->branching_factor - 1) / tree->branching_factor;
+    merkle_node_t *parents = merkle_arena_alloc(tree->arena, parent_count * sizeof(merkle_node_t));
+    merkle_node_t **next_level = merkle_arena_alloc(tree->arena, parent_count * sizeof(merkle_node_t *));
+    unsigned char (*child_hashes)[HASH_SIZE] = merkle_arena_alloc(tree->arena, width * HASH_SIZE);
+
+    if(!parents || !next_level || !child_hashes){
+      return MERKLE_FAILED_MEM_ALLOC;
+    }
+
+    for(size_t i = 0; i < parent_count; ++i){
+      next_level[i] = &parents[i];
+    }
+
+    /* Parents own disjoint runs of the level, so linking and hashing them
+     * is independent and can be done in parallel. */
+    parent_hash_ctx_t hash_ctx = {
+      .hash = tree->hash,
+      .stats = &tree->stats,
+      .parents = next_level,
+      .children = level,
+      .child_hashes = child_hashes,
+      .width = width,
+      .branching_factor = tree->branching_factor
+    };
+    atomic_init(&hash_ctx.failed, false);
+    merkle_parallel_for(pool, parent_count, PARALLEL_NODE_GRAIN, link_parent_range, &hash_ctx);
+
+    if (atomic_load(&hash_ctx.failed)) {
+      return MERKLE_NULL_ARG;
+    }
+
+    tree->levels++;
+    level = next_level;
+    width = parent_count;
+  }
+
+  tree->root = level[0];
+  return MERKLE_SUCCESS;
+}
+
+static void dealloc_flat_storage(merkle_flat_storage_t *flat, size_t leaf_count){
+  if(!flat){
+    return;
+  }
+
+  if(flat->leaf_overrides){
+    for(size_t i = 0; i < leaf_count; ++i){
+      MFree(flat->leaf_overrides[i]);
+    }
+
+    MFree(flat->leaf_overrides);
+  }
+
+  MFree(flat->hash_block ? flat->hash_block : (void *)flat->hashes);
+  MFree(flat->level_offsets);
+  MFree(flat->leaf_data);
+  MFree(flat->leaf_offsets);
+  memset(flat, 0, sizeof(*flat));
+}
 
 void dealloc_merkle_tree(merkle_tree_t *tree) {
   // Check for null pointer
@@ -439,281 +1087,3226 @@ void dealloc_merkle_tree(merkle_tree_t *tree) {
     return;
   }
 
-  // Recursively deallocate the entire tree starting from root
-  dealloc_hash_node(tree->root);
-  // Clean up the tree structure itself
-  clean_up_tree(&tree);
+  // A tree whose nodes versions still share is freed by the last of them
+  if(atomic_fetch_sub_explicit(&tree->refs, 1, memory_order_acq_rel) != 1){
+    return;
+  }
+
+  if(tree->origin){
+    merkle_tree_t *origin = tree->origin;
+
+    // Only the version's own path copies are freed, then its hold on the origin
+    release_node(tree->root);
+    clean_up_tree(&tree);
+    dealloc_merkle_tree(origin);
+    return;
+  }
+
+  // Mapped hashes belong to the file, not the heap
+  if(tree->mapping){
+    munmap(tree->mapping, tree->mapping_size);
+    tree->flat.hashes = NULL;
+  }
+
+  if(tree->layout == MERKLE_LAYOUT_FLAT){
+    // A flat tree is a few contiguous buffers, no node walk needed
+    dealloc_flat_storage(&tree->flat, tree->leaf_count);
+  }
+
+  // Clean up the tree structure itself; pointer-layout nodes go with its arena
+  clean_up_tree(&tree);
+}
+
+void merkle_config_init(merkle_config_t *config){
+  if(!config){
+    return;
+  }
+
+  memset(config, 0, sizeof(*config));
+  config->branching_factor = 2;
+  config->layout = MERKLE_LAYOUT_POINTER;
+}
+
+merkle_tree_t *create_merkle_tree(const void **data, const size_t *size,
+                                  size_t count, size_t branching_factor) {
+  merkle_config_t config;
+  merkle_config_init(&config);
+  config.branching_factor = branching_factor;
+  return create_merkle_tree_ex(data, size, count, &config);
+}
+
+merkle_tree_t *create_merkle_tree_ex(const void **data, const size_t *size,
+                                     size_t count, const merkle_config_t *config) {
+  merkle_tree_t *tree = NULL;
+  merkle_build_tree(data, size, count, config, NULL, &tree);
+  return tree;
+}
+
+merkle_error_t merkle_build_tree(const void **data, const size_t *size, size_t count,
+                                 const merkle_config_t *config, const atomic_bool *cancel,
+                                 merkle_tree_t **out) {
+  merkle_tree_t *tree = NULL;
+
+  // Validate input parameters
+  if (!out) {
+    return MERKLE_NULL_ARG;
+  }
+
+  *out = NULL;
+
+  if (!(data && size && config)) {
+    return MERKLE_NULL_ARG;
+  }
+
+  if (count == 0 || config->branching_factor == 0) {
+    return MERKLE_BAD_ARG;
+  }
+
+  // A branching factor of one never reduces a level, so only a lone leaf can use it
+  if (config->branching_factor == 1 && count > 1) {
+    return MERKLE_BAD_ARG;
+  }
+
+  if (config->layout != MERKLE_LAYOUT_POINTER && config->layout != MERKLE_LAYOUT_FLAT &&
+      config->layout != MERKLE_LAYOUT_BLOCKED) {
+    return MERKLE_BAD_ARG;
+  }
+
+  if (config->leaf_storage != MERKLE_LEAF_COPY && config->leaf_storage != MERKLE_LEAF_BORROW &&
+      config->leaf_storage != MERKLE_LEAF_HASH_ONLY) {
+    return MERKLE_BAD_ARG;
+  }
+
+  if (config->leaf_index != MERKLE_INDEX_NONE && config->leaf_index != MERKLE_INDEX_LEAF_HASH &&
+      (config->leaf_index != MERKLE_INDEX_KEY || !config->key_extractor)) {
+    return MERKLE_BAD_ARG;
+  }
+
+  if (!merkle_hash_get(config->hash)) {
+    return MERKLE_BAD_ARG;
+  }
+
+  if (config->input_check != MERKLE_INPUT_GUARDED && config->input_check != MERKLE_INPUT_TRUSTED) {
+    return MERKLE_BAD_ARG;
+  }
+
+  // Trusted input skips the handlers, leaving the leaf loops pure hash and store
+  bool guarded = config->input_check == MERKLE_INPUT_GUARDED;
+
+  // Initialize signal protection to catch segfaults gracefully
+  if (guarded) {
+    merkle_init_signal_protection();
+  }
+
+  // Initialize the tree structure
+  if(init_tree(&tree,count,config) != MERKLE_SUCCESS){
+    if (guarded) {
+      merkle_cleanup_signal_protection();
+    }
+
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  tree->cancel = cancel;
+
+  // A caller-supplied pool wins, otherwise spin one up just for this build
+  merkle_thread_pool_t *pool = config->thread_pool;
+  merkle_thread_pool_t *owned_pool = NULL;
+
+  if(!pool && config->thread_count > 1 && count > PARALLEL_LEAF_GRAIN){
+    owned_pool = merkle_thread_pool_create(config->thread_count);
+    pool = owned_pool;
+  }
+
+  merkle_error_t ret = tree->layout == MERKLE_LAYOUT_FLAT
+                           ? build_flat_tree(tree, data, size, pool)
+                           : build_pointer_tree(tree, data, size, pool);
+
+  if(ret == MERKLE_SUCCESS){
+    ret = build_leaf_index(tree, data, size, pool);
+  }
+
+  merkle_thread_pool_destroy(owned_pool);
+
+  if (guarded) {
+    merkle_cleanup_signal_protection();
+  }
+
+  // Whichever stage noticed the request, the build reports it the same way
+  if(ret != MERKLE_SUCCESS && build_cancelled(tree)){
+    ret = MERKLE_CANCELLED;
+  }
+
+  if(ret != MERKLE_SUCCESS){
+    clean_up_tree(&tree);
+    return ret;
+  }
+
+  // Nothing polls the flag once the tree is built
+  tree->cancel = NULL;
+  *out = tree;
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Checks leaf block @p i and adds its size to @p total.
+ *
+ * The jump target lives in this call alone, so no caller local is written
+ * between setjmp and a longjmp back to it.
+ *
+ * @return false if the block is NULL, empty, overflows the total or cannot be read.
+ */
+static bool check_leaf_block(const void **data, const size_t *size, size_t i, bool guarded, size_t *total) {
+  volatile bool valid = false;
+
+  // Safe access pattern - catch segfaults if count > actual array size
+  SAFE_ACCESS_TRY_IF(guarded) {
+    if (data[i] && size[i] && size[i] <= SIZE_MAX - *total) {
+      *total += size[i];
+      valid = true;
+    }
+  } SAFE_ACCESS_CATCH {
+    // Segfault occurred - count parameter is incorrect
+    valid = false;
+  } SAFE_ACCESS_END;
+
+  return valid;
+}
+
+static merkle_error_t validate_leaf_blocks(const void **data, const size_t *size, size_t count, bool guarded,
+                                           size_t *total_bytes) {
+  size_t total = 0;
+  bool success = true;
+
+  for (size_t i = 0; i < count && success; ++i) {
+    success = check_leaf_block(data, size, i, guarded, &total);
+  }
+
+  if(!success){
+    return MERKLE_BAD_ARG;
+  }
+
+  *total_bytes = total;
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Shared state for creating pointer-layout leaves in parallel.
+ */
+typedef struct leaf_build_ctx {
+  merkle_tree_t *tree;  /**< Tree whose leaves array receives the nodes. */
+  const void **data;    /**< Caller data blocks. */
+  const size_t *size;   /**< Caller block sizes. */
+  atomic_bool failed;   /**< Set by any chunk that fails to create a leaf. */
+} leaf_build_ctx_t;
+
+/**
+ * @brief Copies and hashes the @p batch leaves from @p first, under signal protection if guarded.
+ * @return false if a block could not be read or hashed.
+ */
+static bool fill_leaf_batch(leaf_build_ctx_t *ctx, size_t first, size_t batch){
+  merkle_node_t **nodes = ctx->tree->leaves + first;
+  const void **data = ctx->data;
+  const size_t *size = ctx->size;
+  const void *blocks[MERKLE_SHA256_MAX_LANES];
+  unsigned char *hashes[MERKLE_SHA256_MAX_LANES];
+  volatile bool success = false;
+
+  // Only copying trees keep a private version of the block
+  bool copy = ctx->tree->leaf_storage == MERKLE_LEAF_COPY;
+
+  for (size_t k = 0; k < batch; ++k) {
+    hashes[k] = nodes[k]->hash;
+  }
+
+  // Copy the data into the nodes and compute hashes - with protection against invalid data
+  SAFE_ACCESS_TRY_IF(ctx->tree->guarded) {
+    for (size_t k = 0; k < batch; ++k) {
+      blocks[k] = data[first + k];
+
+      if(copy){
+        memcpy(nodes[k]->data, blocks[k], size[first + k]);
+        blocks[k] = nodes[k]->data;
+      }
+    }
+
+    success = hash_leaf_blocks(&ctx->tree->stats, ctx->tree->hash, blocks, size + first, hashes, batch) == MERKLE_SUCCESS;
+  } SAFE_ACCESS_CATCH {
+    // Segfault occurred during data access
+    success = false;
+  } SAFE_ACCESS_END;
+
+  return success;
+}
+
+/**
+ * @brief merkle_range_fn filling and hashing leaves [begin, end).
+ *
+ * The nodes and their data slots are carved from the arena beforehand, so
+ * workers never allocate. Each worker arms its own signal protection, so a
+ * bad data pointer fails the build instead of crashing whichever thread
+ * touched it.
+ */
+static void build_leaf_range(void *arg, size_t begin, size_t end){
+  leaf_build_ctx_t *ctx = arg;
+  const void **data = ctx->data;
+
+  /* Leaves are hashed in batches so the SIMD backends get several
+   * independent messages to work on side by side. */
+  for (size_t first = begin; first < end && !atomic_load_explicit(&ctx->failed, memory_order_relaxed);
+       first += MERKLE_SHA256_MAX_LANES) {
+    size_t batch = end - first < MERKLE_SHA256_MAX_LANES ? end - first : MERKLE_SHA256_MAX_LANES;
+
+    // A cancelled build stops between batches and is torn down as a failure
+    if(!fill_leaf_batch(ctx, first, batch) || build_cancelled(ctx->tree)){
+      atomic_store(&ctx->failed, true);
+      return;
+    }
+
+    // Remember the caller's blocks for borrowing trees
+    for (size_t k = 0; k < batch && ctx->tree->borrowed; ++k) {
+      ctx->tree->borrowed[first + k] = data[first + k];
+    }
+  }
+}
+
+/**
+ * @brief Bytes a pointer-layout tree draws from its arena.
+ *
+ * Covers every node, one level-array slot per node and the leaf copies, plus
+ * alignment slack for the two blocks allocated per level.
+ *
+ * @return The size, or 0 if it does not fit in a size_t.
+ */
+static size_t pointer_arena_size(const merkle_tree_t *tree, size_t data_bytes){
+  size_t levels = count_tree_levels(tree->leaf_count, tree->branching_factor);
+  size_t total_nodes = 0;
+  size_t width = tree->leaf_count;
+
+  for(size_t lvl = 0; lvl <= levels; ++lvl){
+    total_nodes += width;
+    width = (width + tree->branching_factor - 1) / tree->branching_factor;
+  }
+
+  // Every node but the root also has its hash copied into its parent
+  size_t per_node = sizeof(merkle_node_t) + sizeof(merkle_node_t *) + HASH_SIZE;
+  size_t slack = (levels + 2) * 3 * sizeof(max_align_t);
+
+  if(total_nodes > (SIZE_MAX - slack) / per_node || data_bytes > SIZE_MAX - slack - total_nodes * per_node){
+    return 0;
+  }
+
+  return total_nodes * per_node + data_bytes + slack;
+}
+
+/**
+ * @brief Carves every leaf node of a pointer-layout tree out of a new arena.
+ *
+ * The arena is sized to the whole tree, so every node lands in a single
+ * allocation.
+ *
+ * @param tree Tree whose leaves array receives the zeroed nodes.
+ * @param data_bytes Leaf data the arena must also have room for.
+ * @return MERKLE_SUCCESS, or an error if the arena could not be set up.
+ */
+static merkle_error_t alloc_pointer_leaves(merkle_tree_t *tree, size_t data_bytes){
+  size_t arena_size = pointer_arena_size(tree, data_bytes);
+
+  if(!arena_size){
+    return MERKLE_FAILED_TREE_BUILD;
+  }
+
+  tree->arena = merkle_arena_create(arena_size);
+  merkle_node_t *leaves = tree->arena ? merkle_arena_alloc(tree->arena, tree->leaf_count * sizeof(merkle_node_t)) : NULL;
+
+  if(!leaves){
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  for(size_t i = 0; i < tree->leaf_count; ++i){
+    tree->leaves[i] = &leaves[i];
+  }
+
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Builds the levels above hashed pointer-layout leaves under the write lock.
+ */
+static merkle_error_t link_pointer_levels(merkle_tree_t *tree, merkle_thread_pool_t *pool){
+  MERKLE_STAT_WRITE_LOCK(tree_stats(tree), &tree->lock);
+  merkle_error_t ret = build_tree_levels(tree, pool);
+  RW_WRITE_UNLOCK(&tree->lock);
+  return ret;
+}
+
+static merkle_error_t build_pointer_tree(merkle_tree_t *tree, const void **data, const size_t *size,
+                                         merkle_thread_pool_t *pool) {
+  size_t count = tree->leaf_count;
+  size_t total_bytes = 0;
+
+  if(validate_leaf_blocks(data, size, count, tree->guarded, &total_bytes) != MERKLE_SUCCESS){
+    return MERKLE_FAILED_TREE_BUILD;
+  }
+
+  bool copy = tree->leaf_storage == MERKLE_LEAF_COPY;
+
+  // Each copy is NUL-terminated so finders may read text blocks as C strings
+  if(copy && total_bytes > SIZE_MAX - count){
+    return MERKLE_FAILED_TREE_BUILD;
+  }
+
+  size_t data_bytes = copy ? total_bytes + count : 0;
+
+  TRY{
+    if(alloc_pointer_leaves(tree, data_bytes) != MERKLE_SUCCESS){
+      THROW;
+    }
+
+    unsigned char *leaf_data = copy ? merkle_arena_alloc(tree->arena, data_bytes) : NULL;
+
+    if(copy && !leaf_data){
+      THROW;
+    }
+
+    // Lay the leaf copies out back to back before the workers fill them
+    for (size_t i = 0; copy && i < count; ++i) {
+      tree->leaves[i]->data = leaf_data;
+      leaf_data += size[i] + 1;
+    }
+
+    // Leaves are independent of each other, so fill and hash them in parallel
+    leaf_build_ctx_t leaf_ctx = { .tree = tree, .data = data, .size = size };
+    atomic_init(&leaf_ctx.failed, false);
+    merkle_parallel_for(pool, count, PARALLEL_LEAF_GRAIN, build_leaf_range, &leaf_ctx);
+
+    if(atomic_load(&leaf_ctx.failed)){
+      THROW;
+    }
+
+    // Build the internal tree structure from the leaf nodes
+    if (link_pointer_levels(tree, pool) != MERKLE_SUCCESS) {
+      THROW;
+    }
+
+    return MERKLE_SUCCESS;
+
+  } CATCH();
+
+  // Nodes built so far belong to the arena, which goes with the tree
+  return MERKLE_FAILED_TREE_BUILD;
+}
+
+/**
+ * @brief Shared state for copying and hashing flat-layout leaves in parallel.
+ */
+typedef struct flat_leaf_ctx {
+  const merkle_hash_vtable_t *hash; /**< Algorithm of the tree. */
+  merkle_stat_counters_t *stats;    /**< Counters of the tree. */
+  merkle_flat_storage_t *flat; /**< Storage with leaf offsets already laid out. */
+  const void **borrowed;       /**< Receives the caller pointers when borrowing (else NULL). */
+  const void **data;           /**< Caller data blocks. */
+  const size_t *size;          /**< Caller block sizes. */
+  bool guarded;                /**< Blocks are read under signal protection. */
+  const atomic_bool *cancel;   /**< Cancellation flag of the build (may be NULL). */
+  atomic_bool failed;          /**< Set by any chunk that fails. */
+} flat_leaf_ctx_t;
+
+/**
+ * @brief Copies and hashes the @p batch flat leaves from @p first, under signal protection if guarded.
+ * @return false if a block could not be read or hashed.
+ */
+static bool fill_flat_batch(flat_leaf_ctx_t *ctx, size_t first, size_t batch){
+  merkle_flat_storage_t *flat = ctx->flat;
+  const void *blocks[MERKLE_SHA256_MAX_LANES];
+  unsigned char *hashes[MERKLE_SHA256_MAX_LANES];
+  volatile bool success = false;
+
+  SAFE_ACCESS_TRY_IF(ctx->guarded) {
+    for(size_t k = 0; k < batch; ++k){
+      size_t i = first + k;
+      blocks[k] = ctx->data[i];
+      hashes[k] = flat_node(flat, 0, i);
+
+      // Without a data buffer the caller's block is hashed in place
+      if(flat->leaf_data){
+        unsigned char *copy = flat->leaf_data + flat->leaf_offsets[i];
+        memcpy(copy, blocks[k], ctx->size[i]);
+        blocks[k] = copy;
+      }
+    }
+
+    success = hash_leaf_blocks(ctx->stats, ctx->hash, blocks, ctx->size + first, hashes, batch) == MERKLE_SUCCESS;
+  } SAFE_ACCESS_CATCH {
+    success = false;
+  } SAFE_ACCESS_END;
+
+  return success;
+}
+
+/**
+ * @brief merkle_range_fn copying and hashing flat leaves [begin, end).
+ */
+static void flat_leaf_range(void *arg, size_t begin, size_t end){
+  flat_leaf_ctx_t *ctx = arg;
+  bool success = true;
+
+  // Copy and hash every leaf, a batch at a time - with protection against invalid data
+  for(size_t first = begin; first < end && success; first += MERKLE_SHA256_MAX_LANES){
+    size_t batch = end - first < MERKLE_SHA256_MAX_LANES ? end - first : MERKLE_SHA256_MAX_LANES;
+
+    if(ctx->cancel && atomic_load_explicit(ctx->cancel, memory_order_relaxed)){
+      success = false;
+      break;
+    }
+
+    success = fill_flat_batch(ctx, first, batch);
+
+    if(ctx->borrowed){
+      for(size_t k = 0; k < batch; ++k){
+        ctx->borrowed[first + k] = ctx->data[first + k];
+      }
+    }
+  }
+
+  if(!success){
+    atomic_store(&ctx->failed, true);
+  }
+}
+
+/**
+ * @brief Shared state for hashing one flat-layout level in parallel.
+ */
+typedef struct flat_level_ctx {
+  const merkle_hash_vtable_t *hash;           /**< Algorithm of the tree. */
+  merkle_stat_counters_t *stats;              /**< Counters of the tree. */
+  const merkle_flat_storage_t *flat;          /**< Storage of the tree. */
+  size_t level;                               /**< Child level. */
+  size_t child_width;                         /**< Nodes on the child level. */
+  size_t branching_factor;                    /**< Children per parent. */
+  atomic_bool failed;                         /**< Set by any chunk that fails. */
+} flat_level_ctx_t;
+
+/**
+ * @brief merkle_range_fn hashing flat parents [begin, end) of one level.
+ */
+static void flat_level_range(void *arg, size_t begin, size_t end){
+  flat_level_ctx_t *ctx = arg;
+  size_t branching_factor = ctx->branching_factor;
+
+  /* Each parent hashes the contiguous run of its children on the level below,
+   * so the runs can be batched without copying. */
+  for(size_t first = begin; first < end; first += MERKLE_SHA256_MAX_LANES){
+    size_t batch = end - first < MERKLE_SHA256_MAX_LANES ? end - first : MERKLE_SHA256_MAX_LANES;
+    const unsigned char *blocks[MERKLE_SHA256_MAX_LANES];
+    size_t sizes[MERKLE_SHA256_MAX_LANES];
+    unsigned char *hashes[MERKLE_SHA256_MAX_LANES];
+
+    for(size_t k = 0; k < batch; ++k){
+      size_t p = first + k;
+      size_t child = p * branching_factor;
+      size_t child_count = ctx->child_width - child < branching_factor ? ctx->child_width - child : branching_factor;
+      blocks[k] = flat_node(ctx->flat, ctx->level, child);
+      sizes[k] = child_count * HASH_SIZE;
+      hashes[k] = flat_node(ctx->flat, ctx->level + 1, p);
+    }
+
+    // Every parent of the batch has all its children
+    if((first + batch) * branching_factor <= ctx->child_width){
+      hash_node_run(ctx->stats, ctx->hash, blocks, branching_factor * HASH_SIZE, hashes, batch);
+      continue;
+    }
+
+    if(hash_node_blocks(ctx->stats, ctx->hash, (const void *const *)blocks, sizes, hashes, batch) != MERKLE_SUCCESS){
+      atomic_store(&ctx->failed, true);
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Lays out the bands of a blocked tree whose level widths are known.
+ *
+ * @param map Map with its band height set.
+ * @return Number of slots the blocked order needs.
+ */
+static size_t plan_flat_blocks(flat_block_map_t *map, const size_t *level_offsets, size_t branching_factor,
+                               size_t levels){
+  size_t band_levels = map->levels;
+  size_t slots = 0;
+  size_t band = 0;
+
+  map->root_level = levels;
+  map->row_span[0] = 1;
+  map->row_start[1] = 0;
+
+  for(size_t row = 1; row <= band_levels; ++row){
+    map->row_span[row] = map->row_span[row - 1] * branching_factor;
+    map->row_start[row + 1] = map->row_start[row] + map->row_span[row];
+  }
+
+  // One block per node on the level above each band; only the last block of a band can be partial
+  for(; band * band_levels < levels; ++band){
+    size_t top = (band + 1) * band_levels < levels ? (band + 1) * band_levels : levels;
+    size_t rows = top - band * band_levels;
+
+    size_t block_slots = map->row_start[rows + 1];
+    size_t stride = 1;
+
+    // Power-of-two strides keep aligned blocks from straddling pages; when
+    // that wastes over an eighth of the band, blocks only start on cache lines
+    while(stride < block_slots){
+      stride *= 2;
+    }
+
+    if(stride - block_slots > stride / 8){
+      stride = (block_slots + FLAT_LINE_SLOTS - 1) / FLAT_LINE_SLOTS * FLAT_LINE_SLOTS;
+    }
+
+    map->band_base[band] = slots;
+    map->band_stride[band] = stride;
+    slots += (level_offsets[top + 1] - level_offsets[top]) * stride;
+  }
+
+  map->band_base[band] = slots;
+  return slots + 1;
+}
+
+/**
+ * @brief Allocates the level offsets and hash arrays of a flat-layout tree.
+ *
+ * Levels are laid out back to back, leaves first and root last, unless the
+ * tree stores its nodes in subtree-blocked order.
+ *
+ * @param tree Flat-layout tree with its leaf count set.
+ * @param levels Levels above the leaves, as count_tree_levels() reports.
+ * @return MERKLE_SUCCESS, or MERKLE_FAILED_MEM_ALLOC.
+ */
+static merkle_error_t alloc_flat_levels(merkle_tree_t *tree, size_t levels){
+  merkle_flat_storage_t *flat = &tree->flat;
+
+  ALLOC_AND_INIT_SIMPLE(flat->level_offsets, levels + 2);
+
+  if(!flat->level_offsets){
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  size_t total_nodes = 0;
+  size_t width = tree->leaf_count;
+
+  for(size_t lvl = 0; lvl <= levels; ++lvl){
+    flat->level_offsets[lvl] = total_nodes;
+    total_nodes += width;
+    width = (width + tree->branching_factor - 1) / tree->branching_factor;
+  }
+
+  flat->level_offsets[levels + 1] = total_nodes;
+
+  if(!flat->blocks.levels){
+    ALLOC_AND_INIT_SIMPLE(flat->hashes, total_nodes);
+    return flat->hashes ? MERKLE_SUCCESS : MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  // Blocks start on page boundaries, so the allocation is over-sized and aligned inside
+  total_nodes = plan_flat_blocks(&flat->blocks, flat->level_offsets, tree->branching_factor, levels);
+  flat->hash_block = MMalloc(total_nodes * HASH_SIZE + FLAT_BLOCK_BYTES);
+
+  if(!flat->hash_block){
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  uintptr_t base = ((uintptr_t)flat->hash_block + FLAT_BLOCK_BYTES - 1) & ~(uintptr_t)(FLAT_BLOCK_BYTES - 1);
+  flat->hashes = (unsigned char (*)[HASH_SIZE])base;
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Hashes every level above filled flat-layout leaves under the write lock.
+ *
+ * Levels depend on each other, the parents within one level do not.
+ */
+static merkle_error_t hash_flat_levels(merkle_tree_t *tree, size_t levels, merkle_thread_pool_t *pool){
+  merkle_flat_storage_t *flat = &tree->flat;
+  bool success = true;
+
+  MERKLE_STAT_WRITE_LOCK(tree_stats(tree), &tree->lock);
+
+  for(size_t lvl = 0; lvl < levels && success; ++lvl){
+    if(build_cancelled(tree)){
+      success = false;
+      break;
+    }
+
+    flat_level_ctx_t level_ctx = {
+      .hash = tree->hash,
+      .stats = &tree->stats,
+      .flat = flat,
+      .level = lvl,
+      .child_width = flat_level_width(flat, lvl),
+      .branching_factor = tree->branching_factor,
+    };
+    atomic_init(&level_ctx.failed, false);
+    merkle_parallel_for(pool, flat_level_width(flat, lvl + 1), PARALLEL_NODE_GRAIN, flat_level_range, &level_ctx);
+    success = !atomic_load(&level_ctx.failed);
+  }
+
+  tree->levels = levels;
+  RW_WRITE_UNLOCK(&tree->lock);
+  return success ? MERKLE_SUCCESS : MERKLE_FAILED_TREE_BUILD;
+}
+
+static merkle_error_t build_flat_tree(merkle_tree_t *tree, const void **data, const size_t *size,
+                                      merkle_thread_pool_t *pool) {
+  merkle_flat_storage_t *flat = &tree->flat;
+  size_t count = tree->leaf_count;
+  size_t branching_factor = tree->branching_factor;
+  size_t total_bytes = 0;
+
+  // Validate every block first so the shared data buffer can be sized up front
+  if(validate_leaf_blocks(data, size, count, tree->guarded, &total_bytes) != MERKLE_SUCCESS){
+    return MERKLE_BAD_ARG;
+  }
+
+  TRY{
+    size_t levels = count_tree_levels(count, branching_factor);
+
+    bool copy = tree->leaf_storage == MERKLE_LEAF_COPY;
+
+    if(alloc_flat_levels(tree, levels) != MERKLE_SUCCESS){
+      THROW;
+    }
+
+    // Each copy is NUL-terminated so finders may read text blocks as C strings
+    if(copy && total_bytes > SIZE_MAX - count){
+      THROW;
+    }
+
+    if(copy){
+      ALLOC_AND_INIT_SIMPLE(flat->leaf_offsets, count + 1);
+      flat->leaf_data = MMalloc(total_bytes + count);
+
+      if(!flat->leaf_offsets || !flat->leaf_data){
+        THROW;
+      }
+
+      // Sizes are known, so every leaf's slot in the data buffer is too
+      size_t offset = 0;
+
+      for(size_t i = 0; i < count; ++i){
+        flat->leaf_offsets[i] = offset;
+        offset += size[i] + 1;
+      }
+
+      flat->leaf_offsets[count] = offset;
+    }
+
+    flat_leaf_ctx_t leaf_ctx = {
+      .hash = tree->hash, .stats = &tree->stats, .flat = flat, .borrowed = tree->borrowed, .data = data,
+      .size = size, .guarded = tree->guarded, .cancel = tree->cancel
+    };
+    atomic_init(&leaf_ctx.failed, false);
+    merkle_parallel_for(pool, count, PARALLEL_LEAF_GRAIN, flat_leaf_range, &leaf_ctx);
+
+    if(atomic_load(&leaf_ctx.failed)){
+      THROW;
+    }
+
+    if(hash_flat_levels(tree, levels, pool) != MERKLE_SUCCESS){
+      THROW;
+    }
+
+    return MERKLE_SUCCESS;
+
+  } CATCH();
+
+  dealloc_flat_storage(flat, count);
+  tree->levels = 0;
+  return MERKLE_FAILED_TREE_BUILD;
+}
+
+/**
+ * @brief Returns the hash of a leaf of a tree that keeps a leaves array or flat storage.
+ */
+static const unsigned char *tree_leaf_hash(const merkle_tree_t *tree, size_t leaf_index){
+  if(tree->layout == MERKLE_LAYOUT_FLAT){
+    return flat_node(&tree->flat, 0, leaf_index);
+  }
+
+  return tree->leaves[leaf_index]->hash;
+}
+
+/**
+ * @brief Shared state for digesting leaf keys in parallel.
+ */
+typedef struct key_digest_ctx {
+  const merkle_tree_t *tree;           /**< Tree whose extractor is called. */
+  const void **data;                   /**< Caller data blocks. */
+  const size_t *size;                  /**< Caller block sizes. */
+  unsigned char (*digests)[HASH_SIZE]; /**< Receives the digest of each leaf's key. */
+  bool *keyed;                         /**< Receives whether each leaf has a key. */
+  atomic_bool failed;                  /**< Set by any chunk that cannot read its blocks. */
+} key_digest_ctx_t;
+
+/**
+ * @brief Extracts and digests the keys of @p count blocks, a hashing batch at a time.
+ *
+ * Signal protection must be armed by the caller.
+ *
+ * @return false if a block could not be read.
+ */
+static bool digest_leaf_keys(const merkle_tree_t *tree, const void *const *data, const size_t *size, size_t count,
+                             unsigned char *const *digests, bool *keyed){
+  volatile bool success = true;
+
+  for(size_t first = 0; first < count && success; first += MERKLE_SHA256_MAX_LANES){
+    size_t batch = count - first < MERKLE_SHA256_MAX_LANES ? count - first : MERKLE_SHA256_MAX_LANES;
+    const void *keys[MERKLE_SHA256_MAX_LANES];
+    size_t key_sizes[MERKLE_SHA256_MAX_LANES];
+    unsigned char *hashes[MERKLE_SHA256_MAX_LANES];
+    size_t found = 0;
+
+    SAFE_ACCESS_TRY_IF(tree->guarded) {
+      for(size_t k = 0; k < batch; ++k){
+        size_t i = first + k;
+        keys[found] = NULL;
+        key_sizes[found] = 0;
+        keyed[i] = tree->key_extractor(data[i], size[i], &keys[found], &key_sizes[found], tree->key_extractor_ctx) &&
+                   keys[found] && key_sizes[found];
+
+        if(keyed[i]){
+          hashes[found++] = digests[i];
+        }
+      }
+
+      success = !found || hash_data_blocks(tree->hash, keys, key_sizes, hashes, found) == MERKLE_SUCCESS;
+    } SAFE_ACCESS_CATCH {
+      // Segfault occurred during data access
+      success = false;
+    } SAFE_ACCESS_END;
+  }
+
+  return success;
+}
+
+/**
+ * @brief merkle_range_fn digesting the keys of leaves [begin, end).
+ */
+static void key_digest_range(void *arg, size_t begin, size_t end){
+  key_digest_ctx_t *ctx = arg;
+  unsigned char *digests[MERKLE_SHA256_MAX_LANES];
+
+  for(size_t first = begin; first < end && !atomic_load_explicit(&ctx->failed, memory_order_relaxed);
+      first += MERKLE_SHA256_MAX_LANES){
+    size_t batch = end - first < MERKLE_SHA256_MAX_LANES ? end - first : MERKLE_SHA256_MAX_LANES;
+
+    for(size_t k = 0; k < batch; ++k){
+      digests[k] = ctx->digests[first + k];
+    }
+
+    if(!digest_leaf_keys(ctx->tree, ctx->data + first, ctx->size + first, batch, digests, ctx->keyed + first)){
+      atomic_store(&ctx->failed, true);
+      return;
+    }
+  }
+}
+
+static merkle_error_t build_leaf_index(merkle_tree_t *tree, const void **data, const size_t *size,
+                                       merkle_thread_pool_t *pool){
+  if(tree->index_kind == MERKLE_INDEX_NONE){
+    return MERKLE_SUCCESS;
+  }
+
+  tree->index = merkle_index_create(tree->leaf_count);
+
+  if(!tree->index){
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  // Leaf hashes already are digests of the content
+  if(tree->index_kind == MERKLE_INDEX_LEAF_HASH){
+    for(size_t i = 0; i < tree->leaf_count; ++i){
+      merkle_index_set(tree->index, i, tree_leaf_hash(tree, i));
+    }
+
+    return MERKLE_SUCCESS;
+  }
+
+  // Keys are digested in parallel, then filed in leaf order
+  key_digest_ctx_t ctx = { .tree = tree, .data = data, .size = size };
+  atomic_init(&ctx.failed, false);
+  ALLOC_AND_INIT_SIMPLE(ctx.digests, tree->leaf_count);
+  ALLOC_AND_INIT_SIMPLE(ctx.keyed, tree->leaf_count);
+
+  if(!ctx.digests || !ctx.keyed){
+    MFree(ctx.digests);
+    MFree(ctx.keyed);
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  merkle_parallel_for(pool, tree->leaf_count, PARALLEL_LEAF_GRAIN, key_digest_range, &ctx);
+
+  for(size_t i = 0; i < tree->leaf_count && !atomic_load(&ctx.failed); ++i){
+    if(ctx.keyed[i]){
+      merkle_index_set(tree->index, i, ctx.digests[i]);
+    }
+  }
+
+  MFree(ctx.digests);
+  MFree(ctx.keyed);
+  return atomic_load(&ctx.failed) ? MERKLE_FAILED_TREE_BUILD : MERKLE_SUCCESS;
+}
+
+merkle_error_t get_tree_hash(merkle_tree_t * const tree, unsigned char copy_into[HASH_SIZE]) {
+  // Validate input parameters
+  if (!tree || !copy_into) {
+    return MERKLE_NULL_ARG;
+  }
+
+  const unsigned char *root = tree_root_hash(tree);
+
+  // Check if tree is properly constructed
+  if (!root || tree->leaf_count == 0) {
+    return MERKLE_BAD_ARG;
+  }
+
+  // Copy the root hash to the output buffer from a consistent snapshot
+  size_t version;
+
+  do {
+    version = snapshot_begin(tree);
+    memcpy(copy_into, root, HASH_SIZE);
+  } while (!snapshot_unchanged(tree, version));
+
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Shared state of a parallel finder scan.
+ */
+typedef struct finder_scan_ctx {
+  const merkle_tree_t *tree; /**< Tree being searched. */
+  value_finder finder;       /**< Caller predicate. */
+  atomic_size_t match;       /**< Lowest matching leaf so far, leaf_count while there is none. */
+} finder_scan_ctx_t;
+
+/**
+ * @brief merkle_range_fn testing leaves [begin, end), stopping at the first match or past a better one.
+ */
+static void finder_scan_range(void *arg, size_t begin, size_t end){
+  finder_scan_ctx_t *ctx = arg;
+
+  for(size_t i = begin; i < end && i < atomic_load_explicit(&ctx->match, memory_order_relaxed); ++i){
+    void *value = tree_leaf_data(ctx->tree, i);
+
+    if(!value || !ctx->finder(value)){
+      continue;
+    }
+
+    // Keep the lowest match; a chunk further left may have found one first
+    size_t best = atomic_load_explicit(&ctx->match, memory_order_relaxed);
+
+    while(i < best && !atomic_compare_exchange_weak_explicit(&ctx->match, &best, i, memory_order_relaxed,
+                                                             memory_order_relaxed)){
+    }
+
+    return;
+  }
+}
+
+/**
+ * @brief Finds the lowest leaf @p finder accepts and generates its proof.
+ *
+ * @return MERKLE_SUCCESS with a proof, MERKLE_NOT_FOUND without a match, or
+ *         the error of generate_proof().
+ */
+static merkle_error_t find_and_prove(merkle_tree_t *const tree, value_finder finder, merkle_thread_pool_t *pool,
+                                     merkle_proof_t **proof){
+  // Hash-only trees can only be searched through the caller's lookup
+  if(tree->leaf_storage == MERKLE_LEAF_HASH_ONLY && !tree->leaf_lookup){
+    return MERKLE_BAD_ARG;
+  }
+
+  finder_scan_ctx_t ctx = { .tree = tree, .finder = finder };
+  atomic_init(&ctx.match, tree->leaf_count);
+  merkle_error_t result = MERKLE_NOT_FOUND;
+
+  // Updates free replaced leaf data, so the search excludes them with the lock
+  MERKLE_STAT_READ_LOCK(tree_stats(tree), &tree->lock);
+  merkle_parallel_for(pool, tree->leaf_count, PARALLEL_LEAF_GRAIN, finder_scan_range, &ctx);
+  size_t match = atomic_load(&ctx.match);
+
+  if(match < tree->leaf_count){
+    result = generate_proof(tree, match, proof);
+  }
+
+  RW_READ_UNLOCK(&tree->lock);
+  return result;
+}
+
+merkle_error_t generate_proof_by_finder(merkle_tree_t *const tree, value_finder finder, size_t *path_length, merkle_proof_t** proof){
+  
+  // Validate input parameters
+  if(!tree || !finder || !proof){
+      return MERKLE_BAD_ARG;
+  }
+
+  merkle_error_t result = find_and_prove(tree, finder, NULL, proof);
+
+  // Finding nothing has always been a success without a proof here
+  return result == MERKLE_NOT_FOUND ? MERKLE_SUCCESS : result;
+}
+
+merkle_error_t generate_proof_by_finder_parallel(merkle_tree_t *const tree, value_finder finder,
+                                                 merkle_thread_pool_t *pool, merkle_proof_t **proof){
+  // Validate input parameters
+  if(!tree || !finder || !proof){
+      return MERKLE_BAD_ARG;
+  }
+
+  return find_and_prove(tree, finder, pool, proof);
+}
+
+merkle_error_t generate_proof_by_key(merkle_tree_t *const tree, const void *key, size_t key_size,
+                                     merkle_proof_t **proof){
+  // Validate input parameters
+  if(!tree || !key || !proof){
+    return MERKLE_NULL_ARG;
+  }
+
+  if(!tree->index || key_size == 0){
+    return MERKLE_BAD_ARG;
+  }
+
+  unsigned char digest[HASH_SIZE];
+  unsigned char *digests[1] = { digest };
+  merkle_error_t result = MERKLE_NOT_FOUND;
+  size_t leaf_index = 0;
+
+  if(hash_data_blocks(tree->hash, &key, &key_size, digests, 1) != MERKLE_SUCCESS){
+    return MERKLE_BAD_ARG;
+  }
+
+  // Updates rewrite the index, so the lookup and the proof share the lock
+  MERKLE_STAT_READ_LOCK(tree_stats(tree), &tree->lock);
+
+  if(merkle_index_find(tree->index, digest, &leaf_index)){
+    result = generate_proof(tree, leaf_index, proof);
+  }
+
+  RW_READ_UNLOCK(&tree->lock);
+  return result;
+}
+
+merkle_error_t generate_proof_from_index(merkle_tree_t *const tree, size_t leaf_index, merkle_proof_t **proof){
+  if(!tree || !proof){
+    return MERKLE_BAD_ARG;
+  }
+  
+  merkle_error_t result;
+  size_t version;
+
+  // A proof that overlapped an update may mix versions, so build it again
+  for(;;){
+    version = snapshot_begin(tree);
+    result = generate_proof(tree,leaf_index,proof);
+
+    if(result != MERKLE_SUCCESS || snapshot_unchanged(tree, version)){
+      return result;
+    }
+
+    free_proof(*proof);
+    *proof = NULL;
+  }
+}
+
+static merkle_error_t generate_proof(merkle_tree_t *const tree, size_t leaf_index, merkle_proof_t **proof){
+  
+  // Validate input parameters
+  if(!tree || tree->leaf_count <= leaf_index || !proof){
+      return MERKLE_BAD_ARG;
+  }
+
+  // Initialize local variables
+  merkle_error_t ret = MERKLE_SUCCESS;
+  *proof = NULL;
+  merkle_proof_t *result = NULL;
+
+  TRY{
+
+    ALLOC_AND_INIT_SIMPLE(result,1);
+
+    if(!result) {
+      ret = MERKLE_FAILED_MEM_ALLOC;
+      THROW;
+    }
+
+    result->path_length = tree->levels;
+    result->leaf_index = leaf_index;
+    result->branching_factor = tree->branching_factor;
+    result->hash_id = tree->hash_id;
+
+    ALLOC_AND_INIT_SIMPLE(result->path,tree->levels);
+
+    if(!result->path){
+      ret = MERKLE_FAILED_MEM_ALLOC;
+      THROW;
+    }
+
+    merkle_node_t *nodes[POINTER_MAX_LEVELS + 1];
+    size_t index = leaf_index;
+    bool success = 1;
+
+    if(tree->layout == MERKLE_LAYOUT_POINTER){
+      pointer_leaf_path(tree, leaf_index, nodes);
+    }
+
+    for(size_t path_len = 0; path_len < result->path_length && success; ++path_len){
+        ALLOC_AND_INIT(merkle_proof_item_t,proof_item,1);
+
+        result->path[path_len] = proof_item;
+
+        if(!proof_item){
+          ret = MERKLE_FAILED_MEM_ALLOC;
+          success = 0;
+          break;
+        }
+
+        if(tree->layout == MERKLE_LAYOUT_FLAT){
+          ret = add_flat_proof_path(tree, path_len, index, proof_item);
+        } else {
+          ret = add_proof_path(nodes[path_len + 1], index % tree->branching_factor, proof_item);
+        }
+
+        index /= tree->branching_factor;
+        success = ret == MERKLE_SUCCESS;
+    }
+
+    if(!success){
+      THROW;
+    }
+
+    *proof = result;
+    MERKLE_STAT_ADD(tree_stats(tree), proofs_generated, 1);
+    return ret;
+
+  }CATCH();
+
+  free_proof(result);
+  return ret;
+}
+
+void dealloc_merkle_proof(merkle_proof_t *proof){
+  free_proof(proof);
+}
+
+static void free_proof(merkle_proof_t *proof){
+  if(!proof){
+    return;
+  }
+
+  for(size_t idx = 0; proof->path && idx != proof->path_length; ++idx){
+    if(!proof->path[idx]) {
+      continue;
+    }
+
+    MFree(proof->path[idx]->sibling_hashes);
+    MFree(proof->path[idx]);
+  }
+
+  MFree(proof->path);
+  MFree(proof);
+}
+
+static merkle_error_t add_proof_path(const merkle_node_t *parent, size_t position, merkle_proof_item_t *proof_item){
+    merkle_error_t result = MERKLE_SUCCESS;
+    
+    TRY{
+        if(!parent || !proof_item || position >= parent->child_count){
+          result = MERKLE_NULL_ARG;
+          THROW;      
+        }
+
+        ALLOC_AND_INIT_SIMPLE(proof_item->sibling_hashes, parent->child_count - 1);
+
+        if(!proof_item->sibling_hashes && parent->child_count > 1){
+          result = MERKLE_FAILED_MEM_ALLOC;
+          THROW;
+        }
+
+        proof_item->sibling_count = parent->child_count - 1;
+        proof_item->node_position = position;
+
+        // The parent's copy of its child hashes holds the siblings as two runs around our node
+        if(parent->child_count > 1){
+          memcpy(proof_item->sibling_hashes[0],parent->child_hashes[0],position * HASH_SIZE);
+          memcpy(proof_item->sibling_hashes[position],parent->child_hashes[position + 1],
+                 (parent->child_count - position - 1) * HASH_SIZE);
+        }
+
+    }CATCH();
+
+    return result;
+}
+
+static merkle_error_t add_flat_proof_path(const merkle_tree_t *tree, size_t level, size_t index, merkle_proof_item_t *proof_item){
+  if(!tree || !proof_item){
+    return MERKLE_NULL_ARG;
+  }
+
+  const merkle_flat_storage_t *flat = &tree->flat;
+  size_t branching_factor = tree->branching_factor;
+  size_t width = flat_level_width(flat, level);
+
+  // Siblings are the other children of our parent, i.e. the aligned group around index
+  size_t first = index - index % branching_factor;
+  const unsigned char (*group)[HASH_SIZE] = (const unsigned char (*)[HASH_SIZE])flat_node(flat, level, first);
+  size_t child_count = width - first < branching_factor ? width - first : branching_factor;
+
+  ALLOC_AND_INIT_SIMPLE(proof_item->sibling_hashes, child_count - 1);
+
+  if(!proof_item->sibling_hashes && child_count > 1){
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  size_t position = index - first;
+  proof_item->sibling_count = child_count - 1;
+  proof_item->node_position = position;
+
+  // The group is contiguous, so the siblings are the two runs around our node
+  if(child_count > 1){
+    memcpy(proof_item->sibling_hashes[0], group[0], position * HASH_SIZE);
+    memcpy(proof_item->sibling_hashes[position], group[position + 1], (child_count - position - 1) * HASH_SIZE);
+  }
+
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Exact size of the serialized proof of one leaf.
+ *
+ * Only the level widths matter, so no node is touched.
+ */
+static size_t proof_buffer_size(const merkle_tree_t *tree, size_t leaf_index){
+  size_t branching_factor = tree->branching_factor;
+  size_t size = MERKLE_PROOF_HEADER_SIZE + tree->levels * MERKLE_PROOF_LEVEL_SIZE;
+  size_t width = tree->leaf_count;
+  size_t index = leaf_index;
+
+  for(size_t level = 0; level < tree->levels; ++level){
+    size_t first = index - index % branching_factor;
+    size_t child_count = width - first < branching_factor ? width - first : branching_factor;
+    size += (child_count - 1) * HASH_SIZE;
+    index /= branching_factor;
+    width = (width + branching_factor - 1) / branching_factor;
+  }
+
+  return size;
+}
+
+merkle_error_t merkle_proof_max_size(merkle_tree_t *const tree, size_t *size){
+  // Validate input parameters
+  if(!tree || !size){
+    return MERKLE_NULL_ARG;
+  }
+
+  // The shape is fixed at build time, so no snapshot is needed
+  size_t levels = tree->levels;
+  size_t siblings = tree->branching_factor - 1;
+
+  // Every level at its widest: a full group of siblings
+  if(siblings > (SIZE_MAX - MERKLE_PROOF_LEVEL_SIZE) / HASH_SIZE){
+    return MERKLE_BAD_LEN;
+  }
+
+  size_t per_level = MERKLE_PROOF_LEVEL_SIZE + siblings * HASH_SIZE;
+
+  if(levels > (SIZE_MAX - MERKLE_PROOF_HEADER_SIZE) / per_level){
+    return MERKLE_BAD_LEN;
+  }
+
+  *size = MERKLE_PROOF_HEADER_SIZE + levels * per_level;
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Writes the proof of a valid leaf into @p out, which holds
+ *        proof_buffer_size() bytes.
+ */
+static void serialize_proof(const merkle_tree_t *tree, size_t leaf_index, unsigned char *out){
+  size_t branching_factor = tree->branching_factor;
+
+  memset(out, 0, MERKLE_PROOF_HEADER_SIZE);
+  memcpy(out, MERKLE_PROOF_MAGIC, 4);
+  out[MERKLE_PROOF_OFFSET_VERSION] = MERKLE_PROOF_VERSION;
+  out[MERKLE_PROOF_OFFSET_HASH_ID] = (unsigned char)tree->hash_id;
+  merkle_store_le64(out + MERKLE_PROOF_OFFSET_LEAF_INDEX, leaf_index);
+  merkle_store_le64(out + MERKLE_PROOF_OFFSET_BRANCHING, branching_factor);
+  merkle_store_le64(out + MERKLE_PROOF_OFFSET_PATH_LENGTH, tree->levels);
+
+  unsigned char *record = out + MERKLE_PROOF_HEADER_SIZE;
+  unsigned char *hashes = record + tree->levels * MERKLE_PROOF_LEVEL_SIZE;
+  merkle_node_t *nodes[POINTER_MAX_LEVELS + 1];
+  const unsigned char *groups[POINTER_MAX_LEVELS];
+  bool pointer = tree->layout == MERKLE_LAYOUT_POINTER;
+  size_t index = leaf_index;
+
+  if(pointer){
+    pointer_leaf_path(tree, leaf_index, nodes);
+  } else {
+    flat_path_groups(&tree->flat, branching_factor, tree->levels, leaf_index, groups);
+  }
+
+  // Siblings are copied straight from the tree into their wire position
+  for(size_t level = 0; level < tree->levels; ++level){
+    size_t first = index - index % branching_factor;
+    size_t position = index - first;
+    size_t child_count;
+    const unsigned char (*group)[HASH_SIZE];
+
+    if(pointer){
+      const merkle_node_t *parent = nodes[level + 1];
+      child_count = parent->child_count;
+      group = (const unsigned char (*)[HASH_SIZE])parent->child_hashes;
+    } else {
+      size_t width = flat_level_width(&tree->flat, level);
+      child_count = width - first < branching_factor ? width - first : branching_factor;
+      group = (const unsigned char (*)[HASH_SIZE])groups[level];
+    }
+
+    // Both layouts keep a sibling group contiguous, so the siblings around our node are two runs
+    memcpy(hashes, group[0], position * HASH_SIZE);
+    hashes += position * HASH_SIZE;
+    memcpy(hashes, group[position + 1], (child_count - position - 1) * HASH_SIZE);
+    hashes += (child_count - position - 1) * HASH_SIZE;
+
+    merkle_store_le32(record, (uint32_t)(child_count - 1));
+    merkle_store_le32(record + 4, (uint32_t)position);
+    record += MERKLE_PROOF_LEVEL_SIZE;
+    index /= branching_factor;
+  }
+}
+
+/**
+ * @brief Serializes a proof as generate_proof_into() does, without snapshot handling.
+ */
+static merkle_error_t write_proof_into(const merkle_tree_t *tree, size_t leaf_index, void *buffer, size_t capacity,
+                                       size_t *written){
+  if(leaf_index >= tree->leaf_count){
+    return MERKLE_INVALID_INDEX;
+  }
+
+  size_t need = proof_buffer_size(tree, leaf_index);
+  *written = need;
+
+  if(capacity < need){
+    return MERKLE_BAD_LEN;
+  }
+
+  serialize_proof(tree, leaf_index, buffer);
+  return MERKLE_SUCCESS;
+}
+
+merkle_error_t generate_proof_into(merkle_tree_t *const tree, size_t leaf_index, void *buffer, size_t capacity,
+                                   size_t *written){
+  // Validate input parameters
+  if(!tree || !written || (!buffer && capacity)){
+    return MERKLE_NULL_ARG;
+  }
+
+  if(tree->branching_factor > UINT32_MAX){
+    return MERKLE_BAD_ARG;
+  }
+
+  merkle_error_t ret;
+  size_t version;
+
+  // The buffer is simply rewritten if an update overlapped the copy
+  do {
+    version = snapshot_begin(tree);
+    ret = write_proof_into(tree, leaf_index, buffer, capacity, written);
+  } while (ret == MERKLE_SUCCESS && !snapshot_unchanged(tree, version));
+
+  if(ret == MERKLE_SUCCESS){
+    MERKLE_STAT_ADD(tree_stats(tree), proofs_generated, 1);
+  }
+
+  return ret;
+}
+
+/**
+ * @brief A requested leaf and its slot in the caller's order.
+ */
+typedef struct proof_batch_entry {
+  size_t leaf; /**< Leaf to prove. */
+  size_t slot; /**< Position in the caller's index array. */
+} proof_batch_entry_t;
+
+/**
+ * @brief Serialized proof sizes of one tree, resolved without divisions.
+ *
+ * A proof is max-size except on the levels where its node falls in the
+ * last, short group of siblings; those groups cover a suffix of the leaves.
+ */
+typedef struct proof_size_plan {
+  size_t full;                              /**< Size with a full group on every level. */
+  size_t short_count;                       /**< Levels whose last group is short. */
+  size_t first_leaf[POINTER_MAX_LEVELS];    /**< First leaf below each short group. */
+  size_t missing[POINTER_MAX_LEVELS];       /**< Bytes each short group lacks. */
+} proof_size_plan_t;
+
+/**
+ * @brief Locates the short sibling groups of @p tree.
+ * @return MERKLE_SUCCESS, or MERKLE_BAD_LEN if proofs do not fit in a size_t.
+ */
+static merkle_error_t plan_proof_sizes(merkle_tree_t *const tree, proof_size_plan_t *plan){
+  merkle_error_t ret = merkle_proof_max_size(tree, &plan->full);
+
+  if(ret != MERKLE_SUCCESS){
+    return ret;
+  }
+
+  size_t branching_factor = tree->branching_factor;
+  size_t width = tree->leaf_count;
+  size_t span = 1;
+  plan->short_count = 0;
+
+  for(size_t level = 0; level < tree->levels; ++level){
+    size_t rest = width % branching_factor;
+
+    if(rest){
+      plan->first_leaf[plan->short_count] = (width - rest) * span;
+      plan->missing[plan->short_count] = (branching_factor - rest) * HASH_SIZE;
+      plan->short_count++;
+    }
+
+    // Below the root a level is at least two nodes wide, so the span stays below the leaf count
+    width = (width + branching_factor - 1) / branching_factor;
+    span = level + 1 < tree->levels ? span * branching_factor : span;
+  }
+
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Returns proof_buffer_size() of @p leaf_index from a plan.
+ */
+static inline size_t planned_proof_size(const proof_size_plan_t *plan, size_t leaf_index){
+  size_t size = plan->full;
+
+  for(size_t k = 0; k < plan->short_count; ++k){
+    size -= leaf_index >= plan->first_leaf[k] ? plan->missing[k] : 0;
+  }
+
+  return size;
+}
+
+/**
+ * @brief Shared state of a parallel proof batch.
+ */
+typedef struct proof_batch_ctx {
+  const merkle_tree_t *tree;          /**< Tree being proven. */
+  const size_t *leaf_indices;         /**< Caller indices, walked directly when already ascending. */
+  const proof_batch_entry_t *order;   /**< Requests in ascending leaf order, or NULL. */
+  unsigned char *buffer;              /**< Output region. */
+  const size_t *offsets;              /**< Start of every slot's proof in @ref buffer. */
+} proof_batch_ctx_t;
+
+/**
+ * @brief qsort() order for batch requests: by leaf, then by slot.
+ */
+static int compare_batch_entries(const void *a, const void *b){
+  const proof_batch_entry_t *x = a;
+  const proof_batch_entry_t *y = b;
+
+  if(x->leaf != y->leaf){
+    return (x->leaf > y->leaf) - (x->leaf < y->leaf);
+  }
+
+  return (x->slot > y->slot) - (x->slot < y->slot);
+}
+
+/**
+ * @brief merkle_range_fn writing requests [begin, end) of the ascending order.
+ */
+static void proof_batch_range(void *arg, size_t begin, size_t end){
+  proof_batch_ctx_t *ctx = arg;
+
+  for(size_t k = begin; k < end; ++k){
+    size_t slot = ctx->order ? ctx->order[k].slot : k;
+    size_t leaf = ctx->order ? ctx->order[k].leaf : ctx->leaf_indices[k];
+
+    // Indices and sizes were checked up front
+    serialize_proof(ctx->tree, leaf, ctx->buffer + ctx->offsets[slot]);
+  }
+}
+
+merkle_error_t generate_proofs_batch(merkle_tree_t *const tree, const size_t *leaf_indices, size_t count,
+                                     merkle_thread_pool_t *pool, void *buffer, size_t capacity, size_t *offsets,
+                                     size_t *written){
+  // Validate input parameters
+  if(!tree || !offsets || !written || (!leaf_indices && count) || (!buffer && capacity)){
+    return MERKLE_NULL_ARG;
+  }
+
+  if(tree->branching_factor > UINT32_MAX){
+    return MERKLE_BAD_ARG;
+  }
+
+  // The shape is fixed at build time, so the layout needs no lock
+  proof_size_plan_t plan;
+  merkle_error_t ret = plan_proof_sizes(tree, &plan);
+
+  if(ret != MERKLE_SUCCESS){
+    return ret;
+  }
+
+  bool ascending = true;
+  size_t total = 0;
+  offsets[0] = 0;
+
+  for(size_t i = 0; i < count; ++i){
+    if(leaf_indices[i] >= tree->leaf_count){
+      return MERKLE_INVALID_INDEX;
+    }
+
+    size_t size = planned_proof_size(&plan, leaf_indices[i]);
+
+    if(size > SIZE_MAX - total){
+      return MERKLE_BAD_LEN;
+    }
+
+    total += size;
+    offsets[i + 1] = total;
+    ascending = ascending && (i == 0 || leaf_indices[i - 1] <= leaf_indices[i]);
+  }
+
+  *written = total;
+
+  if(capacity < total){
+    return MERKLE_BAD_LEN;
+  }
+
+  proof_batch_entry_t *order = NULL;
+
+  // Proving in leaf order keeps consecutive root paths in cache
+  if(!ascending){
+    ALLOC_AND_INIT_SIMPLE(order, count);
+
+    if(!order){
+      return MERKLE_FAILED_MEM_ALLOC;
+    }
+
+    for(size_t i = 0; i < count; ++i){
+      order[i].leaf = leaf_indices[i];
+      order[i].slot = i;
+    }
+
+    qsort(order, count, sizeof(*order), compare_batch_entries);
+  }
+
+  proof_batch_ctx_t ctx = {
+    .tree = tree, .leaf_indices = leaf_indices, .order = order, .buffer = buffer, .offsets = offsets
+  };
+
+  // Writers are held off for the whole batch, so every proof is of one version
+  MERKLE_STAT_READ_LOCK(tree_stats(tree), &tree->lock);
+  merkle_parallel_for(pool, count, PARALLEL_PROOF_GRAIN, proof_batch_range, &ctx);
+  RW_READ_UNLOCK(&tree->lock);
+
+  MFree(order);
+  MERKLE_STAT_ADD(tree_stats(tree), proofs_generated, count);
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief qsort() order for leaf indices.
+ */
+static int compare_indices(const void *a, const void *b){
+  size_t x = *(const size_t *)a;
+  size_t y = *(const size_t *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Walks a multiproof from the leaves up, counting or copying the
+ * sibling hashes it needs.
+ *
+ * @p known holds the sorted known nodes of the current level and is
+ * overwritten with their parents as the walk climbs. Pointer-layout trees
+ * also pass @p paths, the root path of one leaf below each known node, from
+ * which the parents are read.
+ *
+ * @param out Receives the hashes in walk order, or NULL to only count them.
+ * @return Number of hashes the proof needs.
+ */
+static size_t walk_multiproof(const merkle_tree_t *tree, size_t *known, merkle_node_t ***paths, size_t count,
+                              unsigned char (*out)[HASH_SIZE]){
+  size_t branching_factor = tree->branching_factor;
+  size_t width = tree->leaf_count;
+  size_t emitted = 0;
+
+  for(size_t level = 0; level < tree->levels; ++level){
+    size_t parents = 0;
+
+    for(size_t i = 0; i < count;){
+      size_t parent = known[i] / branching_factor;
+      size_t first = parent * branching_factor;
+      size_t last = width - first < branching_factor ? width : first + branching_factor;
+      merkle_node_t **path = paths ? paths[i] : NULL;
+      const merkle_node_t *parent_node = path ? path[level + 1] : NULL;
+
+      // Known children are recomputed by the verifier, the others travel in the proof
+      for(size_t child = first; child < last; ++child){
+        if(i < count && known[i] == child){
+          i++;
+          continue;
+        }
+
+        if(out){
+          const unsigned char *hash = parent_node ? parent_node->children[child - first]->hash
+                                                 : flat_node(&tree->flat, level, child);
+          memcpy(out[emitted], hash, HASH_SIZE);
+        }
+
+        emitted++;
+      }
+
+      known[parents] = parent;
+
+      if(paths){
+        paths[parents] = path;
+      }
+
+      parents++;
+    }
+
+    count = parents;
+    width = (width + branching_factor - 1) / branching_factor;
+  }
+
+  return emitted;
+}
+
+merkle_error_t generate_multiproof(merkle_tree_t *const tree, const size_t *leaf_indices, size_t count,
+                                   merkle_multiproof_t **proof){
+  // Validate input parameters
+  if(!tree || !leaf_indices || !proof || count == 0){
+    return MERKLE_BAD_ARG;
+  }
+
+  *proof = NULL;
+  merkle_error_t ret = MERKLE_FAILED_MEM_ALLOC;
+  size_t *sorted = NULL;
+  size_t *known = NULL;
+  merkle_node_t **path_nodes = NULL;
+  merkle_node_t ***paths = NULL;
+  bool pointer = tree->layout == MERKLE_LAYOUT_POINTER;
+  size_t stride = tree->levels + 1;
+
+  TRY{
+    ALLOC_AND_INIT_SIMPLE(sorted, count);
+    ALLOC_AND_INIT_SIMPLE(known, count);
+
+    if(!sorted || !known){
+      THROW;
+    }
+
+    memcpy(sorted, leaf_indices, count * sizeof(*sorted));
+    qsort(sorted, count, sizeof(*sorted), compare_indices);
+
+    size_t unique = 0;
+
+    for(size_t i = 0; i < count; ++i){
+      if(unique == 0 || sorted[unique - 1] != sorted[i]){
+        sorted[unique++] = sorted[i];
+      }
+    }
+
+    if(sorted[unique - 1] >= tree->leaf_count){
+      ret = MERKLE_INVALID_INDEX;
+      THROW;
+    }
+
+    // Node pointers never change after the build, so the paths are found once
+    if(pointer){
+      if(unique > SIZE_MAX / sizeof(*path_nodes) / stride){
+        THROW;
+      }
+
+      ALLOC_AND_INIT_SIMPLE(path_nodes, unique * stride);
+      ALLOC_AND_INIT_SIMPLE(paths, unique);
+
+      if(!path_nodes || !paths){
+        THROW;
+      }
+
+      for(size_t i = 0; i < unique; ++i){
+        pointer_leaf_path(tree, sorted[i], path_nodes + i * stride);
+        paths[i] = path_nodes + i * stride;
+      }
+    }
+
+    // Size the proof with a counting walk, then fill it with a second one
+    memcpy(known, sorted, unique * sizeof(*known));
+    size_t hash_count = walk_multiproof(tree, known, paths, unique, NULL);
+    merkle_multiproof_t *result = merkle_multiproof_alloc(unique, hash_count);
+
+    if(!result){
+      THROW;
+    }
+
+    // Only the hashes depend on the version, so only the fill walk repeats
+    size_t version;
+
+    do {
+      version = snapshot_begin(tree);
+      memcpy(known, sorted, unique * sizeof(*known));
+
+      for(size_t i = 0; pointer && i < unique; ++i){
+        paths[i] = path_nodes + i * stride;
+      }
+
+      walk_multiproof(tree, known, paths, unique, result->hashes);
+    } while (!snapshot_unchanged(tree, version));
+
+    memcpy(result->leaf_indices, sorted, unique * sizeof(*sorted));
+    result->leaf_count = tree->leaf_count;
+    result->branching_factor = tree->branching_factor;
+    result->hash_id = tree->hash_id;
+    *proof = result;
+    MERKLE_STAT_ADD(tree_stats(tree), proofs_generated, 1);
+    ret = MERKLE_SUCCESS;
+
+  }CATCH();
+
+  MFree(paths);
+  MFree(path_nodes);
+  MFree(known);
+  MFree(sorted);
+  return ret;
+}
+
+/**
+ * @brief Walks a range proof from the leaves up, counting or copying the
+ * edge siblings it needs.
+ *
+ * Pointer-layout trees also pass the root paths of the range's first and
+ * last leaf, whose ancestors are the parents the edge siblings hang from.
+ *
+ * @param out Receives the hashes in walk order, or NULL to only count them.
+ * @return Number of hashes the proof needs.
+ */
+static size_t walk_range_proof(const merkle_tree_t *tree, size_t first, size_t last, merkle_node_t **first_path,
+                               merkle_node_t **last_path, unsigned char (*out)[HASH_SIZE]){
+  size_t branching_factor = tree->branching_factor;
+  size_t width = tree->leaf_count;
+  size_t emitted = 0;
+
+  for(size_t level = 0; level < tree->levels; ++level){
+    size_t left_begin = first / branching_factor * branching_factor;
+    size_t right_begin = last / branching_factor * branching_factor;
+    size_t right_end = width - right_begin < branching_factor ? width : right_begin + branching_factor;
+
+    // Siblings left of the run under its first parent
+    for(size_t child = left_begin; child < first; ++child){
+      if(out){
+        const unsigned char *hash = first_path ? first_path[level + 1]->children[child - left_begin]->hash
+                                               : flat_node(&tree->flat, level, child);
+        memcpy(out[emitted], hash, HASH_SIZE);
+      }
+
+      emitted++;
+    }
+
+    // Siblings right of the run under its last parent
+    for(size_t child = last + 1; child < right_end; ++child){
+      if(out){
+        const unsigned char *hash = last_path ? last_path[level + 1]->children[child - right_begin]->hash
+                                              : flat_node(&tree->flat, level, child);
+        memcpy(out[emitted], hash, HASH_SIZE);
+      }
+
+      emitted++;
+    }
+
+    first /= branching_factor;
+    last /= branching_factor;
+    width = (width + branching_factor - 1) / branching_factor;
+  }
+
+  return emitted;
+}
+
+merkle_error_t generate_range_proof(merkle_tree_t *const tree, size_t first, size_t last,
+                                    merkle_range_proof_t **proof){
+  // Validate input parameters
+  if(!tree || !proof){
+    return MERKLE_NULL_ARG;
+  }
+
+  *proof = NULL;
+
+  if(first > last){
+    return MERKLE_BAD_ARG;
+  }
+
+  if(last >= tree->leaf_count){
+    return MERKLE_INVALID_INDEX;
+  }
+
+  merkle_node_t *first_path[POINTER_MAX_LEVELS + 1];
+  merkle_node_t *last_path[POINTER_MAX_LEVELS + 1];
+  bool pointer = tree->layout == MERKLE_LAYOUT_POINTER;
+
+  // Node pointers never change after the build, so the edge paths are found once
+  if(pointer){
+    pointer_leaf_path(tree, first, first_path);
+    pointer_leaf_path(tree, last, last_path);
+  }
+
+  size_t hash_count = walk_range_proof(tree, first, last, NULL, NULL, NULL);
+  merkle_range_proof_t *result = merkle_range_proof_alloc(hash_count);
+
+  if(!result){
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  size_t version;
+
+  do {
+    version = snapshot_begin(tree);
+    walk_range_proof(tree, first, last, pointer ? first_path : NULL, pointer ? last_path : NULL, result->hashes);
+  } while (!snapshot_unchanged(tree, version));
+
+  result->leaf_count = tree->leaf_count;
+  result->branching_factor = tree->branching_factor;
+  result->hash_id = tree->hash_id;
+  result->first = first;
+  result->last = last;
+  *proof = result;
+  MERKLE_STAT_ADD(tree_stats(tree), proofs_generated, 1);
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Number of nodes on a level of a tree, whatever its layout.
+ */
+static size_t tree_level_width(const merkle_tree_t *tree, size_t level){
+  if(tree->layout == MERKLE_LAYOUT_FLAT){
+    return flat_level_width(&tree->flat, level);
+  }
+
+  size_t width = tree->leaf_count;
+
+  for(size_t lvl = 0; lvl < level; ++lvl){
+    width = (width + tree->branching_factor - 1) / tree->branching_factor;
+  }
+
+  return width;
+}
+
+/**
+ * @brief Returns the hash of node @p index on @p level, whatever the layout.
+ *
+ * Pointer-layout nodes are reached from the root, as in pointer_leaf_path().
+ */
+static const unsigned char *tree_node_hash(const merkle_tree_t *tree, size_t level, size_t index){
+  if(tree->layout == MERKLE_LAYOUT_FLAT){
+    return flat_node(&tree->flat, level, index);
+  }
+
+  size_t branching_factor = tree->branching_factor;
+  size_t span = 1;
+
+  for(size_t lvl = level + 1; lvl < tree->levels; ++lvl){
+    span *= branching_factor;
+  }
+
+  const merkle_node_t *node = tree->root;
+
+  for(size_t lvl = tree->levels; lvl > level; --lvl){
+    node = node->children[(index / span) % branching_factor];
+    span /= branching_factor;
+  }
+
+  return node->hash;
+}
+
+/**
+ * @brief Growable list of node or leaf indices produced by a diff.
+ */
+typedef struct index_list {
+  size_t *items;    /**< Indices found so far. */
+  size_t count;     /**< Entries in @ref items. */
+  size_t capacity;  /**< Allocated entries. */
+  bool failed;      /**< An append could not grow the list. */
+} index_list_t;
+
+/**
+ * @brief Appends @p count consecutive indices starting at @p first.
+ */
+static void index_list_append(index_list_t *list, size_t first, size_t count){
+  if(list->failed){
+    return;
+  }
+
+  if(list->capacity - list->count < count){
+    size_t capacity = list->capacity ? list->capacity : 64;
+
+    while(capacity - list->count < count && capacity <= SIZE_MAX / 2 / sizeof(size_t)){
+      capacity *= 2;
+    }
+
+    size_t *items = NULL;
+
+    if(capacity - list->count >= count){
+      ALLOC_AND_INIT_SIMPLE(items, capacity);
+    }
+
+    if(!items){
+      list->failed = true;
+      return;
+    }
+
+    if(list->count){
+      memcpy(items, list->items, list->count * sizeof(*items));
+    }
+
+    MFree(list->items);
+    list->items = items;
+    list->capacity = capacity;
+  }
+
+  for(size_t i = 0; i < count; ++i){
+    list->items[list->count++] = first + i;
+  }
+}
+
+/**
+ * @brief Shared state of a two-tree diff.
+ */
+typedef struct tree_diff_ctx {
+  const merkle_tree_t *a; /**< First tree. */
+  const merkle_tree_t *b; /**< Second tree, same shape as @ref a. */
+  size_t *widths;         /**< Width of every level of the shared shape. */
+  index_list_t leaves;    /**< Differing leaves in index order. */
+} tree_diff_ctx_t;
+
+/**
+ * @brief Collects the differing leaves below node @p index of @p level.
+ *
+ * Pointer-layout subtrees are followed through their nodes (@p na, @p nb),
+ * flat ones are addressed by index (node NULL). Equal hashes end the descent,
+ * so only the O(k log n) nodes above the k differing leaves are visited.
+ */
+static void diff_subtrees(tree_diff_ctx_t *ctx, const merkle_node_t *na, const merkle_node_t *nb, size_t level,
+                          size_t index){
+  const unsigned char *ha = na ? na->hash : flat_node(&ctx->a->flat, level, index);
+  const unsigned char *hb = nb ? nb->hash : flat_node(&ctx->b->flat, level, index);
+
+  if(memcmp(ha, hb, HASH_SIZE) == 0 || ctx->leaves.failed){
+    return;
+  }
+
+  if(level == 0){
+    index_list_append(&ctx->leaves, index, 1);
+    return;
+  }
+
+  size_t branching_factor = ctx->a->branching_factor;
+  size_t first = index * branching_factor;
+  size_t width = ctx->widths[level - 1];
+  size_t child_count = width - first < branching_factor ? width - first : branching_factor;
+
+  for(size_t c = 0; c < child_count; ++c){
+    diff_subtrees(ctx, na ? na->children[c] : NULL, nb ? nb->children[c] : NULL, level - 1, first + c);
+  }
+}
+
+merkle_error_t merkle_tree_diff(merkle_tree_t *const a, merkle_tree_t *const b, size_t **leaf_indices,
+                                size_t *count){
+  // Validate input parameters
+  if(!a || !b || !leaf_indices || !count){
+    return MERKLE_NULL_ARG;
+  }
+
+  *leaf_indices = NULL;
+  *count = 0;
+
+  // Only trees of the same shape pair their nodes up
+  if(a->leaf_count != b->leaf_count || a->branching_factor != b->branching_factor || !tree_root_hash(a) ||
+     !tree_root_hash(b)){
+    return MERKLE_BAD_ARG;
+  }
+
+  tree_diff_ctx_t ctx = { .a = a, .b = b };
+  ALLOC_AND_INIT_SIMPLE(ctx.widths, a->levels + 1);
+
+  if(!ctx.widths){
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  for(size_t lvl = 0; lvl <= a->levels; ++lvl){
+    ctx.widths[lvl] = tree_level_width(a, lvl);
+  }
+
+  size_t version_a;
+  size_t version_b;
+
+  // A walk that overlapped an update of either tree is repeated
+  do {
+    version_a = snapshot_begin(a);
+    version_b = snapshot_begin(b);
+    ctx.leaves.count = 0;
+    diff_subtrees(&ctx, a->layout == MERKLE_LAYOUT_POINTER ? a->root : NULL,
+                  b->layout == MERKLE_LAYOUT_POINTER ? b->root : NULL, a->levels, 0);
+  } while(!ctx.leaves.failed && (!snapshot_unchanged(a, version_a) || !snapshot_unchanged(b, version_b)));
+
+  MFree(ctx.widths);
+
+  if(ctx.leaves.failed){
+    MFree(ctx.leaves.items);
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  if(ctx.leaves.count == 0){
+    MFree(ctx.leaves.items);
+    return MERKLE_SUCCESS;
+  }
+
+  *leaf_indices = ctx.leaves.items;
+  *count = ctx.leaves.count;
+  return MERKLE_SUCCESS;
+}
+
+merkle_error_t merkle_tree_level_hashes(merkle_tree_t *const tree, size_t level, const size_t *nodes, size_t count,
+                                        unsigned char (*hashes)[HASH_SIZE]){
+  // Validate input parameters
+  if(!tree || (count && (!nodes || !hashes))){
+    return MERKLE_NULL_ARG;
+  }
+
+  if(level > tree->levels || !tree_root_hash(tree)){
+    return MERKLE_BAD_ARG;
+  }
+
+  size_t width = tree_level_width(tree, level);
+
+  for(size_t i = 0; i < count; ++i){
+    if(nodes[i] >= width){
+      return MERKLE_INVALID_INDEX;
+    }
+  }
+
+  size_t version;
+
+  do {
+    version = snapshot_begin(tree);
+
+    for(size_t i = 0; i < count; ++i){
+      memcpy(hashes[i], tree_node_hash(tree, level, nodes[i]), HASH_SIZE);
+    }
+  } while(!snapshot_unchanged(tree, version));
+
+  return MERKLE_SUCCESS;
+}
+
+merkle_error_t merkle_tree_diff_level(merkle_tree_t *const tree, size_t level, const size_t *nodes,
+                                      const unsigned char (*remote)[HASH_SIZE], size_t count, size_t **next,
+                                      size_t *next_count){
+  // Validate input parameters
+  if(!tree || !next || !next_count || (count && (!nodes || !remote))){
+    return MERKLE_NULL_ARG;
+  }
+
+  *next = NULL;
+  *next_count = 0;
+
+  if(level > tree->levels || !tree_root_hash(tree)){
+    return MERKLE_BAD_ARG;
+  }
+
+  size_t branching_factor = tree->branching_factor;
+  size_t width = tree_level_width(tree, level);
+  size_t child_width = level > 0 ? tree_level_width(tree, level - 1) : 0;
+
+  for(size_t i = 0; i < count; ++i){
+    if(nodes[i] >= width){
+      return MERKLE_INVALID_INDEX;
+    }
+  }
+
+  index_list_t list = {0};
+  size_t version;
+
+  // Differing leaves are the answer, differing parents ask for their children
+  do {
+    version = snapshot_begin(tree);
+    list.count = 0;
+
+    for(size_t i = 0; i < count && !list.failed; ++i){
+      if(memcmp(tree_node_hash(tree, level, nodes[i]), remote[i], HASH_SIZE) == 0){
+        continue;
+      }
+
+      if(level == 0){
+        index_list_append(&list, nodes[i], 1);
+        continue;
+      }
+
+      size_t first = nodes[i] * branching_factor;
+      index_list_append(&list, first, child_width - first < branching_factor ? child_width - first : branching_factor);
+    }
+  } while(!list.failed && !snapshot_unchanged(tree, version));
+
+  if(list.failed){
+    MFree(list.items);
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  if(list.count == 0){
+    MFree(list.items);
+    return MERKLE_SUCCESS;
+  }
+
+  *next = list.items;
+  *next_count = list.count;
+  return MERKLE_SUCCESS;
+}
+
+void dealloc_merkle_diff(size_t *indices){
+  MFree(indices);
+}
+
+size_t merkle_tree_leaf_count(const merkle_tree_t *tree){
+  return tree ? tree->leaf_count : 0;
+}
+
+size_t merkle_tree_level_count(const merkle_tree_t *tree){
+  return tree ? tree->levels : 0;
+}
+
+void merkle_tree_shape(const merkle_tree_t *tree, size_t *branching_factor, merkle_hash_id_t *hash_id){
+  *branching_factor = tree->branching_factor;
+  *hash_id = tree->hash_id;
+}
+
+/**
+ * @brief One requested leaf change of update_leaves().
+ */
+typedef struct leaf_update {
+  size_t index;                  /**< Leaf being replaced. */
+  size_t position;               /**< Position of the request in the caller's arrays. */
+  unsigned char *copy;           /**< Fresh copy of the data, when the tree needs a new buffer. */
+  unsigned char hash[HASH_SIZE]; /**< New leaf hash. */
+  merkle_node_t *leaf;           /**< New leaf node of a derived version, until it is linked. */
+  unsigned char key[HASH_SIZE];  /**< Digest of the new block's key (MERKLE_INDEX_KEY). */
+  bool keyed;                    /**< Whether the new block has a key. */
+} leaf_update_t;
+
+/**
+ * @brief qsort() order for leaf updates: by leaf, then by request order.
+ */
+static int compare_leaf_updates(const void *a, const void *b){
+  const leaf_update_t *x = a;
+  const leaf_update_t *y = b;
+
+  if(x->index != y->index){
+    return x->index < y->index ? -1 : 1;
+  }
+
+  return (x->position > y->position) - (x->position < y->position);
+}
+
+/**
+ * @brief Whether a copying flat tree can overwrite a leaf's slot in place.
+ */
+static bool flat_slot_fits(const merkle_tree_t *tree, size_t leaf_index, size_t size){
+  const merkle_flat_storage_t *flat = &tree->flat;
+
+  if(flat->leaf_overrides && flat->leaf_overrides[leaf_index]){
+    return false;
+  }
+
+  // A slot holds the block and its terminator
+  return flat->leaf_offsets[leaf_index + 1] - flat->leaf_offsets[leaf_index] == size + 1;
+}
+
+/**
+ * @brief Rehashes every ancestor of the sorted, distinct leaves in @p dirty once.
+ *
+ * @param tree Pointer-layout tree whose leaf hashes were just replaced.
+ * @param dirty Scratch array holding the updated leaves in index order; it is
+ *              reused for each level's distinct parents.
+ * @param count Number of entries in @p dirty.
+ */
+static void rehash_pointer_ancestors(merkle_tree_t *tree, merkle_node_t **dirty, size_t count){
+  while(count){
+    size_t parents = 0;
+
+    // Siblings are adjacent, so equal parents are too
+    for(size_t k = 0; k < count; ++k){
+      merkle_node_t *parent = dirty[k]->parent;
+
+      if(parent && (parents == 0 || dirty[parents - 1] != parent)){
+        dirty[parents++] = parent;
+      }
+    }
+
+    parent_hash_ctx_t ctx = { .hash = tree->hash, .stats = &tree->stats, .parents = dirty };
+    atomic_init(&ctx.failed, false);
+    hash_parent_range(&ctx, 0, parents);
+    count = parents;
+  }
+}
+
+/**
+ * @brief Rehashes every ancestor of the sorted, distinct leaves in @p dirty once.
+ *
+ * @param tree Flat-layout tree whose leaf hashes were just replaced.
+ * @param dirty Scratch array holding the updated leaf indices in order; it is
+ *              reused for each level's distinct parent indices.
+ * @param count Number of entries in @p dirty.
+ */
+static void rehash_flat_ancestors(merkle_tree_t *tree, size_t *dirty, size_t count){
+  merkle_flat_storage_t *flat = &tree->flat;
+  size_t branching_factor = tree->branching_factor;
+
+  for(size_t lvl = 0; lvl < tree->levels; ++lvl){
+    size_t child_width = flat_level_width(flat, lvl);
+    size_t parent_count = 0;
+
+    for(size_t k = 0; k < count; ++k){
+      size_t parent = dirty[k] / branching_factor;
+
+      if(parent_count == 0 || dirty[parent_count - 1] != parent){
+        dirty[parent_count++] = parent;
+      }
+    }
+
+    // Rehash the distinct parents of this level a batch at a time
+    for(size_t first = 0; first < parent_count; first += MERKLE_SHA256_MAX_LANES){
+      size_t batch = parent_count - first < MERKLE_SHA256_MAX_LANES ? parent_count - first : MERKLE_SHA256_MAX_LANES;
+      const unsigned char *blocks[MERKLE_SHA256_MAX_LANES];
+      size_t sizes[MERKLE_SHA256_MAX_LANES];
+      unsigned char *hashes[MERKLE_SHA256_MAX_LANES];
+
+      for(size_t k = 0; k < batch; ++k){
+        size_t p = dirty[first + k];
+        size_t child = p * branching_factor;
+        size_t child_count = child_width - child < branching_factor ? child_width - child : branching_factor;
+        blocks[k] = flat_node(flat, lvl, child);
+        sizes[k] = child_count * HASH_SIZE;
+        hashes[k] = flat_node(flat, lvl + 1, p);
+      }
+
+      // Dirty parents are sorted, so only the last one of a batch can be short
+      if((dirty[first + batch - 1] + 1) * branching_factor <= child_width){
+        hash_node_run(&tree->stats, tree->hash, blocks, branching_factor * HASH_SIZE, hashes, batch);
+        continue;
+      }
+
+      hash_node_blocks(&tree->stats, tree->hash, (const void *const *)blocks, sizes, hashes, batch);
+    }
+
+    count = parent_count;
+  }
+}
+
+/**
+ * @brief Reads and checks the caller's update requests, keeping the last one per leaf.
+ *
+ * Signal protection must be armed by the caller if the tree is guarded.
+ *
+ * @param updates Receives the requests sorted by leaf (@p count entries).
+ * @param unique Receives the number of distinct leaves.
+ * @return MERKLE_SUCCESS, MERKLE_INVALID_INDEX or MERKLE_BAD_ARG.
+ */
+static merkle_error_t collect_leaf_updates(const merkle_tree_t *tree, const size_t *leaf_indices, const void **data,
+                                           const size_t *sizes, size_t count, leaf_update_t *updates, size_t *unique){
+  // Written inside the protected block and read after a jump out of it
+  volatile merkle_error_t ret = MERKLE_SUCCESS;
+
+  SAFE_ACCESS_TRY_IF(tree->guarded) {
+    for(size_t k = 0; k < count && ret == MERKLE_SUCCESS; ++k){
+      if(leaf_indices[k] >= tree->leaf_count){
+        ret = MERKLE_INVALID_INDEX;
+      } else if(!data[k] || !sizes[k]){
+        ret = MERKLE_BAD_ARG;
+      }
+
+      updates[k].index = leaf_indices[k];
+      updates[k].position = k;
+    }
+  } SAFE_ACCESS_CATCH {
+    ret = MERKLE_BAD_ARG;
+  } SAFE_ACCESS_END;
+
+  if(ret != MERKLE_SUCCESS){
+    return ret;
+  }
+
+  // Several requests for one leaf collapse into the last of them
+  qsort(updates, count, sizeof(*updates), compare_leaf_updates);
+  *unique = 0;
+
+  for(size_t k = 0; k < count; ++k){
+    if(k + 1 < count && updates[k + 1].index == updates[k].index){
+      continue;
+    }
+
+    updates[(*unique)++] = updates[k];
+  }
+
+  return MERKLE_SUCCESS;
+}
+
+/**
+ * @brief Hashes the new blocks of @p updates, copying each into its buffer if it has one.
+ *
+ * Signal protection must be armed by the caller if the tree is guarded.
+ *
+ * @return false if a block could not be read.
+ */
+static bool hash_leaf_updates(const merkle_tree_t *tree, leaf_update_t *updates, size_t unique,
+                              const void **data, const size_t *sizes){
+  volatile bool success = true;
+
+  SAFE_ACCESS_TRY_IF(tree->guarded) {
+    for(size_t first = 0; first < unique && success; first += MERKLE_SHA256_MAX_LANES){
+      size_t batch = unique - first < MERKLE_SHA256_MAX_LANES ? unique - first : MERKLE_SHA256_MAX_LANES;
+      const void *blocks[MERKLE_SHA256_MAX_LANES];
+      size_t block_sizes[MERKLE_SHA256_MAX_LANES];
+      unsigned char *hashes[MERKLE_SHA256_MAX_LANES];
+
+      for(size_t k = 0; k < batch; ++k){
+        leaf_update_t *update = &updates[first + k];
+        blocks[k] = data[update->position];
+        block_sizes[k] = sizes[update->position];
+        hashes[k] = update->hash;
+
+        if(update->copy){
+          memcpy(update->copy, blocks[k], block_sizes[k]);
+          blocks[k] = update->copy;
+        }
+      }
+
+      success = hash_leaf_blocks(tree_stats(tree), tree->hash, blocks, block_sizes, hashes, batch) == MERKLE_SUCCESS;
+    }
+  } SAFE_ACCESS_CATCH {
+    success = false;
+  } SAFE_ACCESS_END;
+
+  return success;
+}
+
+merkle_error_t update_leaf(merkle_tree_t *const tree, size_t leaf_index, const void *data, size_t size){
+  return update_leaves(tree, &leaf_index, &data, &size, 1);
+}
+
+merkle_error_t update_leaves(merkle_tree_t *const tree, const size_t *leaf_indices, const void **data,
+                             const size_t *sizes, size_t count){
+  // Validate input parameters
+  if(!tree || !leaf_indices || !data || !sizes){
+    return MERKLE_NULL_ARG;
+  }
+
+  // Mapped trees are read-only views of their file
+  if(tree->mapping){
+    return MERKLE_BAD_ARG;
+  }
+
+  if(count == 0){
+    return MERKLE_SUCCESS;
+  }
+
+  ALLOC_AND_INIT(leaf_update_t, updates, count);
+  void *dirty = MMalloc(count * (tree->layout == MERKLE_LAYOUT_FLAT ? sizeof(size_t) : sizeof(merkle_node_t *)));
+
+  if(!updates || !dirty){
+    MFree(updates);
+    MFree(dirty);
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  merkle_error_t ret = MERKLE_SUCCESS;
+  size_t unique = 0;
+  bool copy = tree->leaf_storage == MERKLE_LEAF_COPY;
+
+  // Initialize signal protection to catch bad caller arrays gracefully
+  if(tree->guarded){
+    merkle_init_signal_protection();
+  }
+
+  MERKLE_STAT_WRITE_LOCK(tree_stats(tree), &tree->lock);
+
+  TRY{
+    bool success = true;
+
+    // Versions share the tree's nodes, so they must never change under them
+    if(tree->frozen){
+      ret = MERKLE_BAD_ARG;
+      THROW;
+    }
+
+    // Read and check the requests before anything in the tree changes
+    ret = collect_leaf_updates(tree, leaf_indices, data, sizes, count, updates, &unique);
+
+    if(ret != MERKLE_SUCCESS){
+      THROW;
+    }
+
+    // Buffers are allocated up front so a failure leaves the tree untouched
+    for(size_t k = 0; k < unique && success; ++k){
+      size_t size = sizes[updates[k].position];
+
+      if(!copy || (tree->layout == MERKLE_LAYOUT_FLAT && flat_slot_fits(tree, updates[k].index, size))){
+        continue;
+      }
+
+      // Replacement copies are NUL-terminated like the originals
+      updates[k].copy = size < SIZE_MAX ? MMalloc(size + 1) : NULL;
+      success = updates[k].copy != NULL;
+
+      if(success && tree->layout == MERKLE_LAYOUT_FLAT && !tree->flat.leaf_overrides){
+        ALLOC_AND_INIT_SIMPLE(tree->flat.leaf_overrides, tree->leaf_count);
+        success = tree->flat.leaf_overrides != NULL;
+      }
+    }
+
+    if(!success){
+      ret = MERKLE_FAILED_MEM_ALLOC;
+      THROW;
+    }
+
+    // Copy and hash the new blocks - with protection against invalid data
+    if(!hash_leaf_updates(tree, updates, unique, data, sizes)){
+      ret = MERKLE_BAD_ARG;
+      THROW;
+    }
+
+    // A keyed index files the new blocks under their own keys
+    for(size_t first = 0; tree->index_kind == MERKLE_INDEX_KEY && first < unique && success;
+        first += MERKLE_SHA256_MAX_LANES){
+      size_t batch = unique - first < MERKLE_SHA256_MAX_LANES ? unique - first : MERKLE_SHA256_MAX_LANES;
+      const void *blocks[MERKLE_SHA256_MAX_LANES];
+      size_t block_sizes[MERKLE_SHA256_MAX_LANES];
+      unsigned char *digests[MERKLE_SHA256_MAX_LANES];
+      bool keyed[MERKLE_SHA256_MAX_LANES];
+
+      for(size_t k = 0; k < batch; ++k){
+        blocks[k] = data[updates[first + k].position];
+        block_sizes[k] = sizes[updates[first + k].position];
+        digests[k] = updates[first + k].key;
+      }
+
+      success = digest_leaf_keys(tree, blocks, block_sizes, batch, digests, keyed);
+
+      for(size_t k = 0; k < batch; ++k){
+        updates[first + k].keyed = keyed[k];
+      }
+    }
+
+    if(!success){
+      ret = MERKLE_BAD_ARG;
+      THROW;
+    }
+
+    // Commit the new data and leaf hashes, then fix up their ancestors
+    snapshot_publish_begin(tree);
+
+    for(size_t k = 0; k < unique; ++k){
+      leaf_update_t *update = &updates[k];
+      size_t i = update->index;
+
+      if(tree->borrowed){
+        tree->borrowed[i] = data[update->position];
+      }
+
+      if(tree->layout == MERKLE_LAYOUT_FLAT){
+        merkle_flat_storage_t *flat = &tree->flat;
+
+        if(update->copy){
+          MFree(flat->leaf_overrides[i]);
+          flat->leaf_overrides[i] = update->copy;
+        } else if(copy){
+          memcpy(flat->leaf_data + flat->leaf_offsets[i], data[update->position], sizes[update->position]);
+        }
+
+        memcpy(flat_node(flat, 0, i), update->hash, HASH_SIZE);
+        ((size_t *)dirty)[k] = i;
+      } else {
+        merkle_node_t *leaf = tree->leaves[i];
+
+        if(update->copy){
+          // The original copy stays in the arena, later ones are freed as they are replaced
+          if(merkle_arena_owns(tree->arena, leaf->data)){
+            tree->detached_leaves++;
+          } else {
+            MFree(leaf->data);
+          }
+
+          leaf->data = update->copy;
+        }
+
+        memcpy(leaf->hash, update->hash, HASH_SIZE);
+        ((merkle_node_t **)dirty)[k] = leaf;
+      }
+
+      if(tree->index_kind == MERKLE_INDEX_LEAF_HASH){
+        merkle_index_set(tree->index, i, update->hash);
+      } else if(tree->index_kind == MERKLE_INDEX_KEY && update->keyed){
+        merkle_index_set(tree->index, i, update->key);
+      } else if(tree->index_kind == MERKLE_INDEX_KEY){
+        merkle_index_remove(tree->index, i);
+      }
+
+      update->copy = NULL;
+    }
+
+    if(tree->layout == MERKLE_LAYOUT_FLAT){
+      rehash_flat_ancestors(tree, dirty, unique);
+    } else {
+      rehash_pointer_ancestors(tree, dirty, unique);
+    }
+
+    snapshot_publish_end(tree);
+
+  } CATCH();
+
+  RW_WRITE_UNLOCK(&tree->lock);
+
+  if(tree->guarded){
+    merkle_cleanup_signal_protection();
+  }
+
+  // Copies still owned here belong to a request that was not committed
+  for(size_t k = 0; k < count; ++k){
+    MFree(updates[k].copy);
+  }
+
+  MFree(updates);
+  MFree(dirty);
+  return ret;
+}
+
+/**
+ * @brief Adds an owner to a node shared with another version.
+ */
+static void retain_node(merkle_node_t *node){
+  // Arena nodes live as long as their tree, which versions keep alive
+  if(atomic_load_explicit(&node->refs, memory_order_relaxed) != 0){
+    atomic_fetch_add_explicit(&node->refs, 1, memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Frees a node and releases its children once its last owner is gone.
+ */
+static void release_node(merkle_node_t *node){
+  if(!node || atomic_load_explicit(&node->refs, memory_order_relaxed) == 0){
+    return;
+  }
+
+  if(atomic_fetch_sub_explicit(&node->refs, 1, memory_order_acq_rel) != 1){
+    return;
+  }
+
+  for(size_t c = 0; c < node->child_count; ++c){
+    release_node(node->children[c]);
+  }
+
+  // Children arrays and leaf copies share their node's block
+  MFree(node);
+}
+
+/**
+ * @brief Copies the nodes above a sorted run of new leaves, sharing every other subtree.
+ *
+ * @param tree Source version, whose shape and hash algorithm the copy shares.
+ * @param node Node of the source version whose subtree holds every leaf in @p updates.
+ * @param level Level of @p node (0 for leaves).
+ * @param span Leaves under each child of @p node, i.e. branching_factor^(level - 1).
+ * @param updates Distinct updates in leaf order; their leaves are consumed.
+ * @param count Number of entries in @p updates (> 0).
+ * @return The new node holding one reference, or NULL on allocation failure.
+ */
+static merkle_node_t *copy_path(const merkle_tree_t *tree, const merkle_node_t *node, size_t level, size_t span,
+                                leaf_update_t *updates, size_t count){
+  size_t branching_factor = tree->branching_factor;
+
+  if(level == 0){
+    merkle_node_t *leaf = updates[0].leaf;
+    updates[0].leaf = NULL;
+    return leaf;
+  }
+
+  // The children array and its hash copies follow the node in one block
+  merkle_node_t *copy = MMalloc(sizeof(merkle_node_t) + node->child_count * (sizeof(merkle_node_t *) + HASH_SIZE));
+
+  if(!copy){
+    return NULL;
+  }
+
+  copy->children = (merkle_node_t **)(copy + 1);
+  copy->child_hashes = (unsigned char (*)[HASH_SIZE])(copy->children + node->child_count);
+  copy->child_count = node->child_count;
+  memcpy(copy->children, node->children, node->child_count * sizeof(merkle_node_t *));
+  atomic_init(&copy->refs, 1);
+  bool success = true;
+
+  // Updates under the same child are adjacent, each run is copied below it
+  for(size_t k = 0; k < count && success;){
+    size_t child = (updates[k].index / span) % branching_factor;
+    size_t end = k + 1;
+
+    while(end < count && (updates[end].index / span) % branching_factor == child){
+      end++;
+    }
+
+    copy->children[child] = copy_path(tree, node->children[child], level - 1, span / branching_factor, updates + k,
+                                      end - k);
+    success = copy->children[child] != NULL;
+    k = end;
+  }
+
+  for(size_t c = 0; c < copy->child_count; ++c){
+    if(copy->children[c] == node->children[c]){
+      if(success){
+        retain_node(copy->children[c]);
+      }
+    } else if(!success){
+      release_node(copy->children[c]);
+    }
+  }
+
+  if(!success){
+    MFree(copy);
+    return NULL;
+  }
+
+  hash_merkle_node(tree_stats(tree), tree->hash, copy);
+  return copy;
+}
+
+merkle_tree_t *derive_merkle_tree(merkle_tree_t *const tree, const size_t *leaf_indices, const void **data,
+                                  const size_t *sizes, size_t count){
+  // Validate input parameters
+  if(!tree || !leaf_indices || !data || !sizes || count == 0){
+    return NULL;
+  }
+
+  // Only pointer-layout nodes can be shared between versions
+  if(tree->layout != MERKLE_LAYOUT_POINTER || !tree->root){
+    return NULL;
+  }
+
+  ALLOC_AND_INIT(leaf_update_t, updates, count);
+  ALLOC_AND_INIT(merkle_tree_t, version, 1);
+
+  if(!updates || !version){
+    MFree(updates);
+    MFree(version);
+    return NULL;
+  }
+
+  merkle_tree_t *origin = tree->origin ? tree->origin : tree;
+  bool copy = tree->leaf_storage == MERKLE_LEAF_COPY;
+  bool success = false;
+  size_t unique = 0;
+
+  // Initialize signal protection to catch bad caller arrays gracefully
+  if(tree->guarded){
+    merkle_init_signal_protection();
+  }
+
+  // The write lock waits out in-place updates of the source before it freezes
+  MERKLE_STAT_WRITE_LOCK(tree_stats(tree), &tree->lock);
+
+  TRY{
+    if(tree->mapping || collect_leaf_updates(tree, leaf_indices, data, sizes, count, updates, &unique) != MERKLE_SUCCESS){
+      THROW;
+    }
+
+    // Each new leaf is one block: the node, then its NUL-terminated copy
+    bool allocated = true;
+
+    for(size_t k = 0; k < unique && allocated; ++k){
+      size_t size = sizes[updates[k].position];
+
+      if(copy && size > SIZE_MAX - sizeof(merkle_node_t) - 1){
+        allocated = false;
+        break;
+      }
+
+      updates[k].leaf = MMalloc(sizeof(merkle_node_t) + (copy ? size + 1 : 0));
+      allocated = updates[k].leaf != NULL;
+
+      if(allocated && copy){
+        updates[k].copy = (unsigned char *)(updates[k].leaf + 1);
+      }
+    }
+
+    if(!allocated || !hash_leaf_updates(tree, updates, unique, data, sizes)){
+      THROW;
+    }
+
+    for(size_t k = 0; k < unique; ++k){
+      merkle_node_t *leaf = updates[k].leaf;
+      memcpy(leaf->hash, updates[k].hash, HASH_SIZE);
+      atomic_init(&leaf->refs, 1);
+
+      if(copy){
+        leaf->data = updates[k].copy;
+      } else if(tree->leaf_storage == MERKLE_LEAF_BORROW){
+        leaf->data = (void *)data[updates[k].position];
+      }
+    }
+
+    size_t span = 1;
+
+    for(size_t lvl = 1; lvl < tree->levels; ++lvl){
+      span *= tree->branching_factor;
+    }
+
+    version->root = copy_path(tree, tree->root, tree->levels, span, updates, unique);
+
+    if(!version->root){
+      THROW;
+    }
+
+    version->leaf_count = tree->leaf_count;
+    version->levels = tree->levels;
+    version->branching_factor = tree->branching_factor;
+    version->layout = tree->layout;
+    version->leaf_storage = tree->leaf_storage;
+    version->leaf_lookup = tree->leaf_lookup;
+    version->leaf_lookup_ctx = tree->leaf_lookup_ctx;
+    version->hash_id = tree->hash_id;
+    version->hash = tree->hash;
+    version->guarded = tree->guarded;
+    version->origin = origin;
+    version->frozen = true;
+    atomic_init(&version->refs, 1);
+    RW_LOCK_INIT(&version->lock);
+
+    // The origin's arena holds the shared nodes, so it lives as long as the version
+    atomic_fetch_add_explicit(&origin->refs, 1, memory_order_relaxed);
+    tree->frozen = true;
+    success = true;
+
+  } CATCH();
+
+  RW_WRITE_UNLOCK(&tree->lock);
+
+  if(tree->guarded){
+    merkle_cleanup_signal_protection();
+  }
+
+  // Leaves still held here were never linked into the version
+  for(size_t k = 0; k < unique; ++k){
+    MFree(updates[k].leaf);
+  }
+
+  MFree(updates);
+
+  if(!success){
+    MFree(version);
+    return NULL;
+  }
+
+  return version;
+}
+
+/**
+ * @brief Writes all of @p buffer at @p offset, retrying short writes.
+ */
+static bool write_at(int fd, const void *buffer, size_t length, off_t offset){
+  const unsigned char *bytes = buffer;
+
+  while(length){
+    ssize_t written = pwrite(fd, bytes, length, offset);
+
+    if(written < 0 && errno == EINTR){
+      continue;
+    }
+
+    if(written <= 0){
+      return false;
+    }
+
+    bytes += written;
+    length -= (size_t)written;
+    offset += written;
+  }
+
+  return true;
 }
 
-merkle_tree_t *create_merkle_tree(const void **data, const size_t *size,
-                                  size_t count, size_t branching_factor) {
-  merkle_tree_t *tree = NULL;
-  queue_t *queue = NULL;
+/**
+ * @brief Buffered output position of one level while saving a pointer-layout tree.
+ */
+typedef struct save_level {
+  unsigned char (*hashes)[HASH_SIZE]; /**< Hashes not yet written. */
+  size_t used;                        /**< Entries in @ref hashes. */
+  off_t offset;                       /**< File offset of the first buffered hash. */
+} save_level_t;
+
+/**
+ * @brief Writes a level's buffered hashes to the file.
+ */
+static bool flush_save_level(int fd, save_level_t *level){
+  if(!write_at(fd, level->hashes, level->used * HASH_SIZE, level->offset)){
+    return false;
+  }
+
+  level->offset += (off_t)(level->used * HASH_SIZE);
+  level->used = 0;
+  return true;
+}
+
+/**
+ * @brief Appends a subtree's hashes to their levels' buffers, depth first.
+ *
+ * A depth-first walk reaches the nodes of every level from left to right,
+ * which is their order in the file.
+ */
+static bool save_pointer_subtree(int fd, const merkle_node_t *node, size_t level, save_level_t *levels){
+  save_level_t *out = &levels[level];
+  memcpy(out->hashes[out->used++], node->hash, HASH_SIZE);
+
+  if(out->used == SAVE_BUFFER_HASHES && !flush_save_level(fd, out)){
+    return false;
+  }
+
+  for(size_t i = 0; level > 0 && i < node->child_count; ++i){
+    if(!save_pointer_subtree(fd, node->children[i], level - 1, levels)){
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief Writes the nodes of a blocked tree in the level order of the file.
+ */
+static merkle_error_t save_blocked_levels(int fd, const merkle_tree_t *tree){
+  save_level_t out = { .offset = MERKLE_FILE_HEADER_SIZE };
+  bool success = true;
+
+  ALLOC_AND_INIT_SIMPLE(out.hashes, SAVE_BUFFER_HASHES);
+
+  if(!out.hashes){
+    return MERKLE_FAILED_MEM_ALLOC;
+  }
+
+  for(size_t lvl = 0; lvl <= tree->levels && success; ++lvl){
+    size_t width = flat_level_width(&tree->flat, lvl);
+
+    for(size_t i = 0; i < width && success; ++i){
+      memcpy(out.hashes[out.used++], flat_node(&tree->flat, lvl, i), HASH_SIZE);
+      success = out.used < SAVE_BUFFER_HASHES || flush_save_level(fd, &out);
+    }
+  }
+
+  success = success && flush_save_level(fd, &out);
+  MFree(out.hashes);
+  return success ? MERKLE_SUCCESS : MERKLE_IO_ERROR;
+}
 
+merkle_error_t save_merkle_tree(merkle_tree_t *const tree, const char *path){
   // Validate input parameters
-  if (!(data && size && count > 0 && branching_factor > 0)) {
-    return NULL;
+  if(!tree || !path){
+    return MERKLE_NULL_ARG;
   }
 
-  // Initialize signal protection to catch segfaults gracefully
-  merkle_init_signal_protection();
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
 
-  // Initialize the tree structure
-  if(init_tree(&tree,count,branching_factor) != MERKLE_SUCCESS){
-    merkle_cleanup_signal_protection();
-    return NULL;
+  if(fd < 0){
+    return MERKLE_IO_ERROR;
   }
 
+  merkle_error_t ret = MERKLE_IO_ERROR;
+  save_level_t *levels = NULL;
+  MERKLE_STAT_READ_LOCK(tree_stats(tree), &tree->lock);
+
   TRY{
+    unsigned char header[MERKLE_FILE_HEADER_SIZE] = {0};
+    memcpy(header, MERKLE_FILE_MAGIC, 4);
+    header[MERKLE_FILE_OFFSET_VERSION] = MERKLE_FILE_VERSION;
+    header[MERKLE_FILE_OFFSET_HASH_ID] = (unsigned char)tree->hash_id;
+    merkle_store_le64(header + MERKLE_FILE_OFFSET_BRANCHING, tree->branching_factor);
+    merkle_store_le64(header + MERKLE_FILE_OFFSET_LEAF_COUNT, tree->leaf_count);
+    merkle_store_le64(header + MERKLE_FILE_OFFSET_LEVELS, tree->levels);
 
-    // Initialize variables for tree construction
-    size_t leaf_idx = 0;
-    queue = init_queue();
+    if(!write_at(fd, header, sizeof(header), 0)){
+      THROW;
+    }
 
-    if(!queue){
+    // Level-ordered flat storage already is the file layout
+    if(tree->layout == MERKLE_LAYOUT_FLAT && tree->flat.blocks.levels){
+      ret = save_blocked_levels(fd, tree);
       THROW;
     }
 
-    bool success = 1;
-    // Process each data block to create leaf nodes
-    for (size_t i = 0; i < count && success; ++i) {
-      
-      // Safe access pattern - catch segfaults if count > actual array size
-      SAFE_ACCESS_TRY {
-        // Validate current data block
-        if (!data[i] || !size[i]) {
-          success = 0;
-          break;
-        }
-      } SAFE_ACCESS_CATCH {
-        // Segfault occurred - count parameter is incorrect
-        success = 0;
-        break;
-      } SAFE_ACCESS_END;
-      
-      if (!success) break;
-      
-      // Allocate memory for new leaf node
-      merkle_node_t *merkle_node;
-      ALLOC_AND_INIT_SIMPLE(merkle_node, 1);
-
-      if(!merkle_node){
-        success = false;
-        break;
+    if(tree->layout == MERKLE_LAYOUT_FLAT){
+      size_t total = tree->flat.level_offsets[tree->levels + 1];
+
+      if(!write_at(fd, tree->flat.hashes, total * HASH_SIZE, MERKLE_FILE_HEADER_SIZE)){
+        THROW;
       }
 
-      merkle_node->data = MMalloc(size[i]);
+      ret = MERKLE_SUCCESS;
+      THROW;
+    }
 
-      if(merkle_node->data == NULL){
-        dealloc_hash_node(merkle_node);
-        success = false;
-        break;
-      }
+    ALLOC_AND_INIT_SIMPLE(levels, tree->levels + 1);
 
-      // Copy the data into the node and compute hash - with protection against invalid data
-      SAFE_ACCESS_TRY {
-        memcpy(merkle_node->data,data[i],size[i]);
-        
-        // Compute the hash of the data block
-        if(hash_data_block(data[i], size[i],merkle_node->hash) != MERKLE_SUCCESS){
-          dealloc_hash_node(merkle_node);
-          success = false;
-          break;
-        }
-      } SAFE_ACCESS_CATCH {
-        // Segfault occurred during data access
-        dealloc_hash_node(merkle_node);
-        success = false;
-        break;
-      } SAFE_ACCESS_END;
-      
-      if (!success) break;
-
-      // Add the leaf node to the processing queue
-      if(push_queue(queue,merkle_node) != QUEUE_OK){
-        dealloc_hash_node(merkle_node);
-        success = false;
-        break;
-      }
-      // Store reference to the leaf node in the tree
-      (tree->leaves)[leaf_idx++] = merkle_node;
+    if(!levels){
+      ret = MERKLE_FAILED_MEM_ALLOC;
+      THROW;
+    }
+
+    bool success = true;
+    off_t offset = MERKLE_FILE_HEADER_SIZE;
+    size_t width = tree->leaf_count;
+
+    for(size_t lvl = 0; lvl <= tree->levels && success; ++lvl){
+      ALLOC_AND_INIT_SIMPLE(levels[lvl].hashes, SAVE_BUFFER_HASHES);
+      levels[lvl].offset = offset;
+      offset += (off_t)(width * HASH_SIZE);
+      width = (width + tree->branching_factor - 1) / tree->branching_factor;
+      success = levels[lvl].hashes != NULL;
     }
 
     if(!success){
+      ret = MERKLE_FAILED_MEM_ALLOC;
       THROW;
     }
-    
-    RW_WRITE_LOCK(&tree->lock);
-    // Build the internal tree structure from the leaf nodes
-    if (build_tree_from_queue(queue, tree) != MERKLE_SUCCESS) {
-      RW_WRITE_UNLOCK(&tree->lock);
+
+    success = save_pointer_subtree(fd, tree->root, tree->levels, levels);
+
+    for(size_t lvl = 0; lvl <= tree->levels && success; ++lvl){
+      success = flush_save_level(fd, &levels[lvl]);
+    }
+
+    if(!success){
       THROW;
     }
 
-    RW_WRITE_UNLOCK(&tree->lock);
+    ret = MERKLE_SUCCESS;
 
-    // Clean up the temporary queue and return the completed tree
-    free_queue(queue, dealloc_hash_node);
-    merkle_cleanup_signal_protection();
-    return tree;
+  }CATCH();
 
-  } CATCH();
-  
-  free_queue(queue,dealloc_hash_node);
-  clean_up_tree(&tree);
-  merkle_cleanup_signal_protection();
-  return NULL;
-}
+  RW_READ_UNLOCK(&tree->lock);
 
-merkle_error_t get_tree_hash(merkle_tree_t * const tree, unsigned char copy_into[HASH_SIZE]) {
-  // Validate input parameters
-  if (!tree || !copy_into) {
-    return MERKLE_NULL_ARG;
+  for(size_t lvl = 0; levels && lvl <= tree->levels; ++lvl){
+    MFree(levels[lvl].hashes);
   }
 
-  RW_READ_LOCK(&tree->lock);
+  MFree(levels);
 
-  // Check if tree is properly constructed
-  if (!tree->root || tree->leaf_count == 0) {
-    RW_READ_UNLOCK(&tree->lock);
-    return MERKLE_BAD_ARG;
+  if(close(fd) != 0 && ret == MERKLE_SUCCESS){
+    ret = MERKLE_IO_ERROR;
   }
 
-  // Copy the root hash to the output buffer
-  memcpy(copy_into, tree->root->hash, HASH_SIZE);
-  RW_READ_UNLOCK(&tree->lock);
-  return MERKLE_SUCCESS;
+  return ret;
 }
 
-merkle_error_t generate_proof_by_finder(merkle_tree_t *const tree, value_finder finder, size_t *path_length, merkle_proof_t** proof){
-  
+merkle_tree_t *open_merkle_tree_mmap(const char *path){
   // Validate input parameters
-  if(!tree || !finder || !proof){
-      return MERKLE_BAD_ARG;
+  if(!path){
+    return NULL;
   }
 
-  merkle_error_t result = MERKLE_SUCCESS;
-  RW_READ_LOCK(&tree->lock);
+  int fd = open(path, O_RDONLY);
 
-  for(size_t i = 0; i < tree->leaf_count && result == MERKLE_SUCCESS; ++i){
-    if(finder(tree->leaves[i]->data)){
-      result = generate_proof(tree,i,proof);
-      break;
-    }
+  if(fd < 0){
+    return NULL;
   }
 
-  RW_READ_UNLOCK(&tree->lock);
-  return result;
-}
+  struct stat st;
+  void *mapping = MAP_FAILED;
+  size_t mapping_size = 0;
 
-merkle_error_t generate_proof_from_index(merkle_tree_t *const tree, size_t leaf_index, merkle_proof_t **proof){
-  if(!tree || !proof){
-    return MERKLE_BAD_ARG;
+  if(fstat(fd, &st) == 0 && st.st_size >= MERKLE_FILE_HEADER_SIZE && (uintmax_t)st.st_size <= SIZE_MAX){
+    mapping_size = (size_t)st.st_size;
+    mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
   }
-  
-  RW_READ_LOCK(&tree->lock);
-  merkle_error_t result = generate_proof(tree,leaf_index,proof);
-  RW_READ_UNLOCK(&tree->lock);
-  return result;
-}
 
-static merkle_error_t generate_proof(merkle_tree_t *const tree, size_t leaf_index, merkle_proof_t **proof){
-  
-  // Validate input parameters
-  if(!tree || tree->leaf_count <= leaf_index || !proof){
-      return MERKLE_BAD_ARG;
+  // The mapping stays valid after the descriptor is gone
+  close(fd);
+
+  if(mapping == MAP_FAILED){
+    return NULL;
   }
 
-  // Initialize local variables
-  merkle_error_t ret = MERKLE_SUCCESS;
-  *proof = NULL;
-  merkle_proof_t *result = NULL;
+  merkle_tree_t *tree = NULL;
 
   TRY{
+    const unsigned char *header = mapping;
 
-    ALLOC_AND_INIT_SIMPLE(result,1);
-
-    if(!result) {
-      ret = MERKLE_FAILED_MEM_ALLOC;
+    if(memcmp(header, MERKLE_FILE_MAGIC, 4) != 0 || header[MERKLE_FILE_OFFSET_VERSION] != MERKLE_FILE_VERSION ||
+       !merkle_hash_get((merkle_hash_id_t)header[MERKLE_FILE_OFFSET_HASH_ID])){
       THROW;
     }
 
-    result->path_length = tree->levels;
-    result->leaf_index = leaf_index;
-    result->branching_factor = tree->branching_factor;
-
-    ALLOC_AND_INIT_SIMPLE(result->path,tree->levels);
+    uint64_t branching_factor = merkle_load_le64(header + MERKLE_FILE_OFFSET_BRANCHING);
+    uint64_t leaf_count = merkle_load_le64(header + MERKLE_FILE_OFFSET_LEAF_COUNT);
+    uint64_t levels = merkle_load_le64(header + MERKLE_FILE_OFFSET_LEVELS);
+    size_t capacity = (mapping_size - MERKLE_FILE_HEADER_SIZE) / HASH_SIZE;
 
-    if(!result->path){
-      ret = MERKLE_FAILED_MEM_ALLOC;
+    // The header must describe a real tree shape that exactly fills the file
+    if(leaf_count == 0 || leaf_count > capacity || branching_factor == 0 ||
+       (branching_factor == 1 && leaf_count > 1) || branching_factor > SIZE_MAX ||
+       levels != count_tree_levels((size_t)leaf_count, (size_t)branching_factor)){
       THROW;
     }
 
-    merkle_node_t *node = tree->leaves[leaf_index];
-    bool success = 1;
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.branching_factor = (size_t)branching_factor;
+    config.layout = MERKLE_LAYOUT_FLAT;
+    config.leaf_storage = MERKLE_LEAF_HASH_ONLY;
+    config.hash = (merkle_hash_id_t)header[MERKLE_FILE_OFFSET_HASH_ID];
 
-    for(size_t path_len = 0; path_len < result->path_length && node->parent && success; ++path_len){
-        merkle_node_t *prt = node->parent;
-        ALLOC_AND_INIT(merkle_proof_item_t,proof_item,1);
+    if(init_tree(&tree, (size_t)leaf_count, &config) != MERKLE_SUCCESS){
+      THROW;
+    }
 
-        result->path[path_len] = proof_item;
+    merkle_flat_storage_t *flat = &tree->flat;
+    ALLOC_AND_INIT_SIMPLE(flat->level_offsets, levels + 2);
 
-        if(!proof_item){
-          success = 0;
-          break;
-        }
+    if(!flat->level_offsets){
+      THROW;
+    }
 
-        ALLOC_AND_INIT_SIMPLE(proof_item->sibling_hashes, prt->child_count - 1);
-        proof_item->sibling_count = prt->child_count - 1;
+    size_t total_nodes = 0;
+    size_t width = (size_t)leaf_count;
 
-        ret = add_proof_path(node->parent,node,proof_item);
-        success = ret == MERKLE_SUCCESS;
-        node = node->parent;
+    for(size_t lvl = 0; lvl <= levels; ++lvl){
+      flat->level_offsets[lvl] = total_nodes;
+      total_nodes += width;
+      width = (width + config.branching_factor - 1) / config.branching_factor;
     }
 
-    if(!success){
+    flat->level_offsets[levels + 1] = total_nodes;
+
+    if(mapping_size != MERKLE_FILE_HEADER_SIZE + total_nodes * HASH_SIZE){
       THROW;
     }
 
-    *proof = result;
-    return ret;
+    // Proofs touch one page per level, read-ahead would only waste I/O
+    madvise(mapping, mapping_size, MADV_RANDOM);
+
+    flat->hashes = (unsigned char (*)[HASH_SIZE])((unsigned char *)mapping + MERKLE_FILE_HEADER_SIZE);
+    tree->levels = (size_t)levels;
+    tree->mapping = mapping;
+    tree->mapping_size = mapping_size;
+    return tree;
 
   }CATCH();
 
-  for(size_t idx = 0; idx != tree->levels; ++idx){
-    if(!result->path[idx]) {
-      continue;
+  if(tree){
+    dealloc_merkle_tree(tree);
+  }
+
+  munmap(mapping, mapping_size);
+  return NULL;
+}
+
+/**
+ * @brief Shared state for hashing the fixed-size leaves of one read window in parallel.
+ */
+typedef struct window_leaf_ctx {
+  merkle_tree_t *tree;         /**< Tree whose leaf hashes are filled. */
+  const unsigned char *window; /**< Window data, starting at a leaf boundary. */
+  size_t bytes;                /**< Bytes in @ref window. */
+  size_t leaf_size;            /**< Bytes per leaf; only the file's last leaf is shorter. */
+  size_t first_leaf;           /**< Index of the window's first leaf. */
+  atomic_bool failed;          /**< Set by any chunk that fails. */
+} window_leaf_ctx_t;
+
+/**
+ * @brief merkle_range_fn hashing the window's leaves [begin, end).
+ */
+static void window_leaf_range(void *arg, size_t begin, size_t end){
+  window_leaf_ctx_t *ctx = arg;
+  merkle_tree_t *tree = ctx->tree;
+
+  for(size_t first = begin; first < end; first += MERKLE_SHA256_MAX_LANES){
+    size_t batch = end - first < MERKLE_SHA256_MAX_LANES ? end - first : MERKLE_SHA256_MAX_LANES;
+    const void *blocks[MERKLE_SHA256_MAX_LANES];
+    size_t sizes[MERKLE_SHA256_MAX_LANES];
+    unsigned char *hashes[MERKLE_SHA256_MAX_LANES];
+
+    for(size_t k = 0; k < batch; ++k){
+      size_t offset = (first + k) * ctx->leaf_size;
+      size_t leaf = ctx->first_leaf + first + k;
+      blocks[k] = ctx->window + offset;
+      sizes[k] = ctx->bytes - offset < ctx->leaf_size ? ctx->bytes - offset : ctx->leaf_size;
+      hashes[k] = tree->layout == MERKLE_LAYOUT_FLAT ? flat_node(&tree->flat, 0, leaf) : tree->leaves[leaf]->hash;
     }
 
-    MFree(result->path[idx]->sibling_hashes);
-    MFree(result->path[idx]);
+    if(hash_leaf_blocks(&tree->stats, tree->hash, blocks, sizes, hashes, batch) != MERKLE_SUCCESS){
+      atomic_store(&ctx->failed, true);
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Streams the file through the reader into the leaf hashes, then hashes the levels.
+ */
+static merkle_error_t build_tree_from_reader(merkle_tree_t *tree, merkle_chunk_reader_t *reader, size_t leaf_size,
+                                             merkle_thread_pool_t *pool){
+  size_t levels = count_tree_levels(tree->leaf_count, tree->branching_factor);
+  merkle_error_t ret = tree->layout == MERKLE_LAYOUT_FLAT ? alloc_flat_levels(tree, levels)
+                                                          : alloc_pointer_leaves(tree, 0);
+  size_t next_leaf = 0;
+  const unsigned char *window = NULL;
+  size_t bytes = 0;
+
+  // Each window is hashed while the reader thread fills the next one
+  while(ret == MERKLE_SUCCESS && (ret = merkle_chunk_reader_next(reader, &window, &bytes)) == MERKLE_SUCCESS && bytes){
+    size_t window_leaves = (bytes - 1) / leaf_size + 1;
+
+    if(window_leaves > tree->leaf_count - next_leaf){
+      ret = MERKLE_IO_ERROR;
+      break;
+    }
+
+    window_leaf_ctx_t ctx = {
+      .tree = tree, .window = window, .bytes = bytes, .leaf_size = leaf_size, .first_leaf = next_leaf
+    };
+    atomic_init(&ctx.failed, false);
+    merkle_parallel_for(pool, window_leaves, PARALLEL_LEAF_GRAIN, window_leaf_range, &ctx);
+    ret = atomic_load(&ctx.failed) ? MERKLE_FAILED_TREE_BUILD : MERKLE_SUCCESS;
+    next_leaf += window_leaves;
+  }
+
+  if(ret == MERKLE_SUCCESS && next_leaf != tree->leaf_count){
+    ret = MERKLE_IO_ERROR;
+  }
+
+  if(ret == MERKLE_SUCCESS){
+    ret = tree->layout == MERKLE_LAYOUT_FLAT ? hash_flat_levels(tree, levels, pool) : link_pointer_levels(tree, pool);
+  }
+
+  // Flat storage is not part of the arena, so it does not go with the tree
+  if(ret != MERKLE_SUCCESS && tree->layout == MERKLE_LAYOUT_FLAT){
+    dealloc_flat_storage(&tree->flat, tree->leaf_count);
+    tree->levels = 0;
   }
 
-  MFree(result->path);
-  MFree(result);
   return ret;
 }
 
-static merkle_error_t add_proof_path(merkle_node_t *parent, merkle_node_t *node, merkle_proof_item_t *proof_item){
-    merkle_error_t result = MERKLE_SUCCESS;
-    
-    TRY{
-        if(!parent || !node || !proof_item){
-          result = MERKLE_NULL_ARG;
-          THROW;      
-        }
-        
-        for(size_t i = 0,j = 0; i < parent->child_count; ++i){
-          if(parent->children[i] != node){
-            memcpy(&(proof_item->sibling_hashes[0][j]),parent->children[i]->hash,HASH_SIZE);
-            j++;
-          }else{
-            proof_item->node_position = i;
-          }
-        }
+merkle_tree_t *create_merkle_tree_from_fd(int fd, size_t leaf_size, const merkle_config_t *config){
+  merkle_tree_t *tree = NULL;
+  struct stat st;
 
-    }CATCH();
+  // Validate input parameters
+  if(fd < 0 || leaf_size == 0 || !config || config->branching_factor == 0){
+    return NULL;
+  }
 
-    return result;
+  if(config->layout != MERKLE_LAYOUT_POINTER && config->layout != MERKLE_LAYOUT_FLAT &&
+     config->layout != MERKLE_LAYOUT_BLOCKED){
+    return NULL;
+  }
+
+  // Keys would have to be extracted from data the tree never holds
+  if(config->leaf_index != MERKLE_INDEX_NONE && config->leaf_index != MERKLE_INDEX_LEAF_HASH){
+    return NULL;
+  }
+
+  if(!merkle_hash_get(config->hash)){
+    return NULL;
+  }
+
+  // Later updates still read caller blocks under the chosen protection
+  if(config->input_check != MERKLE_INPUT_GUARDED && config->input_check != MERKLE_INPUT_TRUSTED){
+    return NULL;
+  }
+
+  // Leaves are counted from the size, so it has to be known and stable
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0){
+    return NULL;
+  }
+
+  uint64_t length = (uint64_t)st.st_size;
+  uint64_t leaves = (length - 1) / leaf_size + 1;
+
+  if(leaves > SIZE_MAX || (config->branching_factor == 1 && leaves > 1)){
+    return NULL;
+  }
+
+  // Only hashes are kept; the data streams through the reader's windows
+  merkle_config_t hashed = *config;
+  hashed.leaf_storage = MERKLE_LEAF_HASH_ONLY;
+
+  if(init_tree(&tree, (size_t)leaves, &hashed) != MERKLE_SUCCESS){
+    return NULL;
+  }
+
+  // A caller-supplied pool wins, otherwise spin one up just for this build
+  merkle_thread_pool_t *pool = config->thread_pool;
+  merkle_thread_pool_t *owned_pool = NULL;
+
+  if(!pool && config->thread_count > 1 && tree->leaf_count > PARALLEL_LEAF_GRAIN){
+    owned_pool = merkle_thread_pool_create(config->thread_count);
+    pool = owned_pool;
+  }
+
+  merkle_chunk_reader_t *reader = merkle_chunk_reader_create(fd, length, leaf_size, MERKLE_READ_WINDOW);
+  merkle_error_t ret = reader ? build_tree_from_reader(tree, reader, leaf_size, pool) : MERKLE_FAILED_MEM_ALLOC;
+
+  // The leaf-hash index reads nothing but the hashes just computed
+  if(ret == MERKLE_SUCCESS){
+    ret = build_leaf_index(tree, NULL, NULL, pool);
+  }
+
+  merkle_chunk_reader_destroy(reader);
+  merkle_thread_pool_destroy(owned_pool);
+
+  if(ret != MERKLE_SUCCESS){
+    clean_up_tree(&tree);
+    return NULL;
+  }
+
+  return tree;
 }
 
+merkle_tree_t *create_merkle_tree_from_file(const char *path, size_t leaf_size, const merkle_config_t *config){
+  // Validate input parameters
+  if(!path){
+    return NULL;
+  }
+
+  int fd = open(path, O_RDONLY);
+
+  if(fd < 0){
+    return NULL;
+  }
+
+  merkle_tree_t *tree = create_merkle_tree_from_fd(fd, leaf_size, config);
+  close(fd);
+  return tree;
+}
+
+merkle_error_t merkle_get_stats(const merkle_tree_t *tree, merkle_stats_t *out){
+  // Validate input parameters
+  if(!out){
+    return MERKLE_NULL_ARG;
+  }
+
+#ifdef MERKLE_STATS
+  merkle_stat_snapshot(tree ? &tree->stats : &merkle_global_stats, out);
+  return MERKLE_SUCCESS;
+#else
+  (void)tree;
+  return MERKLE_NOT_SUPPORTED;
+#endif
+}
@@ -9,19 +9,37 @@
  * @date May 24, 2025
  */
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <setjmp.h>
+#include "Merkle.h"
+#include "merkle_stats.h"
 #include "merkle_utils.h"
 
+/**
+ * @brief Allocator every Merkle_Malloc()/Merkle_Free() goes through.
+ *
+ * NULL callbacks select calloc()/free(), which also skips the explicit
+ * zeroing that custom allocators need.
+ */
+static merkle_allocator_t merkle_allocator = { NULL, NULL, NULL };
+
 // Thread-local storage for signal handling
 __thread jmp_buf merkle_segv_buf;
 __thread volatile int merkle_segv_occurred = 0;
 
-// Store original signal handlers for restoration
-static __thread void (*original_segv_handler)(int) = NULL;
-static __thread void (*original_bus_handler)(int) = NULL;
-static __thread void (*original_abrt_handler)(int) = NULL;
+// Signal dispositions are process-wide, so the handlers are installed once
+// and the dispositions they replaced are kept here until the last user leaves
+static pthread_mutex_t protection_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t protection_users = 0;
+static struct sigaction original_segv_action;
+#ifdef SIGBUS
+static struct sigaction original_bus_action;
+#endif
+#ifdef SIGABRT
+static struct sigaction original_abrt_action;
+#endif
 
 /**
  * @brief Signal handler for memory access violations
@@ -33,45 +51,63 @@ static void merkle_signal_handler(int sig) {
 
 /**
  * @brief Initialize signal protection for current thread
+ *
+ * The first caller installs the handlers; later callers, from any thread,
+ * only take a reference on them.
  */
 void merkle_init_signal_protection(void) {
-    // Install signal handlers for memory access violations
-    original_segv_handler = signal(SIGSEGV, merkle_signal_handler);
-    
+    pthread_mutex_lock(&protection_lock);
+
+    if (protection_users++ == 0) {
+        struct sigaction action;
+
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = merkle_signal_handler;
+        sigemptyset(&action.sa_mask);
+        // The handler leaves through longjmp(), which would otherwise keep
+        // the signal blocked and turn the next fault into a hard crash
+        action.sa_flags = SA_NODEFER;
+
+        // Install signal handlers for memory access violations
+        sigaction(SIGSEGV, &action, &original_segv_action);
+
 #ifdef SIGBUS  // Not available on all platforms
-    original_bus_handler = signal(SIGBUS, merkle_signal_handler);
+        sigaction(SIGBUS, &action, &original_bus_action);
 #endif
 
 #ifdef SIGABRT
-    original_abrt_handler = signal(SIGABRT, merkle_signal_handler);
+        sigaction(SIGABRT, &action, &original_abrt_action);
 #endif
+    }
+
+    pthread_mutex_unlock(&protection_lock);
 
     merkle_segv_occurred = 0;
 }
 
 /**
  * @brief Cleanup signal protection for current thread
+ *
+ * The original handlers come back only when the last user releases its
+ * reference, so concurrent builds never restore each other's handlers.
  */
 void merkle_cleanup_signal_protection(void) {
-    // Restore original signal handlers
-    if (original_segv_handler != NULL) {
-        signal(SIGSEGV, original_segv_handler);
-        original_segv_handler = NULL;
-    }
-    
+    pthread_mutex_lock(&protection_lock);
+
+    if (protection_users > 0 && --protection_users == 0) {
+        // Restore original signal handlers
+        sigaction(SIGSEGV, &original_segv_action, NULL);
+
 #ifdef SIGBUS
-    if (original_bus_handler != NULL) {
-        signal(SIGBUS, original_bus_handler);
-        original_bus_handler = NULL;
-    }
+        sigaction(SIGBUS, &original_bus_action, NULL);
 #endif
 
 #ifdef SIGABRT
-    if (original_abrt_handler != NULL) {
-        signal(SIGABRT, original_abrt_handler);
-        original_abrt_handler = NULL;
-    }
+        sigaction(SIGABRT, &original_abrt_action, NULL);
 #endif
+    }
+
+    pthread_mutex_unlock(&protection_lock);
 
     merkle_segv_occurred = 0;
 }
@@ -95,7 +131,17 @@ void *Merkle_Malloc(size_t size, const char *file, int line) {
   printf("allocating %zu bytes in file %s line %d", size, file, line);
 #endif
 
-  void *res = calloc(1, size);
+  void *res;
+
+  if (merkle_allocator.alloc) {
+    res = merkle_allocator.alloc(size, merkle_allocator.ctx);
+
+    if (res) {
+      memset(res, 0, size);
+    }
+  } else {
+    res = calloc(1, size);
+  }
 
 #ifdef MERKLE_DEBUG
   if (!res) {
@@ -103,6 +149,11 @@ void *Merkle_Malloc(size_t size, const char *file, int line) {
   }
 #endif
 
+  if (res) {
+    MERKLE_STAT_ADD(NULL, allocations, 1);
+    MERKLE_STAT_ADD(NULL, allocated_bytes, size);
+  }
+
   return res;
 }
 
@@ -122,5 +173,36 @@ void Merkle_Free(void *d, const char *file, int line) {
 #ifdef MERKLE_DEBUG
   printf("freeing in file %s line %d", file, line);
 #endif
-  free(d);
+
+  if (merkle_allocator.free) {
+    if (d) {
+      merkle_allocator.free(d, merkle_allocator.ctx);
+    }
+  } else {
+    free(d);
+  }
+
+  if (d) {
+    MERKLE_STAT_ADD(NULL, frees, 1);
+  }
+}
+
+/**
+ * @brief Installs the allocator used for all library memory.
+ *
+ * @param allocator Callbacks to use, or NULL to restore calloc()/free().
+ * @return MERKLE_SUCCESS, or MERKLE_BAD_ARG if only one callback is set.
+ */
+merkle_error_t merkle_set_allocator(const merkle_allocator_t *allocator) {
+  if (!allocator) {
+    merkle_allocator = (merkle_allocator_t){ NULL, NULL, NULL };
+    return MERKLE_SUCCESS;
+  }
+
+  if (!allocator->alloc || !allocator->free) {
+    return MERKLE_BAD_ARG;
+  }
+
+  merkle_allocator = *allocator;
+  return MERKLE_SUCCESS;
 }
@@ -53,6 +53,20 @@ struct merkle_proof{
     size_t path_length;          /**< Length of the proof path. */
     size_t leaf_index;           /**< Index of the leaf being proven. */
     size_t branching_factor;     /**< Branching factor of the tree. */
+    merkle_hash_id_t hash_id;    /**< Hash algorithm of the tree. */
+};
+
+/**
+ * @brief Internal structure of a multi-leaf proof (for testing).
+ */
+struct merkle_multiproof {
+    size_t leaf_count;                  /**< Number of leaves in the tree. */
+    size_t branching_factor;            /**< Branching factor of the tree. */
+    merkle_hash_id_t hash_id;           /**< Hash algorithm of the tree. */
+    size_t index_count;                 /**< Number of proven leaves. */
+    size_t *leaf_indices;               /**< Proven leaves, sorted and unique. */
+    size_t hash_count;                  /**< Number of hashes in the stream. */
+    unsigned char (*hashes)[HASH_SIZE]; /**< Underivable sibling hashes in walk order. */
 };
 
 #endif // TEST_MERKLE_INTERNAL_H
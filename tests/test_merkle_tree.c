@@ -16,12 +16,23 @@
 #include <assert.h>
 #include <openssl/sha.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 
 // Include the headers
 #include "test_merkle_internal.h"
 #include "Merkle.h"
 #include "merkle_utils.h"
+#include "merkle_async.h"
+#include "merkle_blake3.h"
+#include "merkle_reader.h"
+#include "merkle_sha256.h"
+#include "merkle_thread_pool.h"
+#include "MerkleQueue.h"
 
 // Test framework macros
 #define TEST_ASSERT(condition, message) \
@@ -1553,9 +1564,4173 @@ static int test_lock_cleanup_during_destruction(void) {
     TEST_PASS();
 }
 
+/**
+ * @brief Frees a proof returned by the proof generation API.
+ */
+static void release_test_proof(merkle_proof_t *proof) {
+    if (!proof) {
+        return;
+    }
+
+    for (size_t j = 0; j < proof->path_length; j++) {
+        if (proof->path[j]) {
+            MFree(proof->path[j]->sibling_hashes);
+            MFree(proof->path[j]);
+        }
+    }
+    MFree(proof->path);
+    MFree(proof);
+}
+
+/**
+ * @brief Builds a tree with the given layout through create_merkle_tree_ex().
+ */
+static merkle_tree_t *create_tree_with_layout(const void **data, const size_t *sizes,
+                                              size_t count, size_t bf, merkle_layout_t layout) {
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.branching_factor = bf;
+    config.layout = layout;
+    return create_merkle_tree_ex(data, sizes, count, &config);
+}
+
+/**
+ * @brief Flat layout must produce the same root as the pointer layout.
+ */
+static int test_flat_layout_root_matches_pointer(void) {
+    const size_t counts[] = {1, 2, 3, 5, 7, 8, 16, 33, 100};
+    const size_t factors[] = {2, 3, 4, 10};
+    const char *data[100];
+    size_t sizes[100];
+    create_test_data(data, sizes, 100);
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        for (size_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+            merkle_tree_t *pointer_tree = create_tree_with_layout(
+                (const void **)data, sizes, counts[c], factors[f], MERKLE_LAYOUT_POINTER);
+            merkle_tree_t *flat_tree = create_tree_with_layout(
+                (const void **)data, sizes, counts[c], factors[f], MERKLE_LAYOUT_FLAT);
+            TEST_ASSERT(pointer_tree != NULL && flat_tree != NULL, "Both layouts should build");
+
+            unsigned char pointer_hash[HASH_SIZE];
+            unsigned char flat_hash[HASH_SIZE];
+            TEST_ASSERT(get_tree_hash(pointer_tree, pointer_hash) == MERKLE_SUCCESS, "Should get pointer root");
+            TEST_ASSERT(get_tree_hash(flat_tree, flat_hash) == MERKLE_SUCCESS, "Should get flat root");
+            TEST_ASSERT(memcmp(pointer_hash, flat_hash, HASH_SIZE) == 0,
+                        "Flat root should match pointer root");
+
+            dealloc_merkle_tree(pointer_tree);
+            dealloc_merkle_tree(flat_tree);
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Verify the flat layout against a known four element root hash.
+ */
+static int test_flat_layout_known_root_hash(void) {
+    const char *data[] = {"Hello", "World", "Merkle", "Tree"};
+    size_t sizes[] = {5, 5, 6, 4};
+
+    const unsigned char expected[HASH_SIZE] = {
+        0xa1, 0x55, 0x41, 0x3a, 0xb3, 0xc2, 0x1a, 0x2a,
+        0xe8, 0x88, 0x4c, 0xdb, 0x7a, 0x49, 0x93, 0xa3,
+        0x37, 0xad, 0x1a, 0xed, 0x4d, 0x1d, 0xcf, 0xfe,
+        0xce, 0x16, 0xa5, 0x90, 0x89, 0x9a, 0x80, 0xeb
+    };
+
+    merkle_tree_t *tree = create_tree_with_layout((const void **)data, sizes, 4, 2, MERKLE_LAYOUT_FLAT);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+
+    unsigned char actual_hash[HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(tree, actual_hash) == MERKLE_SUCCESS, "Should get tree hash");
+    TEST_ASSERT(memcmp(actual_hash, expected, HASH_SIZE) == 0, "Root hash mismatch for flat layout");
+
+    dealloc_merkle_tree(tree);
+    TEST_PASS();
+}
+
+/**
+ * @brief Flat layout proofs must be identical to pointer layout proofs.
+ */
+static int test_flat_layout_proofs_match_pointer(void) {
+    const char *data[11];
+    size_t sizes[11];
+    create_test_data(data, sizes, 11);
+
+    for (size_t bf = 2; bf <= 4; bf++) {
+        merkle_tree_t *pointer_tree = create_tree_with_layout(
+            (const void **)data, sizes, 11, bf, MERKLE_LAYOUT_POINTER);
+        merkle_tree_t *flat_tree = create_tree_with_layout(
+            (const void **)data, sizes, 11, bf, MERKLE_LAYOUT_FLAT);
+        TEST_ASSERT(pointer_tree != NULL && flat_tree != NULL, "Both layouts should build");
+
+        for (size_t leaf = 0; leaf < 11; leaf++) {
+            merkle_proof_t *expected = NULL;
+            merkle_proof_t *actual = NULL;
+            TEST_ASSERT(generate_proof_from_index(pointer_tree, leaf, &expected) == MERKLE_SUCCESS,
+                        "Pointer proof should succeed");
+            TEST_ASSERT(generate_proof_from_index(flat_tree, leaf, &actual) == MERKLE_SUCCESS,
+                        "Flat proof should succeed");
+            TEST_ASSERT(actual->path_length == expected->path_length, "Path lengths should match");
+            TEST_ASSERT(actual->leaf_index == leaf, "Flat proof should track leaf index");
+
+            for (size_t lvl = 0; lvl < expected->path_length; lvl++) {
+                merkle_proof_item_t *e = expected->path[lvl];
+                merkle_proof_item_t *a = actual->path[lvl];
+                TEST_ASSERT(a->sibling_count == e->sibling_count, "Sibling counts should match");
+                TEST_ASSERT(a->node_position == e->node_position, "Node positions should match");
+                TEST_ASSERT(memcmp(a->sibling_hashes, e->sibling_hashes,
+                                   e->sibling_count * HASH_SIZE) == 0,
+                            "Sibling hashes should match");
+            }
+
+            release_test_proof(expected);
+            release_test_proof(actual);
+        }
+
+        dealloc_merkle_tree(pointer_tree);
+        dealloc_merkle_tree(flat_tree);
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief The finder sees the copied leaf data of a flat tree.
+ */
+static int test_flat_layout_finder(void) {
+    // Sizes leave out the terminator: stored copies are NUL-terminated in both layouts
+    const char *data[] = {"A", "B", "Target", "D", "E"};
+    size_t sizes[] = {1, 1, 6, 1, 1};
+
+    merkle_tree_t *tree = create_tree_with_layout((const void **)data, sizes, 5, 2, MERKLE_LAYOUT_FLAT);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+
+    merkle_proof_t *proof = NULL;
+    size_t path_length = 0;
+    TEST_ASSERT(generate_proof_by_finder(tree, test_value_finder, &path_length, &proof) == MERKLE_SUCCESS,
+                "Finder should succeed on flat tree");
+    TEST_ASSERT(proof != NULL, "Proof should not be NULL");
+    TEST_ASSERT(proof->leaf_index == 2, "Should find 'Target' at index 2");
+    release_test_proof(proof);
+
+    // An in-place rewrite and a replacement that outgrows its slot stay terminated too
+    const size_t indices[] = {2, 4};
+    const void *updates[] = {"Xarget", "Target"};
+    const size_t update_sizes[] = {6, 6};
+    TEST_ASSERT(update_leaves(tree, indices, updates, update_sizes, 2) == MERKLE_SUCCESS, "Update should succeed");
+    proof = NULL;
+    TEST_ASSERT(generate_proof_by_finder(tree, test_value_finder, &path_length, &proof) == MERKLE_SUCCESS &&
+                proof->leaf_index == 4, "Should find the updated 'Target' at index 4");
+
+    release_test_proof(proof);
+    dealloc_merkle_tree(tree);
+    TEST_PASS();
+}
+
+/**
+ * @brief create_merkle_tree_ex() rejects invalid configurations.
+ */
+static int test_create_ex_invalid_config(void) {
+    const char *data[] = {"A", "B"};
+    size_t sizes[] = {1, 1};
+    merkle_config_t config;
+
+    TEST_ASSERT(create_merkle_tree_ex((const void **)data, sizes, 2, NULL) == NULL,
+                "Should reject NULL config");
+
+    merkle_config_init(&config);
+    config.layout = (merkle_layout_t)42;
+    TEST_ASSERT(create_merkle_tree_ex((const void **)data, sizes, 2, &config) == NULL,
+                "Should reject unknown layout");
+
+    merkle_config_init(&config);
+    config.branching_factor = 1;
+    config.layout = MERKLE_LAYOUT_FLAT;
+    TEST_ASSERT(create_merkle_tree_ex((const void **)data, sizes, 2, &config) == NULL,
+                "Should reject branching factor 1 with several leaves");
+
+    const char *partial[] = {"test1", NULL};
+    size_t partial_sizes[] = {5, 0};
+    merkle_config_init(&config);
+    config.layout = MERKLE_LAYOUT_FLAT;
+    TEST_ASSERT(create_merkle_tree_ex((const void **)partial, partial_sizes, 2, &config) == NULL,
+                "Flat layout should reject invalid leaves");
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Borrowed and hash-only trees hash to the same root as copying trees.
+ */
+static int test_leaf_storage_modes_match_copy(void) {
+    const merkle_leaf_storage_t modes[] = {MERKLE_LEAF_BORROW, MERKLE_LEAF_HASH_ONLY};
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const char *data[37];
+    size_t sizes[37];
+    create_test_data(data, sizes, 37);
+
+    merkle_tree_t *copy_tree = create_merkle_tree((const void **)data, sizes, 37, 3);
+    TEST_ASSERT(copy_tree != NULL, "Copying build should succeed");
+    unsigned char expected[HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(copy_tree, expected) == MERKLE_SUCCESS, "Should get copy root");
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+            merkle_config_t config;
+            merkle_config_init(&config);
+            config.branching_factor = 3;
+            config.layout = layouts[l];
+            config.leaf_storage = modes[m];
+
+            merkle_tree_t *tree = create_merkle_tree_ex((const void **)data, sizes, 37, &config);
+            TEST_ASSERT(tree != NULL, "Build should succeed");
+            unsigned char actual[HASH_SIZE];
+            TEST_ASSERT(get_tree_hash(tree, actual) == MERKLE_SUCCESS, "Should get root");
+            TEST_ASSERT(memcmp(expected, actual, HASH_SIZE) == 0, "Root should not depend on leaf storage");
+
+            merkle_proof_t *expected_proof = NULL;
+            merkle_proof_t *actual_proof = NULL;
+            TEST_ASSERT(generate_proof_from_index(copy_tree, 20, &expected_proof) == MERKLE_SUCCESS,
+                        "Copy proof should succeed");
+            TEST_ASSERT(generate_proof_from_index(tree, 20, &actual_proof) == MERKLE_SUCCESS,
+                        "Proof should succeed");
+            TEST_ASSERT(actual_proof->path_length == expected_proof->path_length, "Path lengths should match");
+
+            for (size_t lvl = 0; lvl < expected_proof->path_length; lvl++) {
+                TEST_ASSERT(memcmp(actual_proof->path[lvl]->sibling_hashes,
+                                   expected_proof->path[lvl]->sibling_hashes,
+                                   expected_proof->path[lvl]->sibling_count * HASH_SIZE) == 0,
+                            "Sibling hashes should match");
+            }
+
+            release_test_proof(expected_proof);
+            release_test_proof(actual_proof);
+            dealloc_merkle_tree(tree);
+        }
+    }
+
+    dealloc_merkle_tree(copy_tree);
+    TEST_PASS();
+}
+
+/**
+ * @brief The finder of a borrowing tree sees the caller's own blocks.
+ */
+static int test_leaf_storage_borrow_finder(void) {
+    const char *data[] = {"A", "B", "C", "Target", "E"};
+    size_t sizes[] = {2, 2, 2, 7, 2};
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+
+    for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+        merkle_config_t config;
+        merkle_config_init(&config);
+        config.layout = layouts[l];
+        config.leaf_storage = MERKLE_LEAF_BORROW;
+
+        merkle_tree_t *tree = create_merkle_tree_ex((const void **)data, sizes, 5, &config);
+        TEST_ASSERT(tree != NULL, "Build should succeed");
+
+        merkle_proof_t *proof = NULL;
+        size_t path_length = 0;
+        TEST_ASSERT(generate_proof_by_finder(tree, test_value_finder, &path_length, &proof) == MERKLE_SUCCESS,
+                    "Finder should succeed on borrowed leaves");
+        TEST_ASSERT(proof != NULL && proof->leaf_index == 3, "Should find 'Target' at index 3");
+
+        release_test_proof(proof);
+        dealloc_merkle_tree(tree);
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Lookup context for hash-only finder tests.
+ */
+typedef struct lookup_source {
+    const char **blocks;
+    size_t lookups;
+} lookup_source_t;
+
+/**
+ * @brief merkle_leaf_lookup serving blocks from a lookup_source_t.
+ */
+static void *lookup_test_leaf(size_t leaf_index, void *ctx) {
+    lookup_source_t *source = ctx;
+    source->lookups++;
+    return (void *)source->blocks[leaf_index];
+}
+
+/**
+ * @brief Hash-only trees search through the caller lookup and fail without one.
+ */
+static int test_leaf_storage_hash_only_lookup(void) {
+    const char *data[] = {"A", "B", "Target", "D"};
+    size_t sizes[] = {2, 2, 7, 2};
+    lookup_source_t source = {data, 0};
+
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.layout = MERKLE_LAYOUT_FLAT;
+    config.leaf_storage = MERKLE_LEAF_HASH_ONLY;
+
+    merkle_tree_t *tree = create_merkle_tree_ex((const void **)data, sizes, 4, &config);
+    TEST_ASSERT(tree != NULL, "Build should succeed");
+
+    merkle_proof_t *proof = NULL;
+    size_t path_length = 0;
+    TEST_ASSERT(generate_proof_by_finder(tree, test_value_finder, &path_length, &proof) == MERKLE_BAD_ARG,
+                "Finder without a lookup should fail on hash-only trees");
+    TEST_ASSERT(proof == NULL, "No proof should be produced");
+    dealloc_merkle_tree(tree);
+
+    config.layout = MERKLE_LAYOUT_POINTER;
+    config.leaf_lookup = lookup_test_leaf;
+    config.leaf_lookup_ctx = &source;
+    tree = create_merkle_tree_ex((const void **)data, sizes, 4, &config);
+    TEST_ASSERT(tree != NULL, "Build should succeed");
+    TEST_ASSERT(generate_proof_by_finder(tree, test_value_finder, &path_length, &proof) == MERKLE_SUCCESS,
+                "Finder should succeed through the lookup");
+    TEST_ASSERT(proof != NULL && proof->leaf_index == 2, "Should find 'Target' at index 2");
+    TEST_ASSERT(source.lookups == 3, "Lookup should stop at the first match");
+
+    release_test_proof(proof);
+    dealloc_merkle_tree(tree);
+
+    config.leaf_storage = (merkle_leaf_storage_t)7;
+    TEST_ASSERT(create_merkle_tree_ex((const void **)data, sizes, 4, &config) == NULL,
+                "Unknown leaf storage should be rejected");
+    TEST_PASS();
+}
+
+/** Leaves used by the parallel build tests, large enough to split into chunks. */
+#define PARALLEL_TEST_LEAVES (20000)
+
+/**
+ * @brief Fills @p data with distinct 8 byte leaves backed by @p storage.
+ */
+static void create_unique_test_data(const void **data, size_t *sizes, unsigned long long *storage, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        storage[i] = 0x9E3779B97F4A7C15ULL * (i + 1);
+        data[i] = &storage[i];
+        sizes[i] = sizeof(storage[i]);
+    }
+}
+
+/**
+ * @brief Parallel builds on either layout produce the serial root.
+ */
+static int test_parallel_build_matches_serial(void) {
+    const size_t factors[] = {2, 3, 16};
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const void **data = malloc(PARALLEL_TEST_LEAVES * sizeof(*data));
+    size_t *sizes = malloc(PARALLEL_TEST_LEAVES * sizeof(*sizes));
+    unsigned long long *storage = malloc(PARALLEL_TEST_LEAVES * sizeof(*storage));
+    TEST_ASSERT(data && sizes && storage, "Test allocation should succeed");
+    create_unique_test_data(data, sizes, storage, PARALLEL_TEST_LEAVES);
+
+    for (size_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+        merkle_tree_t *serial = create_merkle_tree(data, sizes, PARALLEL_TEST_LEAVES, factors[f]);
+        TEST_ASSERT(serial != NULL, "Serial build should succeed");
+        unsigned char expected[HASH_SIZE];
+        TEST_ASSERT(get_tree_hash(serial, expected) == MERKLE_SUCCESS, "Should get serial root");
+        dealloc_merkle_tree(serial);
+
+        for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+            merkle_config_t config;
+            merkle_config_init(&config);
+            config.branching_factor = factors[f];
+            config.layout = layouts[l];
+            config.thread_count = 4;
+
+            merkle_tree_t *tree = create_merkle_tree_ex(data, sizes, PARALLEL_TEST_LEAVES, &config);
+            TEST_ASSERT(tree != NULL, "Parallel build should succeed");
+            unsigned char actual[HASH_SIZE];
+            TEST_ASSERT(get_tree_hash(tree, actual) == MERKLE_SUCCESS, "Should get parallel root");
+            TEST_ASSERT(memcmp(expected, actual, HASH_SIZE) == 0, "Parallel root should match serial root");
+            dealloc_merkle_tree(tree);
+        }
+    }
+
+    free(data);
+    free(sizes);
+    free(storage);
+    TEST_PASS();
+}
+
+/**
+ * @brief A caller-owned pool can be reused across builds and layouts.
+ */
+static int test_parallel_build_shared_pool(void) {
+    const void **data = malloc(PARALLEL_TEST_LEAVES * sizeof(*data));
+    size_t *sizes = malloc(PARALLEL_TEST_LEAVES * sizeof(*sizes));
+    unsigned long long *storage = malloc(PARALLEL_TEST_LEAVES * sizeof(*storage));
+    TEST_ASSERT(data && sizes && storage, "Test allocation should succeed");
+    create_unique_test_data(data, sizes, storage, PARALLEL_TEST_LEAVES);
+
+    TEST_ASSERT(merkle_thread_pool_create(0) == NULL, "Pool without threads should be rejected");
+    merkle_thread_pool_t *pool = merkle_thread_pool_create(3);
+    TEST_ASSERT(pool != NULL, "Pool creation should succeed");
+
+    merkle_tree_t *serial = create_merkle_tree(data, sizes, PARALLEL_TEST_LEAVES, 4);
+    TEST_ASSERT(serial != NULL, "Serial build should succeed");
+    unsigned char expected[HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(serial, expected) == MERKLE_SUCCESS, "Should get serial root");
+    dealloc_merkle_tree(serial);
+
+    for (int round = 0; round < 3; round++) {
+        merkle_config_t config;
+        merkle_config_init(&config);
+        config.branching_factor = 4;
+        config.layout = round % 2 ? MERKLE_LAYOUT_FLAT : MERKLE_LAYOUT_POINTER;
+        config.thread_pool = pool;
+
+        merkle_tree_t *tree = create_merkle_tree_ex(data, sizes, PARALLEL_TEST_LEAVES, &config);
+        TEST_ASSERT(tree != NULL, "Build on shared pool should succeed");
+        unsigned char actual[HASH_SIZE];
+        TEST_ASSERT(get_tree_hash(tree, actual) == MERKLE_SUCCESS, "Should get root");
+        TEST_ASSERT(memcmp(expected, actual, HASH_SIZE) == 0, "Shared pool root should match serial root");
+        dealloc_merkle_tree(tree);
+    }
+
+    // Small inputs and invalid leaves go through the pool path too
+    const char *single[] = {"only"};
+    size_t single_size[] = {4};
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.thread_pool = pool;
+    merkle_tree_t *tree = create_merkle_tree_ex((const void **)single, single_size, 1, &config);
+    TEST_ASSERT(tree != NULL, "Single leaf build on pool should succeed");
+    dealloc_merkle_tree(tree);
+
+    sizes[PARALLEL_TEST_LEAVES / 2] = 0;
+    TEST_ASSERT(create_merkle_tree_ex(data, sizes, PARALLEL_TEST_LEAVES, &config) == NULL,
+                "Invalid leaf should fail the parallel build");
+
+    merkle_thread_pool_destroy(pool);
+    free(data);
+    free(sizes);
+    free(storage);
+    TEST_PASS();
+}
+
+/**
+ * @brief merkle_range_fn counting visits per index.
+ */
+static void count_visits(void *ctx, size_t begin, size_t end) {
+    int *visits = ctx;
+    for (size_t i = begin; i < end; i++) {
+        __atomic_fetch_add(&visits[i], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief merkle_parallel_for visits every index exactly once, with or without a pool.
+ */
+static int test_parallel_for_covers_range(void) {
+    const size_t counts[] = {1, 7, 1000, 12345};
+    merkle_thread_pool_t *pool = merkle_thread_pool_create(4);
+    TEST_ASSERT(pool != NULL, "Pool creation should succeed");
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        for (int with_pool = 0; with_pool < 2; with_pool++) {
+            int *visits = calloc(counts[c], sizeof(*visits));
+            TEST_ASSERT(visits != NULL, "Test allocation should succeed");
+
+            merkle_parallel_for(with_pool ? pool : NULL, counts[c], 16, count_visits, visits);
+
+            for (size_t i = 0; i < counts[c]; i++) {
+                TEST_ASSERT(visits[i] == 1, "Every index should be visited exactly once");
+            }
+
+            free(visits);
+        }
+    }
+
+    merkle_thread_pool_destroy(pool);
+    TEST_PASS();
+}
+
+/** Backends exercised by the SHA-256 tests; unsupported ones are skipped. */
+static const merkle_sha256_backend_t test_sha256_backends[] = {
+    MERKLE_SHA256_SCALAR, MERKLE_SHA256_SHANI, MERKLE_SHA256_AVX2,
+    MERKLE_SHA256_AVX512, MERKLE_SHA256_ARMV8
+};
+
+/**
+ * @brief Every supported SHA-256 backend matches OpenSSL for mixed batches.
+ */
+static int test_sha256_backends_match_openssl(void) {
+    enum { MESSAGES = 70, MAX_LEN = 300 };
+    static unsigned char storage[MESSAGES][MAX_LEN];
+    const unsigned char *msgs[MESSAGES];
+    size_t lens[MESSAGES];
+    unsigned char digests[MESSAGES][HASH_SIZE];
+    unsigned char *outs[MESSAGES];
+
+    // Lengths straddle the one and two block padding boundaries
+    for (size_t i = 0; i < MESSAGES; i++) {
+        lens[i] = (i * 37 + i / 3) % MAX_LEN;
+        for (size_t b = 0; b < lens[i]; b++) {
+            storage[i][b] = (unsigned char)(i * 131 + b * 7);
+        }
+        msgs[i] = storage[i];
+        outs[i] = digests[i];
+    }
+    lens[1] = 55;
+    lens[2] = 56;
+    lens[3] = 64;
+
+    for (size_t b = 0; b < sizeof(test_sha256_backends) / sizeof(test_sha256_backends[0]); b++) {
+        if (merkle_sha256_select_backend(test_sha256_backends[b]) != MERKLE_SUCCESS) {
+            continue;
+        }
+
+        // Odd batch sizes leave vector lanes empty
+        const size_t batches[] = {1, 3, 5, 8, 13, 16, 17, MESSAGES};
+        for (size_t c = 0; c < sizeof(batches) / sizeof(batches[0]); c++) {
+            memset(digests, 0, sizeof(digests));
+            merkle_sha256_batch(msgs, lens, outs, batches[c]);
+
+            for (size_t i = 0; i < batches[c]; i++) {
+                unsigned char expected[HASH_SIZE];
+                SHA256(msgs[i], lens[i], expected);
+                TEST_ASSERT(memcmp(expected, digests[i], HASH_SIZE) == 0,
+                            "Backend digest should match OpenSSL");
+            }
+        }
+    }
+
+    TEST_ASSERT(merkle_sha256_select_backend(MERKLE_SHA256_AUTO) == MERKLE_SUCCESS,
+                "Restoring automatic selection should succeed");
+    TEST_PASS();
+}
+
+/**
+ * @brief The streaming context matches OpenSSL however the message is split.
+ */
+static int test_sha256_streaming_matches_openssl(void) {
+    enum { MAX_LEN = 300 };
+    static unsigned char message[MAX_LEN];
+    const size_t pieces[] = {1, 7, 31, 64, 65, 200};
+
+    for (size_t i = 0; i < MAX_LEN; i++) {
+        message[i] = (unsigned char)(i * 13 + 5);
+    }
+
+    for (size_t b = 0; b < sizeof(test_sha256_backends) / sizeof(test_sha256_backends[0]); b++) {
+        if (merkle_sha256_select_backend(test_sha256_backends[b]) != MERKLE_SUCCESS) {
+            continue;
+        }
+
+        for (size_t len = 0; len <= MAX_LEN; len += (len < 130 ? 1 : 17)) {
+            unsigned char expected[HASH_SIZE];
+            SHA256(message, len, expected);
+
+            for (size_t p = 0; p < sizeof(pieces) / sizeof(pieces[0]); p++) {
+                merkle_sha256_ctx_t ctx;
+                unsigned char actual[HASH_SIZE];
+                merkle_sha256_init(&ctx);
+
+                for (size_t off = 0; off < len; off += pieces[p]) {
+                    merkle_sha256_update(&ctx, message + off, len - off < pieces[p] ? len - off : pieces[p]);
+                }
+
+                merkle_sha256_final(&ctx, actual);
+                TEST_ASSERT(memcmp(expected, actual, HASH_SIZE) == 0, "Streaming digest should match OpenSSL");
+            }
+        }
+    }
+
+    merkle_sha256_select_backend(MERKLE_SHA256_AUTO);
+    TEST_PASS();
+}
+
+/**
+ * @brief Worker threads sharing the EVP path each hash with their own context.
+ */
+static int test_sha256_scalar_parallel_build(void) {
+    enum { leaves = 3000 };
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    merkle_sha256_select_backend(MERKLE_SHA256_SCALAR);
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.branching_factor = 40;
+    merkle_tree_t *serial = create_merkle_tree_ex(data, sizes, leaves, &config);
+    config.thread_count = 4;
+    merkle_tree_t *parallel = create_merkle_tree_ex(data, sizes, leaves, &config);
+    merkle_sha256_select_backend(MERKLE_SHA256_AUTO);
+    merkle_tree_t *reference = create_merkle_tree(data, sizes, leaves, 40);
+
+    unsigned char serial_root[HASH_SIZE], parallel_root[HASH_SIZE], expected[HASH_SIZE];
+    TEST_ASSERT(serial && parallel && reference, "Builds should succeed");
+    TEST_ASSERT(get_tree_hash(serial, serial_root) == MERKLE_SUCCESS &&
+                get_tree_hash(parallel, parallel_root) == MERKLE_SUCCESS &&
+                get_tree_hash(reference, expected) == MERKLE_SUCCESS, "Should get roots");
+    TEST_ASSERT(memcmp(serial_root, expected, HASH_SIZE) == 0 && memcmp(parallel_root, expected, HASH_SIZE) == 0,
+                "Scalar builds should match the default backend");
+
+    dealloc_merkle_tree(reference);
+    dealloc_merkle_tree(parallel);
+    dealloc_merkle_tree(serial);
+    TEST_PASS();
+}
+
+/**
+ * @brief Trees built on every backend share the same root.
+ */
+static int test_sha256_backends_same_root(void) {
+    const char *data[100];
+    size_t sizes[100];
+    create_test_data(data, sizes, 100);
+
+    merkle_sha256_select_backend(MERKLE_SHA256_SCALAR);
+    merkle_tree_t *reference = create_merkle_tree((const void **)data, sizes, 100, 3);
+    TEST_ASSERT(reference != NULL, "Reference build should succeed");
+    unsigned char expected[HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(reference, expected) == MERKLE_SUCCESS, "Should get reference root");
+    dealloc_merkle_tree(reference);
+
+    for (size_t b = 0; b < sizeof(test_sha256_backends) / sizeof(test_sha256_backends[0]); b++) {
+        if (merkle_sha256_select_backend(test_sha256_backends[b]) != MERKLE_SUCCESS) {
+            continue;
+        }
+
+        for (int layout = 0; layout < 2; layout++) {
+            merkle_tree_t *tree = create_tree_with_layout((const void **)data, sizes, 100, 3,
+                                                          layout ? MERKLE_LAYOUT_FLAT : MERKLE_LAYOUT_POINTER);
+            TEST_ASSERT(tree != NULL, "Build should succeed");
+            unsigned char actual[HASH_SIZE];
+            TEST_ASSERT(get_tree_hash(tree, actual) == MERKLE_SUCCESS, "Should get root");
+            TEST_ASSERT(memcmp(expected, actual, HASH_SIZE) == 0, "Root should not depend on the backend");
+            dealloc_merkle_tree(tree);
+        }
+    }
+
+    merkle_sha256_select_backend(MERKLE_SHA256_AUTO);
+    TEST_PASS();
+}
+
+/**
+ * @brief Asserts that @p tree has the root of a fresh build over the same data.
+ */
+static int expect_root_of_rebuild(merkle_tree_t *tree, const char **data, const size_t *sizes,
+                                  size_t count, size_t bf) {
+    merkle_tree_t *rebuilt = create_merkle_tree((const void **)data, sizes, count, bf);
+    TEST_ASSERT(rebuilt != NULL, "Rebuild should succeed");
+    unsigned char expected[HASH_SIZE];
+    unsigned char actual[HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(rebuilt, expected) == MERKLE_SUCCESS, "Should get rebuilt root");
+    TEST_ASSERT(get_tree_hash(tree, actual) == MERKLE_SUCCESS, "Should get updated root");
+    dealloc_merkle_tree(rebuilt);
+    TEST_ASSERT(memcmp(expected, actual, HASH_SIZE) == 0, "Updated root should match a rebuild");
+    return 1;
+}
+
+/**
+ * @brief update_leaf() yields the root of a rebuild on every layout and storage mode.
+ */
+static int test_update_leaf_matches_rebuild(void) {
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const merkle_leaf_storage_t modes[] = {MERKLE_LEAF_COPY, MERKLE_LEAF_BORROW, MERKLE_LEAF_HASH_ONLY};
+    const size_t factors[] = {2, 3, 5};
+    const size_t targets[] = {0, 17, 36};
+    const char *replacements[] = {"first", "a considerably longer replacement", "Data"};
+
+    for (size_t l = 0; l < 2; l++) {
+        for (size_t m = 0; m < 3; m++) {
+            for (size_t f = 0; f < 3; f++) {
+                const char *data[37];
+                size_t sizes[37];
+                create_test_data(data, sizes, 37);
+
+                merkle_config_t config;
+                merkle_config_init(&config);
+                config.branching_factor = factors[f];
+                config.layout = layouts[l];
+                config.leaf_storage = modes[m];
+                merkle_tree_t *tree = create_merkle_tree_ex((const void **)data, sizes, 37, &config);
+                TEST_ASSERT(tree != NULL, "Build should succeed");
+
+                for (size_t t = 0; t < 3; t++) {
+                    data[targets[t]] = replacements[t];
+                    sizes[targets[t]] = strlen(replacements[t]);
+                    TEST_ASSERT(update_leaf(tree, targets[t], data[targets[t]], sizes[targets[t]]) == MERKLE_SUCCESS,
+                                "Update should succeed");
+                    if (!expect_root_of_rebuild(tree, data, sizes, 37, factors[f])) {
+                        dealloc_merkle_tree(tree);
+                        return 0;
+                    }
+                }
+
+                dealloc_merkle_tree(tree);
+            }
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief update_leaves() applies a batch with duplicates, last entry winning.
+ */
+static int test_update_leaves_batch(void) {
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+
+    for (size_t l = 0; l < 2; l++) {
+        const char *data[50];
+        size_t sizes[50];
+        create_test_data(data, sizes, 50);
+        merkle_tree_t *tree = create_tree_with_layout((const void **)data, sizes, 50, 4, layouts[l]);
+        TEST_ASSERT(tree != NULL, "Build should succeed");
+
+        // Unsorted indices with a repeat; in-place and resized copies alike
+        size_t indices[] = {42, 3, 7, 3, 49, 8, 6};
+        const char *blocks[] = {"x42", "old", "Tset", "Target", "last leaf", "q", "World"};
+        size_t block_sizes[] = {3, 3, 4, 7, 9, 1, 5};
+        TEST_ASSERT(update_leaves(tree, indices, (const void **)blocks, block_sizes, 7) == MERKLE_SUCCESS,
+                    "Batch update should succeed");
+
+        for (size_t k = 0; k < 7; k++) {
+            data[indices[k]] = blocks[k];
+            sizes[indices[k]] = block_sizes[k];
+        }
+
+        if (!expect_root_of_rebuild(tree, data, sizes, 50, 4)) {
+            dealloc_merkle_tree(tree);
+            return 0;
+        }
+
+        // The finder sees the replaced copy of leaf 3
+        merkle_proof_t *proof = NULL;
+        size_t path_length = 0;
+        TEST_ASSERT(generate_proof_by_finder(tree, test_value_finder, &path_length, &proof) == MERKLE_SUCCESS,
+                    "Finder should succeed after update");
+        TEST_ASSERT(proof != NULL && proof->leaf_index == 3, "Should find the updated leaf");
+        release_test_proof(proof);
+
+        TEST_ASSERT(update_leaves(tree, indices, (const void **)blocks, block_sizes, 0) == MERKLE_SUCCESS,
+                    "Empty batch should be a no-op");
+        dealloc_merkle_tree(tree);
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Rejected updates leave the tree untouched.
+ */
+static int test_update_leaf_invalid_args(void) {
+    const char *data[] = {"A", "B", "C", "D", "E"};
+    size_t sizes[] = {1, 1, 1, 1, 1};
+    merkle_tree_t *tree = create_merkle_tree((const void **)data, sizes, 5, 2);
+    TEST_ASSERT(tree != NULL, "Build should succeed");
+
+    unsigned char before[HASH_SIZE];
+    unsigned char after[HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(tree, before) == MERKLE_SUCCESS, "Should get root");
+
+    TEST_ASSERT(update_leaf(NULL, 0, "x", 1) == MERKLE_NULL_ARG, "NULL tree should be rejected");
+    TEST_ASSERT(update_leaf(tree, 5, "x", 1) == MERKLE_INVALID_INDEX, "Out of range index should be rejected");
+    TEST_ASSERT(update_leaf(tree, 0, NULL, 1) == MERKLE_BAD_ARG, "NULL block should be rejected");
+    TEST_ASSERT(update_leaf(tree, 0, "x", 0) == MERKLE_BAD_ARG, "Empty block should be rejected");
+
+    // One bad entry rejects the whole batch
+    size_t indices[] = {0, 9};
+    const char *blocks[] = {"x", "y"};
+    size_t block_sizes[] = {1, 1};
+    TEST_ASSERT(update_leaves(tree, indices, (const void **)blocks, block_sizes, 2) == MERKLE_INVALID_INDEX,
+                "Batch with a bad index should be rejected");
+
+    TEST_ASSERT(get_tree_hash(tree, after) == MERKLE_SUCCESS, "Should get root");
+    TEST_ASSERT(memcmp(before, after, HASH_SIZE) == 0, "Failed updates should not change the root");
+
+    dealloc_merkle_tree(tree);
+    TEST_PASS();
+}
+
+/** Largest leaf count exercised against full builds by the streaming tests. */
+#define STREAM_TEST_LEAVES (300)
+
+/**
+ * @brief Streaming builds match create_merkle_tree() for every prefix length.
+ */
+static int test_builder_matches_tree(void) {
+    const size_t factors[] = {2, 3, 4, 7, 16};
+    const void *data[STREAM_TEST_LEAVES];
+    size_t sizes[STREAM_TEST_LEAVES];
+    unsigned long long storage[STREAM_TEST_LEAVES];
+    create_unique_test_data(data, sizes, storage, STREAM_TEST_LEAVES);
+
+    for (size_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+        merkle_builder_t *builder = merkle_builder_init(factors[f]);
+        TEST_ASSERT(builder != NULL, "Builder init should succeed");
+
+        // Finalizing does not consume the builder, so every prefix is checked
+        for (size_t n = 1; n <= STREAM_TEST_LEAVES; n++) {
+            TEST_ASSERT(merkle_builder_append(builder, data[n - 1], sizes[n - 1]) == MERKLE_SUCCESS,
+                        "Append should succeed");
+
+            merkle_tree_t *tree = create_merkle_tree(data, sizes, n, factors[f]);
+            TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+            unsigned char expected[HASH_SIZE];
+            unsigned char actual[HASH_SIZE];
+            TEST_ASSERT(get_tree_hash(tree, expected) == MERKLE_SUCCESS, "Should get tree root");
+            dealloc_merkle_tree(tree);
+
+            TEST_ASSERT(merkle_builder_finalize(builder, actual) == MERKLE_SUCCESS, "Finalize should succeed");
+            TEST_ASSERT(memcmp(expected, actual, HASH_SIZE) == 0, "Streaming root should match the tree root");
+        }
+
+        TEST_ASSERT(merkle_builder_leaf_count(builder) == STREAM_TEST_LEAVES, "Builder should count every leaf");
+        merkle_builder_destroy(builder);
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Chunked appends of uneven sizes give the same root as single appends.
+ */
+static int test_builder_chunked_append(void) {
+    const void *data[PARALLEL_TEST_LEAVES];
+    size_t sizes[PARALLEL_TEST_LEAVES];
+    unsigned long long *storage = malloc(PARALLEL_TEST_LEAVES * sizeof(*storage));
+    TEST_ASSERT(storage != NULL, "Test allocation should succeed");
+    create_unique_test_data(data, sizes, storage, PARALLEL_TEST_LEAVES);
+
+    merkle_tree_t *tree = create_merkle_tree(data, sizes, PARALLEL_TEST_LEAVES, 5);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+    unsigned char expected[HASH_SIZE];
+    unsigned char actual[HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(tree, expected) == MERKLE_SUCCESS, "Should get tree root");
+    dealloc_merkle_tree(tree);
+
+    merkle_builder_t *builder = merkle_builder_init(5);
+    TEST_ASSERT(builder != NULL, "Builder init should succeed");
+
+    size_t appended = 0;
+    for (size_t chunk = 1; appended < PARALLEL_TEST_LEAVES; chunk = chunk * 3 % 97 + 1) {
+        size_t n = PARALLEL_TEST_LEAVES - appended < chunk ? PARALLEL_TEST_LEAVES - appended : chunk;
+        TEST_ASSERT(merkle_builder_append_n(builder, data + appended, sizes + appended, n) == MERKLE_SUCCESS,
+                    "Chunked append should succeed");
+        appended += n;
+    }
+
+    TEST_ASSERT(merkle_builder_finalize(builder, actual) == MERKLE_SUCCESS, "Finalize should succeed");
+    TEST_ASSERT(memcmp(expected, actual, HASH_SIZE) == 0, "Chunked root should match the tree root");
+
+    merkle_builder_destroy(builder);
+    free(storage);
+    TEST_PASS();
+}
+
+/**
+ * @brief Invalid builder arguments are rejected without appending anything.
+ */
+static int test_builder_invalid_args(void) {
+    unsigned char root[HASH_SIZE];
+
+    TEST_ASSERT(merkle_builder_init(0) == NULL, "Zero branching factor should be rejected");
+    TEST_ASSERT(merkle_builder_init(1) == NULL, "Unary branching factor should be rejected");
+
+    merkle_builder_t *builder = merkle_builder_init(2);
+    TEST_ASSERT(builder != NULL, "Builder init should succeed");
+    TEST_ASSERT(merkle_builder_finalize(builder, root) == MERKLE_BAD_ARG, "Empty builder has no root");
+    TEST_ASSERT(merkle_builder_finalize(NULL, root) == MERKLE_NULL_ARG, "NULL builder should be rejected");
+    TEST_ASSERT(merkle_builder_finalize(builder, NULL) == MERKLE_NULL_ARG, "NULL output should be rejected");
+    TEST_ASSERT(merkle_builder_append(NULL, "A", 1) == MERKLE_NULL_ARG, "NULL builder should be rejected");
+    TEST_ASSERT(merkle_builder_append(builder, NULL, 1) == MERKLE_BAD_ARG, "NULL block should be rejected");
+    TEST_ASSERT(merkle_builder_append(builder, "A", 0) == MERKLE_BAD_ARG, "Empty block should be rejected");
+
+    const void *blocks[] = {"A", NULL, "C"};
+    size_t block_sizes[] = {1, 1, 1};
+    TEST_ASSERT(merkle_builder_append_n(builder, blocks, block_sizes, 3) == MERKLE_BAD_ARG,
+                "Chunk with a NULL block should be rejected");
+    TEST_ASSERT(merkle_builder_leaf_count(builder) == 0, "Rejected chunk should append nothing");
+
+    TEST_ASSERT(merkle_builder_append(builder, "A", 1) == MERKLE_SUCCESS, "Append should succeed");
+    TEST_ASSERT(merkle_builder_finalize(builder, root) == MERKLE_SUCCESS, "Single leaf should have a root");
+
+    merkle_builder_destroy(builder);
+    merkle_builder_destroy(NULL);
+    TEST_PASS();
+}
+
+/**
+ * @brief verify_proof() accepts every leaf's proof on both layouts.
+ */
+static int test_verify_proof_roundtrip(void) {
+    const size_t factors[] = {2, 3, 5};
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const void *data[45];
+    size_t sizes[45];
+    unsigned long long storage[45];
+    create_unique_test_data(data, sizes, storage, 45);
+
+    for (size_t f = 0; f < 3; f++) {
+        for (size_t l = 0; l < 2; l++) {
+            merkle_tree_t *tree = create_tree_with_layout(data, sizes, 45, factors[f], layouts[l]);
+            TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+            unsigned char root[HASH_SIZE];
+            TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS, "Should get root");
+
+            for (size_t i = 0; i < 45; i++) {
+                merkle_proof_t *proof = NULL;
+                unsigned char leaf_hash[HASH_SIZE];
+                SHA256(data[i], sizes[i], leaf_hash);
+                TEST_ASSERT(generate_proof_from_index(tree, i, &proof) == MERKLE_SUCCESS, "Proof generation should succeed");
+                TEST_ASSERT(verify_proof(root, leaf_hash, proof) == MERKLE_SUCCESS, "Genuine proof should verify");
+
+                // The same path must not vouch for a neighbouring leaf
+                SHA256(data[(i + 1) % 45], sizes[(i + 1) % 45], leaf_hash);
+                TEST_ASSERT(verify_proof(root, leaf_hash, proof) == MERKLE_PROOF_INVALID,
+                            "Proof should not verify another leaf");
+                release_test_proof(proof);
+            }
+
+            dealloc_merkle_tree(tree);
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief verify_proof() rejects tampered proofs and NULL arguments.
+ */
+static int test_verify_proof_rejects_tampering(void) {
+    const void *data[10];
+    size_t sizes[10];
+    unsigned long long storage[10];
+    create_unique_test_data(data, sizes, storage, 10);
+
+    merkle_tree_t *tree = create_merkle_tree(data, sizes, 10, 3);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+    unsigned char root[HASH_SIZE];
+    unsigned char leaf_hash[HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS, "Should get root");
+    SHA256(data[4], sizes[4], leaf_hash);
+
+    merkle_proof_t *proof = NULL;
+    TEST_ASSERT(generate_proof_from_index(tree, 4, &proof) == MERKLE_SUCCESS, "Proof generation should succeed");
+
+    TEST_ASSERT(verify_proof(NULL, leaf_hash, proof) == MERKLE_NULL_ARG, "NULL root should be rejected");
+    TEST_ASSERT(verify_proof(root, NULL, proof) == MERKLE_NULL_ARG, "NULL leaf hash should be rejected");
+    TEST_ASSERT(verify_proof(root, leaf_hash, NULL) == MERKLE_NULL_ARG, "NULL proof should be rejected");
+
+    proof->path[1]->sibling_hashes[0][7] ^= 0x01;
+    TEST_ASSERT(verify_proof(root, leaf_hash, proof) == MERKLE_PROOF_INVALID, "Altered sibling should be rejected");
+    proof->path[1]->sibling_hashes[0][7] ^= 0x01;
+
+    proof->leaf_index = 5;
+    TEST_ASSERT(verify_proof(root, leaf_hash, proof) == MERKLE_PROOF_INVALID,
+                "Positions disagreeing with the leaf index should be rejected");
+    proof->leaf_index = 4;
+
+    root[0] ^= 0x80;
+    TEST_ASSERT(verify_proof(root, leaf_hash, proof) == MERKLE_PROOF_INVALID, "Wrong root should be rejected");
+    root[0] ^= 0x80;
+    TEST_ASSERT(verify_proof(root, leaf_hash, proof) == MERKLE_SUCCESS, "Restored proof should verify");
+
+    release_test_proof(proof);
+    dealloc_merkle_tree(tree);
+    TEST_PASS();
+}
+
+/**
+ * @brief verify_proofs_batch() agrees with verify_proof() entry by entry.
+ */
+static int test_verify_proofs_batch(void) {
+    enum { leaves = 200, count = 300 };
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    merkle_tree_t *tree = create_merkle_tree(data, sizes, leaves, 4);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+    unsigned char root[HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS, "Should get root");
+
+    // Unordered leaves with repeats, so parents are shared across entries
+    merkle_proof_t *proofs[count];
+    unsigned char leaf_hashes[count][HASH_SIZE];
+    bool results[count];
+
+    for (size_t i = 0; i < count; i++) {
+        size_t leaf = (i * 37) % leaves;
+        SHA256(data[leaf], sizes[leaf], leaf_hashes[i]);
+        TEST_ASSERT(generate_proof_from_index(tree, leaf, &proofs[i]) == MERKLE_SUCCESS,
+                    "Proof generation should succeed");
+    }
+
+    TEST_ASSERT(verify_proofs_batch(root, (const unsigned char (*)[HASH_SIZE])leaf_hashes,
+                                    (const merkle_proof_t *const *)proofs, count, results) == MERKLE_SUCCESS,
+                "Genuine batch should verify");
+
+    for (size_t i = 0; i < count; i++) {
+        TEST_ASSERT(results[i], "Every genuine proof should be reported valid");
+    }
+
+    // Break a few entries in different ways
+    merkle_proof_t *saved = proofs[3];
+    proofs[3] = NULL;
+    leaf_hashes[10][0] ^= 0x01;
+    proofs[20]->path[2]->sibling_hashes[1][31] ^= 0x01;
+
+    TEST_ASSERT(verify_proofs_batch(root, (const unsigned char (*)[HASH_SIZE])leaf_hashes,
+                                    (const merkle_proof_t *const *)proofs, count, results) == MERKLE_PROOF_INVALID,
+                "Batch with bad entries should be rejected");
+
+    for (size_t i = 0; i < count; i++) {
+        bool expected = proofs[i] && verify_proof(root, leaf_hashes[i], proofs[i]) == MERKLE_SUCCESS;
+        TEST_ASSERT(results[i] == expected, "Batch outcome should match verify_proof()");
+    }
+
+    TEST_ASSERT(!results[3] && !results[10] && !results[20], "Broken entries should be reported invalid");
+    TEST_ASSERT(verify_proofs_batch(root, (const unsigned char (*)[HASH_SIZE])leaf_hashes,
+                                    (const merkle_proof_t *const *)proofs, 0, NULL) == MERKLE_SUCCESS,
+                "Empty batch should succeed");
+    TEST_ASSERT(verify_proofs_batch(NULL, (const unsigned char (*)[HASH_SIZE])leaf_hashes,
+                                    (const merkle_proof_t *const *)proofs, count, NULL) == MERKLE_NULL_ARG,
+                "NULL root should be rejected");
+
+    proofs[3] = saved;
+    for (size_t i = 0; i < count; i++) {
+        release_test_proof(proofs[i]);
+    }
+
+    dealloc_merkle_tree(tree);
+    TEST_PASS();
+}
+
+/**
+ * @brief Generates a multiproof for @p indices and verifies it against @p tree's root.
+ */
+static int check_multiproof(merkle_tree_t *tree, const void **data, const size_t *sizes,
+                            const size_t *indices, size_t count, size_t *hash_count) {
+    unsigned char root[HASH_SIZE];
+    unsigned char (*leaf_hashes)[HASH_SIZE] = malloc(count * HASH_SIZE);
+    TEST_ASSERT(leaf_hashes != NULL, "Test allocation should succeed");
+    TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS, "Should get root");
+
+    for (size_t i = 0; i < count; i++) {
+        SHA256(data[indices[i]], sizes[indices[i]], leaf_hashes[i]);
+    }
+
+    merkle_multiproof_t *proof = NULL;
+    TEST_ASSERT(generate_multiproof(tree, indices, count, &proof) == MERKLE_SUCCESS,
+                "Multiproof generation should succeed");
+    merkle_error_t verified = verify_multiproof(root, indices, (const unsigned char (*)[HASH_SIZE])leaf_hashes,
+                                                count, proof);
+    *hash_count = merkle_multiproof_hash_count(proof);
+
+    dealloc_merkle_multiproof(proof);
+    free(leaf_hashes);
+    TEST_ASSERT(verified == MERKLE_SUCCESS, "Multiproof should verify");
+    return 1;
+}
+
+/**
+ * @brief Multiproofs verify for assorted leaf sets on both layouts.
+ */
+static int test_multiproof_roundtrip(void) {
+    enum { leaves = 100 };
+    const size_t factors[] = {2, 3, 4};
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    size_t all[leaves];
+    for (size_t i = 0; i < leaves; i++) {
+        all[i] = leaves - 1 - i;
+    }
+
+    const size_t single[] = {57};
+    const size_t scattered[] = {99, 3, 42, 3, 0, 77, 64, 42};
+    const size_t range[] = {20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30};
+
+    for (size_t f = 0; f < 3; f++) {
+        for (size_t l = 0; l < 2; l++) {
+            merkle_tree_t *tree = create_tree_with_layout(data, sizes, leaves, factors[f], layouts[l]);
+            TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+            size_t hash_count = 0;
+
+            int ok = check_multiproof(tree, data, sizes, all, leaves, &hash_count) && hash_count == 0;
+            ok = ok && check_multiproof(tree, data, sizes, scattered, 8, &hash_count);
+            ok = ok && check_multiproof(tree, data, sizes, range, 11, &hash_count);
+
+            // A single leaf needs exactly the hashes of its ordinary proof
+            merkle_proof_t *plain = NULL;
+            ok = ok && check_multiproof(tree, data, sizes, single, 1, &hash_count);
+            ok = ok && generate_proof_from_index(tree, single[0], &plain) == MERKLE_SUCCESS;
+
+            size_t plain_count = 0;
+            for (size_t j = 0; ok && j < plain->path_length; j++) {
+                plain_count += plain->path[j]->sibling_count;
+            }
+
+            release_test_proof(plain);
+            dealloc_merkle_tree(tree);
+            TEST_ASSERT(ok && plain_count == hash_count, "Multiproofs should verify with the expected size");
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief A clustered range shares nearly every upper-level hash.
+ */
+static int test_multiproof_compact(void) {
+    enum { leaves = 1024, cluster = 64 };
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    merkle_tree_t *tree = create_merkle_tree(data, sizes, leaves, 2);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+
+    size_t indices[cluster];
+    for (size_t i = 0; i < cluster; i++) {
+        indices[i] = 256 + i;
+    }
+
+    // An aligned 2^6 block only needs one sibling per level above it
+    size_t hash_count = 0;
+    int ok = check_multiproof(tree, data, sizes, indices, cluster, &hash_count);
+    dealloc_merkle_tree(tree);
+
+    TEST_ASSERT(ok, "Clustered multiproof should verify");
+    TEST_ASSERT(hash_count == 4, "Clustered multiproof should carry one hash per upper level");
+    TEST_PASS();
+}
+
+/**
+ * @brief Multiproofs are rejected for the wrong leaves, hashes or root.
+ */
+static int test_multiproof_rejects_mismatch(void) {
+    enum { leaves = 30 };
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    merkle_tree_t *tree = create_merkle_tree(data, sizes, leaves, 3);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+    unsigned char root[HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS, "Should get root");
+
+    size_t indices[] = {2, 9, 10, 29};
+    unsigned char leaf_hashes[5][HASH_SIZE];
+    for (size_t i = 0; i < 4; i++) {
+        SHA256(data[indices[i]], sizes[indices[i]], leaf_hashes[i]);
+    }
+
+    merkle_multiproof_t *proof = NULL;
+    size_t bad_index = leaves;
+    TEST_ASSERT(generate_multiproof(tree, &bad_index, 1, &proof) == MERKLE_INVALID_INDEX,
+                "Out of range index should be rejected");
+    TEST_ASSERT(generate_multiproof(tree, indices, 0, &proof) == MERKLE_BAD_ARG, "Empty set should be rejected");
+    TEST_ASSERT(generate_multiproof(tree, indices, 4, &proof) == MERKLE_SUCCESS, "Generation should succeed");
+
+    const unsigned char (*hashes)[HASH_SIZE] = (const unsigned char (*)[HASH_SIZE])leaf_hashes;
+    TEST_ASSERT(verify_multiproof(root, indices, hashes, 4, proof) == MERKLE_SUCCESS, "Genuine proof should verify");
+    TEST_ASSERT(verify_multiproof(root, indices, hashes, 3, proof) == MERKLE_PROOF_INVALID,
+                "Missing leaf should be rejected");
+
+    // Repeating a leaf is fine only with the same hash
+    size_t repeated[] = {29, 2, 9, 10, 2};
+    unsigned char repeated_hashes[5][HASH_SIZE];
+    memcpy(repeated_hashes[0], leaf_hashes[3], HASH_SIZE);
+    memcpy(repeated_hashes[1], leaf_hashes[0], HASH_SIZE);
+    memcpy(repeated_hashes[2], leaf_hashes[1], HASH_SIZE);
+    memcpy(repeated_hashes[3], leaf_hashes[2], HASH_SIZE);
+    memcpy(repeated_hashes[4], leaf_hashes[0], HASH_SIZE);
+    TEST_ASSERT(verify_multiproof(root, repeated, (const unsigned char (*)[HASH_SIZE])repeated_hashes, 5, proof) ==
+                    MERKLE_SUCCESS, "Reordered and repeated leaves should verify");
+    repeated_hashes[4][0] ^= 0x01;
+    TEST_ASSERT(verify_multiproof(root, repeated, (const unsigned char (*)[HASH_SIZE])repeated_hashes, 5, proof) ==
+                    MERKLE_PROOF_INVALID, "Conflicting repeated leaf should be rejected");
+
+    size_t shifted[] = {2, 9, 11, 29};
+    TEST_ASSERT(verify_multiproof(root, shifted, hashes, 4, proof) == MERKLE_PROOF_INVALID,
+                "Different leaf set should be rejected");
+
+    leaf_hashes[1][5] ^= 0x01;
+    TEST_ASSERT(verify_multiproof(root, indices, hashes, 4, proof) == MERKLE_PROOF_INVALID,
+                "Wrong leaf hash should be rejected");
+    leaf_hashes[1][5] ^= 0x01;
+
+    proof->hashes[proof->hash_count - 1][0] ^= 0x01;
+    TEST_ASSERT(verify_multiproof(root, indices, hashes, 4, proof) == MERKLE_PROOF_INVALID,
+                "Altered sibling should be rejected");
+    proof->hashes[proof->hash_count - 1][0] ^= 0x01;
+
+    proof->hash_count--;
+    TEST_ASSERT(verify_multiproof(root, indices, hashes, 4, proof) == MERKLE_PROOF_INVALID,
+                "Truncated proof should be rejected");
+    proof->hash_count++;
+
+    TEST_ASSERT(verify_multiproof(NULL, indices, hashes, 4, proof) == MERKLE_NULL_ARG, "NULL root should be rejected");
+    TEST_ASSERT(verify_multiproof(root, indices, hashes, 4, proof) == MERKLE_SUCCESS, "Restored proof should verify");
+
+    dealloc_merkle_multiproof(proof);
+    dealloc_merkle_tree(tree);
+    TEST_PASS();
+}
+
+/**
+ * @brief Serialized proofs of every leaf verify on both layouts.
+ */
+static int test_proof_buffer_roundtrip(void) {
+    enum { leaves = 40 };
+    const size_t factors[] = {2, 3, 5};
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    for (size_t f = 0; f < 3; f++) {
+        for (size_t l = 0; l < 2; l++) {
+            merkle_tree_t *tree = create_tree_with_layout(data, sizes, leaves, factors[f], layouts[l]);
+            TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+            unsigned char root[HASH_SIZE];
+            TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS, "Should get root");
+
+            size_t capacity = 0;
+            TEST_ASSERT(merkle_proof_max_size(tree, &capacity) == MERKLE_SUCCESS, "Should get max proof size");
+            unsigned char *buffer = malloc(capacity);
+            TEST_ASSERT(buffer != NULL, "Test allocation should succeed");
+
+            for (size_t i = 0; i < leaves; i++) {
+                unsigned char leaf_hash[HASH_SIZE];
+                size_t written = 0;
+                size_t queried = 0;
+                SHA256(data[i], sizes[i], leaf_hash);
+
+                TEST_ASSERT(generate_proof_into(tree, i, NULL, 0, &queried) == MERKLE_BAD_LEN,
+                            "Size query should report a short buffer");
+                TEST_ASSERT(generate_proof_into(tree, i, buffer, capacity, &written) == MERKLE_SUCCESS,
+                            "Serialization should succeed");
+                TEST_ASSERT(written == queried && written <= capacity, "Size query should match the proof");
+                TEST_ASSERT(verify_proof_buffer(root, leaf_hash, buffer, written) == MERKLE_SUCCESS,
+                            "Serialized proof should verify");
+
+                SHA256(data[(i + 1) % leaves], sizes[(i + 1) % leaves], leaf_hash);
+                TEST_ASSERT(verify_proof_buffer(root, leaf_hash, buffer, written) == MERKLE_PROOF_INVALID,
+                            "Serialized proof should not verify another leaf");
+            }
+
+            free(buffer);
+            dealloc_merkle_tree(tree);
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Malformed or altered proof buffers are rejected.
+ */
+static int test_proof_buffer_rejects_tampering(void) {
+    const void *data[11];
+    size_t sizes[11];
+    unsigned long long storage[11];
+    create_unique_test_data(data, sizes, storage, 11);
+
+    merkle_tree_t *tree = create_merkle_tree(data, sizes, 11, 3);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+    unsigned char root[HASH_SIZE];
+    unsigned char leaf_hash[HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS, "Should get root");
+    SHA256(data[7], sizes[7], leaf_hash);
+
+    unsigned char buffer[512];
+    size_t written = 0;
+    TEST_ASSERT(generate_proof_into(tree, 11, buffer, sizeof(buffer), &written) == MERKLE_INVALID_INDEX,
+                "Out of range leaf should be rejected");
+    TEST_ASSERT(generate_proof_into(tree, 7, buffer, 40, &written) == MERKLE_BAD_LEN,
+                "Short buffer should be rejected");
+    TEST_ASSERT(generate_proof_into(tree, 7, buffer, sizeof(buffer), NULL) == MERKLE_NULL_ARG,
+                "NULL size output should be rejected");
+    TEST_ASSERT(generate_proof_into(tree, 7, buffer, sizeof(buffer), &written) == MERKLE_SUCCESS,
+                "Serialization should succeed");
+    TEST_ASSERT(verify_proof_buffer(root, leaf_hash, buffer, written) == MERKLE_SUCCESS, "Genuine proof should verify");
+
+    TEST_ASSERT(verify_proof_buffer(root, leaf_hash, buffer, written - 1) == MERKLE_PROOF_INVALID,
+                "Truncated buffer should be rejected");
+    TEST_ASSERT(verify_proof_buffer(root, leaf_hash, buffer, written + 1) == MERKLE_PROOF_INVALID,
+                "Trailing bytes should be rejected");
+    TEST_ASSERT(verify_proof_buffer(root, leaf_hash, buffer, 10) == MERKLE_PROOF_INVALID,
+                "Partial header should be rejected");
+    TEST_ASSERT(verify_proof_buffer(root, NULL, buffer, written) == MERKLE_NULL_ARG,
+                "NULL leaf hash should be rejected");
+
+    // Magic, version, hash id, leaf index, a level record and a sibling hash
+    const size_t offsets[] = {0, 4, 5, 8, 36, written - 1};
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        buffer[offsets[i]] ^= 0x01;
+        TEST_ASSERT(verify_proof_buffer(root, leaf_hash, buffer, written) == MERKLE_PROOF_INVALID,
+                    "Altered byte should be rejected");
+        buffer[offsets[i]] ^= 0x01;
+    }
+
+    TEST_ASSERT(verify_proof_buffer(root, leaf_hash, buffer, written) == MERKLE_SUCCESS, "Restored proof should verify");
+
+    dealloc_merkle_tree(tree);
+    TEST_PASS();
+}
+
 /**
  * @brief Main test runner.
  */
+/**
+ * @brief Reserves a fresh temporary file path.
+ */
+static int make_temp_path(char path[32]) {
+    strcpy(path, "/tmp/merkle_test_XXXXXX");
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        return 0;
+    }
+
+    close(fd);
+    return 1;
+}
+
+static int test_mmap_tree_roundtrip(void) {
+    enum { leaves = 57 };
+    const size_t factors[] = {2, 3, 4, 7};
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+    char path[32];
+    TEST_ASSERT(make_temp_path(path), "Temporary file should be created");
+
+    for (size_t f = 0; f < 4; f++) {
+        for (size_t l = 0; l < 2; l++) {
+            merkle_tree_t *tree = create_tree_with_layout(data, sizes, leaves, factors[f], layouts[l]);
+            TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+            TEST_ASSERT(save_merkle_tree(tree, path) == MERKLE_SUCCESS, "Saving should succeed");
+
+            merkle_tree_t *mapped = open_merkle_tree_mmap(path);
+            TEST_ASSERT(mapped != NULL, "Saved tree should open");
+
+            unsigned char root[HASH_SIZE];
+            unsigned char mapped_root[HASH_SIZE];
+            TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS, "Should get root");
+            TEST_ASSERT(get_tree_hash(mapped, mapped_root) == MERKLE_SUCCESS, "Should get mapped root");
+            TEST_ASSERT(memcmp(root, mapped_root, HASH_SIZE) == 0, "Mapped root should match");
+
+            for (size_t i = 0; i < leaves; i++) {
+                unsigned char leaf_hash[HASH_SIZE];
+                merkle_proof_t *proof = NULL;
+                SHA256(data[i], sizes[i], leaf_hash);
+
+                TEST_ASSERT(generate_proof_from_index(mapped, i, &proof) == MERKLE_SUCCESS,
+                            "Mapped proof generation should succeed");
+                TEST_ASSERT(verify_proof(root, leaf_hash, proof) == MERKLE_SUCCESS,
+                            "Mapped proof should verify");
+                release_test_proof(proof);
+            }
+
+            // A mapped tree saves back to the same file contents
+            char copy[32];
+            TEST_ASSERT(make_temp_path(copy), "Temporary file should be created");
+            TEST_ASSERT(save_merkle_tree(mapped, copy) == MERKLE_SUCCESS, "Saving a mapped tree should succeed");
+            merkle_tree_t *reopened = open_merkle_tree_mmap(copy);
+            TEST_ASSERT(reopened != NULL, "Copy should open");
+            TEST_ASSERT(get_tree_hash(reopened, mapped_root) == MERKLE_SUCCESS, "Should get copy root");
+            TEST_ASSERT(memcmp(root, mapped_root, HASH_SIZE) == 0, "Copy root should match");
+            dealloc_merkle_tree(reopened);
+            unlink(copy);
+
+            dealloc_merkle_tree(mapped);
+            dealloc_merkle_tree(tree);
+        }
+    }
+
+    unlink(path);
+    TEST_PASS();
+}
+
+static int test_mmap_tree_rejects_bad_files(void) {
+    enum { leaves = 10 };
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+    char path[32];
+    TEST_ASSERT(make_temp_path(path), "Temporary file should be created");
+
+    merkle_tree_t *tree = create_tree_with_layout(data, sizes, leaves, 3, MERKLE_LAYOUT_FLAT);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+    TEST_ASSERT(save_merkle_tree(tree, path) == MERKLE_SUCCESS, "Saving should succeed");
+    TEST_ASSERT(save_merkle_tree(NULL, path) == MERKLE_NULL_ARG, "NULL tree should be rejected");
+    TEST_ASSERT(save_merkle_tree(tree, "/nonexistent/dir/tree") == MERKLE_IO_ERROR,
+                "Unwritable path should be rejected");
+    dealloc_merkle_tree(tree);
+
+    FILE *file = fopen(path, "rb");
+    TEST_ASSERT(file != NULL, "Saved file should be readable");
+    unsigned char contents[2048];
+    size_t length = fread(contents, 1, sizeof(contents), file);
+    fclose(file);
+    TEST_ASSERT(length > 64 && length < sizeof(contents), "Saved file should hold the whole tree");
+
+    // Each variant breaks one part of the header or the size check
+    struct { size_t offset; size_t length; unsigned char flip; } variants[] = {
+        {0, length, 0x01},      // wrong magic
+        {4, length, 0x01},      // wrong version
+        {5, length, 0x40},      // unknown hash algorithm
+        {16, length, 0x01},     // leaf count does not match the file size
+        {24, length, 0x01},     // level count does not match the shape
+        {0, length - 1, 0x01},  // truncated
+        {0, 32, 0x01},          // header only partly present
+    };
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        unsigned char corrupt[2048];
+        memcpy(corrupt, contents, length);
+
+        if (variants[v].length == length) {
+            corrupt[variants[v].offset] ^= variants[v].flip;
+        }
+
+        file = fopen(path, "wb");
+        TEST_ASSERT(file != NULL, "Corrupt file should be writable");
+        fwrite(corrupt, 1, variants[v].length, file);
+        fclose(file);
+        TEST_ASSERT(open_merkle_tree_mmap(path) == NULL, "Corrupt file should be rejected");
+    }
+
+    unlink(path);
+    TEST_ASSERT(open_merkle_tree_mmap(path) == NULL, "Missing file should be rejected");
+    TEST_ASSERT(open_merkle_tree_mmap(NULL) == NULL, "NULL path should be rejected");
+    TEST_PASS();
+}
+
+static int test_mmap_tree_is_read_only(void) {
+    enum { leaves = 9 };
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+    char path[32];
+    TEST_ASSERT(make_temp_path(path), "Temporary file should be created");
+
+    merkle_tree_t *tree = create_tree_with_layout(data, sizes, leaves, 2, MERKLE_LAYOUT_POINTER);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+    TEST_ASSERT(save_merkle_tree(tree, path) == MERKLE_SUCCESS, "Saving should succeed");
+    dealloc_merkle_tree(tree);
+
+    merkle_tree_t *mapped = open_merkle_tree_mmap(path);
+    TEST_ASSERT(mapped != NULL, "Saved tree should open");
+
+    const char *block = "replacement";
+    TEST_ASSERT(update_leaf(mapped, 3, block, strlen(block)) == MERKLE_BAD_ARG,
+                "Mapped trees should reject updates");
+
+    merkle_proof_t *proof = NULL;
+    size_t path_length = 0;
+    TEST_ASSERT(generate_proof_by_finder(mapped, test_value_finder, &path_length, &proof) == MERKLE_BAD_ARG,
+                "Mapped trees keep no data to search");
+
+    dealloc_merkle_tree(mapped);
+    unlink(path);
+    TEST_PASS();
+}
+
+/**
+ * @brief Allocator state for the allocator hook tests.
+ */
+typedef struct counting_allocator {
+    atomic_size_t allocs; /**< Successful allocations. */
+    atomic_size_t frees;  /**< Released blocks. */
+    size_t fail_after;    /**< Allocations allowed before failing (SIZE_MAX never fails). */
+} counting_allocator_t;
+
+static void *counting_alloc(size_t size, void *ctx) {
+    counting_allocator_t *counter = ctx;
+
+    if (atomic_load(&counter->allocs) >= counter->fail_after) {
+        return NULL;
+    }
+
+    void *block = malloc(size);
+
+    if (block) {
+        atomic_fetch_add(&counter->allocs, 1);
+    }
+
+    return block;
+}
+
+static void counting_free(void *ptr, void *ctx) {
+    counting_allocator_t *counter = ctx;
+    atomic_fetch_add(&counter->frees, 1);
+    free(ptr);
+}
+
+static void install_counting_allocator(counting_allocator_t *counter, size_t fail_after) {
+    atomic_init(&counter->allocs, 0);
+    atomic_init(&counter->frees, 0);
+    counter->fail_after = fail_after;
+    merkle_allocator_t allocator = { counting_alloc, counting_free, counter };
+    merkle_set_allocator(&allocator);
+}
+
+static int test_custom_allocator_hook(void) {
+    enum { leaves = 5000 };
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    merkle_allocator_t partial = { counting_alloc, NULL, NULL };
+    TEST_ASSERT(merkle_set_allocator(&partial) == MERKLE_BAD_ARG, "Allocator without free should be rejected");
+
+    counting_allocator_t counter;
+    install_counting_allocator(&counter, SIZE_MAX);
+    merkle_tree_t *tree = create_tree_with_layout(data, sizes, leaves, 3, MERKLE_LAYOUT_POINTER);
+    size_t live = atomic_load(&counter.allocs) - atomic_load(&counter.frees);
+
+    unsigned char root[HASH_SIZE];
+    merkle_proof_t *proof = NULL;
+    bool built = tree && get_tree_hash(tree, root) == MERKLE_SUCCESS &&
+                 generate_proof_from_index(tree, 1234, &proof) == MERKLE_SUCCESS;
+    release_test_proof(proof);
+    dealloc_merkle_tree(tree);
+    merkle_set_allocator(NULL);
+
+    TEST_ASSERT(built, "Tree should build through the custom allocator");
+    TEST_ASSERT(atomic_load(&counter.allocs) > 0, "Library memory should come from the hook");
+    TEST_ASSERT(atomic_load(&counter.allocs) == atomic_load(&counter.frees), "Every block should be returned");
+    TEST_ASSERT(live < 10, "A pointer-layout tree should hold a handful of blocks, not one per node");
+    TEST_PASS();
+}
+
+static int test_allocator_failures_leak_nothing(void) {
+    enum { leaves = 300 };
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    for (size_t l = 0; l < 2; l++) {
+        merkle_tree_t *tree = NULL;
+
+        // Fail each allocation of the build in turn until one budget is enough
+        for (size_t budget = 0; !tree; budget++) {
+            counting_allocator_t counter;
+            install_counting_allocator(&counter, budget);
+            tree = create_tree_with_layout(data, sizes, leaves, 4, layouts[l]);
+
+            if (tree) {
+                counter.fail_after = SIZE_MAX;
+                TEST_ASSERT(update_leaf(tree, 7, "new", 3) == MERKLE_SUCCESS, "Update should succeed");
+                dealloc_merkle_tree(tree);
+            }
+
+            merkle_set_allocator(NULL);
+            TEST_ASSERT(atomic_load(&counter.allocs) == atomic_load(&counter.frees),
+                        "Failed builds should release everything they allocated");
+            TEST_ASSERT(budget < 1000, "Build should eventually fit its budget");
+        }
+    }
+
+    TEST_PASS();
+}
+
+static int test_ring_queue_wraps_and_grows(void) {
+    enum { total = 100 };
+    size_t values[total];
+    queue_t *queue = init_queue_with_capacity(4);
+    TEST_ASSERT(queue != NULL, "Queue creation should succeed");
+
+    for (size_t i = 0; i < total; i++) {
+        values[i] = i;
+    }
+
+    // Interleave pushes and pops so the head wraps before every growth
+    size_t pushed = 0;
+    size_t popped = 0;
+
+    while (popped < total) {
+        for (size_t k = 0; k < 3 && pushed < total; k++) {
+            TEST_ASSERT(push_queue(queue, &values[pushed++]) == QUEUE_OK, "Push should succeed");
+        }
+
+        TEST_ASSERT(back_queue(queue) == &values[pushed - 1], "Back should be the last push");
+        TEST_ASSERT(front_queue(queue) == &values[popped], "Front should be the oldest element");
+        TEST_ASSERT(pop_queue(queue) == &values[popped], "Pop should return elements in order");
+        popped++;
+
+        if (pushed == total) {
+            // Drain the rest through slices, which stop at the buffer's end
+            while (get_queue_size(queue)) {
+                size_t count = 7;
+                void **slice = NULL;
+                TEST_ASSERT(deque_n(queue, &count, &slice) == QUEUE_OK, "Slice should succeed");
+                TEST_ASSERT(count > 0 && count <= 7, "Slice should hold up to the requested count");
+
+                for (size_t k = 0; k < count; k++) {
+                    TEST_ASSERT(slice[k] == &values[popped++], "Slice should preserve order");
+                }
+            }
+        }
+    }
+
+    TEST_ASSERT(pop_queue(queue) == NULL && front_queue(queue) == NULL, "Drained queue should be empty");
+    free_queue(queue, NULL);
+    TEST_PASS();
+}
+
+/**
+ * @brief Shared state of the snapshot read test.
+ */
+typedef struct snapshot_test_data {
+    merkle_tree_t *tree;               /**< Tree updated by the writer. */
+    unsigned char roots[2][HASH_SIZE]; /**< Roots of the two versions the writer toggles between. */
+    unsigned char leaf[2][HASH_SIZE];  /**< Hash of the toggled leaf in each version. */
+    atomic_bool stop;                  /**< Set once the writer is done. */
+    atomic_int inconsistent;           /**< Reads that matched neither version. */
+} snapshot_test_data_t;
+
+enum { SNAPSHOT_LEAVES = 64, SNAPSHOT_TOGGLED = 5 };
+
+static void *snapshot_reader(void *arg) {
+    snapshot_test_data_t *shared = arg;
+    unsigned char buffer[2048];
+
+    while (!atomic_load(&shared->stop)) {
+        unsigned char root[HASH_SIZE];
+
+        if (get_tree_hash(shared->tree, root) != MERKLE_SUCCESS ||
+            (memcmp(root, shared->roots[0], HASH_SIZE) != 0 && memcmp(root, shared->roots[1], HASH_SIZE) != 0)) {
+            atomic_fetch_add(&shared->inconsistent, 1);
+        }
+
+        // A proof of the toggled leaf must belong entirely to one version
+        size_t written = 0;
+
+        if (generate_proof_into(shared->tree, SNAPSHOT_TOGGLED, buffer, sizeof(buffer), &written) != MERKLE_SUCCESS ||
+            (verify_proof_buffer(shared->roots[0], shared->leaf[0], buffer, written) != MERKLE_SUCCESS &&
+             verify_proof_buffer(shared->roots[1], shared->leaf[1], buffer, written) != MERKLE_SUCCESS)) {
+            atomic_fetch_add(&shared->inconsistent, 1);
+        }
+
+        merkle_proof_t *proof = NULL;
+
+        if (generate_proof_from_index(shared->tree, SNAPSHOT_TOGGLED, &proof) != MERKLE_SUCCESS ||
+            (verify_proof(shared->roots[0], shared->leaf[0], proof) != MERKLE_SUCCESS &&
+             verify_proof(shared->roots[1], shared->leaf[1], proof) != MERKLE_SUCCESS)) {
+            atomic_fetch_add(&shared->inconsistent, 1);
+        }
+
+        release_test_proof(proof);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Readers racing a writer only ever observe whole published versions.
+ */
+static int test_snapshot_reads_during_updates(void) {
+    enum { readers = 4, toggles = 2000 };
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const char *versions[2] = {"version-a", "version-b"};
+    const void *data[SNAPSHOT_LEAVES];
+    size_t sizes[SNAPSHOT_LEAVES];
+    unsigned long long storage[SNAPSHOT_LEAVES];
+    create_unique_test_data(data, sizes, storage, SNAPSHOT_LEAVES);
+
+    for (size_t l = 0; l < 2; l++) {
+        snapshot_test_data_t shared;
+        atomic_init(&shared.stop, false);
+        atomic_init(&shared.inconsistent, 0);
+
+        for (size_t v = 0; v < 2; v++) {
+            data[SNAPSHOT_TOGGLED] = versions[v];
+            sizes[SNAPSHOT_TOGGLED] = strlen(versions[v]);
+            merkle_tree_t *reference = create_tree_with_layout(data, sizes, SNAPSHOT_LEAVES, 3, layouts[l]);
+            TEST_ASSERT(reference != NULL, "Reference tree should build");
+            get_tree_hash(reference, shared.roots[v]);
+            dealloc_merkle_tree(reference);
+            SHA256((const unsigned char *)versions[v], sizes[SNAPSHOT_TOGGLED], shared.leaf[v]);
+        }
+
+        shared.tree = create_tree_with_layout(data, sizes, SNAPSHOT_LEAVES, 3, layouts[l]);
+        TEST_ASSERT(shared.tree != NULL, "Tree creation should succeed");
+
+        pthread_t threads[readers];
+
+        for (int i = 0; i < readers; i++) {
+            TEST_ASSERT(pthread_create(&threads[i], NULL, snapshot_reader, &shared) == 0,
+                        "Thread creation should succeed");
+        }
+
+        bool updated = true;
+
+        for (int t = 0; t < toggles && updated; t++) {
+            const char *next = versions[t % 2];
+            updated = update_leaf(shared.tree, SNAPSHOT_TOGGLED, next, strlen(next)) == MERKLE_SUCCESS;
+        }
+
+        atomic_store(&shared.stop, true);
+
+        for (int i = 0; i < readers; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        dealloc_merkle_tree(shared.tree);
+        TEST_ASSERT(updated, "Updates should succeed while readers run");
+        TEST_ASSERT(atomic_load(&shared.inconsistent) == 0, "Every read should match a published version");
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Checks that @p tree has the root and proofs of a fresh build over the same leaves.
+ */
+static int check_tree_version(merkle_tree_t *tree, const void **data, const size_t *sizes, size_t count, size_t bf) {
+    unsigned char expected[HASH_SIZE];
+    unsigned char root[HASH_SIZE];
+    merkle_tree_t *fresh = create_merkle_tree(data, sizes, count, bf);
+    TEST_ASSERT(fresh != NULL, "Reference tree should build");
+    get_tree_hash(fresh, expected);
+    dealloc_merkle_tree(fresh);
+
+    TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS, "Should get version root");
+    TEST_ASSERT(memcmp(root, expected, HASH_SIZE) == 0, "Version root should match a fresh build");
+
+    for (size_t i = 0; i < count; i += 7) {
+        unsigned char leaf[HASH_SIZE];
+        unsigned char buffer[4096];
+        size_t written = 0;
+        merkle_proof_t *proof = NULL;
+        SHA256(data[i], sizes[i], leaf);
+
+        TEST_ASSERT(generate_proof_from_index(tree, i, &proof) == MERKLE_SUCCESS, "Proof generation should succeed");
+        merkle_error_t verified = verify_proof(root, leaf, proof);
+        release_test_proof(proof);
+        TEST_ASSERT(verified == MERKLE_SUCCESS, "Version proof should verify");
+
+        TEST_ASSERT(generate_proof_into(tree, i, buffer, sizeof(buffer), &written) == MERKLE_SUCCESS,
+                    "Serialized proof generation should succeed");
+        TEST_ASSERT(verify_proof_buffer(root, leaf, buffer, written) == MERKLE_SUCCESS,
+                    "Serialized version proof should verify");
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Derived versions have the hashes of a rebuild and leave their source intact.
+ */
+static int test_derive_versions(void) {
+    enum { leaves = 100 };
+    const size_t factors[] = {2, 3, 5, 17, 64};
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    const size_t changed[] = {42, 7, 99, 42};
+    const void *blocks[] = {"stale", "seven", "last", "Target"};
+    const size_t block_sizes[] = {5, 5, 4, 6};
+
+    for (size_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+        create_unique_test_data(data, sizes, storage, leaves);
+        merkle_tree_t *base = create_merkle_tree(data, sizes, leaves, factors[f]);
+        TEST_ASSERT(base != NULL, "Tree creation should succeed");
+
+        // Duplicate indices keep their last entry, as with update_leaves()
+        merkle_tree_t *v1 = derive_merkle_tree(base, changed, blocks, block_sizes, 4);
+        TEST_ASSERT(v1 != NULL, "Derive should succeed");
+        TEST_ASSERT(check_tree_version(base, data, sizes, leaves, factors[f]), "Source should keep its hashes");
+
+        const void *v1_data[leaves];
+        size_t v1_sizes[leaves];
+        memcpy(v1_data, data, sizeof(data));
+        memcpy(v1_sizes, sizes, sizeof(sizes));
+
+        for (size_t k = 1; k < 4; k++) {
+            v1_data[changed[k]] = blocks[k];
+            v1_sizes[changed[k]] = block_sizes[k];
+        }
+
+        TEST_ASSERT(check_tree_version(v1, v1_data, v1_sizes, leaves, factors[f]), "Version should match a rebuild");
+
+        // Versions keep their own copy of the new leaves
+        size_t path_length = 0;
+        merkle_proof_t *proof = NULL;
+        TEST_ASSERT(generate_proof_by_finder(v1, test_value_finder, &path_length, &proof) == MERKLE_SUCCESS &&
+                    proof && proof->leaf_index == 42, "Finder should see the version's leaves");
+        release_test_proof(proof);
+
+        size_t hash_count = 0;
+        const size_t indices[] = {0, 7, 8, 42, 99};
+        TEST_ASSERT(check_multiproof(v1, v1_data, v1_sizes, indices, 5, &hash_count), "Version multiproof should verify");
+
+        // Versions of versions, released out of order
+        size_t index = 0;
+        const void *block = "first";
+        size_t block_size = 5;
+        merkle_tree_t *v2 = derive_merkle_tree(v1, &index, &block, &block_size, 1);
+        TEST_ASSERT(v2 != NULL, "Derive from a version should succeed");
+        dealloc_merkle_tree(base);
+        dealloc_merkle_tree(v1);
+
+        v1_data[0] = block;
+        v1_sizes[0] = block_size;
+        TEST_ASSERT(check_tree_version(v2, v1_data, v1_sizes, leaves, factors[f]),
+                    "Version should outlive the trees it derives from");
+        dealloc_merkle_tree(v2);
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Proofs of wide pointer-layout trees read siblings that stay in step with in-place updates.
+ */
+static int test_wide_pointer_proofs_after_update(void) {
+    enum { leaves = 300 };
+    const size_t factors[] = {17, 64};
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    const size_t changed[] = {0, 63, 64, 150, 299};
+    const void *blocks[] = {"first", "edge", "next", "middle", "last"};
+    const size_t block_sizes[] = {5, 4, 4, 6, 4};
+
+    for (size_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+        create_unique_test_data(data, sizes, storage, leaves);
+        merkle_tree_t *tree = create_merkle_tree(data, sizes, leaves, factors[f]);
+        TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+        TEST_ASSERT(check_tree_version(tree, data, sizes, leaves, factors[f]), "Fresh tree should verify");
+
+        TEST_ASSERT(update_leaves(tree, changed, blocks, block_sizes, 5) == MERKLE_SUCCESS, "Update should succeed");
+
+        for (size_t k = 0; k < 5; k++) {
+            data[changed[k]] = blocks[k];
+            sizes[changed[k]] = block_sizes[k];
+        }
+
+        TEST_ASSERT(check_tree_version(tree, data, sizes, leaves, factors[f]), "Updated tree should match a rebuild");
+        dealloc_merkle_tree(tree);
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Deriving freezes the source, and failed or unsupported derives change nothing.
+ */
+static int test_derive_freezes_source(void) {
+    enum { leaves = 16 };
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    merkle_tree_t *tree = create_merkle_tree(data, sizes, leaves, 2);
+    merkle_tree_t *flat = create_tree_with_layout(data, sizes, leaves, 2, MERKLE_LAYOUT_FLAT);
+    TEST_ASSERT(tree != NULL && flat != NULL, "Tree creation should succeed");
+
+    size_t index = 3;
+    size_t bad_index = leaves;
+    const void *block = "new";
+    size_t block_size = 3;
+    TEST_ASSERT(derive_merkle_tree(flat, &index, &block, &block_size, 1) == NULL, "Flat trees cannot be versioned");
+    TEST_ASSERT(derive_merkle_tree(tree, &bad_index, &block, &block_size, 1) == NULL, "Bad index should fail");
+    TEST_ASSERT(derive_merkle_tree(tree, &index, &block, &block_size, 0) == NULL, "Empty derive should fail");
+    TEST_ASSERT(update_leaf(tree, index, block, block_size) == MERKLE_SUCCESS,
+                "A failed derive should leave the tree updatable");
+
+    merkle_tree_t *version = derive_merkle_tree(tree, &index, &block, &block_size, 1);
+    TEST_ASSERT(version != NULL, "Derive should succeed");
+    TEST_ASSERT(update_leaf(tree, 1, block, block_size) == MERKLE_BAD_ARG, "Source should be frozen");
+    TEST_ASSERT(update_leaf(version, 1, block, block_size) == MERKLE_BAD_ARG, "Versions should be immutable");
+
+    unsigned char a[HASH_SIZE];
+    unsigned char b[HASH_SIZE];
+    get_tree_hash(tree, a);
+    get_tree_hash(version, b);
+    TEST_ASSERT(memcmp(a, b, HASH_SIZE) == 0, "Rewriting a leaf with its data should keep the root");
+
+    dealloc_merkle_tree(version);
+    dealloc_merkle_tree(tree);
+    dealloc_merkle_tree(flat);
+    TEST_PASS();
+}
+
+/**
+ * @brief A version allocates one block per node on the changed path, whatever the tree size.
+ */
+static int test_derive_costs_the_path_only(void) {
+    enum { leaves = 1 << 14, versions = 32 };
+    const void **data = malloc(leaves * sizeof(*data));
+    size_t *sizes = malloc(leaves * sizeof(*sizes));
+    unsigned long long *storage = malloc(leaves * sizeof(*storage));
+    TEST_ASSERT(data && sizes && storage, "Test allocation should succeed");
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    counting_allocator_t counter;
+    install_counting_allocator(&counter, SIZE_MAX);
+    merkle_tree_t *history[versions + 1];
+    history[0] = create_merkle_tree(data, sizes, leaves, 2);
+    bool derived = history[0] != NULL;
+    size_t before = atomic_load(&counter.allocs);
+
+    for (size_t v = 1; v <= versions && derived; v++) {
+        size_t index = (v * 977) % leaves;
+        const void *block = &storage[v];
+        size_t block_size = sizeof(storage[v]);
+        history[v] = derive_merkle_tree(history[v - 1], &index, &block, &block_size, 1);
+        derived = history[v] != NULL;
+    }
+
+    size_t per_version = (atomic_load(&counter.allocs) - before) / versions;
+
+    for (size_t v = 0; derived && v <= versions; v++) {
+        dealloc_merkle_tree(history[v]);
+    }
+
+    merkle_set_allocator(NULL);
+    free(storage);
+    free(sizes);
+    free(data);
+
+    TEST_ASSERT(derived, "Every version should derive");
+    TEST_ASSERT(atomic_load(&counter.allocs) == atomic_load(&counter.frees), "Every version should be released");
+    // The 15 nodes from leaf to root, the tree handle and the update scratch
+    TEST_ASSERT(per_version <= 15 + 3, "A version should only allocate its changed path");
+    TEST_PASS();
+}
+
+/**
+ * @brief Checks that @p key proves leaf @p expected of @p tree.
+ */
+static int check_proof_by_key(merkle_tree_t *tree, const void *key, size_t key_size, size_t expected,
+                              const void *leaf_data, size_t leaf_size) {
+    unsigned char root[HASH_SIZE];
+    unsigned char leaf[HASH_SIZE];
+    merkle_proof_t *proof = NULL;
+    get_tree_hash(tree, root);
+    SHA256(leaf_data, leaf_size, leaf);
+
+    TEST_ASSERT(generate_proof_by_key(tree, key, key_size, &proof) == MERKLE_SUCCESS, "Key lookup should succeed");
+    bool matches = proof->leaf_index == expected && verify_proof(root, leaf, proof) == MERKLE_SUCCESS;
+    release_test_proof(proof);
+    TEST_ASSERT(matches, "Key lookup should prove the expected leaf");
+    return 1;
+}
+
+/**
+ * @brief Leaf-hash indexes find leaves by content and follow updates.
+ */
+static int test_proof_by_leaf_hash_index(void) {
+    enum { leaves = 1000 };
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    // Leaf 900 repeats leaf 300, the lower one is proven
+    data[900] = data[300];
+
+    for (size_t l = 0; l < 2; l++) {
+        merkle_config_t config;
+        merkle_config_init(&config);
+        config.branching_factor = 4;
+        config.layout = layouts[l];
+        config.leaf_index = MERKLE_INDEX_LEAF_HASH;
+        merkle_tree_t *tree = create_merkle_tree_ex(data, sizes, leaves, &config);
+        TEST_ASSERT(tree != NULL, "Indexed tree creation should succeed");
+
+        for (size_t i = 0; i < leaves; i += 37) {
+            TEST_ASSERT(check_proof_by_key(tree, data[i], sizes[i], i, data[i], sizes[i]), "Every leaf should be found");
+        }
+
+        TEST_ASSERT(check_proof_by_key(tree, data[900], sizes[900], 300, data[300], sizes[300]),
+                    "Duplicate content should prove the lowest leaf");
+
+        merkle_proof_t *proof = NULL;
+        TEST_ASSERT(generate_proof_by_key(tree, "absent", 6, &proof) == MERKLE_NOT_FOUND && !proof,
+                    "Unknown content should not be found");
+        TEST_ASSERT(generate_proof_by_key(tree, "absent", 0, &proof) == MERKLE_BAD_ARG, "Empty key should be rejected");
+
+        // The index follows updates: the old content is gone, the new one is filed
+        const void *old = data[10];
+        TEST_ASSERT(update_leaf(tree, 10, "fresh", 5) == MERKLE_SUCCESS, "Update should succeed");
+        TEST_ASSERT(generate_proof_by_key(tree, old, sizes[10], &proof) == MERKLE_NOT_FOUND,
+                    "Replaced content should be gone");
+        TEST_ASSERT(check_proof_by_key(tree, "fresh", 5, 10, "fresh", 5), "New content should be found");
+        TEST_ASSERT(update_leaf(tree, 300, "fresh", 5) == MERKLE_SUCCESS, "Update should succeed");
+        TEST_ASSERT(check_proof_by_key(tree, data[900], sizes[900], 900, data[900], sizes[900]),
+                    "The remaining duplicate should take over");
+        dealloc_merkle_tree(tree);
+    }
+
+    merkle_tree_t *plain = create_merkle_tree(data, sizes, leaves, 2);
+    merkle_proof_t *proof = NULL;
+    TEST_ASSERT(generate_proof_by_key(plain, data[1], sizes[1], &proof) == MERKLE_BAD_ARG,
+                "Trees without an index should reject key lookups");
+    dealloc_merkle_tree(plain);
+    TEST_PASS();
+}
+
+/**
+ * @brief Keys records by the text before '=', records without one stay unindexed.
+ */
+static bool record_key(const void *data, size_t size, const void **key, size_t *key_size, void *ctx) {
+    const char *separator = memchr(data, '=', size);
+    (void)ctx;
+
+    if (!separator) {
+        return false;
+    }
+
+    *key = data;
+    *key_size = (size_t)(separator - (const char *)data);
+    return true;
+}
+
+/**
+ * @brief Extracted-key indexes find records by key, in parallel builds and after updates.
+ */
+static int test_proof_by_extracted_key(void) {
+    enum { leaves = 5000 };
+    static char records[leaves][24];
+    const void *data[leaves];
+    size_t sizes[leaves];
+
+    for (size_t i = 0; i < leaves; i++) {
+        // Every tenth record has no key
+        int length = i % 10 == 9 ? snprintf(records[i], sizeof(records[i]), "loose-%zu", i)
+                                 : snprintf(records[i], sizeof(records[i]), "k%zu=v%zu", i, i * 7);
+        data[i] = records[i];
+        sizes[i] = (size_t)length;
+    }
+
+    merkle_thread_pool_t *pool = merkle_thread_pool_create(4);
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.thread_pool = pool;
+    config.leaf_index = MERKLE_INDEX_KEY;
+
+    TEST_ASSERT(create_merkle_tree_ex(data, sizes, leaves, &config) == NULL, "A key index needs an extractor");
+    config.key_extractor = record_key;
+    merkle_tree_t *tree = create_merkle_tree_ex(data, sizes, leaves, &config);
+    merkle_thread_pool_destroy(pool);
+    TEST_ASSERT(tree != NULL, "Indexed tree creation should succeed");
+
+    TEST_ASSERT(check_proof_by_key(tree, "k4321", 5, 4321, data[4321], sizes[4321]), "Key should be found");
+    TEST_ASSERT(check_proof_by_key(tree, "k0", 2, 0, data[0], sizes[0]), "First key should be found");
+
+    merkle_proof_t *proof = NULL;
+    TEST_ASSERT(generate_proof_by_key(tree, "loose-19", 8, &proof) == MERKLE_NOT_FOUND,
+                "Records without a key should not be indexed");
+
+    // Rewriting a value keeps the key, replacing the key moves it
+    const size_t indices[] = {4321, 17};
+    const void *blocks[] = {"k4321=changed", "moved=x"};
+    const size_t block_sizes[] = {13, 7};
+    TEST_ASSERT(update_leaves(tree, indices, blocks, block_sizes, 2) == MERKLE_SUCCESS, "Update should succeed");
+    TEST_ASSERT(check_proof_by_key(tree, "k4321", 5, 4321, blocks[0], block_sizes[0]),
+                "Key should prove the new record");
+    TEST_ASSERT(check_proof_by_key(tree, "moved", 5, 17, blocks[1], block_sizes[1]), "New key should be found");
+    TEST_ASSERT(generate_proof_by_key(tree, "k17", 3, &proof) == MERKLE_NOT_FOUND, "Replaced key should be gone");
+
+    TEST_ASSERT(update_leaf(tree, 17, "unkeyed", 7) == MERKLE_SUCCESS, "Update should succeed");
+    TEST_ASSERT(generate_proof_by_key(tree, "moved", 5, &proof) == MERKLE_NOT_FOUND,
+                "A record losing its key should leave the index");
+
+    dealloc_merkle_tree(tree);
+    TEST_PASS();
+}
+
+static bool find_marked(void *value) {
+    return ((const unsigned char *)value)[0] == 0xAB;
+}
+
+/**
+ * @brief Parallel finder scans return the lowest match, like the serial one.
+ */
+static int test_parallel_finder(void) {
+    enum { leaves = 20000 };
+    static unsigned char blocks[leaves][8];
+    const void *data[leaves];
+    size_t sizes[leaves];
+    const size_t targets[] = {0, 1023, 1024, 17000, leaves - 1};
+
+    for (size_t i = 0; i < leaves; i++) {
+        memcpy(blocks[i], &i, sizeof(i) < 8 ? sizeof(i) : 8);
+        blocks[i][0] = 0;
+        blocks[i][1] = (unsigned char)(i >> 8) ^ 0x5A;
+        data[i] = blocks[i];
+        sizes[i] = sizeof(blocks[i]);
+    }
+
+    merkle_thread_pool_t *pool = merkle_thread_pool_create(4);
+    TEST_ASSERT(pool != NULL, "Pool creation should succeed");
+    merkle_tree_t *tree = create_tree_with_layout(data, sizes, leaves, 2, MERKLE_LAYOUT_FLAT);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+
+    merkle_proof_t *proof = NULL;
+    TEST_ASSERT(generate_proof_by_finder_parallel(tree, find_marked, pool, &proof) == MERKLE_NOT_FOUND && !proof,
+                "A scan without match should report it");
+
+    for (size_t t = 0; t < sizeof(targets) / sizeof(targets[0]); t++) {
+        // Mark the target and a later leaf; the earlier one must win
+        size_t after = (targets[t] + 5000) % leaves;
+        const unsigned char marked = 0xAB;
+        const size_t indices[] = {targets[t], after};
+        const unsigned char marked_blocks[2][8] = {{marked, 1}, {marked, 2}};
+        const void *updates[] = {marked_blocks[0], marked_blocks[1]};
+        const size_t update_sizes[] = {8, 8};
+        TEST_ASSERT(update_leaves(tree, indices, updates, update_sizes, 2) == MERKLE_SUCCESS, "Update should succeed");
+
+        size_t expected = after < targets[t] ? after : targets[t];
+        TEST_ASSERT(generate_proof_by_finder_parallel(tree, find_marked, pool, &proof) == MERKLE_SUCCESS,
+                    "Parallel scan should find the marked leaf");
+        bool lowest = proof->leaf_index == expected;
+        release_test_proof(proof);
+        TEST_ASSERT(lowest, "Parallel scan should return the lowest match");
+
+        size_t path_length = 0;
+        TEST_ASSERT(generate_proof_by_finder(tree, find_marked, &path_length, &proof) == MERKLE_SUCCESS &&
+                    proof->leaf_index == expected, "Serial scan should agree");
+        release_test_proof(proof);
+
+        const void *restore[] = {data[targets[t]], data[after]};
+        TEST_ASSERT(update_leaves(tree, indices, restore, update_sizes, 2) == MERKLE_SUCCESS, "Restore should succeed");
+    }
+
+    dealloc_merkle_tree(tree);
+    merkle_thread_pool_destroy(pool);
+    TEST_PASS();
+}
+
+/**
+ * @brief Runs the level-by-level diff of @p local against @p remote.
+ *
+ * @p remote plays the peer that only answers merkle_tree_level_hashes()
+ * queries; @p exchanged counts the hashes it sent.
+ */
+static merkle_error_t run_remote_diff(merkle_tree_t *local, merkle_tree_t *remote, size_t **leaves, size_t *count,
+                                      size_t *exchanged) {
+    size_t level = merkle_tree_level_count(local);
+    size_t root = 0;
+    size_t *nodes = &root;
+    size_t node_count = 1;
+    merkle_error_t err = MERKLE_SUCCESS;
+    *exchanged = 0;
+
+    for (;;) {
+        unsigned char (*hashes)[HASH_SIZE] = malloc(node_count * HASH_SIZE);
+        size_t *next = NULL;
+        size_t next_count = 0;
+
+        err = hashes ? merkle_tree_level_hashes(remote, level, nodes, node_count, hashes) : MERKLE_FAILED_MEM_ALLOC;
+
+        if (err == MERKLE_SUCCESS) {
+            *exchanged += node_count;
+            err = merkle_tree_diff_level(local, level, nodes, (const unsigned char (*)[HASH_SIZE])hashes,
+                                         node_count, &next, &next_count);
+        }
+
+        free(hashes);
+
+        if (nodes != &root) {
+            dealloc_merkle_diff(nodes);
+        }
+
+        if (err != MERKLE_SUCCESS || level == 0 || next_count == 0) {
+            *leaves = next;
+            *count = next_count;
+            return err;
+        }
+
+        nodes = next;
+        node_count = next_count;
+        level--;
+    }
+}
+
+/**
+ * @brief Diffs report exactly the changed leaves, across layouts.
+ */
+static int test_tree_diff(void) {
+    enum { leaves = 1000 };
+    static unsigned long long storage[leaves];
+    static unsigned long long changed_storage[leaves];
+    const void *data[leaves];
+    const void *changed[leaves];
+    size_t sizes[leaves];
+    const size_t indices[] = {0, 5, 6, 500, 998, 999};
+    const size_t index_count = sizeof(indices) / sizeof(indices[0]);
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+
+    create_unique_test_data(data, sizes, storage, leaves);
+    memcpy(changed, data, sizeof(data));
+
+    for (size_t i = 0; i < index_count; i++) {
+        changed_storage[i] = ~storage[indices[i]];
+        changed[indices[i]] = &changed_storage[i];
+    }
+
+    for (size_t la = 0; la < 2; la++) {
+        for (size_t lb = 0; lb < 2; lb++) {
+            merkle_tree_t *a = create_tree_with_layout(data, sizes, leaves, 3, layouts[la]);
+            merkle_tree_t *b = create_tree_with_layout(changed, sizes, leaves, 3, layouts[lb]);
+            TEST_ASSERT(a && b, "Tree creation should succeed");
+
+            size_t *diff = NULL;
+            size_t count = 0;
+            TEST_ASSERT(merkle_tree_diff(a, a, &diff, &count) == MERKLE_SUCCESS && count == 0 && !diff,
+                        "A tree should not differ from itself");
+            TEST_ASSERT(merkle_tree_diff(a, b, &diff, &count) == MERKLE_SUCCESS, "Diff should succeed");
+            bool exact = count == index_count && memcmp(diff, indices, sizeof(indices)) == 0;
+            dealloc_merkle_diff(diff);
+            TEST_ASSERT(exact, "Diff should list the changed leaves in order");
+
+            dealloc_merkle_tree(a);
+            dealloc_merkle_tree(b);
+        }
+    }
+
+    // Versions share their unchanged subtrees with the source
+    merkle_tree_t *base = create_tree_with_layout(data, sizes, leaves, 3, MERKLE_LAYOUT_POINTER);
+    TEST_ASSERT(base != NULL, "Tree creation should succeed");
+    const void *updates[] = {changed[500], changed[5]};
+    const size_t update_indices[] = {500, 5};
+    const size_t update_sizes[] = {sizes[500], sizes[5]};
+    merkle_tree_t *version = derive_merkle_tree(base, update_indices, updates, update_sizes, 2);
+    TEST_ASSERT(version != NULL, "Derive should succeed");
+
+    size_t *diff = NULL;
+    size_t count = 0;
+    TEST_ASSERT(merkle_tree_diff(version, base, &diff, &count) == MERKLE_SUCCESS && count == 2 &&
+                diff[0] == 5 && diff[1] == 500, "Diff against the source should list the derived leaves");
+    dealloc_merkle_diff(diff);
+
+    dealloc_merkle_tree(version);
+    dealloc_merkle_tree(base);
+    TEST_PASS();
+}
+
+/**
+ * @brief Trees of different shapes cannot be diffed.
+ */
+static int test_tree_diff_rejects_shape_mismatch(void) {
+    unsigned long long storage[64];
+    const void *data[64];
+    size_t sizes[64];
+    create_unique_test_data(data, sizes, storage, 64);
+
+    merkle_tree_t *a = create_tree_with_layout(data, sizes, 64, 2, MERKLE_LAYOUT_FLAT);
+    merkle_tree_t *b = create_tree_with_layout(data, sizes, 63, 2, MERKLE_LAYOUT_FLAT);
+    merkle_tree_t *c = create_tree_with_layout(data, sizes, 64, 4, MERKLE_LAYOUT_FLAT);
+    TEST_ASSERT(a && b && c, "Tree creation should succeed");
+
+    size_t *diff = NULL;
+    size_t count = 0;
+    TEST_ASSERT(merkle_tree_diff(a, b, &diff, &count) == MERKLE_BAD_ARG, "Leaf counts must match");
+    TEST_ASSERT(merkle_tree_diff(a, c, &diff, &count) == MERKLE_BAD_ARG, "Branching factors must match");
+    TEST_ASSERT(merkle_tree_diff(a, NULL, &diff, &count) == MERKLE_NULL_ARG, "NULL trees should be rejected");
+
+    unsigned char hash[HASH_SIZE];
+    size_t node = 32;
+    TEST_ASSERT(merkle_tree_level_hashes(a, 1, &node, 1, &hash) == MERKLE_INVALID_INDEX,
+                "Nodes outside the level should be rejected");
+    TEST_ASSERT(merkle_tree_level_hashes(a, merkle_tree_level_count(a) + 1, &node, 0, &hash) == MERKLE_BAD_ARG,
+                "Levels above the root should be rejected");
+    TEST_ASSERT(merkle_tree_leaf_count(a) == 64 && merkle_tree_level_count(a) == 6 &&
+                merkle_tree_level_count(c) == 3, "Shape accessors should report the tree's shape");
+
+    dealloc_merkle_tree(a);
+    dealloc_merkle_tree(b);
+    dealloc_merkle_tree(c);
+    TEST_PASS();
+}
+
+/**
+ * @brief The level-by-level protocol finds the local diff's leaves with few hashes.
+ */
+static int test_remote_tree_diff(void) {
+    enum { leaves = 4096 };
+    static unsigned long long storage[leaves];
+    static unsigned long long changed_storage[3];
+    const void *data[leaves];
+    const void *changed[leaves];
+    size_t sizes[leaves];
+    const size_t indices[] = {17, 2048, 4095};
+
+    create_unique_test_data(data, sizes, storage, leaves);
+    memcpy(changed, data, sizeof(data));
+
+    for (size_t i = 0; i < 3; i++) {
+        changed_storage[i] = ~storage[indices[i]];
+        changed[indices[i]] = &changed_storage[i];
+    }
+
+    merkle_tree_t *local = create_tree_with_layout(data, sizes, leaves, 4, MERKLE_LAYOUT_POINTER);
+    merkle_tree_t *remote = create_tree_with_layout(changed, sizes, leaves, 4, MERKLE_LAYOUT_FLAT);
+    TEST_ASSERT(local && remote, "Tree creation should succeed");
+
+    size_t *diff = NULL;
+    size_t count = 0;
+    size_t exchanged = 0;
+    TEST_ASSERT(run_remote_diff(local, remote, &diff, &count, &exchanged) == MERKLE_SUCCESS,
+                "Remote diff should succeed");
+    bool exact = count == 3 && memcmp(diff, indices, sizeof(indices)) == 0;
+    dealloc_merkle_diff(diff);
+    TEST_ASSERT(exact, "Remote diff should list the changed leaves");
+
+    // Root plus bf hashes per level and difference: 1 + 3 * 6 * 4
+    TEST_ASSERT(exchanged <= 1 + 3 * merkle_tree_level_count(local) * 4, "Only differing subtrees should be sent");
+
+    TEST_ASSERT(run_remote_diff(local, local, &diff, &count, &exchanged) == MERKLE_SUCCESS && count == 0 &&
+                !diff && exchanged == 1, "Equal trees should agree after the root");
+
+    dealloc_merkle_tree(local);
+    dealloc_merkle_tree(remote);
+    TEST_PASS();
+}
+
+/**
+ * @brief Proves leaves [@p first, @p last] of @p tree and verifies the proof.
+ */
+static int check_range_proof(merkle_tree_t *tree, const void **data, const size_t *sizes, size_t first,
+                             size_t last, size_t *hash_count) {
+    size_t count = last - first + 1;
+    unsigned char root[HASH_SIZE];
+    unsigned char (*leaf_hashes)[HASH_SIZE] = malloc(count * HASH_SIZE);
+    TEST_ASSERT(leaf_hashes != NULL, "Test allocation should succeed");
+    TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS, "Should get root");
+
+    for (size_t i = 0; i < count; i++) {
+        SHA256(data[first + i], sizes[first + i], leaf_hashes[i]);
+    }
+
+    merkle_range_proof_t *proof = NULL;
+    TEST_ASSERT(generate_range_proof(tree, first, last, &proof) == MERKLE_SUCCESS,
+                "Range proof generation should succeed");
+    merkle_error_t verified = verify_range_proof(root, first, (const unsigned char (*)[HASH_SIZE])leaf_hashes,
+                                                 count, proof);
+    *hash_count = merkle_range_proof_hash_count(proof);
+
+    dealloc_merkle_range_proof(proof);
+    free(leaf_hashes);
+    TEST_ASSERT(verified == MERKLE_SUCCESS, "Range proof should verify");
+    return 1;
+}
+
+/**
+ * @brief Range proofs verify on both layouts and carry only the edge siblings.
+ */
+static int test_range_proof_roundtrip(void) {
+    enum { leaves = 100 };
+    const size_t factors[] = {2, 3, 4};
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const size_t ranges[][2] = {{0, 99}, {57, 57}, {0, 0}, {99, 99}, {20, 30}, {1, 98}, {64, 99}, {13, 77}};
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    for (size_t f = 0; f < 3; f++) {
+        for (size_t l = 0; l < 2; l++) {
+            merkle_tree_t *tree = create_tree_with_layout(data, sizes, leaves, factors[f], layouts[l]);
+            TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+
+            for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+                size_t first = ranges[r][0];
+                size_t last = ranges[r][1];
+                size_t indices[leaves];
+
+                for (size_t i = first; i <= last; i++) {
+                    indices[i - first] = i;
+                }
+
+                // The edges are exactly what a multiproof of the range ships
+                size_t range_count = 0;
+                size_t multi_count = 0;
+                int ok = check_range_proof(tree, data, sizes, first, last, &range_count);
+                ok = ok && check_multiproof(tree, data, sizes, indices, last - first + 1, &multi_count);
+                TEST_ASSERT(ok && range_count == multi_count, "Range proof should match the multiproof's size");
+                TEST_ASSERT(range_count <= 2 * (factors[f] - 1) * merkle_tree_level_count(tree),
+                            "Range proof should need at most two edges per level");
+            }
+
+            dealloc_merkle_tree(tree);
+        }
+    }
+
+    // A single-leaf tree proves its only leaf with no hashes at all
+    merkle_tree_t *single = create_merkle_tree(data, sizes, 1, 2);
+    size_t hash_count = 1;
+    TEST_ASSERT(single && check_range_proof(single, data, sizes, 0, 0, &hash_count) && hash_count == 0,
+                "Single leaf range should verify without hashes");
+    dealloc_merkle_tree(single);
+    TEST_PASS();
+}
+
+/**
+ * @brief Range proofs are rejected for other ranges, leaves or roots.
+ */
+static int test_range_proof_rejects_mismatch(void) {
+    enum { leaves = 50 };
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    merkle_tree_t *tree = create_merkle_tree(data, sizes, leaves, 3);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+
+    merkle_range_proof_t *proof = NULL;
+    TEST_ASSERT(generate_range_proof(tree, 30, 29, &proof) == MERKLE_BAD_ARG && !proof,
+                "Reversed ranges should be rejected");
+    TEST_ASSERT(generate_range_proof(tree, 10, leaves, &proof) == MERKLE_INVALID_INDEX && !proof,
+                "Ranges past the last leaf should be rejected");
+    TEST_ASSERT(generate_range_proof(tree, 10, 19, &proof) == MERKLE_SUCCESS, "Generation should succeed");
+
+    unsigned char root[HASH_SIZE];
+    unsigned char hashes[11][HASH_SIZE];
+    TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS, "Should get root");
+
+    for (size_t i = 0; i < 11; i++) {
+        SHA256(data[9 + i], sizes[9 + i], hashes[i]);
+    }
+
+    const unsigned char (*range)[HASH_SIZE] = (const unsigned char (*)[HASH_SIZE])hashes + 1;
+    int ok = verify_range_proof(root, 10, range, 10, proof) == MERKLE_SUCCESS;
+    ok = ok && verify_range_proof(root, 9, (const unsigned char (*)[HASH_SIZE])hashes, 10, proof) ==
+               MERKLE_PROOF_INVALID;
+    ok = ok && verify_range_proof(root, 10, range, 9, proof) == MERKLE_PROOF_INVALID;
+    ok = ok && verify_range_proof(root, 10, range, 0, proof) == MERKLE_BAD_ARG;
+
+    hashes[5][0] ^= 1;
+    ok = ok && verify_range_proof(root, 10, range, 10, proof) == MERKLE_PROOF_INVALID;
+    hashes[5][0] ^= 1;
+
+    root[HASH_SIZE - 1] ^= 1;
+    ok = ok && verify_range_proof(root, 10, range, 10, proof) == MERKLE_PROOF_INVALID;
+
+    dealloc_merkle_range_proof(proof);
+    dealloc_merkle_tree(tree);
+    TEST_ASSERT(ok, "Range proofs should only verify their own range and root");
+    TEST_PASS();
+}
+
+/**
+ * @brief BLAKE3 digest of @p size bytes, as the tree computes it.
+ */
+static void blake3_digest(const void *data, size_t size, unsigned char digest[HASH_SIZE]) {
+    merkle_blake3_t state;
+    merkle_blake3_init(&state);
+    merkle_blake3_update(&state, data, size);
+    merkle_blake3_final(&state, digest);
+}
+
+/**
+ * @brief The portable BLAKE3 matches the official test vectors.
+ */
+static int test_blake3_vectors(void) {
+    static const struct { size_t length; const char *hex; } vectors[] = {
+        {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+        {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+        {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+        {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+        {2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+    };
+    static unsigned char input[4096];
+
+    // The official vectors hash the repeating byte pattern 0, 1, ..., 250
+    for (size_t i = 0; i < sizeof(input); i++) {
+        input[i] = (unsigned char)(i % 251);
+    }
+
+    for (size_t v = 0; v < sizeof(vectors) / sizeof(vectors[0]); v++) {
+        unsigned char digest[HASH_SIZE];
+        char hex[2 * HASH_SIZE + 1];
+        blake3_digest(input, vectors[v].length, digest);
+
+        for (size_t i = 0; i < HASH_SIZE; i++) {
+            snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+        }
+
+        TEST_ASSERT(strcmp(hex, vectors[v].hex) == 0, "BLAKE3 digest should match the test vector");
+
+        // Feeding the input in odd pieces must not change the digest
+        merkle_blake3_t state;
+        unsigned char pieces[HASH_SIZE];
+        merkle_blake3_init(&state);
+
+        for (size_t i = 0; i < vectors[v].length; i += 7) {
+            merkle_blake3_update(&state, input + i, vectors[v].length - i < 7 ? vectors[v].length - i : 7);
+        }
+
+        merkle_blake3_final(&state, pieces);
+        TEST_ASSERT(memcmp(pieces, digest, HASH_SIZE) == 0, "Incremental BLAKE3 should match one-shot");
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief BLAKE3 trees hash every node with BLAKE3 and their proofs say so.
+ */
+static int test_blake3_tree(void) {
+    enum { leaves = 45 };
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    // Root of a 3-leaf binary tree worked out by hand: the odd leaf is rehashed alone
+    unsigned char leaf_hashes[3][HASH_SIZE];
+    unsigned char pair[HASH_SIZE];
+    unsigned char lone[HASH_SIZE];
+    unsigned char expected[2 * HASH_SIZE];
+    unsigned char root[HASH_SIZE];
+
+    for (size_t i = 0; i < 3; i++) {
+        blake3_digest(data[i], sizes[i], leaf_hashes[i]);
+    }
+
+    blake3_digest(leaf_hashes[0], 2 * HASH_SIZE, pair);
+    blake3_digest(leaf_hashes[2], HASH_SIZE, lone);
+    memcpy(expected, pair, HASH_SIZE);
+    memcpy(expected + HASH_SIZE, lone, HASH_SIZE);
+    blake3_digest(expected, 2 * HASH_SIZE, expected);
+
+    for (size_t l = 0; l < 2; l++) {
+        merkle_config_t config;
+        merkle_config_init(&config);
+        config.layout = layouts[l];
+        config.hash = MERKLE_HASH_BLAKE3;
+
+        merkle_tree_t *small = create_merkle_tree_ex(data, sizes, 3, &config);
+        TEST_ASSERT(small && get_tree_hash(small, root) == MERKLE_SUCCESS, "BLAKE3 tree should build");
+        TEST_ASSERT(memcmp(root, expected, HASH_SIZE) == 0, "BLAKE3 root should match the hand-computed one");
+        dealloc_merkle_tree(small);
+
+        config.branching_factor = 3;
+        merkle_tree_t *tree = create_merkle_tree_ex(data, sizes, leaves, &config);
+        merkle_tree_t *sha = create_tree_with_layout(data, sizes, leaves, 3, layouts[l]);
+        unsigned char sha_root[HASH_SIZE];
+        TEST_ASSERT(tree && sha, "Tree creation should succeed");
+        TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS && get_tree_hash(sha, sha_root) == MERKLE_SUCCESS,
+                    "Should get roots");
+        TEST_ASSERT(memcmp(root, sha_root, HASH_SIZE) != 0, "Algorithms should give different roots");
+
+        unsigned char leaf_hash[HASH_SIZE];
+        blake3_digest(data[17], sizes[17], leaf_hash);
+
+        merkle_proof_t *proof = NULL;
+        merkle_proof_t *sha_proof = NULL;
+        TEST_ASSERT(generate_proof_from_index(tree, 17, &proof) == MERKLE_SUCCESS &&
+                    generate_proof_from_index(sha, 17, &sha_proof) == MERKLE_SUCCESS, "Proofs should generate");
+        TEST_ASSERT(verify_proof(root, leaf_hash, proof) == MERKLE_SUCCESS, "BLAKE3 proof should verify");
+
+        // A batch under one root only accepts proofs of that root's algorithm
+        const merkle_proof_t *batch[] = {proof, sha_proof};
+        unsigned char batch_leaves[2][HASH_SIZE];
+        bool results[2];
+        memcpy(batch_leaves[0], leaf_hash, HASH_SIZE);
+        memcpy(batch_leaves[1], leaf_hash, HASH_SIZE);
+        TEST_ASSERT(verify_proofs_batch(root, (const unsigned char (*)[HASH_SIZE])batch_leaves, batch, 2, results) ==
+                    MERKLE_PROOF_INVALID && results[0] && !results[1], "Mixed batches should reject the odd proof");
+        release_test_proof(proof);
+        release_test_proof(sha_proof);
+
+        unsigned char wire[1024];
+        size_t written = 0;
+        TEST_ASSERT(generate_proof_into(tree, 17, wire, sizeof(wire), &written) == MERKLE_SUCCESS &&
+                    verify_proof_buffer(root, leaf_hash, wire, written) == MERKLE_SUCCESS,
+                    "Serialized BLAKE3 proof should verify");
+
+        merkle_range_proof_t *range = NULL;
+        unsigned char range_leaves[5][HASH_SIZE];
+        for (size_t i = 0; i < 5; i++) {
+            blake3_digest(data[15 + i], sizes[15 + i], range_leaves[i]);
+        }
+        TEST_ASSERT(generate_range_proof(tree, 15, 19, &range) == MERKLE_SUCCESS &&
+                    verify_range_proof(root, 15, (const unsigned char (*)[HASH_SIZE])range_leaves, 5, range) ==
+                    MERKLE_SUCCESS, "BLAKE3 range proof should verify");
+        dealloc_merkle_range_proof(range);
+
+        // Updates rehash with the tree's algorithm
+        unsigned long long replacement = 42;
+        const void *block = &replacement;
+        size_t block_size = sizeof(replacement);
+        const void *updated[leaves];
+        memcpy(updated, data, sizeof(data));
+        updated[30] = block;
+        merkle_tree_t *fresh = create_merkle_tree_ex(updated, sizes, leaves, &config);
+        unsigned char fresh_root[HASH_SIZE];
+        TEST_ASSERT(fresh && update_leaf(tree, 30, block, block_size) == MERKLE_SUCCESS, "Update should succeed");
+        TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS && get_tree_hash(fresh, fresh_root) == MERKLE_SUCCESS &&
+                    memcmp(root, fresh_root, HASH_SIZE) == 0, "Updated root should match a fresh build");
+
+        dealloc_merkle_tree(fresh);
+        dealloc_merkle_tree(sha);
+        dealloc_merkle_tree(tree);
+    }
+
+    // The streaming builder and saved files carry the algorithm too
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.hash = MERKLE_HASH_BLAKE3;
+    config.layout = MERKLE_LAYOUT_FLAT;
+    merkle_tree_t *tree = create_merkle_tree_ex(data, sizes, leaves, &config);
+    merkle_builder_t *builder = merkle_builder_init_hash(2, MERKLE_HASH_BLAKE3);
+    unsigned char built[HASH_SIZE];
+    TEST_ASSERT(tree && builder && get_tree_hash(tree, root) == MERKLE_SUCCESS, "Tree and builder should start");
+    TEST_ASSERT(merkle_builder_append_n(builder, data, sizes, leaves) == MERKLE_SUCCESS &&
+                merkle_builder_finalize(builder, built) == MERKLE_SUCCESS && memcmp(built, root, HASH_SIZE) == 0,
+                "BLAKE3 builder should match the tree");
+    merkle_builder_destroy(builder);
+
+    char path[32];
+    TEST_ASSERT(make_temp_path(path) && save_merkle_tree(tree, path) == MERKLE_SUCCESS, "Saving should succeed");
+    merkle_tree_t *mapped = open_merkle_tree_mmap(path);
+    unlink(path);
+    TEST_ASSERT(mapped != NULL, "Saved BLAKE3 tree should open");
+
+    unsigned char leaf_hash[HASH_SIZE];
+    merkle_proof_t *proof = NULL;
+    blake3_digest(data[3], sizes[3], leaf_hash);
+    TEST_ASSERT(generate_proof_from_index(mapped, 3, &proof) == MERKLE_SUCCESS &&
+                verify_proof(root, leaf_hash, proof) == MERKLE_SUCCESS, "Mapped BLAKE3 proof should verify");
+    release_test_proof(proof);
+
+    dealloc_merkle_tree(mapped);
+    dealloc_merkle_tree(tree);
+    TEST_PASS();
+}
+
+/**
+ * @brief Custom context: SHA-256 over a one-byte domain tag and the message.
+ */
+static void tagged_init(void *ctx) {
+    const unsigned char tag = 0x7A;
+    merkle_sha256_init(ctx);
+    merkle_sha256_update(ctx, &tag, 1);
+}
+
+static void tagged_update(void *ctx, const void *data, size_t len) {
+    merkle_sha256_update(ctx, data, len);
+}
+
+static void tagged_final(void *ctx, unsigned char *digest) {
+    merkle_sha256_final(ctx, digest);
+}
+
+/**
+ * @brief Registered algorithms build trees and verify their proofs.
+ */
+static int test_custom_hash_registration(void) {
+    static const merkle_hash_vtable_t tagged = {
+        "tagged-sha256", HASH_SIZE, sizeof(merkle_sha256_ctx_t), tagged_init, tagged_update, tagged_final, NULL
+    };
+    merkle_hash_vtable_t wide = tagged;
+    wide.digest_size = 64;
+    const merkle_hash_id_t id = (merkle_hash_id_t)200;
+
+    TEST_ASSERT(merkle_hash_get(MERKLE_HASH_SHA256) && merkle_hash_get(MERKLE_HASH_BLAKE3),
+                "Built-in algorithms should be known");
+    TEST_ASSERT(merkle_hash_get(id) == NULL, "Unregistered identifiers should be unknown");
+    TEST_ASSERT(merkle_hash_register(MERKLE_HASH_BLAKE3, &tagged) == MERKLE_BAD_ARG,
+                "Built-in identifiers should be reserved");
+    TEST_ASSERT(merkle_hash_register((merkle_hash_id_t)256, &tagged) == MERKLE_BAD_ARG,
+                "Identifiers must fit one byte");
+    TEST_ASSERT(merkle_hash_register(id, &wide) == MERKLE_BAD_ARG, "Digests must be HASH_SIZE bytes");
+    TEST_ASSERT(merkle_hash_register(id, NULL) == MERKLE_NULL_ARG, "NULL vtables should be rejected");
+
+    const void *data[10];
+    size_t sizes[10];
+    unsigned long long storage[10];
+    create_unique_test_data(data, sizes, storage, 10);
+
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.hash = id;
+    TEST_ASSERT(create_merkle_tree_ex(data, sizes, 10, &config) == NULL,
+                "Trees should not build with an unknown algorithm");
+
+    TEST_ASSERT(merkle_hash_register(id, &tagged) == MERKLE_SUCCESS, "Registration should succeed");
+    TEST_ASSERT(merkle_hash_get(id) == &tagged, "The registered vtable should be returned");
+    TEST_ASSERT(merkle_hash_register(id, &tagged) == MERKLE_BAD_ARG, "Registrations should not be replaced");
+
+    merkle_tree_t *tree = create_merkle_tree_ex(data, sizes, 10, &config);
+    TEST_ASSERT(tree != NULL, "Tree with a registered algorithm should build");
+
+    unsigned char root[HASH_SIZE];
+    unsigned char leaf_hash[HASH_SIZE];
+    merkle_sha256_ctx_t ctx;
+    tagged_init(&ctx);
+    tagged_update(&ctx, data[6], sizes[6]);
+    tagged_final(&ctx, leaf_hash);
+
+    merkle_proof_t *proof = NULL;
+    TEST_ASSERT(get_tree_hash(tree, root) == MERKLE_SUCCESS &&
+                generate_proof_from_index(tree, 6, &proof) == MERKLE_SUCCESS, "Proof should generate");
+    TEST_ASSERT(verify_proof(root, leaf_hash, proof) == MERKLE_SUCCESS, "Custom algorithm proof should verify");
+    release_test_proof(proof);
+
+    dealloc_merkle_tree(tree);
+    TEST_PASS();
+}
+
+/** Marker handler that must survive trusted builds untouched. */
+static void trusted_marker_handler(int sig) {
+    (void)sig;
+}
+
+/**
+ * @brief Trusted input builds and updates like guarded input, without touching signal handlers.
+ */
+static int test_trusted_input(void) {
+    enum { leaves = 2500 };
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    struct sigaction marker, previous, seen;
+    memset(&marker, 0, sizeof(marker));
+    marker.sa_handler = trusted_marker_handler;
+    sigemptyset(&marker.sa_mask);
+    TEST_ASSERT(sigaction(SIGSEGV, &marker, &previous) == 0, "Installing the marker should succeed");
+
+    merkle_thread_pool_t *pool = merkle_thread_pool_create(3);
+    TEST_ASSERT(pool != NULL, "Pool creation should succeed");
+
+    for (size_t l = 0; l < 2; l++) {
+        merkle_config_t config;
+        merkle_config_init(&config);
+        config.branching_factor = 3;
+        config.layout = layouts[l];
+        config.leaf_index = MERKLE_INDEX_LEAF_HASH;
+        merkle_tree_t *guarded = create_merkle_tree_ex(data, sizes, leaves, &config);
+
+        config.input_check = MERKLE_INPUT_TRUSTED;
+        merkle_tree_t *serial = create_merkle_tree_ex(data, sizes, leaves, &config);
+        config.thread_pool = pool;
+        merkle_tree_t *parallel = create_merkle_tree_ex(data, sizes, leaves, &config);
+
+        TEST_ASSERT(guarded && serial && parallel, "Builds should succeed");
+        TEST_ASSERT(sigaction(SIGSEGV, NULL, &seen) == 0 && seen.sa_handler == trusted_marker_handler,
+                    "Trusted builds should leave the handler alone");
+
+        unsigned char expected[HASH_SIZE], serial_root[HASH_SIZE], parallel_root[HASH_SIZE];
+        TEST_ASSERT(get_tree_hash(guarded, expected) == MERKLE_SUCCESS &&
+                    get_tree_hash(serial, serial_root) == MERKLE_SUCCESS &&
+                    get_tree_hash(parallel, parallel_root) == MERKLE_SUCCESS, "Should get roots");
+        TEST_ASSERT(memcmp(expected, serial_root, HASH_SIZE) == 0 && memcmp(expected, parallel_root, HASH_SIZE) == 0,
+                    "Trusted roots should match the guarded one");
+
+        merkle_proof_t *proof = NULL;
+        TEST_ASSERT(generate_proof_by_key(serial, data[1234], sizes[1234], &proof) == MERKLE_SUCCESS,
+                    "The content index should be built");
+        release_test_proof(proof);
+
+        // Updates and versions of a trusted tree skip the handlers too
+        unsigned long long replacement = 77;
+        const void *block = &replacement;
+        size_t block_size = sizeof(replacement);
+        size_t index = 42;
+        TEST_ASSERT(update_leaf(guarded, index, block, block_size) == MERKLE_SUCCESS &&
+                    update_leaf(serial, index, block, block_size) == MERKLE_SUCCESS, "Updates should succeed");
+        // Only pointer trees share nodes with versions, flat ones are updated in place
+        merkle_tree_t *version = parallel;
+        if (layouts[l] == MERKLE_LAYOUT_POINTER) {
+            version = derive_merkle_tree(parallel, &index, &block, &block_size, 1);
+        } else {
+            TEST_ASSERT(update_leaf(parallel, index, block, block_size) == MERKLE_SUCCESS, "Update should succeed");
+        }
+        TEST_ASSERT(version != NULL, "Deriving should succeed");
+        TEST_ASSERT(sigaction(SIGSEGV, NULL, &seen) == 0 && seen.sa_handler == trusted_marker_handler,
+                    "Trusted updates should leave the handler alone");
+
+        unsigned char version_root[HASH_SIZE];
+        TEST_ASSERT(get_tree_hash(guarded, expected) == MERKLE_SUCCESS &&
+                    get_tree_hash(serial, serial_root) == MERKLE_SUCCESS &&
+                    get_tree_hash(version, version_root) == MERKLE_SUCCESS, "Should get updated roots");
+        TEST_ASSERT(memcmp(expected, serial_root, HASH_SIZE) == 0 && memcmp(expected, version_root, HASH_SIZE) == 0,
+                    "Trusted updates should match guarded ones");
+
+        // Cheap checks still apply without the handlers
+        const void *saved = data[7];
+        data[7] = NULL;
+        config.thread_pool = NULL;
+        TEST_ASSERT(create_merkle_tree_ex(data, sizes, leaves, &config) == NULL, "NULL blocks should be rejected");
+        data[7] = saved;
+        TEST_ASSERT(update_leaf(serial, 3, block, 0) == MERKLE_BAD_ARG, "Empty updates should be rejected");
+
+        if (version != parallel) {
+            dealloc_merkle_tree(version);
+        }
+        dealloc_merkle_tree(parallel);
+        dealloc_merkle_tree(serial);
+        dealloc_merkle_tree(guarded);
+    }
+
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.input_check = (merkle_input_check_t)7;
+    TEST_ASSERT(create_merkle_tree_ex(data, sizes, leaves, &config) == NULL, "Unknown modes should be rejected");
+
+    merkle_thread_pool_destroy(pool);
+    sigaction(SIGSEGV, &previous, NULL);
+    TEST_PASS();
+}
+
+static int test_stats_counters(void) {
+    enum { leaves = 100 };
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    merkle_stats_t before, stats, after;
+    TEST_ASSERT(merkle_get_stats(NULL, NULL) == MERKLE_NULL_ARG, "NULL output should be rejected");
+    merkle_error_t ret = merkle_get_stats(NULL, &before);
+    if (ret == MERKLE_NOT_SUPPORTED) {
+        // Built without MERKLE_STATS: nothing is counted
+        TEST_PASS();
+    }
+    TEST_ASSERT(ret == MERKLE_SUCCESS, "Global stats should be readable");
+
+    merkle_tree_t *tree = create_merkle_tree(data, sizes, leaves, 4);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+    TEST_ASSERT(merkle_get_stats(tree, &stats) == MERKLE_SUCCESS, "Tree stats should be readable");
+
+    // 100 leaves with 4 children per parent: 25 + 7 + 2 + 1 internal nodes over 100 + 25 + 7 + 2 children
+    TEST_ASSERT(stats.leaf_hashes == leaves, "Every leaf should be hashed once");
+    TEST_ASSERT(stats.node_hashes == 35, "Every internal node should be hashed once");
+    TEST_ASSERT(stats.bytes_hashed == leaves * sizeof(storage[0]) + (100 + 25 + 7 + 2) * HASH_SIZE,
+                "Leaf and child bytes should be counted");
+    TEST_ASSERT(stats.proofs_generated == 0 && stats.allocations == 0, "Nothing else should be booked yet");
+
+    merkle_proof_t *proof = NULL;
+    TEST_ASSERT(generate_proof_from_index(tree, 3, &proof) == MERKLE_SUCCESS, "Proof should succeed");
+    release_test_proof(proof);
+    TEST_ASSERT(generate_proof_from_index(tree, leaves, &proof) != MERKLE_SUCCESS, "Bad index should fail");
+
+    unsigned long long replacement = 99;
+    TEST_ASSERT(update_leaf(tree, 50, &replacement, sizeof(replacement)) == MERKLE_SUCCESS, "Update should succeed");
+
+    TEST_ASSERT(merkle_get_stats(tree, &after) == MERKLE_SUCCESS, "Tree stats should be readable");
+    TEST_ASSERT(after.proofs_generated == 1, "Only the successful proof should count");
+    TEST_ASSERT(after.leaf_hashes == leaves + 1 && after.node_hashes == 35 + 4,
+                "An update should rehash its leaf and every ancestor");
+    TEST_ASSERT(stats.write_locks >= 1 && after.write_locks >= stats.write_locks + 1, "Write locks should be counted");
+    TEST_ASSERT(after.leaf_hash_ns >= stats.leaf_hash_ns && after.node_hash_ns >= stats.node_hash_ns,
+                "Times should only grow");
+
+    dealloc_merkle_tree(tree);
+
+    TEST_ASSERT(merkle_get_stats(NULL, &stats) == MERKLE_SUCCESS, "Global stats should be readable");
+    TEST_ASSERT(stats.leaf_hashes - before.leaf_hashes >= leaves + 1 &&
+                stats.node_hashes - before.node_hashes >= 35 + 4 &&
+                stats.proofs_generated - before.proofs_generated >= 1,
+                "Tree events should also be booked globally");
+    TEST_ASSERT(stats.allocations > before.allocations && stats.allocated_bytes > before.allocated_bytes &&
+                stats.frees > before.frees, "Allocations should be booked globally");
+    TEST_PASS();
+}
+
+/**
+ * @brief Writes @p bytes of position-dependent content to a fresh temporary file.
+ */
+static unsigned char *write_chunked_test_file(char path[32], size_t bytes) {
+    unsigned char *content = malloc(bytes);
+    if (!content || !make_temp_path(path)) {
+        free(content);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < bytes; i++) {
+        content[i] = (unsigned char)(i * 131 + (i >> 9));
+    }
+
+    FILE *file = fopen(path, "wb");
+    int written = file && fwrite(content, 1, bytes, file) == bytes;
+    if (file) {
+        fclose(file);
+    }
+    if (!written) {
+        unlink(path);
+        free(content);
+        return NULL;
+    }
+    return content;
+}
+
+static int test_chunk_reader_windows(void) {
+    enum { leaf = 100, total = 1037 };
+    char path[32];
+    unsigned char *content = write_chunked_test_file(path, total);
+    TEST_ASSERT(content != NULL, "Test file should be written");
+    int fd = open(path, O_RDONLY);
+    TEST_ASSERT(fd >= 0, "Test file should open");
+
+    TEST_ASSERT(merkle_chunk_reader_create(fd, 0, leaf, 350) == NULL, "Empty ranges should be rejected");
+    TEST_ASSERT(merkle_chunk_reader_create(fd, total, 0, 350) == NULL, "Empty leaves should be rejected");
+
+    // 350 bytes round down to three whole leaves per window
+    merkle_chunk_reader_t *reader = merkle_chunk_reader_create(fd, total, leaf, 350);
+    TEST_ASSERT(reader != NULL, "Reader should start");
+    const unsigned char *window = NULL;
+    size_t bytes = 0, offset = 0, windows = 0;
+    while (merkle_chunk_reader_next(reader, &window, &bytes) == MERKLE_SUCCESS && bytes) {
+        TEST_ASSERT(bytes == 300 || offset + bytes == total, "Only the last window should be short");
+        TEST_ASSERT(memcmp(window, content + offset, bytes) == 0, "Windows should hold the file in order");
+        offset += bytes;
+        windows++;
+    }
+    TEST_ASSERT(offset == total && windows == 4, "Every byte should be returned exactly once");
+    TEST_ASSERT(merkle_chunk_reader_next(reader, &window, &bytes) == MERKLE_SUCCESS && bytes == 0,
+                "The end should stay reported");
+    merkle_chunk_reader_destroy(reader);
+
+    // Stopping early must not hang on a reader blocked on a full pipeline
+    reader = merkle_chunk_reader_create(fd, total, leaf, 100);
+    TEST_ASSERT(reader != NULL && merkle_chunk_reader_next(reader, &window, &bytes) == MERKLE_SUCCESS,
+                "Reader should start");
+    merkle_chunk_reader_destroy(reader);
+
+    // Asking for more than the file holds is a read error, not a short tree
+    reader = merkle_chunk_reader_create(fd, total + 500, leaf, 600);
+    TEST_ASSERT(reader != NULL, "Reader should start");
+    merkle_error_t ret;
+    while ((ret = merkle_chunk_reader_next(reader, &window, &bytes)) == MERKLE_SUCCESS && bytes) {
+    }
+    TEST_ASSERT(ret == MERKLE_IO_ERROR, "A file ending early should fail");
+    merkle_chunk_reader_destroy(reader);
+
+    close(fd);
+    unlink(path);
+    free(content);
+    TEST_PASS();
+}
+
+static int test_tree_from_file(void) {
+    // Leaves do not divide the read window, and the file spans three windows
+    const size_t leaf = 1000;
+    const size_t total = 2 * (size_t)MERKLE_READ_WINDOW + 3 * leaf + 17;
+    const size_t leaves = (total + leaf - 1) / leaf;
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT, MERKLE_LAYOUT_BLOCKED};
+    char path[32];
+    unsigned char *content = write_chunked_test_file(path, total);
+    TEST_ASSERT(content != NULL, "Test file should be written");
+
+    const void **data = malloc(leaves * sizeof(*data));
+    size_t *sizes = malloc(leaves * sizeof(*sizes));
+    TEST_ASSERT(data && sizes, "Chunk arrays should be allocated");
+    for (size_t i = 0; i < leaves; i++) {
+        data[i] = content + i * leaf;
+        sizes[i] = total - i * leaf < leaf ? total - i * leaf : leaf;
+    }
+
+    merkle_thread_pool_t *pool = merkle_thread_pool_create(2);
+    TEST_ASSERT(pool != NULL, "Pool creation should succeed");
+
+    for (size_t l = 0; l < 3; l++) {
+        merkle_config_t config;
+        merkle_config_init(&config);
+        config.branching_factor = 5;
+        config.layout = layouts[l];
+        config.leaf_index = MERKLE_INDEX_LEAF_HASH;
+        merkle_tree_t *expected = create_merkle_tree_ex(data, sizes, leaves, &config);
+        merkle_tree_t *serial = create_merkle_tree_from_file(path, leaf, &config);
+        config.thread_pool = pool;
+        merkle_tree_t *parallel = create_merkle_tree_from_file(path, leaf, &config);
+        TEST_ASSERT(expected && serial && parallel, "Builds should succeed");
+
+        unsigned char root[HASH_SIZE], serial_root[HASH_SIZE], parallel_root[HASH_SIZE];
+        TEST_ASSERT(get_tree_hash(expected, root) == MERKLE_SUCCESS &&
+                    get_tree_hash(serial, serial_root) == MERKLE_SUCCESS &&
+                    get_tree_hash(parallel, parallel_root) == MERKLE_SUCCESS, "Should get roots");
+        TEST_ASSERT(memcmp(root, serial_root, HASH_SIZE) == 0 && memcmp(root, parallel_root, HASH_SIZE) == 0,
+                    "File trees should match the in-memory tree over the same chunks");
+
+        // The index is keyed by leaf hash, so it works without the data
+        merkle_proof_t *proof = NULL;
+        size_t last = leaves - 1;
+        TEST_ASSERT(generate_proof_by_key(serial, data[last], sizes[last], &proof) == MERKLE_SUCCESS,
+                    "The short last leaf should be found");
+        unsigned char leaf_hash[HASH_SIZE];
+        SHA256(data[last], sizes[last], leaf_hash);
+        TEST_ASSERT(verify_proof(root, leaf_hash, proof) == MERKLE_SUCCESS, "Its proof should verify");
+        release_test_proof(proof);
+
+        dealloc_merkle_tree(parallel);
+        dealloc_merkle_tree(serial);
+        dealloc_merkle_tree(expected);
+    }
+
+    // Rejections
+    merkle_config_t config;
+    merkle_config_init(&config);
+    TEST_ASSERT(create_merkle_tree_from_file(path, 0, &config) == NULL, "Empty leaves should be rejected");
+    TEST_ASSERT(create_merkle_tree_from_file(path, leaf, NULL) == NULL, "NULL config should be rejected");
+    TEST_ASSERT(create_merkle_tree_from_file(NULL, leaf, &config) == NULL, "NULL path should be rejected");
+    TEST_ASSERT(create_merkle_tree_from_file("/nonexistent/merkle", leaf, &config) == NULL,
+                "Missing files should be rejected");
+    TEST_ASSERT(create_merkle_tree_from_fd(-1, leaf, &config) == NULL, "Bad descriptors should be rejected");
+    config.leaf_index = MERKLE_INDEX_KEY;
+    TEST_ASSERT(create_merkle_tree_from_file(path, leaf, &config) == NULL, "Key indexes should be rejected");
+    config.leaf_index = MERKLE_INDEX_NONE;
+
+    int pipe_fds[2];
+    TEST_ASSERT(pipe(pipe_fds) == 0, "Pipe should be created");
+    TEST_ASSERT(create_merkle_tree_from_fd(pipe_fds[0], leaf, &config) == NULL, "Pipes cannot be sized");
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    FILE *file = fopen(path, "wb");
+    TEST_ASSERT(file != NULL, "Test file should be truncated");
+    fclose(file);
+    TEST_ASSERT(create_merkle_tree_from_file(path, leaf, &config) == NULL, "Empty files should be rejected");
+
+    merkle_thread_pool_destroy(pool);
+    unlink(path);
+    free(sizes);
+    free(data);
+    free(content);
+    TEST_PASS();
+}
+
+/**
+ * @brief Equal-length batches match OpenSSL whether or not they fill whole blocks.
+ */
+static int test_sha256_fixed_matches_openssl(void) {
+    enum { MESSAGES = 33, MAX_LEN = 192 };
+    static unsigned char storage[MESSAGES][MAX_LEN];
+    const unsigned char *msgs[MESSAGES];
+    unsigned char digests[MESSAGES][HASH_SIZE];
+    unsigned char *outs[MESSAGES];
+    const size_t lens[] = {32, 64, 96, 128, 192};
+    const size_t batches[] = {1, 3, 5, 8, 13, 16, 17, MESSAGES};
+
+    for (size_t i = 0; i < MESSAGES; i++) {
+        for (size_t b = 0; b < MAX_LEN; b++) {
+            storage[i][b] = (unsigned char)(i * 29 + b * 11);
+        }
+        msgs[i] = storage[i];
+        outs[i] = digests[i];
+    }
+
+    for (size_t b = 0; b < sizeof(test_sha256_backends) / sizeof(test_sha256_backends[0]); b++) {
+        if (merkle_sha256_select_backend(test_sha256_backends[b]) != MERKLE_SUCCESS) {
+            continue;
+        }
+
+        for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+            for (size_t c = 0; c < sizeof(batches) / sizeof(batches[0]); c++) {
+                memset(digests, 0, sizeof(digests));
+                merkle_sha256_batch_fixed(msgs, lens[l], outs, batches[c]);
+
+                for (size_t i = 0; i < batches[c]; i++) {
+                    unsigned char expected[HASH_SIZE];
+                    SHA256(msgs[i], lens[l], expected);
+                    TEST_ASSERT(memcmp(expected, digests[i], HASH_SIZE) == 0,
+                                "Fixed-length digest should match OpenSSL");
+                }
+            }
+        }
+    }
+
+    merkle_sha256_select_backend(MERKLE_SHA256_AUTO);
+    TEST_PASS();
+}
+
+/**
+ * @brief Binary and 4-ary trees hashed through full-parent batches match the streaming builder.
+ */
+static int test_fixed_node_trees_match_builder(void) {
+    const size_t factors[] = {2, 4};
+    const size_t counts[] = {1, 2, 5, 16, 17, 100, 1025};
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    enum { MAX_LEAVES = 1025 };
+    const void *data[MAX_LEAVES];
+    size_t sizes[MAX_LEAVES];
+    unsigned long long storage[MAX_LEAVES];
+    create_unique_test_data(data, sizes, storage, MAX_LEAVES);
+
+    for (size_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+        for (size_t n = 0; n < sizeof(counts) / sizeof(counts[0]); n++) {
+            size_t leaves = counts[n];
+            merkle_builder_t *builder = merkle_builder_init(factors[f]);
+            unsigned char expected[HASH_SIZE];
+            TEST_ASSERT(builder && merkle_builder_append_n(builder, data, sizes, leaves) == MERKLE_SUCCESS &&
+                        merkle_builder_finalize(builder, expected) == MERKLE_SUCCESS, "Builder should finish");
+            merkle_builder_destroy(builder);
+
+            for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+                merkle_tree_t *tree = create_tree_with_layout(data, sizes, leaves, factors[f], layouts[l]);
+                unsigned char actual[HASH_SIZE];
+                TEST_ASSERT(tree && get_tree_hash(tree, actual) == MERKLE_SUCCESS, "Build should succeed");
+                TEST_ASSERT(memcmp(expected, actual, HASH_SIZE) == 0, "Tree root should match the builder");
+                dealloc_merkle_tree(tree);
+            }
+        }
+    }
+
+    // Rehashing after updates takes the same path, including the short last parent
+    unsigned long long replacement[3] = {1, 2, 3};
+    const size_t indices[3] = {0, 500, 1024};
+    const void *blocks[3] = {&replacement[0], &replacement[1], &replacement[2]};
+    const size_t block_sizes[3] = {sizeof(replacement[0]), sizeof(replacement[1]), sizeof(replacement[2])};
+    const void *updated[MAX_LEAVES];
+    memcpy(updated, data, sizeof(data));
+
+    for (size_t k = 0; k < 3; k++) {
+        updated[indices[k]] = blocks[k];
+    }
+
+    for (size_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+        merkle_builder_t *builder = merkle_builder_init(factors[f]);
+        unsigned char expected[HASH_SIZE];
+        TEST_ASSERT(builder && merkle_builder_append_n(builder, updated, sizes, MAX_LEAVES) == MERKLE_SUCCESS &&
+                    merkle_builder_finalize(builder, expected) == MERKLE_SUCCESS, "Builder should finish");
+        merkle_builder_destroy(builder);
+
+        for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+            merkle_tree_t *tree = create_tree_with_layout(data, sizes, MAX_LEAVES, factors[f], layouts[l]);
+            unsigned char actual[HASH_SIZE];
+            TEST_ASSERT(tree && update_leaves(tree, indices, blocks, block_sizes, 3) == MERKLE_SUCCESS,
+                        "Updates should succeed");
+            TEST_ASSERT(get_tree_hash(tree, actual) == MERKLE_SUCCESS && memcmp(expected, actual, HASH_SIZE) == 0,
+                        "Updated root should match the builder");
+            dealloc_merkle_tree(tree);
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Completion record filled by record_async_completion().
+ */
+typedef struct async_completion {
+    atomic_int calls;            /**< Times the callback ran. */
+    _Atomic merkle_error_t status; /**< Status the callback received. */
+    merkle_async_t *op;          /**< Handle the callback received. */
+} async_completion_t;
+
+static void record_async_completion(merkle_async_t *op, merkle_error_t status, void *user_data) {
+    async_completion_t *completion = user_data;
+    completion->op = op;
+    atomic_store(&completion->status, status);
+    atomic_fetch_add(&completion->calls, 1);
+}
+
+/**
+ * @brief Asynchronous builds and proofs produce the synchronous results and signal completion.
+ */
+static int test_async_build_and_proof(void) {
+    enum { leaves = 5000 };
+    static const void *data[leaves];
+    static size_t sizes[leaves];
+    static unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+
+    for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+        merkle_config_t config;
+        merkle_config_init(&config);
+        config.branching_factor = 4;
+        config.layout = layouts[l];
+        merkle_tree_t *reference = create_merkle_tree_ex(data, sizes, leaves, &config);
+        unsigned char expected[HASH_SIZE], actual[HASH_SIZE];
+        TEST_ASSERT(reference && get_tree_hash(reference, expected) == MERKLE_SUCCESS, "Reference should build");
+
+        async_completion_t completion = {0};
+        merkle_async_t *op = create_merkle_tree_async(data, sizes, leaves, &config, record_async_completion,
+                                                      &completion);
+        TEST_ASSERT(op != NULL, "Async build should be queued");
+
+        // The descriptor is what an event loop would watch
+        int fd = merkle_async_fd(op);
+        TEST_ASSERT(fd >= 0, "Linux builds should expose an eventfd");
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        TEST_ASSERT(poll(&pfd, 1, 10000) == 1 && (pfd.revents & POLLIN), "Descriptor should become readable");
+        TEST_ASSERT(merkle_async_done(op), "Readable descriptor means the build finished");
+        TEST_ASSERT(merkle_async_wait(op) == MERKLE_SUCCESS, "Async build should succeed");
+
+        merkle_tree_t *tree = merkle_async_take_tree(op);
+        TEST_ASSERT(tree && get_tree_hash(tree, actual) == MERKLE_SUCCESS &&
+                    memcmp(expected, actual, HASH_SIZE) == 0, "Async root should match the synchronous one");
+        TEST_ASSERT(merkle_async_take_tree(op) == NULL, "A tree can only be taken once");
+        TEST_ASSERT(merkle_async_take_proof(op) == NULL, "Builds carry no proof");
+        merkle_async_release(op);
+
+        // The callback may run just after the descriptor fires
+        while (atomic_load(&completion.calls) == 0) {
+            sched_yield();
+        }
+        TEST_ASSERT(atomic_load(&completion.calls) == 1 && atomic_load(&completion.status) == MERKLE_SUCCESS &&
+                    completion.op == op, "Callback should run once with the status");
+
+        merkle_async_t *proof_op = generate_proof_async(tree, 1234, NULL, NULL);
+        TEST_ASSERT(proof_op && merkle_async_wait(proof_op) == MERKLE_SUCCESS, "Async proof should succeed");
+        merkle_proof_t *proof = merkle_async_take_proof(proof_op);
+        unsigned char leaf_hash[HASH_SIZE];
+        SHA256(data[1234], sizes[1234], leaf_hash);
+        TEST_ASSERT(proof && verify_proof(expected, leaf_hash, proof) == MERKLE_SUCCESS, "Async proof should verify");
+        dealloc_merkle_proof(proof);
+        merkle_async_release(proof_op);
+
+        // Failures are reported like the synchronous calls report them
+        proof_op = generate_proof_async(tree, leaves, NULL, NULL);
+        TEST_ASSERT(proof_op && merkle_async_wait(proof_op) == MERKLE_BAD_ARG, "Out-of-range proof should fail");
+        TEST_ASSERT(merkle_async_take_proof(proof_op) == NULL, "A failed proof has no result");
+        merkle_async_release(proof_op);
+
+        // Results nobody takes are freed with the handle, even if it goes first
+        op = create_merkle_tree_async(data, sizes, leaves, &config, NULL, NULL);
+        TEST_ASSERT(op && merkle_async_wait(op) == MERKLE_SUCCESS, "Second build should succeed");
+        merkle_async_release(op);
+        proof_op = generate_proof_async(tree, 7, NULL, NULL);
+        TEST_ASSERT(proof_op && merkle_async_wait(proof_op) == MERKLE_SUCCESS, "Second proof should succeed");
+        merkle_async_release(proof_op);
+        op = create_merkle_tree_async(data, sizes, leaves, &config, NULL, NULL);
+        TEST_ASSERT(op != NULL, "Third build should be queued");
+        merkle_async_release(op);
+
+        dealloc_merkle_tree(tree);
+        dealloc_merkle_tree(reference);
+    }
+
+    TEST_ASSERT(create_merkle_tree_async(NULL, sizes, leaves, NULL, NULL, NULL) == NULL, "NULL data should be rejected");
+    TEST_ASSERT(generate_proof_async(NULL, 0, NULL, NULL) == NULL, "NULL tree should be rejected");
+    TEST_ASSERT(merkle_async_wait(NULL) == MERKLE_NULL_ARG && merkle_async_cancel(NULL) == MERKLE_NULL_ARG &&
+                merkle_async_fd(NULL) == -1 && !merkle_async_done(NULL), "NULL handles should be rejected");
+    merkle_async_release(NULL);
+    TEST_PASS();
+}
+
+/**
+ * @brief Gate holding the only worker of a pool until the test opens it.
+ */
+typedef struct async_gate {
+    pthread_mutex_t mutex;
+    pthread_cond_t opened_cond;
+    bool opened;
+} async_gate_t;
+
+static void wait_at_async_gate(void *arg) {
+    async_gate_t *gate = arg;
+    pthread_mutex_lock(&gate->mutex);
+    while (!gate->opened) {
+        pthread_cond_wait(&gate->opened_cond, &gate->mutex);
+    }
+    pthread_mutex_unlock(&gate->mutex);
+}
+
+/**
+ * @brief Cancelled operations finish with MERKLE_CANCELLED and no result.
+ */
+static int test_async_cancel(void) {
+    enum { leaves = 2000 };
+    static const void *data[leaves];
+    static size_t sizes[leaves];
+    static unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    // A queued build never starts once cancelled
+    merkle_thread_pool_t *pool = merkle_thread_pool_create(1);
+    async_gate_t gate = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false};
+    TEST_ASSERT(pool && merkle_thread_pool_submit(pool, wait_at_async_gate, &gate) == MERKLE_SUCCESS,
+                "Pool should be blocked");
+
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.thread_pool = pool;
+    async_completion_t completion = {0};
+    merkle_async_t *op = create_merkle_tree_async(data, sizes, leaves, &config, record_async_completion, &completion);
+    merkle_async_t *dropped = create_merkle_tree_async(data, sizes, leaves, &config, NULL, NULL);
+    TEST_ASSERT(op && dropped && !merkle_async_done(op), "Builds should wait behind the gate");
+    TEST_ASSERT(merkle_async_cancel(op) == MERKLE_SUCCESS, "Cancel should be accepted");
+    merkle_async_release(dropped);
+
+    pthread_mutex_lock(&gate.mutex);
+    gate.opened = true;
+    pthread_cond_signal(&gate.opened_cond);
+    pthread_mutex_unlock(&gate.mutex);
+
+    TEST_ASSERT(merkle_async_wait(op) == MERKLE_CANCELLED, "Cancelled build should report it");
+    TEST_ASSERT(merkle_async_take_tree(op) == NULL, "Cancelled build has no tree");
+    merkle_thread_pool_destroy(pool);
+    TEST_ASSERT(atomic_load(&completion.calls) == 1 && atomic_load(&completion.status) == MERKLE_CANCELLED,
+                "Callback should see the cancellation");
+    merkle_async_release(op);
+
+    // A running build polls the flag between batches; raise it up front to hit those checks
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+
+    for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+        merkle_config_init(&config);
+        config.layout = layouts[l];
+        atomic_bool cancel = true;
+        merkle_tree_t *tree = NULL;
+        TEST_ASSERT(merkle_build_tree(data, sizes, leaves, &config, &cancel, &tree) == MERKLE_CANCELLED && !tree,
+                    "Started build should stop when cancelled");
+
+        atomic_store(&cancel, false);
+        TEST_ASSERT(merkle_build_tree(data, sizes, leaves, &config, &cancel, &tree) == MERKLE_SUCCESS && tree,
+                    "Uncancelled build should finish");
+        dealloc_merkle_tree(tree);
+    }
+
+    TEST_PASS();
+}
+
+/** Takes a reference on the signal handlers from another thread. */
+static void *init_protection_thread(void *arg) {
+    (void)arg;
+    merkle_init_signal_protection();
+    return NULL;
+}
+
+/** Releases a reference on the signal handlers from another thread. */
+static void *cleanup_protection_thread(void *arg) {
+    (void)arg;
+    merkle_cleanup_signal_protection();
+    return NULL;
+}
+
+/**
+ * @brief Concurrent guarded builds share the signal handlers and restore the caller's afterwards.
+ */
+static int test_async_signal_protection(void) {
+    enum { leaves = 3000, builds = 6 };
+    static const void *data[leaves];
+    static size_t sizes[leaves];
+    static unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    struct sigaction marker, previous, seen;
+    memset(&marker, 0, sizeof(marker));
+    marker.sa_handler = trusted_marker_handler;
+    sigemptyset(&marker.sa_mask);
+    TEST_ASSERT(sigaction(SIGSEGV, &marker, &previous) == 0, "Installing the marker should succeed");
+
+    // Interleave two threads so the first one out is not the last one in
+    pthread_t thread;
+    merkle_init_signal_protection();
+    TEST_ASSERT(pthread_create(&thread, NULL, init_protection_thread, NULL) == 0 &&
+                pthread_join(thread, NULL) == 0, "Second reference should be taken");
+    merkle_cleanup_signal_protection();
+    TEST_ASSERT(sigaction(SIGSEGV, NULL, &seen) == 0 && seen.sa_handler != trusted_marker_handler,
+                "Handlers should stay installed while another thread holds them");
+    TEST_ASSERT(pthread_create(&thread, NULL, cleanup_protection_thread, NULL) == 0 &&
+                pthread_join(thread, NULL) == 0, "Second reference should be released");
+    TEST_ASSERT(sigaction(SIGSEGV, NULL, &seen) == 0 && seen.sa_handler == trusted_marker_handler,
+                "The last release should restore the caller's handler");
+
+    merkle_config_t config;
+    merkle_config_init(&config);
+    config.branching_factor = 4;
+    unsigned char expected[HASH_SIZE], actual[HASH_SIZE];
+    merkle_tree_t *reference = create_merkle_tree_ex(data, sizes, leaves, &config);
+    TEST_ASSERT(reference && get_tree_hash(reference, expected) == MERKLE_SUCCESS, "Reference should build");
+
+    // Overlapping builds on the library pool, plus one on this thread
+    merkle_async_t *ops[builds];
+    for (size_t i = 0; i < builds; i++) {
+        ops[i] = create_merkle_tree_async(data, sizes, leaves, &config, NULL, NULL);
+        TEST_ASSERT(ops[i] != NULL, "Async build should be queued");
+    }
+    merkle_tree_t *local = create_merkle_tree_ex(data, sizes, leaves, &config);
+    TEST_ASSERT(local != NULL, "Concurrent synchronous build should succeed");
+    dealloc_merkle_tree(local);
+
+    for (size_t i = 0; i < builds; i++) {
+        TEST_ASSERT(merkle_async_wait(ops[i]) == MERKLE_SUCCESS, "Async build should succeed");
+        merkle_tree_t *tree = merkle_async_take_tree(ops[i]);
+        TEST_ASSERT(tree && get_tree_hash(tree, actual) == MERKLE_SUCCESS &&
+                    memcmp(expected, actual, HASH_SIZE) == 0, "Async root should match the synchronous one");
+        dealloc_merkle_tree(tree);
+        merkle_async_release(ops[i]);
+    }
+
+    TEST_ASSERT(sigaction(SIGSEGV, NULL, &seen) == 0 && seen.sa_handler == trusted_marker_handler,
+                "The caller's handler should be back once every build is done");
+    TEST_ASSERT(sigaction(SIGSEGV, &previous, NULL) == 0, "Restoring the handler should succeed");
+
+    dealloc_merkle_tree(reference);
+    TEST_PASS();
+}
+
+/**
+ * @brief Hash of an empty sparse subtree of every height, recomputed with OpenSSL.
+ */
+static void sparse_test_defaults(unsigned char defaults[MERKLE_SPARSE_DEPTH + 1][HASH_SIZE]) {
+    memset(defaults[0], 0, HASH_SIZE);
+    for (size_t h = 1; h <= MERKLE_SPARSE_DEPTH; h++) {
+        unsigned char pair[2 * HASH_SIZE];
+        memcpy(pair, defaults[h - 1], HASH_SIZE);
+        memcpy(pair + HASH_SIZE, defaults[h - 1], HASH_SIZE);
+        SHA256(pair, sizeof(pair), defaults[h]);
+    }
+}
+
+static int sparse_test_bit(const unsigned char *key, size_t i) {
+    return (key[i / 8] >> (7 - i % 8)) & 1;
+}
+
+/**
+ * @brief Reference sparse subtree hash: splits the keys by one bit per level.
+ */
+static void sparse_test_node(unsigned char (*keys)[HASH_SIZE], unsigned char (*leaf_hashes)[HASH_SIZE], size_t n,
+                             size_t depth, unsigned char defaults[MERKLE_SPARSE_DEPTH + 1][HASH_SIZE],
+                             unsigned char out[HASH_SIZE]) {
+    if (n == 0) {
+        memcpy(out, defaults[MERKLE_SPARSE_DEPTH - depth], HASH_SIZE);
+        return;
+    }
+    if (depth == MERKLE_SPARSE_DEPTH) {
+        memcpy(out, leaf_hashes[0], HASH_SIZE);
+        return;
+    }
+
+    // Partition in place: keys with a 0 bit first
+    size_t zeros = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!sparse_test_bit(keys[i], depth)) {
+            unsigned char tmp[HASH_SIZE];
+            memcpy(tmp, keys[i], HASH_SIZE);
+            memcpy(keys[i], keys[zeros], HASH_SIZE);
+            memcpy(keys[zeros], tmp, HASH_SIZE);
+            memcpy(tmp, leaf_hashes[i], HASH_SIZE);
+            memcpy(leaf_hashes[i], leaf_hashes[zeros], HASH_SIZE);
+            memcpy(leaf_hashes[zeros], tmp, HASH_SIZE);
+            zeros++;
+        }
+    }
+
+    unsigned char pair[2 * HASH_SIZE];
+    sparse_test_node(keys, leaf_hashes, zeros, depth + 1, defaults, pair);
+    sparse_test_node(keys + zeros, leaf_hashes + zeros, n - zeros, depth + 1, defaults, pair + HASH_SIZE);
+    SHA256(pair, sizeof(pair), out);
+}
+
+/**
+ * @brief Reference root of a sparse tree holding @p values[i] at @p keys[i] for every present slot.
+ */
+static void sparse_test_root(const unsigned char (*keys)[HASH_SIZE], char (*values)[32], const bool *present,
+                             size_t count, unsigned char root[HASH_SIZE]) {
+    static unsigned char defaults[MERKLE_SPARSE_DEPTH + 1][HASH_SIZE];
+    static unsigned char work_keys[64][HASH_SIZE];
+    static unsigned char work_hashes[64][HASH_SIZE];
+    size_t n = 0;
+
+    sparse_test_defaults(defaults);
+    for (size_t i = 0; i < count; i++) {
+        if (present[i]) {
+            memcpy(work_keys[n], keys[i], HASH_SIZE);
+            SHA256((const unsigned char *)values[i], strlen(values[i]), work_hashes[n]);
+            n++;
+        }
+    }
+    sparse_test_node(work_keys, work_hashes, n, 0, defaults, root);
+}
+
+/**
+ * @brief Keys spread over the key space plus pairs forking deep down.
+ */
+static void sparse_test_keys(unsigned char (*keys)[HASH_SIZE], char (*values)[32], size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        SHA256((const unsigned char *)&i, sizeof(i), keys[i]);
+        snprintf(values[i], 32, "value-%zu", i);
+    }
+    // Neighbours in the very last bit and a fork in the middle of the path
+    memcpy(keys[1], keys[0], HASH_SIZE);
+    keys[1][HASH_SIZE - 1] ^= 1;
+    memcpy(keys[2], keys[0], HASH_SIZE);
+    keys[2][HASH_SIZE / 2] ^= 0x10;
+}
+
+/**
+ * @brief Sparse roots match a level-by-level reference through inserts, updates and removals.
+ */
+static int test_sparse_root_matches_reference(void) {
+    enum { keys_count = 40 };
+    static unsigned char keys[keys_count][HASH_SIZE];
+    static char values[keys_count][32];
+    bool present[keys_count];
+    unsigned char root[HASH_SIZE];
+    unsigned char expected[HASH_SIZE];
+    unsigned char defaults[MERKLE_SPARSE_DEPTH + 1][HASH_SIZE];
+
+    sparse_test_keys(keys, values, keys_count);
+    sparse_test_defaults(defaults);
+
+    merkle_sparse_t *tree = merkle_sparse_create(MERKLE_HASH_SHA256);
+    TEST_ASSERT(tree != NULL, "Sparse tree creation should succeed");
+    TEST_ASSERT(merkle_sparse_root(tree, root) == MERKLE_SUCCESS &&
+                memcmp(root, defaults[MERKLE_SPARSE_DEPTH], HASH_SIZE) == 0, "Empty tree should have the default root");
+
+    memset(present, 0, sizeof(present));
+    for (size_t i = 0; i < keys_count; i++) {
+        TEST_ASSERT(merkle_sparse_insert(tree, keys[i], values[i], strlen(values[i])) == MERKLE_SUCCESS,
+                    "Insert should succeed");
+        present[i] = true;
+        if (i < 4 || i % 9 == 0) {
+            merkle_sparse_root(tree, root);
+            sparse_test_root(keys, values, present, keys_count, expected);
+            TEST_ASSERT(memcmp(root, expected, HASH_SIZE) == 0, "Root should match the reference after an insert");
+        }
+    }
+    TEST_ASSERT(merkle_sparse_count(tree) == keys_count, "Every key should be stored");
+    merkle_sparse_root(tree, root);
+    sparse_test_root(keys, values, present, keys_count, expected);
+    TEST_ASSERT(memcmp(root, expected, HASH_SIZE) == 0, "Root should match the reference");
+
+    // One batch in reverse order, with a repeated key whose last value wins
+    const void *batch_values[keys_count + 1];
+    size_t batch_sizes[keys_count + 1];
+    static unsigned char batch_keys[keys_count + 1][HASH_SIZE];
+    for (size_t i = 0; i < keys_count; i++) {
+        memcpy(batch_keys[i], keys[keys_count - 1 - i], HASH_SIZE);
+        batch_values[i] = values[keys_count - 1 - i];
+        batch_sizes[i] = strlen(values[keys_count - 1 - i]);
+    }
+    memcpy(batch_keys[keys_count], keys[5], HASH_SIZE);
+    batch_values[keys_count] = values[5];
+    batch_sizes[keys_count] = strlen(values[5]);
+    batch_values[keys_count - 1 - 5] = "stale";
+    batch_sizes[keys_count - 1 - 5] = 5;
+
+    merkle_sparse_t *batched = merkle_sparse_create(MERKLE_HASH_SHA256);
+    TEST_ASSERT(batched && merkle_sparse_insert_batch(batched, (const unsigned char (*)[HASH_SIZE])batch_keys,
+                                                      batch_values, batch_sizes, keys_count + 1) == MERKLE_SUCCESS,
+                "Batch insert should succeed");
+    unsigned char batched_root[HASH_SIZE];
+    merkle_sparse_root(batched, batched_root);
+    TEST_ASSERT(merkle_sparse_count(batched) == keys_count && memcmp(batched_root, root, HASH_SIZE) == 0,
+                "Batch insert should match one-by-one inserts");
+
+    const void *value = NULL;
+    size_t size = 0;
+    TEST_ASSERT(merkle_sparse_get(batched, keys[5], &value, &size) == MERKLE_SUCCESS &&
+                size == strlen(values[5]) && memcmp(value, values[5], size) == 0, "Last value should win");
+
+    // Updating a value moves the root, restoring it moves it back
+    TEST_ASSERT(merkle_sparse_insert(tree, keys[1], "other", 5) == MERKLE_SUCCESS, "Update should succeed");
+    merkle_sparse_root(tree, expected);
+    TEST_ASSERT(memcmp(expected, root, HASH_SIZE) != 0 && merkle_sparse_count(tree) == keys_count,
+                "Update should change the root but not the count");
+    merkle_sparse_insert(tree, keys[1], values[1], strlen(values[1]));
+    merkle_sparse_root(tree, expected);
+    TEST_ASSERT(memcmp(expected, root, HASH_SIZE) == 0, "Restoring the value should restore the root");
+
+    // Removals, including the deep neighbours
+    const size_t removed[] = {1, 0, 17, 39};
+    for (size_t r = 0; r < sizeof(removed) / sizeof(removed[0]); r++) {
+        TEST_ASSERT(merkle_sparse_remove(tree, keys[removed[r]]) == MERKLE_SUCCESS, "Remove should succeed");
+        present[removed[r]] = false;
+        merkle_sparse_root(tree, root);
+        sparse_test_root(keys, values, present, keys_count, expected);
+        TEST_ASSERT(memcmp(root, expected, HASH_SIZE) == 0, "Root should match the reference after a remove");
+    }
+    TEST_ASSERT(merkle_sparse_remove(tree, keys[0]) == MERKLE_NOT_FOUND &&
+                merkle_sparse_get(tree, keys[0], &value, &size) == MERKLE_NOT_FOUND, "Removed key should be gone");
+    TEST_ASSERT(merkle_sparse_count(tree) == keys_count - 4, "Count should drop with removals");
+
+    for (size_t i = 0; i < keys_count; i++) {
+        if (present[i]) {
+            TEST_ASSERT(merkle_sparse_remove(tree, keys[i]) == MERKLE_SUCCESS, "Remove should succeed");
+        }
+    }
+    merkle_sparse_root(tree, root);
+    TEST_ASSERT(merkle_sparse_count(tree) == 0 && memcmp(root, defaults[MERKLE_SPARSE_DEPTH], HASH_SIZE) == 0,
+                "Emptied tree should have the default root");
+
+    // Bad input leaves the tree untouched
+    batch_values[3] = NULL;
+    TEST_ASSERT(merkle_sparse_insert_batch(batched, (const unsigned char (*)[HASH_SIZE])batch_keys, batch_values,
+                                           batch_sizes, keys_count) == MERKLE_BAD_ARG, "NULL value should be rejected");
+    TEST_ASSERT(merkle_sparse_insert(batched, keys[0], "x", 0) == MERKLE_BAD_ARG, "Empty value should be rejected");
+    merkle_sparse_root(batched, root);
+    TEST_ASSERT(memcmp(root, batched_root, HASH_SIZE) == 0 && merkle_sparse_count(batched) == keys_count,
+                "Rejected batch should change nothing");
+
+    TEST_ASSERT(merkle_sparse_insert(NULL, keys[0], "x", 1) == MERKLE_NULL_ARG &&
+                merkle_sparse_remove(tree, NULL) == MERKLE_NULL_ARG &&
+                merkle_sparse_get(tree, keys[0], NULL, &size) == MERKLE_NULL_ARG &&
+                merkle_sparse_root(NULL, root) == MERKLE_NULL_ARG, "NULL arguments should be rejected");
+    TEST_ASSERT(merkle_sparse_create((merkle_hash_id_t)77) == NULL, "Unknown hash should be rejected");
+
+    merkle_sparse_destroy(tree);
+    merkle_sparse_destroy(batched);
+    merkle_sparse_destroy(NULL);
+    TEST_PASS();
+}
+
+/**
+ * @brief Sparse proofs show membership and non-membership and elide empty siblings.
+ */
+static int test_sparse_proofs(void) {
+    enum { keys_count = 40 };
+    static unsigned char keys[keys_count][HASH_SIZE];
+    static char values[keys_count][32];
+    unsigned char root[HASH_SIZE];
+    merkle_sparse_proof_t *proof = NULL;
+
+    sparse_test_keys(keys, values, keys_count);
+
+    // Against an empty tree every sibling is a default
+    merkle_sparse_t *tree = merkle_sparse_create(MERKLE_HASH_SHA256);
+    TEST_ASSERT(tree != NULL, "Sparse tree creation should succeed");
+    merkle_sparse_root(tree, root);
+    TEST_ASSERT(merkle_sparse_prove(tree, keys[0], &proof) == MERKLE_SUCCESS &&
+                merkle_sparse_proof_sibling_count(proof) == 0, "Empty tree proof should carry no siblings");
+    TEST_ASSERT(merkle_sparse_verify(root, keys[0], NULL, 0, proof) == MERKLE_SUCCESS,
+                "Absence should verify against the empty root");
+    dealloc_merkle_sparse_proof(proof);
+
+    // Leave out keys 2 (a mid-path neighbour) and the last few
+    const size_t stored = keys_count - 5;
+    for (size_t i = 0; i < stored; i++) {
+        if (i != 2) {
+            merkle_sparse_insert(tree, keys[i], values[i], strlen(values[i]));
+        }
+    }
+    merkle_sparse_root(tree, root);
+
+    for (size_t i = 0; i < keys_count; i++) {
+        bool member = i < stored && i != 2;
+        TEST_ASSERT(merkle_sparse_prove(tree, keys[i], &proof) == MERKLE_SUCCESS, "Proof generation should succeed");
+        TEST_ASSERT(merkle_sparse_proof_sibling_count(proof) <= 16, "Empty siblings should be elided");
+
+        if (member) {
+            TEST_ASSERT(merkle_sparse_verify(root, keys[i], values[i], strlen(values[i]), proof) == MERKLE_SUCCESS,
+                        "Membership should verify");
+            TEST_ASSERT(merkle_sparse_verify(root, keys[i], NULL, 0, proof) == MERKLE_PROOF_INVALID,
+                        "A present key should not verify as absent");
+            TEST_ASSERT(merkle_sparse_verify(root, keys[i], "wrong", 5, proof) == MERKLE_PROOF_INVALID,
+                        "A wrong value should not verify");
+        } else {
+            TEST_ASSERT(merkle_sparse_verify(root, keys[i], NULL, 0, proof) == MERKLE_SUCCESS,
+                        "Non-membership should verify");
+            TEST_ASSERT(merkle_sparse_verify(root, keys[i], values[i], strlen(values[i]), proof) ==
+                        MERKLE_PROOF_INVALID, "An absent key should not verify a value");
+        }
+        dealloc_merkle_sparse_proof(proof);
+    }
+
+    // A key absent right next to a present one needs the deepest sibling
+    unsigned char neighbour[HASH_SIZE];
+    memcpy(neighbour, keys[3], HASH_SIZE);
+    neighbour[HASH_SIZE - 1] ^= 1;
+    TEST_ASSERT(merkle_sparse_prove(tree, neighbour, &proof) == MERKLE_SUCCESS &&
+                merkle_sparse_verify(root, neighbour, NULL, 0, proof) == MERKLE_SUCCESS,
+                "Absence next to a present key should verify");
+    TEST_ASSERT(merkle_sparse_verify(root, keys[3], NULL, 0, proof) == MERKLE_PROOF_INVALID,
+                "Proof should be bound to its key");
+
+    unsigned char bad_root[HASH_SIZE];
+    memcpy(bad_root, root, HASH_SIZE);
+    bad_root[0] ^= 1;
+    TEST_ASSERT(merkle_sparse_verify(bad_root, neighbour, NULL, 0, proof) == MERKLE_PROOF_INVALID,
+                "Wrong root should be rejected");
+    TEST_ASSERT(merkle_sparse_verify(root, neighbour, "x", 0, proof) == MERKLE_BAD_ARG,
+                "Empty value should be rejected");
+    TEST_ASSERT(merkle_sparse_verify(NULL, neighbour, NULL, 0, proof) == MERKLE_NULL_ARG &&
+                merkle_sparse_verify(root, neighbour, NULL, 0, NULL) == MERKLE_NULL_ARG &&
+                merkle_sparse_prove(tree, NULL, &proof) == MERKLE_NULL_ARG, "NULL arguments should be rejected");
+    dealloc_merkle_sparse_proof(proof);
+    dealloc_merkle_sparse_proof(NULL);
+    TEST_ASSERT(merkle_sparse_proof_sibling_count(NULL) == 0, "NULL proof has no siblings");
+
+    // Proofs outlive later changes and fail against the new root
+    TEST_ASSERT(merkle_sparse_prove(tree, keys[4], &proof) == MERKLE_SUCCESS, "Proof generation should succeed");
+    merkle_sparse_remove(tree, keys[5]);
+    merkle_sparse_root(tree, bad_root);
+    TEST_ASSERT(merkle_sparse_verify(bad_root, keys[4], values[4], strlen(values[4]), proof) == MERKLE_PROOF_INVALID,
+                "Stale proof should not verify against the new root");
+    dealloc_merkle_sparse_proof(proof);
+
+    // BLAKE3 trees carry their algorithm in the proof
+    merkle_sparse_t *blake = merkle_sparse_create(MERKLE_HASH_BLAKE3);
+    TEST_ASSERT(blake && merkle_sparse_insert(blake, keys[0], values[0], strlen(values[0])) == MERKLE_SUCCESS,
+                "BLAKE3 sparse tree should accept inserts");
+    merkle_sparse_root(blake, root);
+    TEST_ASSERT(merkle_sparse_prove(blake, keys[0], &proof) == MERKLE_SUCCESS &&
+                merkle_sparse_verify(root, keys[0], values[0], strlen(values[0]), proof) == MERKLE_SUCCESS,
+                "BLAKE3 membership should verify");
+    dealloc_merkle_sparse_proof(proof);
+
+    merkle_sparse_destroy(blake);
+    merkle_sparse_destroy(tree);
+    TEST_PASS();
+}
+
+/**
+ * @brief Batched proofs equal generate_proof_into() output slot by slot.
+ */
+static int test_proofs_batch_matches_single(void) {
+    enum { leaves = 3000, requests = 1200 };
+    const size_t factors[] = {2, 3};
+    const merkle_layout_t layouts[] = {MERKLE_LAYOUT_POINTER, MERKLE_LAYOUT_FLAT};
+    static const void *data[leaves];
+    static size_t sizes[leaves];
+    static unsigned long long storage[leaves];
+    size_t shuffled[requests];
+    size_t ascending[requests];
+    size_t offsets[requests + 1];
+    create_unique_test_data(data, sizes, storage, leaves);
+
+    // Unsorted with repeats, and an already ascending set
+    for (size_t i = 0; i < requests; i++) {
+        shuffled[i] = (i * 7919 + 13) % leaves;
+        ascending[i] = i * leaves / requests;
+    }
+    shuffled[5] = shuffled[17];
+
+    merkle_thread_pool_t *pool = merkle_thread_pool_create(2);
+    TEST_ASSERT(pool != NULL, "Pool creation should succeed");
+
+    for (size_t f = 0; f < 2; f++) {
+        for (size_t l = 0; l < 2; l++) {
+            merkle_tree_t *tree = create_tree_with_layout(data, sizes, leaves, factors[f], layouts[l]);
+            TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+            unsigned char root[HASH_SIZE];
+            get_tree_hash(tree, root);
+
+            size_t max_size = 0;
+            merkle_proof_max_size(tree, &max_size);
+            unsigned char *single = malloc(max_size);
+            unsigned char *buffer = malloc(max_size * requests);
+            TEST_ASSERT(single && buffer, "Test allocation should succeed");
+
+            for (size_t run = 0; run < 4; run++) {
+                const size_t *indices = run & 1 ? ascending : shuffled;
+                merkle_thread_pool_t *run_pool = run & 2 ? pool : NULL;
+                size_t total = 0;
+                size_t queried = 0;
+
+                TEST_ASSERT(generate_proofs_batch(tree, indices, requests, run_pool, NULL, 0, offsets, &queried) ==
+                            MERKLE_BAD_LEN, "Size query should report a short buffer");
+                TEST_ASSERT(generate_proofs_batch(tree, indices, requests, run_pool, buffer, max_size * requests,
+                                                  offsets, &total) == MERKLE_SUCCESS, "Batch should succeed");
+                TEST_ASSERT(total == queried && offsets[0] == 0 && offsets[requests] == total,
+                            "Offsets should cover the batch");
+
+                for (size_t i = 0; i < requests; i++) {
+                    size_t written = 0;
+                    generate_proof_into(tree, indices[i], single, max_size, &written);
+                    TEST_ASSERT(offsets[i + 1] - offsets[i] == written &&
+                                memcmp(buffer + offsets[i], single, written) == 0,
+                                "Batched proof should equal the single proof");
+                }
+
+                unsigned char leaf_hash[HASH_SIZE];
+                SHA256(data[indices[9]], sizes[indices[9]], leaf_hash);
+                TEST_ASSERT(verify_proof_buffer(root, leaf_hash, buffer + offsets[9], offsets[10] - offsets[9]) ==
+                            MERKLE_SUCCESS, "Batched proof should verify");
+            }
+
+            free(single);
+            free(buffer);
+            dealloc_merkle_tree(tree);
+        }
+    }
+
+    merkle_thread_pool_destroy(pool);
+    TEST_PASS();
+}
+
+/**
+ * @brief Proof batches reject bad input before writing anything.
+ */
+static int test_proofs_batch_rejects_bad_input(void) {
+    const void *data[11];
+    size_t sizes[11];
+    create_test_data((const char **)data, sizes, 11);
+    merkle_tree_t *tree = create_merkle_tree(data, sizes, 11, 3);
+    TEST_ASSERT(tree != NULL, "Tree creation should succeed");
+
+    unsigned char buffer[4096];
+    size_t offsets[4];
+    size_t written = 0;
+    const size_t indices[] = {3, 11, 4};
+
+    TEST_ASSERT(generate_proofs_batch(tree, indices, 3, NULL, buffer, sizeof(buffer), offsets, &written) ==
+                MERKLE_INVALID_INDEX, "Out of range leaf should be rejected");
+    TEST_ASSERT(generate_proofs_batch(tree, indices, 1, NULL, buffer, 40, offsets, &written) == MERKLE_BAD_LEN &&
+                written == offsets[1], "Short buffer should report the needed size");
+    TEST_ASSERT(generate_proofs_batch(tree, indices, 0, NULL, NULL, 0, offsets, &written) == MERKLE_SUCCESS &&
+                written == 0 && offsets[0] == 0, "Empty batch should succeed");
+    TEST_ASSERT(generate_proofs_batch(NULL, indices, 1, NULL, buffer, sizeof(buffer), offsets, &written) ==
+                MERKLE_NULL_ARG &&
+                generate_proofs_batch(tree, NULL, 1, NULL, buffer, sizeof(buffer), offsets, &written) ==
+                MERKLE_NULL_ARG &&
+                generate_proofs_batch(tree, indices, 1, NULL, buffer, sizeof(buffer), NULL, &written) ==
+                MERKLE_NULL_ARG &&
+                generate_proofs_batch(tree, indices, 1, NULL, NULL, 8, offsets, &written) == MERKLE_NULL_ARG,
+                "NULL arguments should be rejected");
+
+    dealloc_merkle_tree(tree);
+    TEST_PASS();
+}
+
+/**
+ * @brief Reads a whole small file into @p out, returning its length or 0 on failure.
+ */
+static size_t read_test_file(const char *path, unsigned char *out, size_t capacity) {
+    FILE *file = fopen(path, "rb");
+    size_t length = file ? fread(out, 1, capacity, file) : 0;
+
+    if (file) {
+        fclose(file);
+    }
+
+    return length;
+}
+
+/**
+ * @brief Blocked trees hold the nodes of flat trees and prove and update alike.
+ */
+static int test_blocked_layout_matches_flat(void) {
+    enum { max_leaves = 5000 };
+    const size_t factors[] = {2, 3, 4, 16};
+    const size_t counts[] = {1, 2, 63, 64, 65, 1000, max_leaves};
+    static const void *data[max_leaves];
+    static size_t sizes[max_leaves];
+    static unsigned long long storage[max_leaves];
+    static unsigned char flat_node_hashes[max_leaves][HASH_SIZE];
+    static unsigned char blocked_node_hashes[max_leaves][HASH_SIZE];
+    static size_t nodes[max_leaves];
+    create_unique_test_data(data, sizes, storage, max_leaves);
+
+    for (size_t i = 0; i < max_leaves; i++) {
+        nodes[i] = i;
+    }
+
+    for (size_t f = 0; f < 4; f++) {
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+            size_t count = counts[c];
+            merkle_tree_t *flat = create_tree_with_layout(data, sizes, count, factors[f], MERKLE_LAYOUT_FLAT);
+            merkle_tree_t *blocked = create_tree_with_layout(data, sizes, count, factors[f], MERKLE_LAYOUT_BLOCKED);
+            TEST_ASSERT(flat && blocked, "Tree creation should succeed");
+
+            unsigned char flat_root[HASH_SIZE];
+            unsigned char blocked_root[HASH_SIZE];
+            get_tree_hash(flat, flat_root);
+            get_tree_hash(blocked, blocked_root);
+            TEST_ASSERT(memcmp(flat_root, blocked_root, HASH_SIZE) == 0, "Blocked root should match flat root");
+
+            // Every node of every level, not just the ones proofs visit
+            size_t width = count;
+            for (size_t level = 0; level <= merkle_tree_level_count(flat); level++) {
+                TEST_ASSERT(merkle_tree_level_hashes(flat, level, nodes, width, flat_node_hashes) == MERKLE_SUCCESS &&
+                            merkle_tree_level_hashes(blocked, level, nodes, width, blocked_node_hashes) ==
+                            MERKLE_SUCCESS, "Level hashes should be readable");
+                TEST_ASSERT(memcmp(flat_node_hashes, blocked_node_hashes, width * HASH_SIZE) == 0,
+                            "Blocked level should match flat level");
+                width = (width + factors[f] - 1) / factors[f];
+            }
+
+            size_t max_size = 0;
+            merkle_proof_max_size(flat, &max_size);
+            unsigned char *flat_proof = malloc(max_size);
+            unsigned char *blocked_proof = malloc(max_size);
+            TEST_ASSERT(flat_proof && blocked_proof, "Test allocation should succeed");
+
+            for (size_t i = 0; i < count; i += count / 97 + 1) {
+                size_t flat_written = 0;
+                size_t blocked_written = 0;
+                merkle_proof_t *proof = NULL;
+                unsigned char leaf_hash[HASH_SIZE];
+                SHA256(data[i], sizes[i], leaf_hash);
+
+                generate_proof_into(flat, i, flat_proof, max_size, &flat_written);
+                generate_proof_into(blocked, i, blocked_proof, max_size, &blocked_written);
+                TEST_ASSERT(flat_written == blocked_written && memcmp(flat_proof, blocked_proof, flat_written) == 0,
+                            "Blocked proof should equal the flat proof");
+                TEST_ASSERT(generate_proof_from_index(blocked, i, &proof) == MERKLE_SUCCESS &&
+                            verify_proof(blocked_root, leaf_hash, proof) == MERKLE_SUCCESS,
+                            "Blocked proof object should verify");
+                release_test_proof(proof);
+            }
+
+            free(flat_proof);
+            free(blocked_proof);
+
+            // Updates rehash the same ancestors, and the diff finds exactly the changed leaves
+            unsigned long long replacement[3] = {1, 2, 3};
+            const void *update_data[3] = {&replacement[0], &replacement[1], &replacement[2]};
+            const size_t update_sizes[3] = {sizeof(replacement[0]), sizeof(replacement[1]), sizeof(replacement[2])};
+            const size_t updates[3] = {0, count / 2, count - 1};
+            size_t update_count = count > 2 ? 3 : count;
+            merkle_tree_t *pointer = create_tree_with_layout(data, sizes, count, factors[f], MERKLE_LAYOUT_POINTER);
+            TEST_ASSERT(pointer != NULL, "Tree creation should succeed");
+            TEST_ASSERT(update_leaves(flat, updates, update_data, update_sizes, update_count) == MERKLE_SUCCESS &&
+                        update_leaves(blocked, updates, update_data, update_sizes, update_count) == MERKLE_SUCCESS,
+                        "Updates should succeed");
+            get_tree_hash(flat, flat_root);
+            get_tree_hash(blocked, blocked_root);
+            TEST_ASSERT(memcmp(flat_root, blocked_root, HASH_SIZE) == 0, "Updated roots should match");
+
+            size_t *diff = NULL;
+            size_t diff_count = 0;
+            TEST_ASSERT(merkle_tree_diff(blocked, pointer, &diff, &diff_count) == MERKLE_SUCCESS &&
+                        diff_count == update_count && diff[0] == 0 && diff[update_count - 1] == count - 1,
+                        "Diff should report the updated leaves");
+            dealloc_merkle_diff(diff);
+
+            dealloc_merkle_tree(pointer);
+            dealloc_merkle_tree(flat);
+            dealloc_merkle_tree(blocked);
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Multiproofs, range proofs and saved files of blocked trees match flat trees.
+ */
+static int test_blocked_layout_proofs_and_files(void) {
+    enum { leaves = 700 };
+    const size_t factors[] = {2, 3, 4};
+    const size_t scattered[] = {699, 3, 42, 3, 0, 77, 640, 42};
+    static unsigned char flat_file[64 * 1024];
+    static unsigned char blocked_file[64 * 1024];
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    create_unique_test_data(data, sizes, storage, leaves);
+    char flat_path[32];
+    char blocked_path[32];
+    TEST_ASSERT(make_temp_path(flat_path) && make_temp_path(blocked_path), "Temporary files should be created");
+
+    for (size_t f = 0; f < 3; f++) {
+        merkle_tree_t *flat = create_tree_with_layout(data, sizes, leaves, factors[f], MERKLE_LAYOUT_FLAT);
+        merkle_tree_t *blocked = create_tree_with_layout(data, sizes, leaves, factors[f], MERKLE_LAYOUT_BLOCKED);
+        TEST_ASSERT(flat && blocked, "Tree creation should succeed");
+
+        size_t hash_count = 0;
+        size_t range_count = 0;
+        TEST_ASSERT(check_multiproof(blocked, data, sizes, scattered, 8, &hash_count) &&
+                    check_range_proof(blocked, data, sizes, 13, 577, &range_count) &&
+                    check_range_proof(blocked, data, sizes, 0, leaves - 1, &range_count) && range_count == 0,
+                    "Blocked multiproofs and range proofs should verify");
+
+        // Saved files keep the level order, so both layouts write the same bytes
+        TEST_ASSERT(save_merkle_tree(flat, flat_path) == MERKLE_SUCCESS &&
+                    save_merkle_tree(blocked, blocked_path) == MERKLE_SUCCESS, "Saving should succeed");
+        size_t flat_length = read_test_file(flat_path, flat_file, sizeof(flat_file));
+        size_t blocked_length = read_test_file(blocked_path, blocked_file, sizeof(blocked_file));
+        TEST_ASSERT(flat_length > 0 && flat_length < sizeof(flat_file) && flat_length == blocked_length &&
+                    memcmp(flat_file, blocked_file, flat_length) == 0, "Saved files should be identical");
+
+        merkle_tree_t *mapped = open_merkle_tree_mmap(blocked_path);
+        unsigned char root[HASH_SIZE];
+        unsigned char mapped_root[HASH_SIZE];
+        TEST_ASSERT(mapped != NULL, "Saved blocked tree should open");
+        get_tree_hash(blocked, root);
+        get_tree_hash(mapped, mapped_root);
+        TEST_ASSERT(memcmp(root, mapped_root, HASH_SIZE) == 0, "Mapped root should match");
+
+        dealloc_merkle_tree(mapped);
+        dealloc_merkle_tree(flat);
+        dealloc_merkle_tree(blocked);
+    }
+
+    unlink(flat_path);
+    unlink(blocked_path);
+    TEST_PASS();
+}
+
+/**
+ * @brief Builds one shard tree per range of @p span leaves and exports it, last range first.
+ * @return Number of shards, or 0 if a shard failed to build or export.
+ */
+static size_t build_test_shards(const void **data, const size_t *sizes, size_t count, size_t bf, size_t height,
+                                size_t span, merkle_tree_t **trees, merkle_shard_info_t *infos) {
+    size_t shards = (count + span - 1) / span;
+
+    for (size_t s = shards; s-- > 0;) {
+        size_t first = s * span;
+        size_t leaves = count - first < span ? count - first : span;
+        unsigned char encoded[MERKLE_SHARD_ENCODED_SIZE];
+        merkle_shard_info_t info;
+        trees[s] = create_tree_with_layout(data + first, sizes + first, leaves, bf,
+                                           s % 2 ? MERKLE_LAYOUT_FLAT : MERKLE_LAYOUT_POINTER);
+
+        // Descriptions travel as bytes, as they would between machines
+        if (!trees[s] || merkle_shard_export(trees[s], first, height, &info) != MERKLE_SUCCESS ||
+            merkle_shard_encode(&info, encoded) != MERKLE_SUCCESS ||
+            merkle_shard_decode(encoded, sizeof(encoded), &infos[shards - 1 - s]) != MERKLE_SUCCESS) {
+            return 0;
+        }
+    }
+
+    return shards;
+}
+
+/**
+ * @brief Shards combine into the root and proofs of a monolithic build.
+ */
+static int test_shard_combine_matches_monolithic(void) {
+    enum { max_leaves = 300, max_shards = 300 };
+    const size_t counts[] = {1, 2, 7, 64, 65, 300};
+    static const void *data[max_leaves];
+    static size_t sizes[max_leaves];
+    static unsigned long long storage[max_leaves];
+    static merkle_tree_t *trees[max_shards];
+    static merkle_shard_info_t infos[max_shards];
+    create_unique_test_data(data, sizes, storage, max_leaves);
+
+    for (size_t bf = 2; bf <= 4; bf++) {
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+            size_t count = counts[c];
+            merkle_tree_t *whole = create_tree_with_layout(data, sizes, count, bf, MERKLE_LAYOUT_FLAT);
+            TEST_ASSERT(whole != NULL, "Monolithic tree creation should succeed");
+            unsigned char expected_root[HASH_SIZE];
+            get_tree_hash(whole, expected_root);
+
+            for (size_t height = 0, span = 1; height <= 4; height++, span *= bf) {
+                size_t shards = build_test_shards(data, sizes, count, bf, height, span, trees, infos);
+                TEST_ASSERT(shards > 0, "Shards should build and export");
+
+                merkle_shard_set_t *set = NULL;
+                unsigned char root[HASH_SIZE];
+                TEST_ASSERT(merkle_shard_combine(infos, shards, &set) == MERKLE_SUCCESS,
+                            "Combining shards should succeed");
+                TEST_ASSERT(merkle_shard_set_leaf_count(set) == count, "Set should count every leaf");
+                TEST_ASSERT(merkle_shard_set_root(set, root) == MERKLE_SUCCESS &&
+                            memcmp(root, expected_root, HASH_SIZE) == 0,
+                            "Combined root should match the monolithic root");
+
+                for (size_t leaf = 0; leaf < count; leaf += count / 23 + 1) {
+                    merkle_proof_t *expected = NULL;
+                    merkle_proof_t *actual = NULL;
+                    unsigned char leaf_hash[HASH_SIZE];
+                    SHA256(data[leaf], sizes[leaf], leaf_hash);
+                    TEST_ASSERT(generate_proof_from_index(whole, leaf, &expected) == MERKLE_SUCCESS &&
+                                merkle_shard_prove(set, trees[leaf / span], leaf, &actual) == MERKLE_SUCCESS,
+                                "Proofs should be generated");
+                    TEST_ASSERT(actual->path_length == expected->path_length && actual->leaf_index == leaf,
+                                "Stitched proof should have the monolithic shape");
+
+                    for (size_t lvl = 0; lvl < expected->path_length; lvl++) {
+                        merkle_proof_item_t *e = expected->path[lvl];
+                        merkle_proof_item_t *a = actual->path[lvl];
+                        TEST_ASSERT(a->sibling_count == e->sibling_count && a->node_position == e->node_position &&
+                                    (e->sibling_count == 0 ||
+                                     memcmp(a->sibling_hashes, e->sibling_hashes, e->sibling_count * HASH_SIZE) == 0),
+                                    "Stitched proof levels should match");
+                    }
+
+                    TEST_ASSERT(verify_proof(root, leaf_hash, actual) == MERKLE_SUCCESS,
+                                "Stitched proof should verify");
+                    release_test_proof(expected);
+                    release_test_proof(actual);
+                }
+
+                merkle_shard_set_destroy(set);
+
+                for (size_t s = 0; s < shards; s++) {
+                    dealloc_merkle_tree(trees[s]);
+                }
+            }
+
+            dealloc_merkle_tree(whole);
+        }
+    }
+
+    TEST_PASS();
+}
+
+/**
+ * @brief Misaligned, overlapping or incomplete shards and foreign shard trees are rejected.
+ */
+static int test_shard_combine_rejects_bad_input(void) {
+    enum { leaves = 20, span = 8 };
+    const void *data[leaves];
+    size_t sizes[leaves];
+    unsigned long long storage[leaves];
+    merkle_tree_t *trees[3];
+    merkle_shard_info_t infos[3];
+    merkle_shard_info_t bad[3];
+    merkle_shard_set_t *set = NULL;
+    merkle_proof_t *proof = NULL;
+    create_unique_test_data(data, sizes, storage, leaves);
+    TEST_ASSERT(build_test_shards(data, sizes, leaves, 2, 3, span, trees, infos) == 3, "Shards should build");
+
+    // Ranges must start on a shard boundary and fit the height
+    merkle_shard_info_t info;
+    TEST_ASSERT(merkle_shard_export(trees[1], 4, 3, &info) == MERKLE_BAD_ARG, "Misaligned shard should fail");
+    TEST_ASSERT(merkle_shard_export(trees[1], 8, 2, &info) == MERKLE_BAD_ARG, "Too short a height should fail");
+    TEST_ASSERT(merkle_shard_export(NULL, 0, 3, &info) == MERKLE_NULL_ARG, "NULL shard should fail");
+
+    TEST_ASSERT(merkle_shard_combine(infos, 2, &set) == MERKLE_BAD_ARG && set == NULL,
+                "A missing shard should fail");
+    memcpy(bad, infos, sizeof(bad));
+    bad[1] = bad[0];
+    TEST_ASSERT(merkle_shard_combine(bad, 3, &set) == MERKLE_BAD_ARG, "Duplicate shards should fail");
+    memcpy(bad, infos, sizeof(bad));
+    bad[2].branching_factor = 3;
+    TEST_ASSERT(merkle_shard_combine(bad, 3, &set) == MERKLE_BAD_ARG, "Mixed branching factors should fail");
+
+    unsigned char encoded[MERKLE_SHARD_ENCODED_SIZE];
+    TEST_ASSERT(merkle_shard_encode(&infos[0], encoded) == MERKLE_SUCCESS, "Encoding should succeed");
+    encoded[0] ^= 1;
+    TEST_ASSERT(merkle_shard_decode(encoded, sizeof(encoded), &info) == MERKLE_BAD_ARG, "Bad magic should fail");
+    TEST_ASSERT(merkle_shard_decode(encoded, sizeof(encoded) - 1, &info) == MERKLE_BAD_ARG,
+                "Short input should fail");
+
+    TEST_ASSERT(merkle_shard_combine(infos, 3, &set) == MERKLE_SUCCESS, "Combining should succeed");
+    TEST_ASSERT(merkle_shard_prove(set, trees[0], leaves, &proof) == MERKLE_INVALID_INDEX && proof == NULL,
+                "Out of range leaf should fail");
+    TEST_ASSERT(merkle_shard_prove(set, trees[0], 9, &proof) == MERKLE_BAD_ARG && proof == NULL,
+                "Another shard's tree should fail");
+    TEST_ASSERT(merkle_shard_prove(set, trees[1], 9, &proof) == MERKLE_SUCCESS, "Own shard tree should succeed");
+    release_test_proof(proof);
+
+    merkle_shard_set_destroy(set);
+
+    for (size_t s = 0; s < 3; s++) {
+        dealloc_merkle_tree(trees[s]);
+    }
+
+    TEST_PASS();
+}
+
 int main(void) {
     printf("Starting Merkle Tree Unit Tests\n");
     printf("================================\n\n");
@@ -1641,6 +5816,135 @@ int main(void) {
     RUN_TEST(test_concurrent_reads);
     RUN_TEST(test_read_write_synchronization);
     RUN_TEST(test_locking_stress_test);
+    RUN_TEST(test_snapshot_reads_during_updates);
+
+    // Flat layout tests
+    printf("\n--- Flat Layout Tests ---\n");
+    RUN_TEST(test_flat_layout_root_matches_pointer);
+    RUN_TEST(test_flat_layout_known_root_hash);
+    RUN_TEST(test_flat_layout_proofs_match_pointer);
+    RUN_TEST(test_flat_layout_finder);
+    RUN_TEST(test_create_ex_invalid_config);
+
+    // Parallel construction tests
+    printf("\n--- Parallel Build Tests ---\n");
+    RUN_TEST(test_parallel_build_matches_serial);
+    RUN_TEST(test_parallel_build_shared_pool);
+    RUN_TEST(test_parallel_for_covers_range);
+
+    // Leaf storage mode tests
+    printf("\n--- Leaf Storage Tests ---\n");
+    RUN_TEST(test_leaf_storage_modes_match_copy);
+    RUN_TEST(test_leaf_storage_borrow_finder);
+    RUN_TEST(test_leaf_storage_hash_only_lookup);
+
+    // Batched SHA-256 backend tests
+    printf("\n--- SHA-256 Backend Tests ---\n");
+    RUN_TEST(test_sha256_backends_match_openssl);
+    RUN_TEST(test_sha256_backends_same_root);
+    RUN_TEST(test_sha256_streaming_matches_openssl);
+    RUN_TEST(test_sha256_scalar_parallel_build);
+
+    // Incremental update tests
+    printf("\n--- Leaf Update Tests ---\n");
+    RUN_TEST(test_update_leaf_matches_rebuild);
+    RUN_TEST(test_update_leaves_batch);
+    RUN_TEST(test_update_leaf_invalid_args);
+
+    // Streaming builder tests
+    printf("\n--- Streaming Builder Tests ---\n");
+    RUN_TEST(test_builder_matches_tree);
+    RUN_TEST(test_builder_chunked_append);
+    RUN_TEST(test_builder_invalid_args);
+
+    // Proof verification tests
+    printf("\n--- Proof Verification Tests ---\n");
+    RUN_TEST(test_verify_proof_roundtrip);
+    RUN_TEST(test_verify_proof_rejects_tampering);
+    RUN_TEST(test_verify_proofs_batch);
+
+    // Multi-leaf proof tests
+    printf("\n--- Multiproof Tests ---\n");
+    RUN_TEST(test_multiproof_roundtrip);
+    RUN_TEST(test_multiproof_compact);
+    RUN_TEST(test_multiproof_rejects_mismatch);
+
+    // Serialized proof tests
+    printf("\n--- Proof Buffer Tests ---\n");
+    RUN_TEST(test_proof_buffer_roundtrip);
+    RUN_TEST(test_proof_buffer_rejects_tampering);
+
+    printf("\n--- Persistence Tests ---\n");
+    RUN_TEST(test_mmap_tree_roundtrip);
+    RUN_TEST(test_mmap_tree_rejects_bad_files);
+    RUN_TEST(test_mmap_tree_is_read_only);
+
+    printf("\n--- Allocator Tests ---\n");
+    RUN_TEST(test_custom_allocator_hook);
+    RUN_TEST(test_allocator_failures_leak_nothing);
+
+    printf("\n--- Versioning Tests ---\n");
+    RUN_TEST(test_derive_versions);
+    RUN_TEST(test_wide_pointer_proofs_after_update);
+    RUN_TEST(test_derive_freezes_source);
+    RUN_TEST(test_derive_costs_the_path_only);
+
+    printf("\n--- Content Index Tests ---\n");
+    RUN_TEST(test_proof_by_leaf_hash_index);
+    RUN_TEST(test_proof_by_extracted_key);
+    RUN_TEST(test_parallel_finder);
+
+    printf("\n--- Diff Tests ---\n");
+    RUN_TEST(test_tree_diff);
+    RUN_TEST(test_tree_diff_rejects_shape_mismatch);
+    RUN_TEST(test_remote_tree_diff);
+
+    printf("\n--- Range Proof Tests ---\n");
+    RUN_TEST(test_range_proof_roundtrip);
+    RUN_TEST(test_range_proof_rejects_mismatch);
+
+    printf("\n--- Hash Algorithm Tests ---\n");
+    RUN_TEST(test_blake3_vectors);
+    RUN_TEST(test_blake3_tree);
+    RUN_TEST(test_custom_hash_registration);
+
+    printf("\n--- Trusted Input Tests ---\n");
+    RUN_TEST(test_trusted_input);
+
+    printf("\n--- Stats Tests ---\n");
+    RUN_TEST(test_stats_counters);
+
+    printf("\n--- File Input Tests ---\n");
+    RUN_TEST(test_chunk_reader_windows);
+    RUN_TEST(test_tree_from_file);
+
+    printf("\n--- Fixed-Length Node Hashing Tests ---\n");
+    RUN_TEST(test_sha256_fixed_matches_openssl);
+    RUN_TEST(test_fixed_node_trees_match_builder);
+
+    printf("\n--- Async Tests ---\n");
+    RUN_TEST(test_async_build_and_proof);
+    RUN_TEST(test_async_cancel);
+    RUN_TEST(test_async_signal_protection);
+
+    printf("\n--- Sparse Tree Tests ---\n");
+    RUN_TEST(test_sparse_root_matches_reference);
+    RUN_TEST(test_sparse_proofs);
+
+    printf("\n--- Proof Batch Tests ---\n");
+    RUN_TEST(test_proofs_batch_matches_single);
+    RUN_TEST(test_proofs_batch_rejects_bad_input);
+
+    printf("\n--- Blocked Layout Tests ---\n");
+    RUN_TEST(test_blocked_layout_matches_flat);
+    RUN_TEST(test_blocked_layout_proofs_and_files);
+
+    printf("\n--- Sharded Build Tests ---\n");
+    RUN_TEST(test_shard_combine_matches_monolithic);
+    RUN_TEST(test_shard_combine_rejects_bad_input);
+
+    printf("\n--- Queue Tests ---\n");
+    RUN_TEST(test_ring_queue_wraps_and_grows);
 
     return print_test_summary();
 }